@@ -37,6 +37,7 @@ extern "C"
 #endif
 
 #include "mlt_animation.h"
+#include "mlt_atom.h"
 #include "mlt_audio.h"
 #include "mlt_factory.h"
 #include "mlt_frame.h"
@@ -59,6 +60,8 @@ extern "C"
 #include "mlt_cache.h"
 #include "mlt_version.h"
 #include "mlt_slices.h"
+#include "mlt_cpu.h"
+#include "mlt_trace.h"
 
 #ifdef __cplusplus
 }
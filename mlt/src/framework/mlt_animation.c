@@ -30,15 +30,6 @@
 #include <stdlib.h>
 #include <string.h>
 
-/** \brief animation list node pointer */
-typedef struct animation_node_s *animation_node;
-/** \brief private animation list node */
-struct animation_node_s
-{
-	struct mlt_animation_item_s item;
-	animation_node next, prev;
-};
-
 /** \brief Property Animation class
  *
  * This is the animation engine for a Property object. It is dependent upon
@@ -51,7 +42,11 @@ struct mlt_animation_s
 	int length;           /**< the maximum number of frames to use when interpreting negative keyframe positions */
 	double fps;           /**< framerate to use when converting time clock strings to frame units */
 	locale_t locale;      /**< pointer to a locale to use when converting strings to numeric values */
-	animation_node nodes; /**< a linked list of keyframes (and possibly non-keyframe values) */
+	struct mlt_animation_item_s *nodes; /**< an array of keyframes (and possibly non-keyframe values) ordered by frame */
+	int count;            /**< the number of nodes */
+	int size;             /**< the number of nodes allocated */
+	int hint;             /**< the index of the node found by the last lookup */
+	int unsorted;         /**< whether changing a keyframe's frame left the nodes out of order */
 };
 
 /** Create a new animation object.
@@ -75,77 +70,156 @@ mlt_animation mlt_animation_new( )
 void mlt_animation_interpolate( mlt_animation self )
 {
 	// Parse all items to ensure non-keyframes are calculated correctly.
-	if ( self && self->nodes )
+	if ( self && self->count )
 	{
-		animation_node current = self->nodes;
-		while ( current )
+		int i;
+		for ( i = 0; i < self->count; i++ )
 		{
-			if ( !current->item.is_key )
+			mlt_animation_item current = &self->nodes[ i ];
+			if ( !current->is_key )
 			{
 				double progress;
 				mlt_property points[4];
-				animation_node prev = current->prev;
-				animation_node next = current->next;
+				int prev = i - 1;
+				int next = i + 1;
 
-				while ( prev && !prev->item.is_key ) prev = prev->prev;
-				while ( next && !next->item.is_key ) next = next->next;
+				while ( prev >= 0 && !self->nodes[ prev ].is_key ) prev--;
+				while ( next < self->count && !self->nodes[ next ].is_key ) next++;
 
-				if ( !prev ) {
-					current->item.is_key = 1;
-					prev = current;
+				if ( prev < 0 ) {
+					current->is_key = 1;
+					prev = i;
 				}
-				if ( !next ) {
-					next = current;
+				if ( next >= self->count ) {
+					next = i;
 				}
-				points[0] = prev->prev? prev->prev->item.property : prev->item.property;
-				points[1] = prev->item.property;
-				points[2] = next->item.property;
-				points[3] = next->next? next->next->item.property : next->item.property;
-				progress = current->item.frame - prev->item.frame;
-				progress /= next->item.frame - prev->item.frame;
-				mlt_property_interpolate( current->item.property, points, progress,
-					self->fps, self->locale, current->item.keyframe_type );
+				points[0] = self->nodes[ prev > 0? prev - 1 : prev ].property;
+				points[1] = self->nodes[ prev ].property;
+				points[2] = self->nodes[ next ].property;
+				points[3] = self->nodes[ next + 1 < self->count? next + 1 : next ].property;
+				progress = current->frame - self->nodes[ prev ].frame;
+				progress /= self->nodes[ next ].frame - self->nodes[ prev ].frame;
+				mlt_property_interpolate( current->property, points, progress,
+					self->fps, self->locale, current->keyframe_type );
 			}
-
-			// Move to the next item
-			current = current->next;
 		}
 	}
 }
 
-/** Remove a node from the linked list.
+/** Check whether the nodes are ordered by frame.
  *
  * \private \memberof mlt_animation_s
  * \param self an animation
- * \param node the node to remove
- * \return false
  */
 
-static int mlt_animation_drop( mlt_animation self, animation_node node )
+static void mlt_animation_check_order( mlt_animation self )
+{
+	int i;
+	self->unsorted = 0;
+	for ( i = 1; i < self->count && !self->unsorted; i++ )
+		self->unsorted = self->nodes[ i - 1 ].frame > self->nodes[ i ].frame;
+}
+
+/** Find the node at or preceding a position.
+ *
+ * The node found last and the one after it are tried first, which makes
+ * sequential access take constant time. Otherwise, this is a binary search.
+ * \private \memberof mlt_animation_s
+ * \param self an animation
+ * \param position a frame number
+ * \return the index of the last node whose frame is not after \p position,
+ * 0 if there is none, or -1 if the animation has no nodes
+ */
+
+static int mlt_animation_find( mlt_animation self, int position )
 {
-	if ( node == self->nodes )
+	int i = self->hint;
+	int lo, hi;
+
+	if ( self->count == 0 )
+		return -1;
+
+	if ( self->unsorted )
 	{
-		self->nodes = node->next;
-		if ( self->nodes ) {
-			self->nodes->prev = NULL;
-			self->nodes->item.is_key = 1;
-		}
+		i = 0;
+		while ( i + 1 < self->count && position >= self->nodes[ i + 1 ].frame )
+			i++;
+		return i;
 	}
-	else if ( node->next && node->prev )
+
+	if ( i < 0 || i >= self->count )
+		i = 0;
+	if ( i > 0 && position < self->nodes[ i ].frame )
+		i = -1;
+	else if ( i + 1 < self->count && position >= self->nodes[ i + 1 ].frame )
+		i = ( i + 2 < self->count && position >= self->nodes[ i + 2 ].frame )? -1 : i + 1;
+
+	if ( i < 0 )
 	{
-		node->prev->next = node->next;
-		node->next->prev = node->prev;
+		// Find the first node after the position.
+		lo = 1;
+		hi = self->count;
+		while ( lo < hi )
+		{
+			int mid = lo + ( hi - lo ) / 2;
+			if ( self->nodes[ mid ].frame <= position )
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		i = lo - 1;
 	}
-	else if ( node->next )
+	self->hint = i;
+
+	return i;
+}
+
+/** Find the first node at or following a position.
+ *
+ * \private \memberof mlt_animation_s
+ * \param self an animation
+ * \param position a frame number
+ * \return the index of the first node whose frame is not before \p position
+ * or the number of nodes if there is none
+ */
+
+static int mlt_animation_find_next( mlt_animation self, int position )
+{
+	int lo = 0, hi = self->count;
+
+	if ( self->unsorted )
 	{
-		node->next->prev = node->prev;
+		while ( lo < self->count && position > self->nodes[ lo ].frame )
+			lo++;
+		return lo;
 	}
-	else if ( node->prev )
+
+	while ( lo < hi )
 	{
-		node->prev->next = node->next;
+		int mid = lo + ( hi - lo ) / 2;
+		if ( self->nodes[ mid ].frame < position )
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
-	mlt_property_close( node->item.property );
-	free( node );
+	return lo;
+}
+
+/** Remove a node.
+ *
+ * \private \memberof mlt_animation_s
+ * \param self an animation
+ * \param index the index of the node to remove
+ * \return false
+ */
+
+static int mlt_animation_drop( mlt_animation self, int index )
+{
+	mlt_property_close( self->nodes[ index ].property );
+	self->count--;
+	memmove( &self->nodes[ index ], &self->nodes[ index + 1 ], ( self->count - index ) * sizeof( *self->nodes ) );
+	if ( index == 0 && self->count )
+		self->nodes[ 0 ].is_key = 1;
 
 	return 0;
 }
@@ -162,8 +236,10 @@ static void mlt_animation_clean( mlt_animation self )
 
 	free( self->data );
 	self->data = NULL;
-	while ( self->nodes )
-		mlt_animation_drop( self, self->nodes );
+	while ( self->count )
+		mlt_property_close( self->nodes[ --self->count ].property );
+	self->hint = 0;
+	self->unsorted = 0;
 }
 
 /** Parse a string representing an animation.
@@ -278,12 +354,11 @@ int mlt_animation_get_length( mlt_animation self )
 		if ( self->length > 0 ) {
 			length = self->length;
 		}
-		else if ( self->nodes ) {
-			animation_node node = self->nodes;
-			while ( node ) {
-				if ( node->item.frame > length )
-					length = node->item.frame;
-				node = node->next;
+		else {
+			int i;
+			for ( i = 0; i < self->count; i++ ) {
+				if ( self->nodes[ i ].frame > length )
+					length = self->nodes[ i ].frame;
 			}
 		}
 	}
@@ -394,36 +469,35 @@ int mlt_animation_get_item( mlt_animation self, mlt_animation_item item, int pos
 
 	int error = 0;
 	// Need to find the nearest keyframe to the position specified
-	animation_node node = self->nodes;
-
-	// Iterate through the keyframes until we reach last or have
-	while ( node && node->next && position >= node->next->item.frame )
-		node = node->next;
+	int i = mlt_animation_find( self, position );
 
-	if ( node )
+	if ( i >= 0 )
 	{
-		item->keyframe_type = node->item.keyframe_type;
+		mlt_animation_item node = &self->nodes[ i ];
+		mlt_animation_item next = i + 1 < self->count? node + 1 : NULL;
+
+		item->keyframe_type = node->keyframe_type;
 
 		// Position is before the first keyframe.
-		if ( position < node->item.frame )
+		if ( position < node->frame )
 		{
 			item->is_key = 0;
 			if ( item->property )
-				mlt_property_pass( item->property, node->item.property );
+				mlt_property_pass( item->property, node->property );
 		}
 		// Item exists.
-		else if ( position == node->item.frame )
+		else if ( position == node->frame )
 		{
-			item->is_key = node->item.is_key;
+			item->is_key = node->is_key;
 			if ( item->property )
-				mlt_property_pass( item->property, node->item.property );
+				mlt_property_pass( item->property, node->property );
 		}
 		// Position is after the last keyframe.
-		else if ( !node->next )
+		else if ( !next )
 		{
 			item->is_key = 0;
 			if ( item->property )
-				mlt_property_pass( item->property, node->item.property );
+				mlt_property_pass( item->property, node->property );
 		}
 		// Interpolation needed.
 		else
@@ -432,12 +506,12 @@ int mlt_animation_get_item( mlt_animation self, mlt_animation_item item, int pos
 			{
 				double progress;
 				mlt_property points[4];
-				points[0] = node->prev? node->prev->item.property : node->item.property;
-				points[1] = node->item.property;
-				points[2] = node->next->item.property;
-				points[3] = node->next->next? node->next->next->item.property : node->next->item.property;
-				progress = position - node->item.frame;
-				progress /= node->next->item.frame - node->item.frame;
+				points[0] = i > 0? node[ -1 ].property : node->property;
+				points[1] = node->property;
+				points[2] = next->property;
+				points[3] = i + 2 < self->count? next[ 1 ].property : next->property;
+				progress = position - node->frame;
+				progress /= next->frame - node->frame;
 				mlt_property_interpolate( item->property, points, progress,
 					self->fps, self->locale, item->keyframe_type );
 			}
@@ -454,6 +528,59 @@ int mlt_animation_get_item( mlt_animation self, mlt_animation_item item, int pos
 	return error;
 }
 
+/** Load animation items for a range of positions.
+ *
+ * This is equivalent to calling mlt_animation_get_item() for each position
+ * but takes constant time per position.
+ * \public \memberof mlt_animation_s
+ * \param self an animation
+ * \param items an array of \p count already allocated animation items that will be filled in
+ * \param position the frame number of the first item
+ * \param count the number of items
+ * \return true if there was an error
+ */
+
+int mlt_animation_get_items( mlt_animation self, mlt_animation_item items, int position, int count )
+{
+	int error = !self || !items;
+	int i;
+
+	for ( i = 0; !error && i < count; i++ )
+		error = mlt_animation_get_item( self, &items[ i ], position + i );
+
+	return error;
+}
+
+/** Evaluate the animation as real numbers for a range of positions.
+ *
+ * This is convenient for drawing a curve of the animation.
+ * \public \memberof mlt_animation_s
+ * \param self an animation
+ * \param values an array of \p count numbers that will be filled in
+ * \param position the frame number of the first value
+ * \param count the number of values
+ * \return true if there was an error
+ */
+
+int mlt_animation_get_doubles( mlt_animation self, double *values, int position, int count )
+{
+	if (!self || !values) return 1;
+
+	int error = 0;
+	int i;
+	struct mlt_animation_item_s item;
+	item.property = mlt_property_init();
+
+	for ( i = 0; !error && i < count; i++ )
+	{
+		error = mlt_animation_get_item( self, &item, position + i );
+		values[ i ] = mlt_property_get_double( item.property, self->fps, self->locale );
+	}
+	mlt_property_close( item.property );
+
+	return error;
+}
+
 /** Insert an animation item.
  *
  * \public \memberof mlt_animation_s
@@ -468,57 +595,41 @@ int mlt_animation_insert( mlt_animation self, mlt_animation_item item )
 	if (!self || !item) return 1;
 
 	int error = 0;
-	animation_node node = calloc( 1, sizeof( *node ) );
-	node->item.frame = item->frame;
-	node->item.is_key = 1;
-	node->item.keyframe_type = item->keyframe_type;
-	node->item.property = mlt_property_init();
-	mlt_property_pass( node->item.property, item->property );
-
-	// Determine if we need to insert or append to the list, or if it's a new list
-	if ( self->nodes )
-	{
-		// Get the first item
-		animation_node current = self->nodes;
+	int i = mlt_animation_find_next( self, item->frame );
+	mlt_animation_item node;
 
-		// Locate an existing nearby item
-		while ( current->next && item->frame > current->item.frame )
-			current = current->next;
+	if ( i == self->count && i > 0 )
+		i--;
 
-		if ( item->frame < current->item.frame )
-		{
-			if ( current == self->nodes )
-				self->nodes = node;
-			if ( current->prev )
-				current->prev->next = node;
-			node->next = current;
-			node->prev = current->prev;
-			current->prev = node;
-		}
-		else if ( item->frame > current->item.frame )
-		{
-			if ( current->next )
-				current->next->prev = node;
-			node->next = current->next;
-			node->prev = current;
-			current->next = node;
-		}
-		else
-		{
-			// Update matching node.
-			current->item.frame = item->frame;
-			current->item.is_key = 1;
-			current->item.keyframe_type = item->keyframe_type;
-			mlt_property_close( current->item.property );
-			current->item.property = node->item.property;
-			free( node );
-		}
+	if ( i < self->count && item->frame == self->nodes[ i ].frame )
+	{
+		// Update matching node.
+		node = &self->nodes[ i ];
+		mlt_property_close( node->property );
 	}
 	else
 	{
-		// Set the first item
-		self->nodes = node;
+		// Insert before the node found unless appending.
+		if ( i < self->count && item->frame > self->nodes[ i ].frame )
+			i++;
+		if ( self->count == self->size )
+		{
+			int size = self->size? self->size * 2 : 8;
+			mlt_animation_item nodes = realloc( self->nodes, size * sizeof( *nodes ) );
+			if ( !nodes )
+				return 1;
+			self->nodes = nodes;
+			self->size = size;
+		}
+		node = &self->nodes[ i ];
+		memmove( node + 1, node, ( self->count - i ) * sizeof( *node ) );
+		self->count++;
 	}
+	node->frame = item->frame;
+	node->is_key = 1;
+	node->keyframe_type = item->keyframe_type;
+	node->property = mlt_property_init();
+	mlt_property_pass( node->property, item->property );
 
 	return error;
 }
@@ -536,13 +647,20 @@ int mlt_animation_remove( mlt_animation self, int position )
 	if (!self) return 1;
 
 	int error = 1;
-	animation_node node = self->nodes;
+	int i = 0;
 
-	while ( node && position != node->item.frame )
-		node = node->next;
+	if ( self->unsorted )
+	{
+		while ( i < self->count && position != self->nodes[ i ].frame )
+			i++;
+	}
+	else
+	{
+		i = mlt_animation_find_next( self, position );
+	}
 
-	if ( node && position == node->item.frame )
-		error = mlt_animation_drop( self, node );
+	if ( i < self->count && position == self->nodes[ i ].frame )
+		error = mlt_animation_drop( self, i );
 
 	return error;
 }
@@ -560,21 +678,19 @@ int mlt_animation_next_key( mlt_animation self, mlt_animation_item item, int pos
 {
 	if (!self || !item) return 1;
 
-	animation_node node = self->nodes;
-
-	while ( node && position > node->item.frame )
-		node = node->next;
+	int i = mlt_animation_find_next( self, position );
 
-	if ( node )
+	if ( i < self->count )
 	{
-		item->frame = node->item.frame;
-		item->is_key = node->item.is_key;
-		item->keyframe_type = node->item.keyframe_type;
+		mlt_animation_item node = &self->nodes[ i ];
+		item->frame = node->frame;
+		item->is_key = node->is_key;
+		item->keyframe_type = node->keyframe_type;
 		if ( item->property )
-			mlt_property_pass( item->property, node->item.property );
+			mlt_property_pass( item->property, node->property );
 	}
 
-	return ( node == NULL );
+	return ( i >= self->count );
 }
 
 /** Get the keyfame at the position or the next preceding.
@@ -590,21 +706,19 @@ int mlt_animation_prev_key( mlt_animation self, mlt_animation_item item, int pos
 {
 	if (!self || !item) return 1;
 
-	animation_node node = self->nodes;
-
-	while ( node && node->next && position >= node->next->item.frame )
-		node = node->next;
+	int i = mlt_animation_find( self, position );
 
-	if ( node )
+	if ( i >= 0 )
 	{
-		item->frame = node->item.frame;
-		item->is_key = node->item.is_key;
-		item->keyframe_type = node->item.keyframe_type;
+		mlt_animation_item node = &self->nodes[ i ];
+		item->frame = node->frame;
+		item->is_key = node->is_key;
+		item->keyframe_type = node->keyframe_type;
 		if ( item->property )
-			mlt_property_pass( item->property, node->item.property );
+			mlt_property_pass( item->property, node->property );
 	}
 
-	return ( node == NULL );
+	return ( i < 0 );
 }
 
 /** Serialize a cut of the animation (with time format).
@@ -650,7 +764,7 @@ char *mlt_animation_serialize_cut_tf( mlt_animation self, int in, int out, mlt_t
 
 				// If the first keyframe is larger than the current position
 				// then do nothing here
-				if ( self->nodes->item.frame > item.frame )
+				if ( self->nodes[ 0 ].frame > item.frame )
 				{
 					item.frame ++;
 					continue;
@@ -810,14 +924,7 @@ char *mlt_animation_serialize( mlt_animation self )
 
 int mlt_animation_key_count( mlt_animation self )
 {
-	int count = -1;
-	if ( self )
-	{
-		animation_node node = self->nodes;
-		for ( count = 0; node; ++count )
-			node = node->next;
-	}
-	return count;
+	return self? self->count : -1;
 }
 
 /** Get an animation item for the N-th keyframe.
@@ -834,20 +941,15 @@ int mlt_animation_key_get( mlt_animation self, mlt_animation_item item, int inde
 	if (!self || !item) return 1;
 
 	int error = 0;
-	animation_node node = self->nodes;
 
-	// Iterate through the keyframes.
-	int i = index;
-	while ( i-- && node )
-		node = node->next;
-
-	if ( node )
+	if ( index >= 0 && index < self->count )
 	{
-		item->is_key = node->item.is_key;
-		item->frame = node->item.frame;
-		item->keyframe_type = node->item.keyframe_type;
+		mlt_animation_item node = &self->nodes[ index ];
+		item->is_key = node->is_key;
+		item->frame = node->frame;
+		item->keyframe_type = node->keyframe_type;
 		if ( item->property )
-			mlt_property_pass( item->property, node->item.property );
+			mlt_property_pass( item->property, node->property );
 	}
 	else
 	{
@@ -869,6 +971,7 @@ void mlt_animation_close( mlt_animation self )
 	if ( self )
 	{
 		mlt_animation_clean( self );
+		free( self->nodes );
 		free( self );
 	}
 }
@@ -887,15 +990,9 @@ int mlt_animation_key_set_type(mlt_animation self, int index, mlt_keyframe_type
 	if (!self) return 1;
 
 	int error = 0;
-	animation_node node = self->nodes;
-
-	// Iterate through the keyframes.
-	int i = index;
-	while ( i-- && node )
-		node = node->next;
 
-	if ( node ) {
-		node->item.keyframe_type = type;
+	if ( index >= 0 && index < self->count ) {
+		self->nodes[ index ].keyframe_type = type;
 		mlt_animation_interpolate(self);
 	} else {
 		error = 1;
@@ -918,15 +1015,10 @@ int mlt_animation_key_set_frame(mlt_animation self, int index, int frame)
 	if (!self) return 1;
 
 	int error = 0;
-	animation_node node = self->nodes;
-
-	// Iterate through the keyframes.
-	int i = index;
-	while ( i-- && node )
-		node = node->next;
 
-	if ( node ) {
-		node->item.frame = frame;
+	if ( index >= 0 && index < self->count ) {
+		self->nodes[ index ].frame = frame;
+		mlt_animation_check_order( self );
 		mlt_animation_interpolate(self);
 	} else {
 		error = 1;
@@ -0,0 +1,245 @@
+/**
+ * \file mlt_atom.c
+ * \brief interned property names
+ * \see mlt_atom_s
+ *
+ * Copyright (C) 2020 Meltytech, LLC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "mlt_atom.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define ATOM_TABLE_INITIAL_SIZE (1024)
+
+/** \brief Atom table
+ *
+ * The table is an open-addressing hash set that only grows. Readers probe it
+ * without locking; writers hold a mutex and publish new slots and new tables
+ * with release semantics. A table that has been replaced is kept alive
+ * because a reader may still be probing it.
+ */
+
+typedef struct atom_table_s
+{
+	unsigned int mask;
+	unsigned int count;
+	_Atomic( mlt_atom ) *slots;
+	struct atom_table_s *retired;
+}
+atom_table;
+
+static _Atomic( atom_table* ) atoms = NULL;
+static pthread_mutex_t atoms_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** The property names that the framework reads or writes for every frame */
+
+static const char *fixed_names[] =
+{
+	"_profile", "_producer", "_image_planes", "_alpha_value", "_position", "_speed",
+	"image", "alpha", "format", "width", "height", "aspect_ratio", "progressive",
+	"top_field_first", "colorspace", "force_full_luma", "rescale.interp",
+	"consumer_deinterlace", "deinterlace_method", "test_image", "test_audio",
+	"audio", "audio_format", "audio_frequency", "audio_channels", "audio_samples",
+	"in", "out", "length", "hide", "distort", "meta.volume",
+	NULL
+};
+
+/** Compute the hash of a string.
+ *
+ * \public \memberof mlt_atom_s
+ * \param name a string
+ * \return the hash value that is also stored in an atom for the same string
+ */
+
+unsigned int mlt_atom_hash( const char *name )
+{
+	unsigned int hash = 5381;
+	while ( *name )
+		hash = hash * 33 + (unsigned int) ( *name ++ );
+	// Mix the high bits into the low ones since the tables use a mask.
+	hash ^= hash >> 16;
+	hash *= 0x45d9f3b;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+/** Search a table for a string.
+ *
+ * \private \memberof mlt_atom_s
+ * \param table the table to search
+ * \param name the string
+ * \param hash the hash of the string
+ * \return the atom or NULL if not in the table
+ */
+
+static mlt_atom table_find( atom_table *table, const char *name, unsigned int hash )
+{
+	unsigned int i = hash & table->mask;
+	mlt_atom atom;
+
+	while ( ( atom = atomic_load_explicit( &table->slots[ i ], memory_order_acquire ) ) )
+	{
+		if ( atom->hash == hash && !strcmp( atom->name, name ) )
+			return atom;
+		i = ( i + 1 ) & table->mask;
+	}
+	return NULL;
+}
+
+/** Put an atom into a table that has room for it.
+ *
+ * \private \memberof mlt_atom_s
+ * \param table the table to modify
+ * \param atom the atom to insert
+ */
+
+static void table_insert( atom_table *table, mlt_atom atom )
+{
+	unsigned int i = atom->hash & table->mask;
+	while ( atomic_load_explicit( &table->slots[ i ], memory_order_relaxed ) )
+		i = ( i + 1 ) & table->mask;
+	atomic_store_explicit( &table->slots[ i ], atom, memory_order_release );
+	table->count ++;
+}
+
+/** Allocate a table and copy the contents of the previous one.
+ *
+ * \private \memberof mlt_atom_s
+ * \param previous the table to replace (optional)
+ * \return a new table
+ */
+
+static atom_table *table_grow( atom_table *previous )
+{
+	atom_table *table = calloc( 1, sizeof( atom_table ) );
+	unsigned int size = previous? ( previous->mask + 1 ) * 2 : ATOM_TABLE_INITIAL_SIZE;
+	unsigned int i;
+
+	table->mask = size - 1;
+	table->slots = calloc( size, sizeof( mlt_atom ) );
+	table->retired = previous;
+	if ( previous )
+	{
+		for ( i = 0; i <= previous->mask; i ++ )
+		{
+			mlt_atom atom = atomic_load_explicit( &previous->slots[ i ], memory_order_relaxed );
+			if ( atom )
+				table_insert( table, atom );
+		}
+	}
+	return table;
+}
+
+/** Look up an existing atom.
+ *
+ * This never allocates and never blocks.
+ * \public \memberof mlt_atom_s
+ * \param name a string
+ * \return the atom for the string or NULL if it has not been interned yet
+ */
+
+mlt_atom mlt_atom_find( const char *name )
+{
+	atom_table *table = atomic_load_explicit( &atoms, memory_order_acquire );
+	if ( !name || !table )
+		return NULL;
+	return table_find( table, name, mlt_atom_hash( name ) );
+}
+
+/** Get the atom for a string, interning it if necessary.
+ *
+ * \public \memberof mlt_atom_s
+ * \param name a string
+ * \return the atom for the string or NULL if name is NULL
+ */
+
+mlt_atom mlt_atom_get( const char *name )
+{
+	if ( !name )
+		return NULL;
+
+	unsigned int hash = mlt_atom_hash( name );
+	atom_table *table = atomic_load_explicit( &atoms, memory_order_acquire );
+	mlt_atom result = table? table_find( table, name, hash ) : NULL;
+
+	if ( !result )
+	{
+		pthread_mutex_lock( &atoms_mutex );
+
+		// Check again in case another thread won the race.
+		table = atomic_load_explicit( &atoms, memory_order_relaxed );
+		result = table? table_find( table, name, hash ) : NULL;
+
+		if ( !result )
+		{
+			size_t length = strlen( name ) + 1;
+			struct mlt_atom_s *atom = malloc( sizeof( struct mlt_atom_s ) + length );
+
+			atom->hash = hash;
+			atom->name = memcpy( atom + 1, name, length );
+
+			// Keep the load factor at or below one half.
+			if ( !table || ( table->count + 1 ) * 2 > table->mask + 1 )
+			{
+				table = table_grow( table );
+				table_insert( table, atom );
+				atomic_store_explicit( &atoms, table, memory_order_release );
+			}
+			else
+			{
+				table_insert( table, atom );
+			}
+			result = atom;
+		}
+
+		pthread_mutex_unlock( &atoms_mutex );
+	}
+
+	return result;
+}
+
+/** Get the string of an atom.
+ *
+ * Do not free the returned string.
+ * \public \memberof mlt_atom_s
+ * \param self an atom
+ * \return the string or NULL if self is NULL
+ */
+
+const char *mlt_atom_name( mlt_atom self )
+{
+	return self? self->name : NULL;
+}
+
+/** Intern the property names that the framework uses for every frame.
+ *
+ * This is called by mlt_factory_init(). A property list shares the atom of a
+ * name that is interned before the property is set, so comparing names in a
+ * lookup is then a pointer comparison.
+ * \public \memberof mlt_atom_s
+ */
+
+void mlt_atom_init( )
+{
+	int i;
+	for ( i = 0; fixed_names[ i ]; i ++ )
+		mlt_atom_get( fixed_names[ i ] );
+}
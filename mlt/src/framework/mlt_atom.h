@@ -0,0 +1,49 @@
+/**
+ * \file mlt_atom.h
+ * \brief interned property names
+ * \see mlt_atom_s
+ *
+ * Copyright (C) 2020 Meltytech, LLC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef MLT_ATOM_H
+#define MLT_ATOM_H
+
+#include "mlt_types.h"
+
+/** \brief Atom class
+ *
+ * An atom is the unique, process-wide copy of a string. Two atoms are equal
+ * if and only if their pointers are equal, which makes them cheap keys for
+ * the property lists. Atoms are never freed, so only intern names that are
+ * fixed in the code; a property list keeps a private copy of any name that
+ * has not been interned.
+ */
+
+struct mlt_atom_s
+{
+	unsigned int hash; /**< the hash of the name */
+	const char *name;  /**< the interned string */
+};
+
+extern mlt_atom mlt_atom_get( const char *name );
+extern mlt_atom mlt_atom_find( const char *name );
+extern const char *mlt_atom_name( mlt_atom self );
+extern unsigned int mlt_atom_hash( const char *name );
+extern void mlt_atom_init( );
+
+#endif
@@ -3,7 +3,7 @@
  * \brief least recently used cache
  * \see mlt_profile_s
  *
- * Copyright (C) 2007-2014 Meltytech, LLC
+ * Copyright (C) 2007-2020 Meltytech, LLC
  *
  * This library is free software; you can redistribute it and/or
  * modify it under the terms of the GNU Lesser General Public
@@ -27,14 +27,16 @@
 #include "mlt_frame.h"
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <pthread.h>
-
-/** the maximum number of data objects to cache per line */
-#define MAX_CACHE_SIZE (200)
+#include <stdatomic.h>
 
 /** the default number of data objects to cache per line */
 #define DEFAULT_CACHE_SIZE (4)
 
+/** the initial number of hash buckets per cache */
+#define INITIAL_BUCKETS (16)
+
 /** \brief Cache item class
  *
  * A cache item is a structure holding information about a data object including
@@ -44,6 +46,10 @@
  * When you close the cache item, the reference count is decremented.
  * The data object is destroyed when all cache items are closed and the cache
  * releases its reference.
+ *
+ * Every call to mlt_cache_put() creates a new item. If the cache replaces or
+ * evicts an item that still has references, the item lives on, outside of the
+ * cache, until the last reference is closed.
  */
 
 typedef struct mlt_cache_item_s
@@ -52,17 +58,35 @@ typedef struct mlt_cache_item_s
 	void *object;              /**< a parent object to the cache data that uniquely identifies this cached item */
 	void *data;                /**< the opaque pointer to the cached data */
 	int size;                  /**< the size of the cached data */
-	int refcount;              /**< a reference counter to control when destructor is called */
+	atomic_int refcount;       /**< a reference counter to control when destructor is called */
 	mlt_destructor destructor; /**< a function to release or destroy the cached data */
+	mlt_frame frame;           /**< the cached frame if this belongs to a frame cache */
+	mlt_position position;     /**< the position of the cached frame */
+	int cached;                /**< whether the item is still in the cache */
+	struct mlt_cache_item_s *prev;        /**< the next less recently used item in the same cache */
+	struct mlt_cache_item_s *next;        /**< the next more recently used item in the same cache */
+	struct mlt_cache_item_s *global_prev; /**< the next less recently used item in any cache */
+	struct mlt_cache_item_s *global_next; /**< the next more recently used item in any cache */
+	struct mlt_cache_item_s *bucket_next; /**< the next item in the same hash bucket */
 } mlt_cache_item_s;
 
 /** \brief Cache class
  *
  * This is a utility class for implementing a Least Recently Used (LRU) cache
  * of data blobs indexed by the address of some other object (e.g., a service).
- * Instead of sorting and manipulating linked lists, it tries to be simple and
- * elegant by copying pointers between two arrays of fixed size to shuffle the
- * order of elements.
+ * Items are found through a hash table and kept in a doubly linked list in
+ * order of use, so both mlt_cache_get() and mlt_cache_put() take constant time.
+ *
+ * Each cache limits the number of items it holds. In addition, all caches
+ * share an optional budget of bytes (see mlt_cache_set_budget()) based upon
+ * the \p size given to mlt_cache_put() and the size of the images and audio
+ * of cached frames. When the budget is exceeded, the least recently used
+ * items of any cache are released first. Items put with a size of 0, such as
+ * decoders, do not count against the budget and are never released for it.
+ *
+ * Each cache has its own mutex, so services using different caches do not
+ * wait for each other. Only items with a size share a second mutex for the
+ * list and byte count of all caches.
  *
  * This class is useful if you have a service that wants to cache something
  * somewhat large, but will not scale if there are many instances of the service.
@@ -81,91 +105,433 @@ typedef struct mlt_cache_item_s
 struct mlt_cache_s
 {
 	int count;             /**< the number of items currently in the cache */
-	int size;              /**< the maximum number of items permitted in the cache <= \p MAX_CACHE_SIZE */
-	int is_frames;         /**< indicates if this cache is used to cache frames */
-	void* *current;        /**< pointer to the current array of pointers */
-	void* A[ MAX_CACHE_SIZE ];
-	void* B[ MAX_CACHE_SIZE ];
-	pthread_mutex_t mutex; /**< a mutex to prevent multi-threaded race conditions */
-	mlt_properties active; /**< a list of cache items some of which may no longer
-	                            be in \p current but to which there are
-	                            outstanding references */
-	mlt_properties garbage;/**< a list cache items pending release. A cache item
-	                            is copied to this list when it is updated but there
-	                            are outstanding references to the old data object. */
+	int size;              /**< the maximum number of items permitted in the cache */
+	mlt_cache_item *buckets; /**< the hash table of items */
+	int bucket_count;      /**< the number of buckets, a power of two */
+	mlt_cache_item lru;    /**< the least recently used item */
+	mlt_cache_item mru;    /**< the most recently used item */
+	pthread_mutex_t mutex; /**< protects the table and list of this cache */
 };
 
-/** Get the data pointer from the cache item.
+/** a mutex shared by all caches to protect the global list, bytes, and budget;
+ * it may be locked while holding the mutex of a cache, but not the reverse
+ */
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** the least and most recently used items across all caches */
+static mlt_cache_item global_lru = NULL;
+static mlt_cache_item global_mru = NULL;
+
+/** the number of bytes held by all caches */
+static int64_t cache_bytes = 0;
+
+/** the maximum number of bytes to hold in all caches or 0 for no limit */
+static int64_t cache_budget = 0;
+static pthread_once_t budget_once = PTHREAD_ONCE_INIT;
+
+/** Read the initial budget from the environment.
  *
+ * The MLT_CACHE_BUDGET environment variable is a number of bytes with an
+ * optional K, M, or G suffix.
+ * \private \memberof mlt_cache_s
+ */
+
+static void budget_init( )
+{
+	const char *value = getenv( "MLT_CACHE_BUDGET" );
+	if ( value )
+	{
+		char *end = NULL;
+		int64_t bytes = strtoll( value, &end, 10 );
+		if ( end )
+		{
+			switch ( *end )
+			{
+			case 'g': case 'G': bytes *= 1024;
+				// fall through
+			case 'm': case 'M': bytes *= 1024;
+				// fall through
+			case 'k': case 'K': bytes *= 1024;
+			default: break;
+			}
+		}
+		if ( bytes > 0 )
+			cache_budget = bytes;
+	}
+}
+
+/** Set the maximum number of bytes held by all caches.
+ *
+ * When the total size of the items in all caches exceeds the budget, the least
+ * recently used items are released regardless of the cache to which they
+ * belong. The item counts of mlt_cache_set_size() still apply. The default
+ * is taken from the MLT_CACHE_BUDGET environment variable, or no limit.
  * \public \memberof mlt_cache_s
- * \param item a cache item
- * \param[out] size the number of bytes pointed at, if supplied when putting the data into the cache
- * \return the data pointer
+ * \param bytes the budget in bytes or 0 for no limit
  */
 
-void *mlt_cache_item_data( mlt_cache_item item, int *size )
+void mlt_cache_set_budget( int64_t bytes )
 {
-	if ( size && item )
-		*size = item->size;
-	return item? item->data : NULL;
+	pthread_once( &budget_once, budget_init );
+	pthread_mutex_lock( &cache_mutex );
+	cache_budget = bytes > 0 ? bytes : 0;
+	pthread_mutex_unlock( &cache_mutex );
 }
 
-/** Close a cache item given its parent object pointer.
+/** Get the maximum number of bytes held by all caches.
+ *
+ * \public \memberof mlt_cache_s
+ * \return the budget in bytes or 0 for no limit
+ */
+
+int64_t mlt_cache_get_budget( )
+{
+	int64_t result;
+	pthread_once( &budget_once, budget_init );
+	pthread_mutex_lock( &cache_mutex );
+	result = cache_budget;
+	pthread_mutex_unlock( &cache_mutex );
+	return result;
+}
+
+/** Get the number of bytes currently held by all caches.
+ *
+ * \public \memberof mlt_cache_s
+ * \return the number of bytes
+ */
+
+int64_t mlt_cache_get_bytes( )
+{
+	int64_t result;
+	pthread_mutex_lock( &cache_mutex );
+	result = cache_bytes;
+	pthread_mutex_unlock( &cache_mutex );
+	return result;
+}
+
+/** Compute the hash bucket of a key.
  *
  * \private \memberof mlt_cache_s
  * \param cache a cache
- * \param object the object to which the data object belongs
- * \param data the data object, which might be in the garbage list (optional)
+ * \param object the object to which the data belongs
+ * \param position the position of the frame for frame caches
+ * \return the bucket index
  */
 
-static void cache_object_close( mlt_cache cache, void *object, void* data )
+static inline int bucket_of( mlt_cache cache, void *object, mlt_position position )
 {
-	char key[19];
+	uint64_t key = object ? ( uint64_t )( uintptr_t ) object >> 4 : ( uint64_t )( int64_t ) position;
+	return ( int )( ( key * UINT64_C( 0x9E3779B97F4A7C15 ) ) >> 32 ) & ( cache->bucket_count - 1 );
+}
 
-	if ( cache->is_frames )
-	{
-		// Frame caches are easy - just close the object as mlt_frame.
-		mlt_frame_close( object );
+/** Find the cached item for a key.
+ *
+ * \private \memberof mlt_cache_s
+ * \param cache a cache
+ * \param object the object to which the data belongs or NULL for a frame
+ * \param position the position of the frame for frame caches
+ * \return the item or NULL if not found
+ */
+
+static mlt_cache_item cache_find( mlt_cache cache, void *object, mlt_position position )
+{
+	mlt_cache_item item = cache->buckets[ bucket_of( cache, object, position ) ];
+	while ( item && !( item->object == object && ( object || item->position == position ) ) )
+		item = item->bucket_next;
+	return item;
+}
+
+/** Double the number of hash buckets.
+ *
+ * \private \memberof mlt_cache_s
+ * \param cache a cache
+ */
+
+static void cache_rehash( mlt_cache cache )
+{
+	mlt_cache_item *buckets = calloc( cache->bucket_count * 2, sizeof( mlt_cache_item ) );
+	mlt_cache_item item;
+
+	if ( !buckets )
 		return;
+	free( cache->buckets );
+	cache->buckets = buckets;
+	cache->bucket_count *= 2;
+	for ( item = cache->lru; item; item = item->next )
+	{
+		int i = bucket_of( cache, item->object, item->position );
+		item->bucket_next = buckets[ i ];
+		buckets[ i ] = item;
 	}
+}
 
-	// Fetch the cache item from the active list by its owner's address
-	sprintf( key, "%p", object );
-	mlt_cache_item item = mlt_properties_get_data( cache->active, key, NULL );
-	if ( item )
+/** Append an item at the most recently used end of the list of all caches.
+ *
+ * The caller must hold cache_mutex.
+ * \private \memberof mlt_cache_s
+ * \param item a cache item with a size
+ */
+
+static void global_append( mlt_cache_item item )
+{
+	item->global_prev = global_mru;
+	item->global_next = NULL;
+	if ( global_mru )
+		global_mru->global_next = item;
+	else
+		global_lru = item;
+	global_mru = item;
+}
+
+/** Remove an item from the list of all caches.
+ *
+ * The caller must hold cache_mutex.
+ * \private \memberof mlt_cache_s
+ * \param item a cache item with a size
+ */
+
+static void global_remove( mlt_cache_item item )
+{
+	if ( item->global_prev )
+		item->global_prev->global_next = item->global_next;
+	else
+		global_lru = item->global_next;
+	if ( item->global_next )
+		item->global_next->global_prev = item->global_prev;
+	else
+		global_mru = item->global_prev;
+}
+
+/** Append an item at the most recently used end of the list of its cache.
+ *
+ * \private \memberof mlt_cache_s
+ * \param item a cache item
+ */
+
+static void list_append( mlt_cache_item item )
+{
+	mlt_cache cache = item->cache;
+
+	item->prev = cache->mru;
+	item->next = NULL;
+	if ( cache->mru )
+		cache->mru->next = item;
+	else
+		cache->lru = item;
+	cache->mru = item;
+}
+
+/** Remove an item from the list of its cache.
+ *
+ * \private \memberof mlt_cache_s
+ * \param item a cache item
+ */
+
+static void list_remove( mlt_cache_item item )
+{
+	mlt_cache cache = item->cache;
+
+	if ( item->prev )
+		item->prev->next = item->next;
+	else
+		cache->lru = item->next;
+	if ( item->next )
+		item->next->prev = item->prev;
+	else
+		cache->mru = item->prev;
+}
+
+/** Add an item to its cache.
+ *
+ * The caller must hold the mutex of the cache.
+ * \private \memberof mlt_cache_s
+ * \param item a new cache item holding the reference of the cache
+ */
+
+static void cache_insert( mlt_cache_item item )
+{
+	mlt_cache cache = item->cache;
+	int i;
+
+	if ( cache->count >= cache->bucket_count )
+		cache_rehash( cache );
+	i = bucket_of( cache, item->object, item->position );
+	item->bucket_next = cache->buckets[ i ];
+	cache->buckets[ i ] = item;
+	list_append( item );
+	item->cached = 1;
+	cache->count ++;
+	if ( item->size > 0 )
 	{
-		mlt_log( NULL, MLT_LOG_DEBUG, "%s: item %p object %p data %p refcount %d\n", __FUNCTION__,
-			item, item->object, item->data, item->refcount );
-		if ( item->destructor && --item->refcount <= 0 )
+		pthread_mutex_lock( &cache_mutex );
+		global_append( item );
+		cache_bytes += item->size;
+		pthread_mutex_unlock( &cache_mutex );
+	}
+}
+
+/** Take an item out of its cache.
+ *
+ * The caller must hold the mutex of the cache and release the reference that
+ * belonged to the cache. If \p locked is false and the item has a size, this
+ * locks cache_mutex.
+ * \private \memberof mlt_cache_s
+ * \param item a cached item
+ * \param locked whether the caller holds cache_mutex
+ */
+
+static void cache_remove( mlt_cache_item item, int locked )
+{
+	mlt_cache cache = item->cache;
+	mlt_cache_item *link = &cache->buckets[ bucket_of( cache, item->object, item->position ) ];
+
+	while ( *link != item )
+		link = &( *link )->bucket_next;
+	*link = item->bucket_next;
+	item->bucket_next = NULL;
+	list_remove( item );
+	item->cached = 0;
+	cache->count --;
+	if ( item->size > 0 )
+	{
+		if ( !locked )
+			pthread_mutex_lock( &cache_mutex );
+		global_remove( item );
+		cache_bytes -= item->size;
+		if ( !locked )
+			pthread_mutex_unlock( &cache_mutex );
+	}
+}
+
+/** Move an item to the most recently used end of the lists.
+ *
+ * The caller must hold the mutex of the cache.
+ * \private \memberof mlt_cache_s
+ * \param item a cached item
+ */
+
+static void cache_touch( mlt_cache_item item )
+{
+	if ( item->cache->mru != item )
+	{
+		list_remove( item );
+		list_append( item );
+	}
+	if ( item->size > 0 )
+	{
+		pthread_mutex_lock( &cache_mutex );
+		if ( global_mru != item )
 		{
-			// Destroy the data object
-			item->destructor( item->data );
-			item->data = NULL;
-			item->destructor = NULL;
-			// Do not dispose of the cache item because it could likely be used
-			// again.
+			global_remove( item );
+			global_append( item );
 		}
+		pthread_mutex_unlock( &cache_mutex );
 	}
+}
+
+/** Release a reference to an item.
+ *
+ * If it was the last reference, the item is put on a list so that the caller
+ * can destroy it with release_items() after unlocking.
+ * \private \memberof mlt_cache_s
+ * \param item a cache item
+ * \param[in,out] garbage a list of items to destroy
+ */
 
-	// Fetch the cache item from the garbage collection by its data address
-	if ( data )
+static void item_release( mlt_cache_item item, mlt_cache_item *garbage )
+{
+	if ( atomic_fetch_sub( &item->refcount, 1 ) <= 1 )
 	{
-		sprintf( key, "%p", data );
-		item = mlt_properties_get_data( cache->garbage, key, NULL );
-		if ( item )
+		item->bucket_next = *garbage;
+		*garbage = item;
+	}
+}
+
+/** Destroy items whose references have all been released.
+ *
+ * This is called without holding a mutex because destructors may be slow
+ * or may use another cache.
+ * \private \memberof mlt_cache_s
+ * \param garbage a list of items to destroy
+ */
+
+static void release_items( mlt_cache_item garbage )
+{
+	while ( garbage )
+	{
+		mlt_cache_item next = garbage->bucket_next;
+		mlt_log( NULL, MLT_LOG_DEBUG, "%s: item %p object %p data %p\n", __FUNCTION__,
+			garbage, garbage->object, garbage->data );
+		if ( garbage->frame )
+			mlt_frame_close( garbage->frame );
+		else if ( garbage->destructor )
+			garbage->destructor( garbage->data );
+		free( garbage );
+		garbage = next;
+	}
+}
+
+/** Remove items from a cache until it is within its size.
+ *
+ * The caller must hold the mutex of the cache.
+ * \private \memberof mlt_cache_s
+ * \param cache the cache to which an item was just added
+ * \param keep an item that must not be removed
+ * \param[in,out] garbage a list of items to destroy
+ */
+
+static void cache_evict( mlt_cache cache, mlt_cache_item keep, mlt_cache_item *garbage )
+{
+	while ( cache->count > cache->size && cache->lru && cache->lru != keep )
+	{
+		mlt_cache_item item = cache->lru;
+		cache_remove( item, 0 );
+		item_release( item, garbage );
+	}
+}
+
+/** Remove the least recently used items of all caches until within the budget.
+ *
+ * This is called without holding the mutex of a cache. Since that must be
+ * locked before cache_mutex, an item whose cache is busy is skipped rather
+ * than waited for, and the budget is enforced again on the next put.
+ * \private \memberof mlt_cache_s
+ * \param keep an item that must not be removed
+ * \param[in,out] garbage a list of items to destroy
+ */
+
+static void budget_evict( mlt_cache_item keep, mlt_cache_item *garbage )
+{
+	mlt_cache_item item, next;
+
+	pthread_mutex_lock( &cache_mutex );
+	for ( item = global_lru; item && cache_budget > 0 && cache_bytes > cache_budget; item = next )
+	{
+		next = item->global_next;
+		if ( item != keep && !pthread_mutex_trylock( &item->cache->mutex ) )
 		{
-			mlt_log( NULL, MLT_LOG_DEBUG, "collecting garbage item %p object %p data %p refcount %d\n",
-				item, item->object, item->data, item->refcount );
-			if ( item->destructor && --item->refcount <= 0 )
-			{
-				item->destructor( item->data );
-				item->data = NULL;
-				item->destructor = NULL;
-				// We do not need the garbage-collected cache item
-				mlt_properties_set_data( cache->garbage, key, NULL, 0, NULL, NULL );
-			}
+			mlt_cache cache = item->cache;
+			cache_remove( item, 1 );
+			item_release( item, garbage );
+			pthread_mutex_unlock( &cache->mutex );
 		}
 	}
+	pthread_mutex_unlock( &cache_mutex );
+}
+
+/** Get the data pointer from the cache item.
+ *
+ * \public \memberof mlt_cache_s
+ * \param item a cache item
+ * \param[out] size the number of bytes pointed at, if supplied when putting the data into the cache
+ * \return the data pointer
+ */
+
+void *mlt_cache_item_data( mlt_cache_item item, int *size )
+{
+	if ( size && item )
+		*size = item->size;
+	return item? item->data : NULL;
 }
 
 /** Close a cache item.
@@ -181,9 +547,11 @@ void mlt_cache_item_close( mlt_cache_item item )
 {
 	if ( item )
 	{
-		pthread_mutex_lock( &item->cache->mutex );
-		cache_object_close( item->cache, item->object, item->data );
-		pthread_mutex_unlock( &item->cache->mutex );
+		mlt_cache_item garbage = NULL;
+		mlt_log( NULL, MLT_LOG_DEBUG, "%s: item %p object %p data %p refcount %d\n", __FUNCTION__,
+			item, item->object, item->data, atomic_load( &item->refcount ) );
+		item_release( item, &garbage );
+		release_items( garbage );
 	}
 }
 
@@ -197,29 +565,38 @@ void mlt_cache_item_close( mlt_cache_item item )
 mlt_cache mlt_cache_init()
 {
 	mlt_cache result = calloc( 1, sizeof( struct mlt_cache_s ) );
+	pthread_once( &budget_once, budget_init );
 	if ( result )
 	{
 		result->size = DEFAULT_CACHE_SIZE;
-		result->current = result->A;
-		pthread_mutex_init( &result->mutex, NULL );
-		result->active = mlt_properties_new();
-		result->garbage = mlt_properties_new();
+		result->bucket_count = INITIAL_BUCKETS;
+		result->buckets = calloc( result->bucket_count, sizeof( mlt_cache_item ) );
+		if ( result->buckets )
+		{
+			pthread_mutex_init( &result->mutex, NULL );
+		}
+		else
+		{
+			free( result );
+			result = NULL;
+		}
 	}
 	return result;
 }
 
 /** Set the number of items to cache.
  *
- * This must be called before using the cache. The size can not be more
- * than \p MAX_CACHE_SIZE.
+ * This must be called before using the cache. A size of 0 turns caching off:
+ * only the item put last is kept, until the next one is put, so that it can
+ * still be got right after it is put.
  * \public \memberof mlt_cache_s
  * \param cache the cache to adjust
- * \param size the new size of the cache
+ * \param size the new size of the cache, which is ignored if negative
  */
 
 void mlt_cache_set_size( mlt_cache cache, int size )
 {
-	if ( size <= MAX_CACHE_SIZE )
+	if ( size >= 0 )
 		cache->size = size;
 }
 
@@ -237,6 +614,7 @@ int mlt_cache_get_size( mlt_cache cache )
 
 /** Destroy a cache.
  *
+ * Items that still have references are destroyed when they are closed.
  * \public \memberof mlt_cache_s
  * \param cache the cache to destroy
  */
@@ -245,15 +623,19 @@ void mlt_cache_close( mlt_cache cache )
 {
 	if ( cache )
 	{
-		while ( cache->count-- )
+		mlt_cache_item garbage = NULL;
+		pthread_mutex_lock( &cache->mutex );
+		while ( cache->lru )
 		{
-			void *object = cache->current[ cache->count ];
-			mlt_log( NULL, MLT_LOG_DEBUG, "%s: %d = %p\n", __FUNCTION__, cache->count, object );
-			cache_object_close( cache, object, NULL );
+			mlt_cache_item item = cache->lru;
+			mlt_log( NULL, MLT_LOG_DEBUG, "%s: %d = %p\n", __FUNCTION__, cache->count, item->object );
+			cache_remove( item, 0 );
+			item_release( item, &garbage );
 		}
-		mlt_properties_close( cache->active );
-		mlt_properties_close( cache->garbage );
+		pthread_mutex_unlock( &cache->mutex );
+		release_items( garbage );
 		pthread_mutex_destroy( &cache->mutex );
+		free( cache->buckets );
 		free( cache );
 	}
 }
@@ -267,167 +649,65 @@ void mlt_cache_close( mlt_cache cache )
 
 void mlt_cache_purge( mlt_cache cache, void *object )
 {
-	if (!cache) return;
-	pthread_mutex_lock( &cache->mutex );
 	if ( cache && object )
 	{
-		int i, j;
-		void **alt = cache->current == cache->A ? cache->B : cache->A;
-
-		for ( i = 0, j = 0; i < cache->count; i++ )
-		{
-			void *o = cache->current[ i ];
-
-			if ( o == object )
-			{
-				cache_object_close( cache, o, NULL );
-			}
-			else
-			{
-				alt[ j++ ] = o;
-			}
-		}
-		cache->count = j;
-		cache->current = alt;
-	}
-	pthread_mutex_unlock( &cache->mutex );
-}
-
-/** Shuffle the cache entries between the two arrays and return the cache entry for an object.
- *
- * \private \memberof mlt_cache_s
- * \param cache a cache object
- * \param object the object that owns the cached data
- * \return a cache entry if there was a hit or NULL for a miss
- */
-
-static void** shuffle_get_hit( mlt_cache cache, void *object )
-{
-	int i = cache->count;
-	int j = cache->count - 1;
-	void **hit = NULL;
-	void **alt = cache->current == cache->A ? cache->B : cache->A;
-
-	if ( cache->count > 0 && cache->count < cache->size )
-	{
-		// first determine if we have a hit
-		while ( i-- && !hit )
-		{
-			void **o = &cache->current[ i ];
-			if ( *o == object )
-				hit = o;
-		}
-		// if there was no hit, we will not be shuffling out an entry
-		// and are still filling the cache
-		if ( !hit )
-			++j;
-		// reset these
-		i = cache->count;
-		hit = NULL;
-	}
-
-	// shuffle the existing entries to the alternate array
-	while ( i-- )
-	{
-		void **o = &cache->current[ i ];
-
-		if ( !hit && *o == object )
-		{
-			hit = o;
-		}
-		else if ( j > 0 )
+		mlt_cache_item garbage = NULL;
+		pthread_mutex_lock( &cache->mutex );
+		mlt_cache_item item = cache_find( cache, object, 0 );
+		if ( item )
 		{
-			alt[ --j ] = *o;
-// 			mlt_log( NULL, MLT_LOG_DEBUG, "%s: shuffle %d = %p\n", __FUNCTION__, j, alt[j] );
+			cache_remove( item, 0 );
+			item_release( item, &garbage );
 		}
+		pthread_mutex_unlock( &cache->mutex );
+		release_items( garbage );
 	}
-	return hit;
 }
 
 /** Put a chunk of data in the cache.
  *
- * This function and mlt_cache_get() are not scalable with a large volume
- * of unique \p object parameter values. Therefore, it does not make sense
- * to use it for a frame/image cache using the frame position for \p object.
- * Instead, use mlt_cache_put_frame() for that.
+ * This function and mlt_cache_get() are keyed by the address of \p object.
+ * For a frame/image cache that uses the frame position as the key, use
+ * mlt_cache_put_frame() instead.
  *
  * \public \memberof mlt_cache_s
  * \param cache a cache object
  * \param object the object to which this data belongs
  * \param data an opaque pointer to the data to cache
- * \param size the size of the data in bytes
+ * \param size the size of the data in bytes, which counts against the budget
  * \param destructor a pointer to a function that can destroy or release a reference to the data.
  */
 
 void mlt_cache_put( mlt_cache cache, void *object, void* data, int size, mlt_destructor destructor )
 {
-	pthread_mutex_lock( &cache->mutex );
-	void **hit = shuffle_get_hit( cache, object );
-	void **alt = cache->current == cache->A ? cache->B : cache->A;
-
-	// add the object to the cache
-	if ( hit )
-	{
-		// release the old data
-		cache_object_close( cache, *hit, NULL );
-		// the MRU end gets the updated data
-		hit = &alt[ cache->count - 1 ];
-	}
-	else if ( cache->count < cache->size )
-	{
-		// more room in cache, add it to MRU end
-		hit = &alt[ cache->count++ ];
-	}
-	else
-	{
-		// release the entry at the LRU end
-		cache_object_close( cache, cache->current[0], NULL );
-
-		// The MRU end gets the new item
-		hit = &alt[ cache->count - 1 ];
-	}
-	*hit = object;
-	mlt_log( NULL, MLT_LOG_DEBUG, "%s: put %d = %p, %p\n", __FUNCTION__, cache->count - 1, object, data );
+	mlt_cache_item item = calloc( 1, sizeof( mlt_cache_item_s ) );
+	mlt_cache_item garbage = NULL;
 
-	// Fetch the cache item
-	char key[19];
-	sprintf( key, "%p", object );
-	mlt_cache_item item = mlt_properties_get_data( cache->active, key, NULL );
 	if ( !item )
-	{
-		item = calloc( 1, sizeof( mlt_cache_item_s ) );
-		if ( item )
-			mlt_properties_set_data( cache->active, key, item, 0, free, NULL );
-	}
-	if ( item )
-	{
-		// If updating the cache item but not all references are released
-		// copy the item to the garbage collection.
-		if ( item->refcount > 0 && item->data )
-		{
-			mlt_cache_item orphan = calloc( 1, sizeof( mlt_cache_item_s ) );
-			if ( orphan )
-			{
-				mlt_log( NULL, MLT_LOG_DEBUG, "adding to garbage collection object %p data %p\n", item->object, item->data );
-				*orphan = *item;
-				sprintf( key, "%p", orphan->data );
-				// We store in the garbage collection by data address, not the owner's!
-				mlt_properties_set_data( cache->garbage, key, orphan, 0, free, NULL );
-			}
-		}
+		return;
+	item->cache = cache;
+	item->object = object;
+	item->data = data;
+	item->size = size;
+	item->destructor = destructor;
+	atomic_init( &item->refcount, 1 );
 
-		// Set/update the cache item
-		item->cache = cache;
-		item->object = object;
-		item->data = data;
-		item->size = size;
-		item->destructor = destructor;
-		item->refcount = 1;
+	pthread_mutex_lock( &cache->mutex );
+	mlt_cache_item old = cache_find( cache, object, 0 );
+	if ( old )
+	{
+		// The old data is released when its last reference is closed.
+		cache_remove( old, 0 );
+		item_release( old, &garbage );
 	}
-	
-	// swap the current array
-	cache->current = alt;
+	cache_insert( item );
+	cache_evict( cache, item, &garbage );
+	mlt_log( NULL, MLT_LOG_DEBUG, "%s: put %d = %p, %p\n", __FUNCTION__, cache->count - 1, object, data );
 	pthread_mutex_unlock( &cache->mutex );
+	if ( size > 0 )
+		budget_evict( item, &garbage );
+
+	release_items( garbage );
 }
 
 /** Get a chunk of data from the cache.
@@ -442,81 +722,39 @@ mlt_cache_item mlt_cache_get( mlt_cache cache, void *object )
 {
 	mlt_cache_item result = NULL;
 	pthread_mutex_lock( &cache->mutex );
-	void **hit = shuffle_get_hit( cache, object );
-	void **alt = cache->current == cache->A ? cache->B : cache->A;
-
-	if ( hit )
+	result = cache_find( cache, object, 0 );
+	if ( result )
 	{
-		// copy the hit to the MRU end
-		alt[ cache->count - 1 ] = *hit;
-		hit = &alt[ cache->count - 1 ];
-
-		char key[19];
-		sprintf( key, "%p", *hit );
-		result = mlt_properties_get_data( cache->active, key, NULL );
-		if ( result && result->data )
-		{
-			result->refcount++;
-			mlt_log( NULL, MLT_LOG_DEBUG, "%s: get %d = %p, %p\n", __FUNCTION__, cache->count - 1, *hit, result->data );
-		}
-
-		// swap the current array
-		cache->current = alt;
+		cache_touch( result );
+		atomic_fetch_add( &result->refcount, 1 );
+		mlt_log( NULL, MLT_LOG_DEBUG, "%s: get %d = %p, %p\n", __FUNCTION__, cache->count - 1, object, result->data );
 	}
 	pthread_mutex_unlock( &cache->mutex );
 	
 	return result;
 }
 
-/** Shuffle the cache entries between the two arrays and return the frame for a position.
+/** Compute the number of bytes held by a frame.
  *
  * \private \memberof mlt_cache_s
- * \param cache a cache object
- * \param position the position of the frame that you want
- * \return a frame if there was a hit or NULL for a miss
+ * \param frame a frame
+ * \return the number of bytes of its image, alpha, and audio
  */
 
-static mlt_frame* shuffle_get_frame( mlt_cache cache, mlt_position position )
+static int frame_size( mlt_frame frame )
 {
-	int i = cache->count;
-	int j = cache->count - 1;
-	mlt_frame *hit = NULL;
-	mlt_frame *alt = (mlt_frame*) ( cache->current == cache->A ? cache->B : cache->A );
-
-	if ( cache->count > 0 && cache->count < cache->size )
-	{
-		// first determine if we have a hit
-		while ( i-- && !hit )
-		{
-			mlt_frame *o = (mlt_frame*) &cache->current[ i ];
-			if ( mlt_frame_original_position( *o ) == position )
-				hit = o;
-		}
-		// if there was no hit, we will not be shuffling out an entry
-		// and are still filling the cache
-		if ( !hit )
-			++j;
-		// reset these
-		i = cache->count;
-		hit = NULL;
-	}
-
-	// shuffle the existing entries to the alternate array
-	while ( i-- )
-	{
-		mlt_frame *o = (mlt_frame*) &cache->current[ i ];
-
-		if ( !hit && mlt_frame_original_position( *o ) == position )
-		{
-			hit = o;
-		}
-		else if ( j > 0 )
-		{
-			alt[ --j ] = *o;
-// 			mlt_log( NULL, MLT_LOG_DEBUG, "%s: shuffle %d = %p\n", __FUNCTION__, j, alt[j] );
-		}
-	}
-	return hit;
+	mlt_properties properties = MLT_FRAME_PROPERTIES( frame );
+	int size = 0, total = 0;
+
+	if ( mlt_properties_get_data( properties, "image", &size ) )
+		total += size;
+	size = 0;
+	if ( mlt_properties_get_data( properties, "alpha", &size ) )
+		total += size;
+	size = 0;
+	if ( mlt_properties_get_data( properties, "audio", &size ) )
+		total += size;
+	return total;
 }
 
 /** Put a frame in the cache.
@@ -534,38 +772,34 @@ static mlt_frame* shuffle_get_frame( mlt_cache cache, mlt_position position )
 
 void mlt_cache_put_frame( mlt_cache cache, mlt_frame frame )
 {
-	pthread_mutex_lock( &cache->mutex );
-	mlt_frame *hit = shuffle_get_frame( cache, mlt_frame_original_position( frame ) );
-	mlt_frame *alt = (mlt_frame*) ( cache->current == cache->A ? cache->B : cache->A );
+	mlt_cache_item item = calloc( 1, sizeof( mlt_cache_item_s ) );
+	mlt_cache_item garbage = NULL;
 
-	// add the frame to the cache
-	if ( hit )
-	{
-		// release the old data
-		mlt_frame_close( *hit );
-		// the MRU end gets the updated data
-		hit = &alt[ cache->count - 1 ];
-	}
-	else if ( cache->count < cache->size )
-	{
-		// more room in cache, add it to MRU end
-		hit = &alt[ cache->count++ ];
-	}
-	else
-	{
-		// release the entry at the LRU end
-		mlt_frame_close( cache->current[0] );
+	if ( !item )
+		return;
+
+	// Copy the frame outside of the lock.
+	item->cache = cache;
+	item->frame = mlt_frame_clone( frame, 1 );
+	item->position = mlt_frame_original_position( frame );
+	item->size = frame_size( item->frame );
+	atomic_init( &item->refcount, 1 );
 
-		// The MRU end gets the new item
-		hit = &alt[ cache->count - 1 ];
+	pthread_mutex_lock( &cache->mutex );
+	mlt_cache_item old = cache_find( cache, NULL, item->position );
+	if ( old )
+	{
+		cache_remove( old, 0 );
+		item_release( old, &garbage );
 	}
-	*hit = mlt_frame_clone( frame, 1 );
+	cache_insert( item );
+	cache_evict( cache, item, &garbage );
 	mlt_log( NULL, MLT_LOG_DEBUG, "%s: put %d = %p\n", __FUNCTION__, cache->count - 1, frame );
-
-	// swap the current array
-	cache->current = (void**) alt;
-	cache->is_frames = 1;
 	pthread_mutex_unlock( &cache->mutex );
+	if ( item->size > 0 )
+		budget_evict( item, &garbage );
+
+	release_items( garbage );
 }
 
 /** Get a frame from the cache.
@@ -582,23 +816,26 @@ void mlt_cache_put_frame( mlt_cache cache, mlt_frame frame )
 mlt_frame mlt_cache_get_frame( mlt_cache cache, mlt_position position )
 {
 	mlt_frame result = NULL;
-	pthread_mutex_lock( &cache->mutex );
-	mlt_frame *hit = shuffle_get_frame( cache, position );
-	mlt_frame *alt = (mlt_frame*) ( cache->current == cache->A ? cache->B : cache->A );
+	mlt_cache_item garbage = NULL;
+	mlt_cache_item item;
 
-	if ( hit )
+	pthread_mutex_lock( &cache->mutex );
+	item = cache_find( cache, NULL, position );
+	if ( item )
 	{
-		// copy the hit to the MRU end
-		alt[ cache->count - 1 ] = *hit;
-		hit = &alt[ cache->count - 1 ];
-
-		result = mlt_frame_clone( *hit, 1 );
-		mlt_log( NULL, MLT_LOG_DEBUG, "%s: get %d = %p\n", __FUNCTION__, cache->count - 1, *hit );
-
-		// swap the current array
-		cache->current = (void**) alt;
+		cache_touch( item );
+		atomic_fetch_add( &item->refcount, 1 );
+		mlt_log( NULL, MLT_LOG_DEBUG, "%s: get %d = %p\n", __FUNCTION__, cache->count - 1, item->frame );
 	}
 	pthread_mutex_unlock( &cache->mutex );
 
+	if ( item )
+	{
+		// Copy the frame outside of the lock while holding a reference.
+		result = mlt_frame_clone( item->frame, 1 );
+		item_release( item, &garbage );
+		release_items( garbage );
+	}
+
 	return result;
 }
@@ -26,6 +26,8 @@
 #include "mlt_frame.h"
 #include "mlt_profile.h"
 #include "mlt_log.h"
+#include "mlt_slices.h"
+#include "mlt_trace.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -797,6 +799,7 @@ static void *consumer_read_ahead_thread( void *arg )
 	int count = 0;
 	int skipped = 0;
 	int64_t time_process = 0;
+	int64_t wait_start = -1;
 	int skip_next = 0;
 	mlt_position pos = 0;
 	mlt_position start_pos = 0;
@@ -848,8 +851,15 @@ static void *consumer_read_ahead_thread( void *arg )
 	
 		// Put the current frame into the queue
 		pthread_mutex_lock( &priv->queue_mutex );
+		wait_start = -1;
 		while( priv->ahead && mlt_deque_count( priv->queue ) >= buffer )
+		{
+			if ( mlt_trace_enabled && wait_start < 0 )
+				wait_start = mlt_trace_time( );
 			pthread_cond_wait( &priv->queue_cond, &priv->queue_mutex );
+		}
+		if ( wait_start >= 0 )
+			mlt_trace_span( "consumer_wait", "queue full", frame ? mlt_frame_get_position( frame ) : -1, wait_start );
 		if ( priv->is_purge )
 		{
 			mlt_frame_close( frame );
@@ -1061,13 +1071,18 @@ static void *consumer_worker_thread( void *arg )
 		// Get the next unprocessed frame from the work queue
 		pthread_mutex_lock( &priv->queue_mutex );
 		int index = first_unprocessed_frame( self );
+		int64_t wait_start = -1;
 		while ( priv->ahead && index >= mlt_deque_count( priv->queue ) )
 		{
 			mlt_log_debug( MLT_CONSUMER_SERVICE(self), "waiting in worker index = %d queue count = %d\n",
 				index, mlt_deque_count( priv->queue ) );
+			if ( mlt_trace_enabled && wait_start < 0 )
+				wait_start = mlt_trace_time( );
 			pthread_cond_wait( &priv->queue_cond, &priv->queue_mutex );
 			index = first_unprocessed_frame( self );
 		}
+		if ( wait_start >= 0 )
+			mlt_trace_span( "consumer_wait", "queue empty", -1, wait_start );
 
 		// Mark the frame for processing
 		frame = mlt_deque_peek( priv->queue, index );
@@ -1100,7 +1115,10 @@ static void *consumer_worker_thread( void *arg )
 			width = mlt_properties_get_int( properties, "width" );
 			height = mlt_properties_get_int( properties, "height" );
 			mlt_events_fire( MLT_CONSUMER_PROPERTIES( self ), "consumer-frame-render", frame, NULL );
+			// Count this thread against the slices pool while it renders.
+			mlt_slices_attach_normal();
 			mlt_frame_get_image( frame, &image, &format, &width, &height, 0 );
+			mlt_slices_detach_normal();
 		}
 		mlt_properties_set_int( MLT_FRAME_PROPERTIES( frame ), "rendered", 1 );
 		mlt_frame_close( frame );
@@ -1428,12 +1446,15 @@ static mlt_frame worker_get_frame( mlt_consumer self, mlt_properties properties
 		}
 
 		// Wait for prefill
+		int64_t wait_start = mlt_trace_enabled ? mlt_trace_time( ) : -1;
 		while ( priv->ahead && first_unprocessed_frame( self ) < prefill )
 		{
 			pthread_mutex_lock( &priv->done_mutex );
 			pthread_cond_wait( &priv->done_cond, &priv->done_mutex );
 			pthread_mutex_unlock( &priv->done_mutex );
 		}
+		if ( wait_start >= 0 )
+			mlt_trace_span( "consumer_wait", "prefill", -1, wait_start );
 		priv->process_head = threads;
 	}
 
@@ -1462,13 +1483,18 @@ static mlt_frame worker_get_frame( mlt_consumer self, mlt_properties properties
 	}
 
 	// Wait if not realtime.
+	int64_t wait_start = -1;
 	while ( priv->ahead && priv->real_time < 0 && !priv->is_purge &&
 		!( mlt_properties_get_int( MLT_FRAME_PROPERTIES( MLT_FRAME( mlt_deque_peek_front( priv->queue ) ) ), "rendered" ) ) )
 	{
+		if ( mlt_trace_enabled && wait_start < 0 )
+			wait_start = mlt_trace_time( );
 		pthread_mutex_lock( &priv->done_mutex );
 		pthread_cond_wait( &priv->done_cond, &priv->done_mutex );
 		pthread_mutex_unlock( &priv->done_mutex );
 	}
+	if ( wait_start >= 0 )
+		mlt_trace_span( "consumer_wait", "render", -1, wait_start );
 
 	// Get the frame from the queue.
 	pthread_mutex_lock( &priv->queue_mutex );
@@ -1584,8 +1610,15 @@ mlt_frame mlt_consumer_rt_frame( mlt_consumer self )
 		// Get frame from queue
 		pthread_mutex_lock( &priv->queue_mutex );
 		mlt_log_timings_begin();
+		int64_t wait_start = -1;
 		while( priv->ahead && mlt_deque_count( priv->queue ) < size )
+		{
+			if ( mlt_trace_enabled && wait_start < 0 )
+				wait_start = mlt_trace_time( );
 			pthread_cond_wait( &priv->queue_cond, &priv->queue_mutex );
+		}
+		if ( wait_start >= 0 )
+			mlt_trace_span( "consumer_wait", "frame queue", -1, wait_start );
 		frame = mlt_deque_pop_front( priv->queue );
 		mlt_log_timings_end( NULL, "wait_for_frame_queue" );
 		pthread_cond_broadcast( &priv->queue_cond );
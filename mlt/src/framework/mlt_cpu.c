@@ -0,0 +1,230 @@
+/**
+ * \file mlt_cpu.c
+ * \brief CPU feature detection and kernel selection
+ * \see mlt_cpu_feature
+ *
+ * Copyright (C) 2020 Meltytech, LLC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "mlt_cpu.h"
+#include "mlt_log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define ENV_FEATURES "MLT_CPU_FEATURES"
+#define FEATURE_COUNT ( ( int )( sizeof( feature_names ) / sizeof( feature_names[0] ) ) )
+
+/** \brief an implementation of a kernel
+ *
+ * The registered kernels are kept for the life of the process. A module
+ * registers them only once, and it keeps what it selected, even when the
+ * factory is closed and initialized again.
+ */
+
+typedef struct cpu_kernel_s
+{
+	char *name;              /**< the name of the kernel */
+	int features;            /**< the CPU features the implementation requires */
+	void *function;          /**< the implementation */
+	struct cpu_kernel_s *next;
+}
+cpu_kernel;
+
+static const struct
+{
+	mlt_cpu_feature feature;
+	const char *name;
+}
+feature_names[] =
+{
+	{ mlt_cpu_sse2, "sse2" },
+	{ mlt_cpu_ssse3, "ssse3" },
+	{ mlt_cpu_avx2, "avx2" },
+	{ mlt_cpu_avx512, "avx512" },
+	{ mlt_cpu_neon, "neon" },
+};
+
+static int cpu_features = 0;
+static pthread_once_t cpu_once = PTHREAD_ONCE_INIT;
+static cpu_kernel *kernels = NULL;
+static pthread_mutex_t kernels_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Parse the features in the environment variable.
+ *
+ * \private \memberof mlt_cpu
+ * \param value a comma-separated list of feature names
+ * \return the features named
+ */
+
+static int parse_features( const char *value )
+{
+	int features = 0;
+	int i;
+
+	value += strspn( value, ", " );
+	while ( *value )
+	{
+		size_t n = strcspn( value, ", " );
+		for ( i = 0; i < FEATURE_COUNT; i++ )
+			if ( strlen( feature_names[i].name ) == n && !strncmp( value, feature_names[i].name, n ) )
+				break;
+		if ( i < FEATURE_COUNT )
+			features |= feature_names[i].feature;
+		else if ( n != 4 || strncmp( value, "none", 4 ) )
+			mlt_log_warning( NULL, "[cpu] unknown feature in %s: %.*s\n", ENV_FEATURES, ( int ) n, value );
+		value += n;
+		value += strspn( value, ", " );
+	}
+	return features;
+}
+
+/** Detect the features of the CPU once per process.
+ *
+ * \private \memberof mlt_cpu
+ */
+
+static void cpu_init( )
+{
+	char *env = getenv( ENV_FEATURES );
+	int i;
+
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+	__builtin_cpu_init( );
+	if ( __builtin_cpu_supports( "sse2" ) )
+		cpu_features |= mlt_cpu_sse2;
+	if ( __builtin_cpu_supports( "ssse3" ) )
+		cpu_features |= mlt_cpu_ssse3;
+	if ( __builtin_cpu_supports( "avx2" ) )
+		cpu_features |= mlt_cpu_avx2;
+	if ( __builtin_cpu_supports( "avx512f" ) && __builtin_cpu_supports( "avx512bw" ) )
+		cpu_features |= mlt_cpu_avx512;
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+	cpu_features |= mlt_cpu_neon;
+#endif
+
+	if ( env )
+		cpu_features &= parse_features( env );
+
+	for ( i = 0; i < FEATURE_COUNT; i++ )
+		if ( cpu_features & feature_names[i].feature )
+			mlt_log_verbose( NULL, "[cpu] %s\n", feature_names[i].name );
+}
+
+/** Get the CPU features that kernels may use.
+ *
+ * These are the features detected in the CPU less those not listed in the
+ * MLT_CPU_FEATURES environment variable if it is set.
+ * \public \memberof mlt_cpu
+ * \return a bitmask of mlt_cpu_feature
+ */
+
+int mlt_cpu_features( )
+{
+	pthread_once( &cpu_once, cpu_init );
+	return cpu_features;
+}
+
+/** Determine if kernels may use some CPU features.
+ *
+ * \public \memberof mlt_cpu
+ * \param features a bitmask of mlt_cpu_feature
+ * \return true if all of the features are available
+ */
+
+int mlt_cpu_has( int features )
+{
+	return ( mlt_cpu_features( ) & features ) == features;
+}
+
+/** Get the name of a CPU feature.
+ *
+ * \public \memberof mlt_cpu
+ * \param feature a CPU feature
+ * \return the name as used in MLT_CPU_FEATURES or NULL if not a feature
+ */
+
+const char *mlt_cpu_feature_name( mlt_cpu_feature feature )
+{
+	int i;
+	for ( i = 0; i < FEATURE_COUNT; i++ )
+		if ( feature_names[i].feature == feature )
+			return feature_names[i].name;
+	return NULL;
+}
+
+/** Register an implementation of a kernel.
+ *
+ * A module registers every implementation it was compiled with, including
+ * any that the CPU may not support, and then calls mlt_cpu_select().
+ * Registering the same kernel and features again replaces the function.
+ * \public \memberof mlt_cpu
+ * \param kernel the name of the kernel, prefixed by the module or service
+ * \param features a bitmask of mlt_cpu_feature that the implementation requires
+ * \param function the implementation
+ */
+
+void mlt_cpu_register( const char *kernel, int features, void *function )
+{
+	cpu_kernel *k;
+
+	pthread_mutex_lock( &kernels_mutex );
+	for ( k = kernels; k; k = k->next )
+		if ( k->features == features && !strcmp( k->name, kernel ) )
+			break;
+	if ( !k )
+	{
+		k = calloc( 1, sizeof( *k ) );
+		k->name = strdup( kernel );
+		k->features = features;
+		k->next = kernels;
+		kernels = k;
+	}
+	k->function = function;
+	pthread_mutex_unlock( &kernels_mutex );
+}
+
+/** Select the best implementation of a kernel for this CPU.
+ *
+ * Of the implementations whose features are all available, the one
+ * requiring the greatest feature wins. The result does not change during
+ * the process unless more implementations are registered, so callers
+ * should select once and keep the function.
+ * \public \memberof mlt_cpu
+ * \param kernel the name of the kernel
+ * \return the function or NULL to use the portable C code
+ */
+
+void *mlt_cpu_select( const char *kernel )
+{
+	int available = mlt_cpu_features( );
+	cpu_kernel *k, *best = NULL;
+
+	pthread_mutex_lock( &kernels_mutex );
+	for ( k = kernels; k; k = k->next )
+		if ( ( k->features & available ) == k->features && !strcmp( k->name, kernel ) &&
+		     ( !best || k->features > best->features ) )
+			best = k;
+	pthread_mutex_unlock( &kernels_mutex );
+
+	if ( best )
+		mlt_log_debug( NULL, "[cpu] %s uses features 0x%x\n", kernel, best->features );
+	else
+		mlt_log_debug( NULL, "[cpu] %s uses C\n", kernel );
+	return best ? best->function : NULL;
+}
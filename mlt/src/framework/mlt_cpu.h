@@ -0,0 +1,55 @@
+/**
+ * \file mlt_cpu.h
+ * \brief CPU feature detection and kernel selection
+ * \see mlt_cpu_feature
+ *
+ * Copyright (C) 2020 Meltytech, LLC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef MLT_CPU_H
+#define MLT_CPU_H
+
+#include "mlt_types.h"
+
+/**
+ * \envvar \em MLT_CPU_FEATURES Restrict the CPU features that kernels may use
+ * to a comma-separated list of feature names, for example "sse2,ssse3" or
+ * "none" for the portable C kernels. Features the CPU lacks cannot be added.
+ */
+
+/** The CPU features that kernels can require.
+ *
+ * A greater value is a more capable instruction set of the same architecture.
+ */
+
+typedef enum
+{
+	mlt_cpu_sse2   = 1 << 0, /**< x86 SSE2 */
+	mlt_cpu_ssse3  = 1 << 1, /**< x86 SSSE3 */
+	mlt_cpu_avx2   = 1 << 2, /**< x86 AVX2 */
+	mlt_cpu_avx512 = 1 << 3, /**< x86 AVX-512 foundation and byte and word instructions */
+	mlt_cpu_neon   = 1 << 4  /**< ARM NEON */
+}
+mlt_cpu_feature;
+
+extern int mlt_cpu_features( );
+extern int mlt_cpu_has( int features );
+extern const char *mlt_cpu_feature_name( mlt_cpu_feature feature );
+extern void mlt_cpu_register( const char *kernel, int features, void *function );
+extern void *mlt_cpu_select( const char *kernel );
+
+#endif
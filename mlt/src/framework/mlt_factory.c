@@ -215,6 +215,16 @@ mlt_repository mlt_factory_init( const char *directory )
 		// Initialise the pool
 		mlt_pool_init( );
 
+		// Intern the property names used for every frame
+		mlt_atom_init( );
+
+		// Detect the CPU features for the kernels of the modules
+		mlt_cpu_features( );
+
+		// Start a trace of the frame pipeline if requested and not yet started
+		if ( getenv( "MLT_TRACE" ) && !mlt_trace_enabled )
+			mlt_trace_open( getenv( "MLT_TRACE" ) );
+
 		// Create and set up the events object
 		event_object = mlt_properties_new( );
 		mlt_events_init( event_object );
@@ -496,6 +506,7 @@ void mlt_factory_close( )
 {
 	if ( mlt_directory != NULL )
 	{
+		mlt_trace_close( );
 		mlt_properties_close( event_object );
 		event_object = NULL;
 #if !defined(_WIN32)
@@ -23,6 +23,7 @@
 #include "mlt_filter.h"
 #include "mlt_frame.h"
 #include "mlt_producer.h"
+#include "mlt_trace.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -322,6 +323,14 @@ mlt_frame mlt_filter_process( mlt_filter self, mlt_frame frame )
 		mlt_properties_set_data( MLT_FRAME_PROPERTIES(frame), name, self, 0,
 			(mlt_destructor) mlt_filter_close, NULL );
 
+		if ( mlt_trace_enabled )
+		{
+			// Attribute the closures the filter pushes to it.
+			mlt_service previous = mlt_trace_enter( MLT_FILTER_SERVICE( self ) );
+			frame = self->process( self, frame );
+			mlt_trace_enter( previous );
+			return frame;
+		}
 		return self->process( self, frame );
 	}
 }
@@ -25,10 +25,105 @@
 #include "mlt_factory.h"
 #include "mlt_profile.h"
 #include "mlt_log.h"
+#include "mlt_trace.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+
+/** \brief Atoms for the frame properties read on every image request */
+
+static struct
+{
+	mlt_atom image;
+	mlt_atom format;
+	mlt_atom width;
+	mlt_atom height;
+	mlt_atom test_image;
+	mlt_atom producer;
+	mlt_atom planes;
+	mlt_atom alpha_value;
+} atoms;
+static pthread_once_t atoms_once = PTHREAD_ONCE_INIT;
+
+static void init_atoms( )
+{
+	atoms.image = mlt_atom_get( "image" );
+	atoms.format = mlt_atom_get( "format" );
+	atoms.width = mlt_atom_get( "width" );
+	atoms.height = mlt_atom_get( "height" );
+	atoms.test_image = mlt_atom_get( "test_image" );
+	atoms.producer = mlt_atom_get( "_producer" );
+	atoms.planes = mlt_atom_get( "_image_planes" );
+	atoms.alpha_value = mlt_atom_get( "_alpha_value" );
+}
+
+/** \brief the layout of an image whose lines are not packed
+ *
+ * This is stored on a frame by mlt_frame_set_image_planes(). It only applies
+ * while the image of the frame is the one it was set for.
+ */
+
+typedef struct
+{
+	void *image;         ///< the image of the frame when this was set
+	uint8_t *planes[4];  ///< the first byte of each plane
+	int strides[4];      ///< the number of bytes between the lines of each plane
+}
+image_planes;
+
+/** Get the layout of the image of a frame if it is not packed.
+ *
+ * \private \memberof mlt_frame_s
+ * \param properties the properties of a frame
+ * \return the layout or NULL if the image is packed
+ */
+
+static image_planes *get_image_planes( mlt_properties properties )
+{
+	image_planes *layout = mlt_properties_get_data_by_atom( properties, atoms.planes, NULL );
+	if ( layout && layout->image != mlt_properties_get_data_by_atom( properties, atoms.image, NULL ) )
+		layout = NULL;
+	return layout;
+}
+
+/** Get the number of lines of a plane of an image.
+ *
+ * \private \memberof mlt_frame_s
+ */
+
+static int plane_height( mlt_image_format format, int plane, int height )
+{
+	return ( format == mlt_image_yuv420p && plane > 0 ) ? height / 2 : height;
+}
+
+/** Copy the planes of an image between layouts.
+ *
+ * \private \memberof mlt_frame_s
+ */
+
+static void copy_planes( mlt_image_format format, int width, int height, uint8_t *src[4], int src_strides[4], uint8_t *dst[4], int dst_strides[4] )
+{
+	uint8_t *packed[4];
+	int packed_strides[4];
+	int i, y;
+
+	mlt_image_format_planes( format, width, height, NULL, packed, packed_strides );
+	for ( i = 0; i < 4; i++ )
+	{
+		uint8_t *s = src[i];
+		uint8_t *d = dst[i];
+		if ( !s || !d || !packed_strides[i] )
+			continue;
+		for ( y = plane_height( format, i, height ); y > 0; y-- )
+		{
+			memcpy( d, s, packed_strides[i] );
+			s += src_strides[i];
+			d += dst_strides[i];
+		}
+	}
+}
 
 /** Construct a frame object.
  *
@@ -42,6 +137,8 @@ mlt_frame mlt_frame_init( mlt_service service )
 	// Allocate a frame
 	mlt_frame self = calloc( 1, sizeof( struct mlt_frame_s ) );
 
+	pthread_once( &atoms_once, init_atoms );
+
 	if ( self != NULL )
 	{
 		mlt_profile profile = mlt_service_profile( service );
@@ -91,8 +188,8 @@ int mlt_frame_is_test_card( mlt_frame self )
 {
 	mlt_properties properties = MLT_FRAME_PROPERTIES( self );
 	return ( mlt_deque_count( self->stack_image ) == 0
-			 && !mlt_properties_get_data( properties, "image", NULL ) )
-			|| mlt_properties_get_int( properties, "test_image" );
+			 && !mlt_properties_get_data_by_atom( properties, atoms.image, NULL ) )
+			|| mlt_properties_get_int_by_atom( properties, atoms.test_image );
 }
 
 /** Determine if the frame will produce audio from a test card.
@@ -194,6 +291,8 @@ int mlt_frame_set_position( mlt_frame self, mlt_position value )
 
 int mlt_frame_push_get_image( mlt_frame self, mlt_get_image get_image )
 {
+	if ( mlt_trace_enabled )
+		mlt_trace_closure( self, 0, get_image );
 	return mlt_deque_push_back( self->stack_image, get_image );
 }
 
@@ -244,6 +343,9 @@ mlt_frame mlt_frame_pop_frame( mlt_frame self )
 
 int mlt_frame_push_service( mlt_frame self, void *that )
 {
+	// Some services push their get_image function this way.
+	if ( mlt_trace_enabled )
+		mlt_trace_closure( self, 0, that );
 	return mlt_deque_push_back( self->stack_image, that );
 }
 
@@ -294,6 +396,8 @@ int mlt_frame_pop_service_int( mlt_frame self )
 
 int mlt_frame_push_audio( mlt_frame self, void *that )
 {
+	if ( mlt_trace_enabled )
+		mlt_trace_closure( self, 1, that );
 	return mlt_deque_push_back( self->stack_audio, that );
 }
 
@@ -333,9 +437,71 @@ mlt_deque mlt_frame_service_stack( mlt_frame self )
 
 int mlt_frame_set_image( mlt_frame self, uint8_t *image, int size, mlt_destructor destroy )
 {
+	if ( mlt_properties_get_data_by_atom( MLT_FRAME_PROPERTIES( self ), atoms.planes, NULL ) )
+		mlt_properties_clear( MLT_FRAME_PROPERTIES( self ), "_image_planes" );
 	return mlt_properties_set_data( MLT_FRAME_PROPERTIES( self ), "image", image, size, destroy, NULL );
 }
 
+/** Describe the planes of the image of the frame.
+ *
+ * Use this after mlt_frame_set_image() when the lines of the image are padded
+ * or its planes are not contiguous, for example to reference a decoded picture
+ * or a region of a larger image without copying it. The image still owns the
+ * memory. Functions that honor the layout get the image with
+ * mlt_frame_get_image_strided(); mlt_frame_get_image() packs the image first.
+ *
+ * \public \memberof mlt_frame_s
+ * \param self a frame
+ * \param planes the first byte of each plane of the image
+ * \param strides the number of bytes between the lines of each plane
+ * \return true if error
+ */
+
+int mlt_frame_set_image_planes( mlt_frame self, uint8_t *planes[4], int strides[4] )
+{
+	mlt_properties properties = MLT_FRAME_PROPERTIES( self );
+	image_planes *layout = calloc( 1, sizeof( *layout ) );
+
+	if ( !layout )
+		return 1;
+	layout->image = mlt_properties_get_data_by_atom( properties, atoms.image, NULL );
+	memcpy( layout->planes, planes, sizeof( layout->planes ) );
+	memcpy( layout->strides, strides, sizeof( layout->strides ) );
+	return mlt_properties_set_data( properties, "_image_planes", layout, sizeof( *layout ), free, NULL );
+}
+
+/** Get the planes of the image of the frame.
+ *
+ * This returns the layout set by mlt_frame_set_image_planes() or else the
+ * layout of the packed image as mlt_image_format_planes() computes it.
+ *
+ * \public \memberof mlt_frame_s
+ * \param self a frame
+ * \param[out] planes the first byte of each plane of the image
+ * \param[out] strides the number of bytes between the lines of each plane
+ * \return true if the frame has no image
+ */
+
+int mlt_frame_get_image_planes( mlt_frame self, uint8_t *planes[4], int strides[4] )
+{
+	mlt_properties properties = MLT_FRAME_PROPERTIES( self );
+	uint8_t *image = mlt_properties_get_data_by_atom( properties, atoms.image, NULL );
+	image_planes *layout = get_image_planes( properties );
+
+	if ( layout )
+	{
+		memcpy( planes, layout->planes, sizeof( layout->planes ) );
+		memcpy( strides, layout->strides, sizeof( layout->strides ) );
+	}
+	else
+	{
+		mlt_image_format_planes( mlt_properties_get_int_by_atom( properties, atoms.format ),
+			mlt_properties_get_int_by_atom( properties, atoms.width ),
+			mlt_properties_get_int_by_atom( properties, atoms.height ), image, planes, strides );
+	}
+	return image == NULL;
+}
+
 /** Set a new alpha channel on the frame.
   *
   * \public \memberof mlt_frame_s
@@ -349,9 +515,50 @@ int mlt_frame_set_image( mlt_frame self, uint8_t *image, int size, mlt_destructo
 int mlt_frame_set_alpha( mlt_frame self, uint8_t *alpha, int size, mlt_destructor destroy )
 {
 	self->get_alpha_mask = NULL;
+	if ( mlt_properties_get_by_atom( MLT_FRAME_PROPERTIES( self ), atoms.alpha_value ) )
+		mlt_properties_clear( MLT_FRAME_PROPERTIES( self ), "_alpha_value" );
 	return mlt_properties_set_data( MLT_FRAME_PROPERTIES( self ), "alpha", alpha, size, destroy, NULL );
 }
 
+/** Set an alpha channel whose pixels all have the same value.
+ *
+ * This replaces the alpha channel of the frame without allocating it. Code
+ * that checks mlt_frame_get_alpha_value() can skip the alpha of each pixel,
+ * while mlt_frame_get_alpha() only creates the channel if it is not opaque.
+ *
+ * \public \memberof mlt_frame_s
+ * \param self a frame
+ * \param value the alpha of every pixel from 0 (transparent) to 255 (opaque)
+ * \return true if error
+ */
+
+int mlt_frame_set_alpha_value( mlt_frame self, int value )
+{
+	mlt_frame_set_alpha( self, NULL, 0, NULL );
+	return mlt_properties_set_int( MLT_FRAME_PROPERTIES( self ), "_alpha_value", CLAMP( value, 0, 255 ) );
+}
+
+/** Get the alpha of the frame if it is the same for every pixel.
+ *
+ * A frame without an alpha channel is opaque. This does not look at an alpha
+ * channel in the image itself, as with mlt_image_rgb24a.
+ *
+ * \public \memberof mlt_frame_s
+ * \param self a frame
+ * \return the alpha of every pixel from 0 to 255, or -1 if the frame has an alpha channel
+ */
+
+int mlt_frame_get_alpha_value( mlt_frame self )
+{
+	mlt_properties properties = MLT_FRAME_PROPERTIES( self );
+
+	if ( ( self->get_alpha_mask && self->get_alpha_mask( self ) ) || mlt_properties_get_data( properties, "alpha", NULL ) )
+		return -1;
+	if ( mlt_properties_get_by_atom( properties, atoms.alpha_value ) )
+		return mlt_properties_get_int_by_atom( properties, atoms.alpha_value );
+	return 255;
+}
+
 /** Replace image stack with the information provided.
  *
  * This might prove to be unreliable and restrictive - the idea is that a transition
@@ -384,7 +591,7 @@ void mlt_frame_replace_image( mlt_frame self, uint8_t *image, mlt_image_format f
 	while( mlt_deque_pop_back( self->stack_image ) ) ;
 
 	// Update the information
-	mlt_properties_set_data( MLT_FRAME_PROPERTIES( self ), "image", image, 0, NULL, NULL );
+	mlt_frame_set_image( self, image, 0, NULL );
 	mlt_properties_set_int( MLT_FRAME_PROPERTIES( self ), "width", width );
 	mlt_properties_set_int( MLT_FRAME_PROPERTIES( self ), "height", height );
 	mlt_properties_set_int( MLT_FRAME_PROPERTIES( self ), "format", format );
@@ -478,6 +685,137 @@ int mlt_image_format_size( mlt_image_format format, int width, int height, int *
 	return 0;
 }
 
+/** Share a buffer of one frame with another frame.
+ *
+ * Only a block of mlt_pool can be shared; it gets another reference that the
+ * other frame releases.
+ * \private \memberof mlt_frame_s
+ * \param properties the properties of the frame with the buffer
+ * \param new_props the properties of the frame to receive the buffer
+ * \param name the name of the buffer property
+ * \param size the size of the buffer in bytes
+ * \return true if the buffer is shared, false if it must be copied
+ */
+
+static int share_buffer( mlt_properties properties, mlt_properties new_props, const char *name, int size )
+{
+	void *data = mlt_properties_get_data( properties, name, NULL );
+
+	if ( data && size > 0 && mlt_properties_get_destructor( properties, name ) == mlt_pool_release )
+	{
+		mlt_pool_inc_ref( data );
+		mlt_properties_set_data( new_props, name, data, size, mlt_pool_release, NULL );
+		return 1;
+	}
+	return 0;
+}
+
+/** Determine whether a frame is the only user of a buffer.
+ *
+ * Only a block of mlt_pool with one reference belongs to the frame alone. A
+ * buffer with another destructor or none may belong to a producer, such as a
+ * decoded picture or a cached image, and must be treated as shared.
+ * \private \memberof mlt_frame_s
+ * \param properties the properties of a frame
+ * \param name the name of the buffer property
+ * \param data the buffer
+ * \return true if the buffer may be modified in place
+ */
+
+static int is_private_buffer( mlt_properties properties, const char *name, void *data )
+{
+	return mlt_properties_get_destructor( properties, name ) == mlt_pool_release && mlt_pool_ref_count( data ) == 1;
+}
+
+/** Make a buffer shared with other frames private to a frame before it is modified.
+ *
+ * \private \memberof mlt_frame_s
+ * \param properties the properties of a frame
+ * \param name the name of the buffer property
+ * \param size the size of the buffer in bytes if the property does not have it
+ * \return the buffer, which is a copy if it was shared
+ */
+
+static void *unshare_buffer( mlt_properties properties, const char *name, int size )
+{
+	int length = 0;
+	void *data = mlt_properties_get_data( properties, name, &length );
+
+	if ( length > 0 )
+		size = length;
+	if ( data && size > 0 && !is_private_buffer( properties, name, data ) )
+	{
+		void *copy = mlt_pool_alloc( size );
+		if ( copy )
+		{
+			memcpy( copy, data, size );
+			mlt_properties_set_data( properties, name, copy, size, mlt_pool_release, NULL );
+			data = copy;
+		}
+	}
+	return data;
+}
+
+/** Pack the image of a frame if its lines are not packed.
+ *
+ * \private \memberof mlt_frame_s
+ * \param self a frame
+ * \param[in,out] buffer the image returned by mlt_frame_get_image()
+ * \param format the format of the image
+ * \param width the width of the image
+ * \param height the height of the image
+ */
+
+static void pack_image( mlt_frame self, uint8_t **buffer, mlt_image_format format, int width, int height )
+{
+	image_planes *layout = get_image_planes( MLT_FRAME_PROPERTIES( self ) );
+
+	if ( layout && *buffer == layout->planes[0] )
+	{
+		int size = mlt_image_format_size( format, width, height, NULL );
+		uint8_t *image = mlt_pool_alloc( size );
+		uint8_t *planes[4];
+		int strides[4];
+
+		if ( image )
+		{
+			mlt_image_format_planes( format, width, height, image, planes, strides );
+			copy_planes( format, width, height, layout->planes, layout->strides, planes, strides );
+			mlt_frame_set_image( self, image, size, mlt_pool_release );
+			*buffer = image;
+		}
+	}
+}
+
+/** Make the image and alpha channel of a frame writable.
+ *
+ * \private \memberof mlt_frame_s
+ * \param self a frame
+ * \param[in,out] buffer the image returned by mlt_frame_get_image()
+ * \param format the format of the image
+ * \param width the width of the image
+ * \param height the height of the image
+ */
+
+static void unshare_image( mlt_frame self, uint8_t **buffer, mlt_image_format format, int width, int height )
+{
+	mlt_properties properties = MLT_FRAME_PROPERTIES( self );
+	uint8_t *image = mlt_properties_get_data_by_atom( properties, atoms.image, NULL );
+	image_planes *layout = get_image_planes( properties );
+
+	if ( *buffer && layout && *buffer == layout->planes[0] )
+	{
+		// The planes may extend beyond the size of the image, so pack them instead
+		if ( !is_private_buffer( properties, "image", image ) )
+			pack_image( self, buffer, format, width, height );
+	}
+	else if ( *buffer && *buffer == image )
+	{
+		*buffer = unshare_buffer( properties, "image", mlt_image_format_size( format, width, height, NULL ) );
+	}
+	unshare_buffer( properties, "alpha", width * height );
+}
+
 static int generate_test_image( mlt_properties properties, uint8_t **buffer,  mlt_image_format *format, int *width, int *height, int writable )
 {
 	mlt_producer producer = mlt_properties_get_data( properties, "test_card_producer", NULL );
@@ -587,42 +925,43 @@ static int generate_test_image( mlt_properties properties, uint8_t **buffer,  ml
 }
 
 
-/** Get the image associated to the frame.
+/** Get the image associated to the frame, packed or not.
  *
- * You should express the desired format, width, and height as inputs. As long
- * as the loader producer was used to generate this or the imageconvert filter
- * was attached, then you will get the image back in the format you desire.
- * However, you do not always get the width and height you request depending
- * on properties and filters. You do not need to supply a pre-allocated
- * buffer, but you should always supply the desired image format.
- *
- * \public \memberof mlt_frame_s
- * \param self a frame
- * \param[out] buffer an image buffer
- * \param[in,out] format the image format
- * \param[in,out] width the horizontal size in pixels
- * \param[in,out] height the vertical size in pixels
- * \param writable whether or not you will need to be able to write to the memory returned in \p buffer
- * \return true if error
- * \todo Better describe the width and height as inputs.
+ * \private \memberof mlt_frame_s
+ * \see mlt_frame_get_image
  */
 
-int mlt_frame_get_image( mlt_frame self, uint8_t **buffer, mlt_image_format *format, int *width, int *height, int writable )
+static int frame_get_image( mlt_frame self, uint8_t **buffer, mlt_image_format *format, int *width, int *height, int writable, int packed )
 {
 	mlt_properties properties = MLT_FRAME_PROPERTIES( self );
 	mlt_get_image get_image = mlt_frame_pop_get_image( self );
+	int convert;
 	mlt_image_format requested_format = *format;
 	int error = 0;
 
 	if ( get_image )
 	{
 		mlt_properties_set_int( properties, "image_count", mlt_properties_get_int( properties, "image_count" ) - 1 );
-		error = get_image( self, buffer, format, width, height, writable );
+		if ( mlt_trace_enabled )
+		{
+			// Look up the name before the closure pops anything else.
+			const char *name = mlt_trace_closure_name( self, 0, get_image );
+			int64_t start = mlt_trace_time( );
+			error = get_image( self, buffer, format, width, height, writable );
+			mlt_trace_span( "get_image", name, mlt_frame_get_position( self ), start );
+		}
+		else
+		{
+			error = get_image( self, buffer, format, width, height, writable );
+		}
 		if ( !error && buffer && *buffer )
 		{
 			mlt_properties_set_int( properties, "width", *width );
 			mlt_properties_set_int( properties, "height", *height );
-			if ( self->convert_image && requested_format != mlt_image_none )
+			convert = self->convert_image && requested_format != mlt_image_none;
+			if ( packed || ( convert && requested_format != *format ) )
+				pack_image( self, buffer, *format, *width, *height );
+			if ( convert )
 				self->convert_image( self, buffer, format, requested_format );
 			mlt_properties_set_int( properties, "format", *format );
 		}
@@ -630,18 +969,27 @@ int mlt_frame_get_image( mlt_frame self, uint8_t **buffer, mlt_image_format *for
 		{
 			error = generate_test_image( properties, buffer, format, width, height, writable );
 		}
+		if ( !error && writable && buffer )
+			unshare_image( self, buffer, *format, *width, *height );
 	}
-	else if ( mlt_properties_get_data( properties, "image", NULL ) && buffer )
+	else if ( mlt_properties_get_data_by_atom( properties, atoms.image, NULL ) && buffer )
 	{
-		*format = mlt_properties_get_int( properties, "format" );
-		*buffer = mlt_properties_get_data( properties, "image", NULL );
-		*width = mlt_properties_get_int( properties, "width" );
-		*height = mlt_properties_get_int( properties, "height" );
-		if ( self->convert_image && *buffer && requested_format != mlt_image_none )
+		*format = mlt_properties_get_int_by_atom( properties, atoms.format );
+		*buffer = mlt_properties_get_data_by_atom( properties, atoms.image, NULL );
+		*width = mlt_properties_get_int_by_atom( properties, atoms.width );
+		*height = mlt_properties_get_int_by_atom( properties, atoms.height );
+		if ( get_image_planes( properties ) )
+			*buffer = get_image_planes( properties )->planes[0];
+		convert = self->convert_image && requested_format != mlt_image_none;
+		if ( packed || ( convert && requested_format != *format ) )
+			pack_image( self, buffer, *format, *width, *height );
+		if ( convert && *buffer )
 		{
 			self->convert_image( self, buffer, format, requested_format );
 			mlt_properties_set_int( properties, "format", *format );
 		}
+		if ( writable )
+			unshare_image( self, buffer, *format, *width, *height );
 	}
 	else
 	{
@@ -651,10 +999,111 @@ int mlt_frame_get_image( mlt_frame self, uint8_t **buffer, mlt_image_format *for
 	return error;
 }
 
+/** Get the image associated to the frame.
+ *
+ * You should express the desired format, width, and height as inputs. As long
+ * as the loader producer was used to generate this or the imageconvert filter
+ * was attached, then you will get the image back in the format you desire.
+ * However, you do not always get the width and height you request depending
+ * on properties and filters. You do not need to supply a pre-allocated
+ * buffer, but you should always supply the desired image format.
+ *
+ * The image and alpha channel may be shared with other frames, for example
+ * by mlt_frame_clone(), or belong to the producer, such as a decoded picture
+ * or a cached image. Request a writable image if you modify either one, and
+ * it is copied unless it is a block of mlt_pool that only this frame uses.
+ *
+ * The image is always packed; an image with a layout set by
+ * mlt_frame_set_image_planes() is copied into a packed one.
+ *
+ * \public \memberof mlt_frame_s
+ * \param self a frame
+ * \param[out] buffer an image buffer
+ * \param[in,out] format the image format
+ * \param[in,out] width the horizontal size in pixels
+ * \param[in,out] height the vertical size in pixels
+ * \param writable whether or not you will need to be able to write to the memory returned in \p buffer
+ * \return true if error
+ * \todo Better describe the width and height as inputs.
+ */
+
+int mlt_frame_get_image( mlt_frame self, uint8_t **buffer, mlt_image_format *format, int *width, int *height, int writable )
+{
+	return frame_get_image( self, buffer, format, width, height, writable, 1 );
+}
+
+/** Get the image associated to the frame without packing it.
+ *
+ * This is the same as mlt_frame_get_image() except that an image with padded
+ * lines or separate planes, such as a decoded picture or a cropped region, is
+ * not copied. Use the planes and strides to access it, not the size of the
+ * image format.
+ *
+ * \public \memberof mlt_frame_s
+ * \param self a frame
+ * \param[out] planes the first byte of each plane of the image
+ * \param[out] strides the number of bytes between the lines of each plane
+ * \param[in,out] format the image format
+ * \param[in,out] width the horizontal size in pixels
+ * \param[in,out] height the vertical size in pixels
+ * \param writable whether or not you will need to be able to write to the image
+ * \return true if error
+ */
+
+int mlt_frame_get_image_strided( mlt_frame self, uint8_t *planes[4], int strides[4], mlt_image_format *format, int *width, int *height, int writable )
+{
+	uint8_t *buffer = NULL;
+	int error = frame_get_image( self, &buffer, format, width, height, writable, 0 );
+
+	if ( !error && buffer )
+	{
+		image_planes *layout = get_image_planes( MLT_FRAME_PROPERTIES( self ) );
+		if ( layout && buffer == layout->planes[0] )
+		{
+			memcpy( planes, layout->planes, sizeof( layout->planes ) );
+			memcpy( strides, layout->strides, sizeof( layout->strides ) );
+		}
+		else
+		{
+			mlt_image_format_planes( *format, *width, *height, buffer, planes, strides );
+		}
+	}
+	else
+	{
+		memset( planes, 0, 4 * sizeof( *planes ) );
+		memset( strides, 0, 4 * sizeof( *strides ) );
+	}
+	return error;
+}
+
+/** Create the alpha channel of a frame from its alpha value.
+ *
+ * An opaque channel is only created if \p opaque is set.
+ */
+
+static uint8_t *make_alpha( mlt_frame self, int opaque )
+{
+	mlt_properties properties = MLT_FRAME_PROPERTIES( self );
+	int value = mlt_properties_get_by_atom( properties, atoms.alpha_value ) ?
+		mlt_properties_get_int_by_atom( properties, atoms.alpha_value ) : 255;
+	uint8_t *alpha = NULL;
+
+	if ( value < 255 || opaque )
+	{
+		int size = mlt_properties_get_int_by_atom( properties, atoms.width ) * mlt_properties_get_int_by_atom( properties, atoms.height );
+		alpha = mlt_pool_alloc( size );
+		memset( alpha, value, size );
+		mlt_properties_set_data( properties, "alpha", alpha, size, mlt_pool_release, NULL );
+	}
+	return alpha;
+}
+
 /** Get the alpha channel associated to the frame.
  *
  * Unlike mlt_frame_get_alpha(), this function WILL create an opaque alpha
- * channel if one does not already exist.
+ * channel if one does not already exist. Since callers of this function
+ * commonly write to the alpha channel, one shared with another frame is
+ * copied first.
  *
  * \public \memberof mlt_frame_s
  * \deprecated use mlt_frame_get_alpha() instead
@@ -670,14 +1119,10 @@ uint8_t *mlt_frame_get_alpha_mask( mlt_frame self )
 		if ( self->get_alpha_mask != NULL )
 			alpha = self->get_alpha_mask( self );
 		if ( alpha == NULL )
-			alpha = mlt_properties_get_data( &self->parent, "alpha", NULL );
+			alpha = unshare_buffer( &self->parent, "alpha", mlt_properties_get_int_by_atom( &self->parent, atoms.width ) *
+				mlt_properties_get_int_by_atom( &self->parent, atoms.height ) );
 		if ( alpha == NULL )
-		{
-			int size = mlt_properties_get_int( &self->parent, "width" ) * mlt_properties_get_int( &self->parent, "height" );
-			alpha = mlt_pool_alloc( size );
-			memset( alpha, 255, size );
-			mlt_properties_set_data( &self->parent, "alpha", alpha, size, mlt_pool_release, NULL );
-		}
+			alpha = make_alpha( self, 1 );
 	}
 	return alpha;
 }
@@ -685,7 +1130,11 @@ uint8_t *mlt_frame_get_alpha_mask( mlt_frame self )
 /** Get the alpha channel associated to the frame (without creating if it has not).
  *
  * Unlike mlt_frame_get_alpha_mask(), this function does NOT create an alpha
- * channel if one does not already exist.
+ * channel if one does not already exist, unless it was set as a value that
+ * is not opaque with mlt_frame_set_alpha_value(). In that case, it allocates
+ * a channel filled with the value, which replaces the value on the frame.
+ * Code that only needs a constant alpha should check
+ * mlt_frame_get_alpha_value() first to avoid the allocation.
  *
  * \public \memberof mlt_frame_s
  * \param self a frame
@@ -701,10 +1150,70 @@ uint8_t *mlt_frame_get_alpha( mlt_frame self )
 			alpha = self->get_alpha_mask( self );
 		if ( alpha == NULL )
 			alpha = mlt_properties_get_data( &self->parent, "alpha", NULL );
+		if ( alpha == NULL )
+			alpha = make_alpha( self, 0 );
 	}
 	return alpha;
 }
 
+/** Determine whether an image of a frame is fully opaque.
+ *
+ * An image in a format with an alpha channel is checked pixel by pixel.
+ * Otherwise, it is opaque unless the frame has an alpha channel that is not.
+ * This does not change the frame, so a caller that asks again for the same
+ * image may want to remember the answer.
+ * GPU images are never reported as opaque since they cannot be inspected.
+ *
+ * \public \memberof mlt_frame_s
+ * \param self a frame
+ * \param image the image, as returned by mlt_frame_get_image()
+ * \param format the format of the image
+ * \param width the width of the image
+ * \param height the height of the image
+ * \return true if no pixel of the image is transparent
+ */
+
+int mlt_frame_is_opaque( mlt_frame self, uint8_t *image, mlt_image_format format, int width, int height )
+{
+	int n = width * height;
+	int value;
+	uint8_t *alpha;
+
+	if ( !self || !image || n <= 0 )
+		return 0;
+
+	switch ( format )
+	{
+	case mlt_image_rgb24a:
+		for ( image += 3; n --; image += 4 )
+			if ( *image != 0xff )
+				return 0;
+		return 1;
+	case mlt_image_none:
+	case mlt_image_glsl:
+	case mlt_image_glsl_texture:
+		return 0;
+	default:
+		break;
+	}
+
+	// A constant alpha does not need to be checked per pixel
+	value = mlt_frame_get_alpha_value( self );
+	if ( value >= 0 )
+		return value == 255;
+	alpha = mlt_frame_get_alpha( self );
+	if ( alpha )
+	{
+		int size = 0;
+		if ( !self->get_alpha_mask && mlt_properties_get_data( &self->parent, "alpha", &size ) == alpha && size > 0 && size < n )
+			return 0;
+		while ( n -- )
+			if ( *alpha ++ != 0xff )
+				return 0;
+	}
+	return 1;
+}
+
 /** Get the audio associated to the frame.
  *
  * You should express the desired format, frequency, channels, and samples as inputs. As long
@@ -735,7 +1244,17 @@ int mlt_frame_get_audio( mlt_frame self, void **buffer, mlt_audio_format *format
 
 	if ( hide == 0 && get_audio != NULL )
 	{
-		get_audio( self, buffer, format, frequency, channels, samples );
+		if ( mlt_trace_enabled )
+		{
+			const char *name = mlt_trace_closure_name( self, 1, get_audio );
+			int64_t start = mlt_trace_time( );
+			get_audio( self, buffer, format, frequency, channels, samples );
+			mlt_trace_span( "get_audio", name, mlt_frame_get_position( self ), start );
+		}
+		else
+		{
+			get_audio( self, buffer, format, frequency, channels, samples );
+		}
 		mlt_properties_set_int( properties, "audio_frequency", *frequency );
 		mlt_properties_set_int( properties, "audio_channels", *channels );
 		mlt_properties_set_int( properties, "audio_samples", *samples );
@@ -775,6 +1294,10 @@ int mlt_frame_get_audio( mlt_frame self, void **buffer, mlt_audio_format *format
 		mlt_properties_set_int( properties, "test_audio", 1 );
 	}
 
+	// Audio filters modify the audio in place, so it cannot stay shared
+	if ( *buffer && *buffer == mlt_properties_get_data( properties, "audio", NULL ) )
+		*buffer = unshare_buffer( properties, "audio", mlt_audio_format_size( *format, *samples, *channels ) );
+
 	// TODO: This does not belong here
 	if ( *format == mlt_audio_s16 && mlt_properties_get( properties, "meta.volume" ) && *buffer )
 	{
@@ -912,7 +1435,7 @@ unsigned char *mlt_frame_get_waveform( mlt_frame self, int w, int h )
 mlt_producer mlt_frame_get_original_producer( mlt_frame self )
 {
 	if ( self != NULL )
-		return mlt_properties_get_data( MLT_FRAME_PROPERTIES( self ), "_producer", NULL );
+		return mlt_properties_get_data_by_atom( MLT_FRAME_PROPERTIES( self ), atoms.producer, NULL );
 	return NULL;
 }
 
@@ -1016,6 +1539,10 @@ mlt_properties mlt_frame_get_unique_properties( mlt_frame self, mlt_service serv
  * This does not copy the get_image/get_audio processing stacks or any
  * data properties other than the audio and image.
  *
+ * A deep copy shares the audio, image, and alpha channel with the original
+ * when they are allocated from mlt_pool, and the first frame to modify one
+ * of them gets its own copy; see mlt_frame_get_image().
+ *
  * \public \memberof mlt_frame_s
  * \param self the frame to clone
  * \param is_deep a boolean to indicate whether to make a deep copy of the audio
@@ -1042,6 +1569,7 @@ mlt_frame mlt_frame_clone( mlt_frame self, int is_deep )
 
 	if ( is_deep )
 	{
+		// Buffers from mlt_pool are shared until one of the frames modifies them.
 		data = mlt_properties_get_data( properties, "audio", &size );
 		if ( data )
 		{
@@ -1049,9 +1577,12 @@ mlt_frame mlt_frame_clone( mlt_frame self, int is_deep )
 				size = mlt_audio_format_size( mlt_properties_get_int( properties, "audio_format" ),
 					mlt_properties_get_int( properties, "audio_samples" ),
 					mlt_properties_get_int( properties, "audio_channels" ) );
-			copy = mlt_pool_alloc( size );
-			memcpy( copy, data, size );
-			mlt_properties_set_data( new_props, "audio", copy, size, mlt_pool_release, NULL );
+			if ( !share_buffer( properties, new_props, "audio", size ) )
+			{
+				copy = mlt_pool_alloc( size );
+				memcpy( copy, data, size );
+				mlt_properties_set_data( new_props, "audio", copy, size, mlt_pool_release, NULL );
+			}
 		}
 		data = mlt_properties_get_data( properties, "image", &size );
 		if ( data )
@@ -1059,21 +1590,46 @@ mlt_frame mlt_frame_clone( mlt_frame self, int is_deep )
 			int width = mlt_properties_get_int( properties, "width" );
 			int height = mlt_properties_get_int( properties, "height" );
 
+			mlt_image_format format = mlt_properties_get_int( properties, "format" );
+			image_planes *layout = get_image_planes( properties );
+
 			if ( ! size )
-				size = mlt_image_format_size( mlt_properties_get_int( properties, "format" ),
-					width, height, NULL );
-			copy = mlt_pool_alloc( size );
-			memcpy( copy, data, size );
-			mlt_properties_set_data( new_props, "image", copy, size, mlt_pool_release, NULL );
+				size = mlt_image_format_size( format, width, height, NULL );
+			if ( share_buffer( properties, new_props, "image", size ) )
+			{
+				if ( layout )
+					mlt_frame_set_image_planes( new_frame, layout->planes, layout->strides );
+			}
+			else if ( layout )
+			{
+				uint8_t *planes[4];
+				int strides[4];
+
+				// Pack the copy
+				size = mlt_image_format_size( format, width, height, NULL );
+				copy = mlt_pool_alloc( size );
+				mlt_image_format_planes( format, width, height, copy, planes, strides );
+				copy_planes( format, width, height, layout->planes, layout->strides, planes, strides );
+				mlt_properties_set_data( new_props, "image", copy, size, mlt_pool_release, NULL );
+			}
+			else
+			{
+				copy = mlt_pool_alloc( size );
+				memcpy( copy, data, size );
+				mlt_properties_set_data( new_props, "image", copy, size, mlt_pool_release, NULL );
+			}
 
 			data = mlt_properties_get_data( properties, "alpha", &size );
 			if ( data )
 			{
 				if ( ! size )
 					size = width * height;
-				copy = mlt_pool_alloc( size );
-				memcpy( copy, data, size );
-				mlt_properties_set_data( new_props, "alpha", copy, size, mlt_pool_release, NULL );
+				if ( !share_buffer( properties, new_props, "alpha", size ) )
+				{
+					copy = mlt_pool_alloc( size );
+					memcpy( copy, data, size );
+					mlt_properties_set_data( new_props, "alpha", copy, size, mlt_pool_release, NULL );
+				}
 			};
 		}
 	}
@@ -1089,6 +1645,8 @@ mlt_frame mlt_frame_clone( mlt_frame self, int is_deep )
 		mlt_properties_set_data( new_props, "audio", data, size, NULL, NULL );
 		data = mlt_properties_get_data( properties, "image", &size );
 		mlt_properties_set_data( new_props, "image", data, size, NULL, NULL );
+		if ( get_image_planes( properties ) )
+			mlt_frame_set_image_planes( new_frame, get_image_planes( properties )->planes, get_image_planes( properties )->strides );
 		data = mlt_properties_get_data( properties, "alpha", &size );
 		mlt_properties_set_data( new_props, "alpha", data, size, NULL, NULL );
 	}
@@ -1155,3 +1713,44 @@ int mlt_image_format_planes( mlt_image_format format, int width, int height, voi
 
 	return 0;
 }
+
+/** Build the pointers of padded and aligned image planes.
+ *
+ * Each plane starts and each line is padded to a multiple of MLT_IMAGE_ALIGN
+ * bytes, which suits vector instructions. Call this with NULL data to get the
+ * number of bytes to allocate, and again with the allocation to get the
+ * planes, which are then described with mlt_frame_set_image_planes().
+ *
+ * \public \memberof mlt_frame_s
+ * \param format the image format
+ * \param width width of the image in pixels
+ * \param height height of the image in pixels
+ * \param data the allocated image or NULL
+ * \param[out] planes pointers to plane's pointers will be set
+ * \param[out] strides pointers to plane's strides will be set
+ * \return the number of bytes to allocate
+ */
+
+int mlt_image_format_aligned_planes( mlt_image_format format, int width, int height, void *data, uint8_t *planes[4], int strides[4] )
+{
+	uint8_t *packed[4];
+	int packed_strides[4];
+	int offset = data ? ( MLT_IMAGE_ALIGN - ( uintptr_t ) data % MLT_IMAGE_ALIGN ) % MLT_IMAGE_ALIGN : 0;
+	int size = 0;
+	int i;
+
+	mlt_image_format_planes( format, width, height, NULL, packed, packed_strides );
+	for ( i = 0; i < 4; i++ )
+	{
+		if ( !packed_strides[i] )
+		{
+			planes[i] = NULL;
+			strides[i] = 0;
+			continue;
+		}
+		strides[i] = ( packed_strides[i] + MLT_IMAGE_ALIGN - 1 ) / MLT_IMAGE_ALIGN * MLT_IMAGE_ALIGN;
+		planes[i] = data ? ( uint8_t* ) data + offset + size : NULL;
+		size += strides[i] * plane_height( format, i, height );
+	}
+	return size + MLT_IMAGE_ALIGN - 1;
+}
@@ -109,6 +109,9 @@ struct mlt_frame_s
 #define MLT_FRAME_IMAGE_STACK( frame )		( ( frame )->stack_image )
 #define MLT_FRAME_AUDIO_STACK( frame )		( ( frame )->stack_audio )
 
+/** The alignment in bytes of the planes and lines from mlt_image_format_aligned_planes() */
+#define MLT_IMAGE_ALIGN (64)
+
 extern mlt_frame mlt_frame_init( mlt_service service );
 extern mlt_properties mlt_frame_properties( mlt_frame self );
 extern int mlt_frame_is_test_card( mlt_frame self );
@@ -119,11 +122,17 @@ extern mlt_position mlt_frame_get_position( mlt_frame self );
 extern mlt_position mlt_frame_original_position( mlt_frame self );
 extern int mlt_frame_set_position( mlt_frame self, mlt_position value );
 extern int mlt_frame_set_image( mlt_frame self, uint8_t *image, int size, mlt_destructor destroy );
+extern int mlt_frame_set_image_planes( mlt_frame self, uint8_t *planes[4], int strides[4] );
+extern int mlt_frame_get_image_planes( mlt_frame self, uint8_t *planes[4], int strides[4] );
 extern int mlt_frame_set_alpha( mlt_frame self, uint8_t *alpha, int size, mlt_destructor destroy );
+extern int mlt_frame_set_alpha_value( mlt_frame self, int value );
+extern int mlt_frame_get_alpha_value( mlt_frame self );
 extern void mlt_frame_replace_image( mlt_frame self, uint8_t *image, mlt_image_format format, int width, int height );
 extern int mlt_frame_get_image( mlt_frame self, uint8_t **buffer, mlt_image_format *format, int *width, int *height, int writable );
+extern int mlt_frame_get_image_strided( mlt_frame self, uint8_t *planes[4], int strides[4], mlt_image_format *format, int *width, int *height, int writable );
 extern uint8_t *mlt_frame_get_alpha_mask( mlt_frame self );
 extern uint8_t *mlt_frame_get_alpha( mlt_frame self );
+extern int mlt_frame_is_opaque( mlt_frame self, uint8_t *image, mlt_image_format format, int width, int height );
 extern int mlt_frame_get_audio( mlt_frame self, void **buffer, mlt_audio_format *format, int *frequency, int *channels, int *samples );
 extern int mlt_frame_set_audio( mlt_frame self, void *buffer, mlt_audio_format, int size, mlt_destructor );
 extern unsigned char *mlt_frame_get_waveform( mlt_frame self, int w, int h );
@@ -149,6 +158,7 @@ extern const char * mlt_image_format_name( mlt_image_format format );
 extern int mlt_image_format_size( mlt_image_format format, int width, int height, int *bpp );
 extern void mlt_frame_write_ppm( mlt_frame frame );
 extern int mlt_image_format_planes( mlt_image_format format, int width, int height, void* data, unsigned char *planes[4], int strides[4]);
+extern int mlt_image_format_aligned_planes( mlt_image_format format, int width, int height, void *data, uint8_t *planes[4], int strides[4] );
 extern mlt_image_format mlt_image_format_id( const char * name );
 
 /** This macro scales RGB into the YUV gamut - y is scaled by 219/255 and uv by 224/255. */
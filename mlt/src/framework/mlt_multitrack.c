@@ -25,6 +25,7 @@
 #include "mlt_frame.h"
 #include "mlt_factory.h"
 #include "mlt_cache.h"
+#include "mlt_filter.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -549,6 +550,46 @@ mlt_position mlt_multitrack_clip( mlt_multitrack self, mlt_whence whence, int in
 	return position;
 }
 
+/** Determine whether a track frame may be rendered ahead.
+ *
+ * The tractor may run the track's own stack of the frame a second time, so
+ * every producer and filter that made the frame must declare that this is
+ * safe with the property \em _track_ahead_safe. Cuts only pass frames on.
+ *
+ * \private \memberof mlt_multitrack_s
+ * \param frame a frame of a track
+ * \return true if all of its services are safe
+ */
+
+static int track_ahead_safe( mlt_frame frame )
+{
+	mlt_properties properties = MLT_FRAME_PROPERTIES( frame );
+	mlt_deque services = MLT_FRAME_SERVICE_STACK( frame );
+	int i, count = mlt_deque_count( services );
+
+	for ( i = 0; i < count; i ++ )
+	{
+		mlt_service service = mlt_deque_peek( services, i );
+		if ( !mlt_properties_get_int( MLT_SERVICE_PROPERTIES( service ), "_track_ahead_safe" ) &&
+			 !( mlt_service_identify( service ) == producer_type && mlt_producer_is_cut( MLT_PRODUCER( service ) ) ) )
+			return 0;
+	}
+
+	// Each filter that processed the frame holds a reference on it.
+	count = mlt_properties_count( properties );
+	for ( i = 0; i < count; i ++ )
+	{
+		char *name = mlt_properties_get_name( properties, i );
+		if ( !strncmp( name, "filter.", 7 ) )
+		{
+			mlt_filter filter = mlt_properties_get_data_at( properties, i, NULL );
+			if ( filter && !mlt_properties_get_int( MLT_FILTER_PROPERTIES( filter ), "_track_ahead_safe" ) )
+				return 0;
+		}
+	}
+	return 1;
+}
+
 /** Get frame method.
  *
  * <pre>
@@ -616,6 +657,15 @@ static int producer_get_frame( mlt_producer parent, mlt_frame_ptr frame, int ind
 		mlt_properties_set_double( properties, "_speed", speed );
 		mlt_frame_set_position( *frame, position );
 		mlt_properties_set_int( properties, "hide", hide );
+
+		// Let the tractor find where the track's own processing ends
+		if ( mlt_properties_get_int( producer_properties, "_track_threads" ) && track_ahead_safe( *frame ) )
+		{
+			if ( !( hide & 1 ) )
+				mlt_properties_set_int( properties, "_track_image_depth", mlt_deque_count( MLT_FRAME_IMAGE_STACK( *frame ) ) );
+			if ( !( hide & 2 ) )
+				mlt_properties_set_int( properties, "_track_audio_depth", mlt_deque_count( MLT_FRAME_AUDIO_STACK( *frame ) ) );
+		}
 	}
 	else
 	{
@@ -43,6 +43,7 @@ struct playlist_entry_s
 	int repeat;
 	mlt_position producer_length;
 	mlt_event event;
+	mlt_properties parent;
 	int preservation_hack;
 };
 
@@ -84,6 +85,10 @@ mlt_playlist mlt_playlist_init( )
 		mlt_properties_set( MLT_PRODUCER_PROPERTIES( &self->blank ), "mlt_service", "blank" );
 		mlt_properties_set( MLT_PRODUCER_PROPERTIES( &self->blank ), "resource", "blank" );
 
+		// Only the clips put anything on the stacks of a frame for a tractor to render ahead
+		mlt_properties_set_int( MLT_PRODUCER_PROPERTIES( &self->blank ), "_track_ahead_safe", 1 );
+		mlt_properties_set_int( MLT_PRODUCER_PROPERTIES( producer ), "_track_ahead_safe", 1 );
+
 		// Indicate that this producer is a playlist
 		mlt_properties_set_data( MLT_PLAYLIST_PROPERTIES( self ), "playlist", self, 0, NULL, NULL );
 
@@ -98,6 +103,7 @@ mlt_playlist mlt_playlist_init( )
 		self->size = 10;
 		self->list = calloc( self->size, sizeof( playlist_entry * ) );
 		if ( self->list == NULL ) goto error2;
+		self->index_count = -1;
 		
 		mlt_events_register( MLT_PLAYLIST_PROPERTIES( self ), "playlist-next", (mlt_transmitter) mlt_playlist_next );
 	}
@@ -166,58 +172,214 @@ mlt_properties mlt_playlist_properties( mlt_playlist self )
 	return MLT_PRODUCER_PROPERTIES( &self->parent );
 }
 
-/** Refresh the playlist after a clip has been changed.
+/** Rebuild the index from the entries' frame counts.
+ *
+ * The index is a Fenwick tree, which yields the start of any entry and the
+ * entry at any position in O(log n). It is left unusable if an entry has a
+ * negative frame count, in which case lookups fall back to a linear search.
  *
  * \private \memberof mlt_playlist_s
  * \param self a playlist
- * \return false
  */
 
-static int mlt_playlist_virtual_refresh( mlt_playlist self )
+static void mlt_playlist_index_build( mlt_playlist self )
 {
-	// Obtain the properties
-	mlt_properties properties = MLT_PLAYLIST_PROPERTIES( self );
-	int i = 0;
-	mlt_position frame_count = 0;
+	int i, j;
 
-	for ( i = 0; i < self->count; i ++ )
+	if ( self->index_size < self->size )
 	{
-		// Get the producer
-		mlt_producer producer = self->list[ i ]->producer;
-		if ( producer )
-		{
-			int current_length = mlt_producer_get_playtime( producer );
+		free( self->index );
+		self->index_size = self->size;
+		self->index = malloc( ( self->index_size + 1 ) * sizeof( mlt_position ) );
+	}
+	self->index_count = -1;
+	if ( self->index == NULL )
+	{
+		self->index_size = 0;
+		return;
+	}
 
-			// Check if the length of the producer has changed
-			if ( self->list[ i ]->frame_in != mlt_producer_get_in( producer ) ||
-				self->list[ i ]->frame_out != mlt_producer_get_out( producer ) )
-			{
-				// This clip should be removed...
-				if ( current_length < 1 )
-				{
-					self->list[ i ]->frame_in = 0;
-					self->list[ i ]->frame_out = -1;
-					self->list[ i ]->frame_count = 0;
-				}
-				else
-				{
-					self->list[ i ]->frame_in = mlt_producer_get_in( producer );
-					self->list[ i ]->frame_out = mlt_producer_get_out( producer );
-					self->list[ i ]->frame_count = current_length;
-				}
+	for ( i = 1; i <= self->count; i ++ )
+	{
+		if ( self->list[ i - 1 ]->frame_count < 0 )
+			return;
+		self->index[ i ] = self->list[ i - 1 ]->frame_count;
+	}
+	for ( i = 1; i <= self->count; i ++ )
+	{
+		j = i + ( i & -i );
+		if ( j <= self->count )
+			self->index[ j ] += self->index[ i ];
+	}
+	self->index_count = self->count;
+}
+
+/** Get the total frame count of the first entries using the index.
+ *
+ * \private \memberof mlt_playlist_s
+ * \param self a playlist
+ * \param clips the number of entries, which must not exceed the number indexed
+ * \return the sum of their frame counts
+ */
+
+static mlt_position mlt_playlist_index_sum( mlt_playlist self, int clips )
+{
+	mlt_position sum = 0;
+	for ( ; clips > 0; clips -= clips & -clips )
+		sum += self->index[ clips ];
+	return sum;
+}
+
+/** Update the index after an entry's frame count changed or an entry was appended.
+ *
+ * \private \memberof mlt_playlist_s
+ * \param self a playlist
+ * \param clip the index of the playlist entry
+ */
+
+static void mlt_playlist_index_update( mlt_playlist self, int clip )
+{
+	mlt_position value = self->list[ clip ]->frame_count;
+	int i = clip + 1;
+
+	if ( self->index_count < 0 || clip > self->index_count || value < 0 ||
+		 ( clip == self->index_count && clip >= self->index_size ) )
+	{
+		mlt_playlist_index_build( self );
+	}
+	else if ( clip == self->index_count )
+	{
+		// Each node holds the sum of the ( i & -i ) entries ending at it
+		self->index[ i ] = value + mlt_playlist_index_sum( self, i - 1 ) - mlt_playlist_index_sum( self, i - ( i & -i ) );
+		self->index_count ++;
+	}
+	else
+	{
+		mlt_position delta = value - mlt_playlist_index_sum( self, i ) + mlt_playlist_index_sum( self, i - 1 );
+		for ( ; delta && i <= self->index_count; i += i & -i )
+			self->index[ i ] += delta;
+	}
+}
+
+/** Get the time at which an entry starts.
+ *
+ * \private \memberof mlt_playlist_s
+ * \param self a playlist
+ * \param clip the index of the playlist entry, between 0 and the number of entries
+ * \return the sum of the frame counts of the preceding entries
+ */
+
+static mlt_position mlt_playlist_start( mlt_playlist self, int clip )
+{
+	mlt_position position = 0;
+
+	if ( self->index_count == self->count )
+		return mlt_playlist_index_sum( self, clip );
+
+	while ( clip -- > 0 )
+		position += self->list[ clip ]->frame_count;
+	return position;
+}
+
+/** Find the entry at a time.
+ *
+ * Entries with a frame count of 0 are skipped.
+ * \private \memberof mlt_playlist_s
+ * \param self a playlist
+ * \param[in, out] position the time to look up, returns the time relative to the start of the entry
+ * \return the index of the playlist entry or the number of entries if the position is beyond the end
+ */
+
+static int mlt_playlist_find( mlt_playlist self, mlt_position *position )
+{
+	int clip = 0;
 
-				// Update the producer_length
-				self->list[ i ]->producer_length = current_length;
+	if ( self->index_count == self->count )
+	{
+		int step = 1;
+
+		// Descend the tree for the last entry that ends at or before the position
+		while ( step * 2 <= self->count )
+			step *= 2;
+		for ( ; step > 0; step /= 2 )
+		{
+			if ( clip + step <= self->count && self->index[ clip + step ] <= *position )
+			{
+				clip += step;
+				*position -= self->index[ clip ];
 			}
 		}
+	}
+	else
+	{
+		while ( clip < self->count && *position >= self->list[ clip ]->frame_count )
+			*position -= self->list[ clip ++ ]->frame_count;
+	}
+
+	return clip;
+}
+
+/** Synchronise an entry with its producer.
+ *
+ * \private \memberof mlt_playlist_s
+ * \param self a playlist
+ * \param clip the index of the playlist entry
+ */
+
+static void mlt_playlist_virtual_sync( mlt_playlist self, int clip )
+{
+	playlist_entry *entry = self->list[ clip ];
 
-		// Calculate the frame_count
-		self->list[ i ]->frame_count = ( self->list[ i ]->frame_out - self->list[ i ]->frame_in + 1 ) * self->list[ i ]->repeat;
+	// Get the producer
+	mlt_producer producer = entry->producer;
+	if ( producer )
+	{
+		int current_length = mlt_producer_get_playtime( producer );
+
+		// Check if the length of the producer has changed
+		if ( entry->frame_in != mlt_producer_get_in( producer ) ||
+			entry->frame_out != mlt_producer_get_out( producer ) )
+		{
+			// This clip should be removed...
+			if ( current_length < 1 )
+			{
+				entry->frame_in = 0;
+				entry->frame_out = -1;
+				entry->frame_count = 0;
+			}
+			else
+			{
+				entry->frame_in = mlt_producer_get_in( producer );
+				entry->frame_out = mlt_producer_get_out( producer );
+				entry->frame_count = current_length;
+			}
 
-		// Update the frame_count for self clip
-		frame_count += self->list[ i ]->frame_count;
+			// Update the producer_length
+			entry->producer_length = current_length;
+		}
 	}
 
+	// Calculate the frame_count
+	entry->frame_count = ( entry->frame_out - entry->frame_in + 1 ) * entry->repeat;
+}
+
+/** Update the length of the playlist from the index.
+ *
+ * \private \memberof mlt_playlist_s
+ * \param self a playlist
+ * \return false
+ */
+
+static int mlt_playlist_virtual_length( mlt_playlist self )
+{
+	// Obtain the properties
+	mlt_properties properties = MLT_PLAYLIST_PROPERTIES( self );
+	mlt_position frame_count;
+
+	if ( self->index_count != self->count )
+		mlt_playlist_index_build( self );
+	frame_count = mlt_playlist_start( self, self->count );
+
 	// Refresh all properties
 	mlt_events_block( properties, properties );
 	mlt_properties_set_position( properties, "length", frame_count );
@@ -227,17 +389,66 @@ static int mlt_playlist_virtual_refresh( mlt_playlist self )
 	return 0;
 }
 
+/** Refresh the playlist after a clip has been changed.
+ *
+ * \private \memberof mlt_playlist_s
+ * \param self a playlist
+ * \return false
+ */
+
+static int mlt_playlist_virtual_refresh( mlt_playlist self )
+{
+	int i = 0;
+
+	for ( i = 0; i < self->count; i ++ )
+		mlt_playlist_virtual_sync( self, i );
+
+	mlt_playlist_index_build( self );
+
+	return mlt_playlist_virtual_length( self );
+}
+
+/** Refresh the playlist after a single clip has been changed.
+ *
+ * Use this instead of mlt_playlist_virtual_refresh() when no other entry
+ * changed, since it does not need to visit every entry.
+ * \private \memberof mlt_playlist_s
+ * \param self a playlist
+ * \param clip the index of the playlist entry or -1 if only the order or number of entries changed
+ * \return false
+ */
+
+static int mlt_playlist_virtual_refresh_clip( mlt_playlist self, int clip )
+{
+	if ( clip >= 0 && clip < self->count )
+	{
+		mlt_playlist_virtual_sync( self, clip );
+		mlt_playlist_index_update( self, clip );
+	}
+	return mlt_playlist_virtual_length( self );
+}
+
 /** Listener for producers on the playlist.
  *
- * Refreshes the playlist whenever an entry receives producer-changed.
+ * Refreshes the entries that use the producer whenever it receives producer-changed.
  * \private \memberof mlt_playlist_s
- * \param producer a producer
+ * \param parent the properties of the producer
  * \param self a playlist
  */
 
-static void mlt_playlist_listener( mlt_producer producer, mlt_playlist self )
+static void mlt_playlist_listener( mlt_properties parent, mlt_playlist self )
 {
-	mlt_playlist_virtual_refresh( self );
+	int i = 0;
+
+	for ( i = 0; i < self->count; i ++ )
+	{
+		if ( self->list[ i ]->parent == parent )
+		{
+			mlt_playlist_virtual_sync( self, i );
+			mlt_playlist_index_update( self, i );
+		}
+	}
+	mlt_playlist_virtual_length( self );
 }
 
 /** Append to the virtual playlist.
@@ -331,9 +542,9 @@ static int mlt_playlist_virtual_append( mlt_playlist self, mlt_producer source,
 	if ( self->count >= self->size )
 	{
 		int i;
-		self->list = realloc( self->list, ( self->size + 10 ) * sizeof( playlist_entry * ) );
-		for ( i = self->size; i < self->size + 10; i ++ ) self->list[ i ] = NULL;
-		self->size += 10;
+		self->list = realloc( self->list, self->size * 2 * sizeof( playlist_entry * ) );
+		for ( i = self->size; i < self->size * 2; i ++ ) self->list[ i ] = NULL;
+		self->size *= 2;
 	}
 
 	// Create the entry
@@ -346,6 +557,7 @@ static int mlt_playlist_virtual_append( mlt_playlist self, mlt_producer source,
 		self->list[ self->count ]->frame_count = out - in + 1;
 		self->list[ self->count ]->repeat = 1;
 		self->list[ self->count ]->producer_length = mlt_producer_get_playtime( producer );
+		self->list[ self->count ]->parent = parent;
 		self->list[ self->count ]->event = mlt_events_listen( parent, self, "producer-changed", ( mlt_listener )mlt_playlist_listener );
 		mlt_event_inc_ref( self->list[ self->count ]->event );
 		mlt_properties_set( properties, "eof", "pause" );
@@ -353,7 +565,7 @@ static int mlt_playlist_virtual_append( mlt_playlist self, mlt_producer source,
 		self->count ++;
 	}
 
-	return mlt_playlist_virtual_refresh( self );
+	return mlt_playlist_virtual_refresh_clip( self, self->count - 1 );
 }
 
 /** Locate a producer by index.
@@ -371,25 +583,17 @@ static mlt_producer mlt_playlist_locate( mlt_playlist self, mlt_position *positi
 	// Default producer to NULL
 	mlt_producer producer = NULL;
 
-	// Loop for each producer until found
-	for ( *clip = 0; *clip < self->count; *clip += 1 )
-	{
-		// Increment the total
-		*total += self->list[ *clip ]->frame_count;
+	// Find the clip - note that 0 length clips get skipped automatically
+	*clip = mlt_playlist_find( self, position );
 
-		// Check if the position indicates that we have found the clip
-		// Note that 0 length clips get skipped automatically
-		if ( *position < self->list[ *clip ]->frame_count )
-		{
-			// Found it, now break
-			producer = self->list[ *clip ]->producer;
-			break;
-		}
-		else
-		{
-			// Decrement position by length of self entry
-			*position -= self->list[ *clip ]->frame_count;
-		}
+	if ( *clip < self->count )
+	{
+		producer = self->list[ *clip ]->producer;
+		*total += mlt_playlist_start( self, *clip + 1 );
+	}
+	else
+	{
+		*total += mlt_playlist_start( self, self->count );
 	}
 
 	return producer;
@@ -523,23 +727,11 @@ static mlt_producer mlt_playlist_virtual_set_out( mlt_playlist self )
 	// Map playlist position to real producer in virtual playlist
 	mlt_position position = mlt_producer_frame( &self->parent );
 
-	// Loop through the virtual playlist
-	int i = 0;
+	// Find the entry in the virtual playlist
+	int i = mlt_playlist_find( self, &position );
 
-	for ( i = 0; i < self->count; i ++ )
-	{
-		if ( position < self->list[ i ]->frame_count )
-		{
-			// Found it, now break
-			producer = self->list[ i ]->producer;
-			break;
-		}
-		else
-		{
-			// Decrement position by length of this entry
-			position -= self->list[ i ]->frame_count;
-		}
-	}
+	if ( i < self->count )
+		producer = self->list[ i ]->producer;
 
 	// Seek in real producer to relative position
 	if ( i < self->count && self->list[ i ]->frame_out != position )
@@ -549,7 +741,7 @@ static mlt_producer mlt_playlist_virtual_set_out( mlt_playlist self )
 		self->list[ i ]->frame_count = self->list[ i ]->frame_out - self->list[ i ]->frame_in + 1;
 
 		// Refresh the playlist
-		mlt_playlist_virtual_refresh( self );
+		mlt_playlist_virtual_refresh_clip( self, i );
 	}
 
 	return producer;
@@ -567,24 +759,8 @@ int mlt_playlist_current_clip( mlt_playlist self )
 	// Map playlist position to real producer in virtual playlist
 	mlt_position position = mlt_producer_frame( &self->parent );
 
-	// Loop through the virtual playlist
-	int i = 0;
-
-	for ( i = 0; i < self->count; i ++ )
-	{
-		if ( position < self->list[ i ]->frame_count )
-		{
-			// Found it, now break
-			break;
-		}
-		else
-		{
-			// Decrement position by length of this entry
-			position -= self->list[ i ]->frame_count;
-		}
-	}
-
-	return i;
+	// Find the entry in the virtual playlist
+	return mlt_playlist_find( self, &position );
 }
 
 /** Obtain the current clips producer.
@@ -615,9 +791,7 @@ mlt_producer mlt_playlist_current( mlt_playlist self )
 
 mlt_position mlt_playlist_clip( mlt_playlist self, mlt_whence whence, int index )
 {
-	mlt_position position = 0;
 	int absolute_clip = index;
-	int i = 0;
 
 	// Determine the absolute clip
 	switch ( whence )
@@ -642,10 +816,7 @@ mlt_position mlt_playlist_clip( mlt_playlist self, mlt_whence whence, int index
 		absolute_clip = self->count;
 
 	// Now determine the position
-	for ( i = 0; i < absolute_clip; i ++ )
-		position += self->list[ i ]->frame_count;
-
-	return position;
+	return mlt_playlist_start( self, absolute_clip );
 }
 
 /** Get all the info about the clip specified.
@@ -709,6 +880,7 @@ int mlt_playlist_clear( mlt_playlist self )
 		mlt_producer_close( self->list[ i ]->producer );
 	}
 	self->count = 0;
+	self->index_count = -1;
 	return mlt_playlist_virtual_refresh( self );
 }
 
@@ -804,7 +976,7 @@ int mlt_playlist_insert( mlt_playlist self, mlt_producer producer, int where, ml
 	mlt_playlist_move( self, self->count - 1, where );
 	mlt_events_unblock( MLT_PLAYLIST_PROPERTIES( self ), self );
 
-	return mlt_playlist_virtual_refresh( self );
+	return mlt_playlist_virtual_refresh_clip( self, -1 );
 }
 
 /** Remove an entry in the playlist.
@@ -839,6 +1011,7 @@ int mlt_playlist_remove( mlt_playlist self, int where )
 		for ( i = where + 1; i < self->count; i ++ )
 			self->list[ i - 1 ] = self->list[ i ];
 		self->count --;
+		self->index_count = -1;
 
 		if ( entry->preservation_hack == 0 )
 		{
@@ -874,7 +1047,7 @@ int mlt_playlist_remove( mlt_playlist self, int where )
 		free( entry );
 
 		// Refresh the playlist
-		mlt_playlist_virtual_refresh( self );
+		mlt_playlist_virtual_refresh_clip( self, -1 );
 	}
 
 	return error;
@@ -937,10 +1110,11 @@ int mlt_playlist_move( mlt_playlist self, int src, int dest )
 				self->list[ i ] = self->list[ i + 1 ];
 		}
 		self->list[ dest ] = src_entry;
+		mlt_playlist_index_build( self );
 
 		mlt_playlist_get_clip_info( self, &current_info, current );
 		mlt_producer_seek( MLT_PLAYLIST_PRODUCER( self ), current_info.start + position );
-		mlt_playlist_virtual_refresh( self );
+		mlt_playlist_virtual_refresh_clip( self, -1 );
 	}
 
 	return 0;
@@ -983,6 +1157,7 @@ int mlt_playlist_reorder( mlt_playlist self, const int *indices )
 	// Delete the old list and save the new list
 	free( self->list );
 	self->list = new_list;
+	self->index_count = -1;
 	mlt_playlist_virtual_refresh( self );
 
 	return 0;
@@ -1004,7 +1179,7 @@ int mlt_playlist_repeat_clip( mlt_playlist self, int clip, int repeat )
 	{
 		playlist_entry *entry = self->list[ clip ];
 		entry->repeat = repeat;
-		mlt_playlist_virtual_refresh( self );
+		mlt_playlist_virtual_refresh_clip( self, clip );
 	}
 	return error;
 }
@@ -1060,7 +1235,7 @@ int mlt_playlist_resize_clip( mlt_playlist self, int clip, mlt_position in, mlt_
 
 		mlt_producer_set_in_and_out( producer, in, out );
 		mlt_events_unblock( properties, properties );
-		mlt_playlist_virtual_refresh( self );
+		mlt_playlist_virtual_refresh_clip( self, clip );
 	}
 	return error;
 }
@@ -2167,6 +2342,7 @@ void mlt_playlist_close( mlt_playlist self )
 		mlt_producer_close( &self->blank );
 		mlt_producer_close( &self->parent );
 		free( self->list );
+		free( self->index );
 		free( self );
 	}
 }
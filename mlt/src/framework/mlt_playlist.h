@@ -77,6 +77,9 @@ struct mlt_playlist_s
 	int size;
 	int count;
 	playlist_entry **list;
+	mlt_position *index;  /**< a Fenwick tree over the entries' frame counts */
+	int index_size;       /**< the capacity of the index */
+	int index_count;      /**< the number of indexed entries, -1 if not usable */
 };
 
 #define MLT_PLAYLIST_PRODUCER( playlist )	( &( playlist )->parent )
@@ -21,12 +21,13 @@
  */
 
 #include "mlt_properties.h"
-#include "mlt_deque.h"
 #include "mlt_log.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
 
 // Not nice - memalign is defined here apparently?
 #ifdef linux
@@ -55,10 +56,165 @@
 
 #if !USE_MLT_POOL
 
+/** \brief the size and reference count of a block
+ *
+ * Without the pool, the blocks come straight from the system allocator so
+ * that they may be given to free() and checked by memory debuggers, and the
+ * references are counted in this table instead of in front of the block.
+ */
+
+typedef struct shared_block_s
+{
+	void *ptr;
+	int size;
+	int references;
+	struct shared_block_s *next;
+}
+shared_block;
+
+#define SHARED_BUCKETS (1024)
+
+static shared_block *shared_blocks[ SHARED_BUCKETS ];
+static pthread_mutex_t shared_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Find the link to the entry of a block in the table.
+ *
+ * The caller must hold shared_mutex.
+ * \private \memberof mlt_pool_s
+ * \param ptr a block
+ * \return the link to the entry, which is NULL if the block is not in the table
+ */
+
+static shared_block **shared_find( void *ptr )
+{
+	shared_block **link = &shared_blocks[ ( ( uintptr_t )ptr >> 4 ) % SHARED_BUCKETS ];
+	while ( *link && ( *link )->ptr != ptr )
+		link = &( *link )->next;
+	return link;
+}
+
+/** Add a block to the table with one reference.
+ *
+ * \private \memberof mlt_pool_s
+ * \param ptr a block
+ * \param size the size of the block
+ * \return \p ptr or NULL if out of memory
+ */
+
+static void *shared_add( void *ptr, int size )
+{
+	shared_block **link, *block = NULL;
+
+	if ( !ptr )
+		return NULL;
+	pthread_mutex_lock( &shared_mutex );
+	link = shared_find( ptr );
+
+	// An entry remains if a block was given to free() instead of mlt_pool_release()
+	if ( !*link && ( block = malloc( sizeof( shared_block ) ) ) )
+	{
+		block->ptr = ptr;
+		block->next = NULL;
+		*link = block;
+	}
+	block = *link;
+	if ( block )
+	{
+		block->size = size;
+		block->references = 1;
+	}
+	pthread_mutex_unlock( &shared_mutex );
+	if ( !block )
+	{
+		mlt_free( ptr );
+		ptr = NULL;
+	}
+	return ptr;
+}
+
 void mlt_pool_init() {}
-void *mlt_pool_alloc( int size ) { return mlt_alloc( size ); }
-void *mlt_pool_realloc( void *ptr, int size ) { return mlt_realloc( ptr, size ); }
-void mlt_pool_release( void *release ) { return mlt_free( release ); }
+void *mlt_pool_alloc( int size )
+{
+	return shared_add( mlt_alloc( size ), size );
+}
+void *mlt_pool_realloc( void *ptr, int size )
+{
+	shared_block **link, *block;
+	void *result;
+
+	if ( !ptr )
+		return mlt_pool_alloc( size );
+	pthread_mutex_lock( &shared_mutex );
+	link = shared_find( ptr );
+	block = *link;
+	if ( block && block->references > 1 )
+	{
+		// Do not resize a block that is shared
+		int copy = size < block->size ? size : block->size;
+		pthread_mutex_unlock( &shared_mutex );
+		result = mlt_pool_alloc( size );
+		if ( result )
+			memcpy( result, ptr, copy );
+		mlt_pool_release( ptr );
+		return result;
+	}
+	if ( block )
+		*link = block->next;
+	pthread_mutex_unlock( &shared_mutex );
+	free( block );
+	return shared_add( mlt_realloc( ptr, size ), size );
+}
+void mlt_pool_release( void *release )
+{
+	shared_block **link, *block = NULL;
+
+	if ( !release )
+		return;
+	pthread_mutex_lock( &shared_mutex );
+	link = shared_find( release );
+	if ( *link && --( *link )->references > 0 )
+	{
+		pthread_mutex_unlock( &shared_mutex );
+		return;
+	}
+	if ( *link )
+	{
+		block = *link;
+		*link = block->next;
+	}
+	pthread_mutex_unlock( &shared_mutex );
+	free( block );
+	mlt_free( release );
+}
+int mlt_pool_inc_ref( void *ptr )
+{
+	shared_block *block;
+	int references = 0;
+
+	if ( ptr )
+	{
+		pthread_mutex_lock( &shared_mutex );
+		block = *shared_find( ptr );
+		if ( block )
+			references = ++block->references;
+		pthread_mutex_unlock( &shared_mutex );
+	}
+	return references;
+}
+int mlt_pool_ref_count( void *ptr )
+{
+	shared_block *block;
+	int references = 0;
+
+	if ( ptr )
+	{
+		pthread_mutex_lock( &shared_mutex );
+		block = *shared_find( ptr );
+		references = block ? block->references : 1;
+		pthread_mutex_unlock( &shared_mutex );
+	}
+	return references;
+}
 void mlt_pool_purge() {}
 void mlt_pool_close() {}
 void mlt_pool_stat() {}
@@ -69,15 +225,35 @@ void mlt_pool_stat() {}
 
 static mlt_properties pools = NULL;
 
+/** the number of pools, one per power of two from 2^8 to 2^30 */
+
+#define POOL_MIN_BITS (8)
+#define POOL_COUNT (31 - POOL_MIN_BITS)
+
+/** the number of bytes a thread may keep in each of its magazines */
+
+#define MAGAZINE_BYTES (16 * 1024 * 1024)
+#define MAGAZINE_MIN (2)
+#define MAGAZINE_MAX (64)
+
 /** \brief Pool (memory) class
+ *
+ * The free blocks of a pool are kept in a LIFO that is linked through the
+ * first word of each block. It is only touched when a thread's magazine is
+ * empty or full. Chains are pushed with a compare and swap, and blocks are
+ * only ever taken by exchanging the whole stack for NULL, so that a block
+ * is never popped while another thread may be reading its link; this is
+ * what makes the stack immune to ABA without tagging the pointer.
  */
 
 typedef struct mlt_pool_s
 {
-	pthread_mutex_t lock; ///< lock to prevent race conditions
-	mlt_deque stack;      ///< a stack of addresses to memory blocks
-	int size;             ///< the size of the memory block as a power of 2
-	int count;            ///< the number of blocks in the pool
+	_Atomic( void * ) stack; ///< a stack of addresses to memory blocks
+	atomic_int available;   ///< the number of blocks on the stack
+	int size;               ///< the size of the memory block as a power of 2
+	int index;              ///< the index of the pool and of the thread magazine
+	atomic_int count;       ///< the number of blocks in the pool
+	int capacity;           ///< the number of blocks a thread may cache
 }
 *mlt_pool;
 
@@ -90,33 +266,281 @@ typedef struct mlt_pool_s
 typedef struct __attribute__ ((aligned (16))) mlt_release_s
 {
 	mlt_pool pool;
-	int references;
+	atomic_int references;
 }
 *mlt_release;
 
+/** \brief private to mlt_pool_s, a per-thread cache of free blocks
+ *
+ * Each thread allocates from and releases to its own magazines first, and
+ * only that thread ever touches them, so the steady state needs no lock.
+ * Other threads ask it to empty them through the purge flag, which it checks
+ * on its next allocation or release. mlt_pool_stat() reads the counters.
+ */
+
+typedef struct thread_cache_s
+{
+	struct
+	{
+		void *head;
+		int count;
+	} magazine[ POOL_COUNT ];
+	int generation;
+	atomic_int purge;
+	atomic_int hits;
+	atomic_int misses;
+	_Atomic( int64_t ) held;
+	struct thread_cache_s *next;
+	struct thread_cache_s *prev;
+}
+thread_cache;
+
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t caches_mutex = PTHREAD_MUTEX_INITIALIZER;
+static thread_cache *caches = NULL;
+static atomic_int generation = 0;
+
+/** Get the link to the next free block.
+ *
+ * \private \memberof mlt_pool_s
+ * \param ptr an opaque pointer of a free block
+ * \return a pointer to the link
+ */
+
+static inline void **next_block( void *ptr )
+{
+	return ( void ** )ptr;
+}
+
+/** Push a chain of free blocks onto the shared stack of a pool.
+ *
+ * \private \memberof mlt_pool_s
+ * \param self a pool
+ * \param head the first block of the chain
+ * \param tail the last block of the chain
+ * \param count the number of blocks in the chain
+ */
+
+static void stack_push( mlt_pool self, void *head, void *tail, int count )
+{
+	void *top = atomic_load_explicit( &self->stack, memory_order_relaxed );
+	do
+		*next_block( tail ) = top;
+	while ( !atomic_compare_exchange_weak_explicit( &self->stack, &top, head,
+		memory_order_release, memory_order_relaxed ) );
+	atomic_fetch_add_explicit( &self->available, count, memory_order_relaxed );
+}
+
+/** Take free blocks from the shared stack of a pool.
+ *
+ * The whole stack is taken and the blocks beyond \p max are pushed back.
+ * \private \memberof mlt_pool_s
+ * \param self a pool
+ * \param max the most blocks to take or 0 for all of them
+ * \param[out] count the number of blocks taken (optional)
+ * \return the first block of a chain that ends with NULL or NULL if the stack is empty
+ */
+
+static void *stack_take( mlt_pool self, int max, int *count )
+{
+	void *head = NULL, *tail, *rest;
+	int taken = 0;
+
+	if ( atomic_load_explicit( &self->stack, memory_order_relaxed ) )
+		head = atomic_exchange_explicit( &self->stack, NULL, memory_order_acquire );
+	if ( head )
+	{
+		tail = head;
+		taken = 1;
+		while ( taken != max && *next_block( tail ) )
+		{
+			tail = *next_block( tail );
+			taken ++;
+		}
+		rest = *next_block( tail );
+		*next_block( tail ) = NULL;
+		atomic_fetch_sub_explicit( &self->available, taken, memory_order_relaxed );
+		if ( rest )
+		{
+			// Put the rest back, which only needs its tail if another thread
+			// pushed blocks in the meantime
+			void *top = NULL;
+			if ( !atomic_compare_exchange_strong_explicit( &self->stack, &top, rest,
+				memory_order_release, memory_order_relaxed ) )
+			{
+				void *last = rest;
+				while ( *next_block( last ) )
+					last = *next_block( last );
+				stack_push( self, rest, last, 0 );
+			}
+		}
+	}
+
+	if ( count )
+		*count = taken;
+	return head;
+}
+
+/** Free a chain of blocks.
+ *
+ * \private \memberof mlt_pool_s
+ * \param head the first block of the chain
+ * \return the number of blocks freed
+ */
+
+static int chain_free( void *head )
+{
+	int count = 0;
+	while ( head )
+	{
+		void *next = *next_block( head );
+		mlt_free( ( char * )head - sizeof( struct mlt_release_s ) );
+		head = next;
+		count ++;
+	}
+	return count;
+}
+
+/** Empty the magazines of a thread.
+ *
+ * The blocks go back to the shared stacks, or are freed if \p release is
+ * set or the pools have been closed since the thread cached them. Only the
+ * thread that owns the cache may call this.
+ * \private \memberof mlt_pool_s
+ * \param cache a thread cache
+ * \param release whether to free the blocks
+ */
+
+static void cache_drain( thread_cache *cache, int release )
+{
+	int current = cache->generation == atomic_load( &generation );
+	int i;
+
+	for ( i = 0; i < POOL_COUNT; i ++ )
+	{
+		void *head = cache->magazine[ i ].head;
+		if ( head )
+		{
+			mlt_pool pool = ( ( mlt_release )( ( char * )head - sizeof( struct mlt_release_s ) ) )->pool;
+			if ( current && !release )
+			{
+				void *tail = head;
+				while ( *next_block( tail ) )
+					tail = *next_block( tail );
+				stack_push( pool, head, tail, cache->magazine[ i ].count );
+			}
+			else if ( current )
+			{
+				atomic_fetch_sub_explicit( &pool->count, chain_free( head ), memory_order_relaxed );
+			}
+			else
+			{
+				chain_free( head );
+			}
+			cache->magazine[ i ].head = NULL;
+			cache->magazine[ i ].count = 0;
+		}
+	}
+	atomic_store_explicit( &cache->held, 0, memory_order_relaxed );
+}
+
+/** Release a thread's cache when the thread exits.
+ *
+ * \private \memberof mlt_pool_s
+ * \param data a thread cache
+ */
+
+static void cache_close( void *data )
+{
+	thread_cache *cache = data;
+
+	cache_drain( cache, atomic_load( &cache->purge ) );
+	pthread_mutex_lock( &caches_mutex );
+	if ( cache->prev )
+		cache->prev->next = cache->next;
+	else
+		caches = cache->next;
+	if ( cache->next )
+		cache->next->prev = cache->prev;
+	pthread_mutex_unlock( &caches_mutex );
+
+	free( cache );
+}
+
+static void cache_key_init( )
+{
+	pthread_key_create( &cache_key, cache_close );
+}
+
+/** Get the cache of the calling thread, creating it as needed.
+ *
+ * \private \memberof mlt_pool_s
+ * \return a thread cache
+ */
+
+static thread_cache *cache_get( )
+{
+	thread_cache *cache = pthread_getspecific( cache_key );
+	if ( !cache )
+	{
+		cache = calloc( 1, sizeof( thread_cache ) );
+		if ( cache )
+		{
+			pthread_mutex_lock( &caches_mutex );
+			cache->generation = atomic_load( &generation );
+			cache->next = caches;
+			if ( caches )
+				caches->prev = cache;
+			caches = cache;
+			pthread_mutex_unlock( &caches_mutex );
+			pthread_setspecific( cache_key, cache );
+		}
+	}
+	else if ( cache->generation != atomic_load_explicit( &generation, memory_order_relaxed ) )
+	{
+		// The pools were closed and initialised again.
+		cache_drain( cache, 1 );
+		cache->generation = atomic_load( &generation );
+	}
+	else if ( atomic_load_explicit( &cache->purge, memory_order_relaxed ) )
+	{
+		// Another thread called mlt_pool_purge().
+		atomic_store_explicit( &cache->purge, 0, memory_order_relaxed );
+		cache_drain( cache, 1 );
+	}
+	return cache;
+}
+
 /** Create a pool.
  *
  * \private \memberof mlt_pool_s
- * \param size the size of the memory blocks to hold as some power of two
+ * \param index the power of two of the memory blocks minus POOL_MIN_BITS
  * \return a new pool object
  */
 
-static mlt_pool pool_init( int size )
+static mlt_pool pool_init( int index )
 {
+	int size = 1 << ( index + POOL_MIN_BITS );
+
 	// Create the pool
 	mlt_pool self = calloc( 1, sizeof( struct mlt_pool_s ) );
 
 	// Initialise it
 	if ( self != NULL )
 	{
-		// Initialise the mutex
-		pthread_mutex_init( &self->lock, NULL );
-
-		// Create the stack
-		self->stack = mlt_deque_init( );
-
 		// Assign the size
 		self->size = size;
+		self->index = index;
+		atomic_init( &self->stack, NULL );
+
+		// Determine how many blocks a thread may keep for itself, a few even
+		// of the largest sizes since those are the images of big frames
+		self->capacity = MAGAZINE_BYTES / size;
+		if ( self->capacity < MAGAZINE_MIN )
+			self->capacity = MAGAZINE_MIN;
+		if ( self->capacity > MAGAZINE_MAX )
+			self->capacity = MAGAZINE_MAX;
 	}
 
 	// Return it
@@ -138,17 +562,40 @@ static void *pool_fetch( mlt_pool self )
 	// Sanity check
 	if ( self != NULL )
 	{
-		// Lock the pool
-		pthread_mutex_lock( &self->lock );
+		thread_cache *cache = cache_get( );
+		int index = self->index;
 
-		// Check if the stack is empty
-		if ( mlt_deque_count( self->stack ) != 0 )
+		if ( cache && cache->magazine[ index ].head )
+		{
+			// Pop the top of this thread's magazine
+			ptr = cache->magazine[ index ].head;
+			cache->magazine[ index ].head = *next_block( ptr );
+			cache->magazine[ index ].count --;
+			atomic_store_explicit( &cache->hits, atomic_load_explicit( &cache->hits, memory_order_relaxed ) + 1, memory_order_relaxed );
+			atomic_store_explicit( &cache->held, atomic_load_explicit( &cache->held, memory_order_relaxed ) - self->size, memory_order_relaxed );
+		}
+		else
 		{
-			// Pop the top of the stack
-			ptr = mlt_deque_pop_back( self->stack );
+			// Refill from the shared stack, keeping up to half a magazine
+			int keep = cache ? self->capacity / 2 : 0;
+			int count = 0;
+
+			if ( cache )
+				atomic_store_explicit( &cache->misses, atomic_load_explicit( &cache->misses, memory_order_relaxed ) + 1, memory_order_relaxed );
+
+			ptr = stack_take( self, 1 + keep, &count );
+			if ( ptr && count > 1 )
+			{
+				cache->magazine[ index ].head = *next_block( ptr );
+				cache->magazine[ index ].count = count - 1;
+				atomic_store_explicit( &cache->held, atomic_load_explicit( &cache->held, memory_order_relaxed ) + ( int64_t )( count - 1 ) * self->size, memory_order_relaxed );
+			}
+		}
 
+		if ( ptr )
+		{
 			// Assign the reference
-			( ( mlt_release )ptr )->references = 1;
+			atomic_store_explicit( &( ( mlt_release )( ( char * )ptr - sizeof( struct mlt_release_s ) ) )->references, 1, memory_order_relaxed );
 		}
 		else
 		{
@@ -167,21 +614,18 @@ static void *pool_fetch( mlt_pool self )
 			if ( release != NULL )
 			{
 				// Increment the number of items allocated to this pool
-				self->count ++;
+				atomic_fetch_add_explicit( &self->count, 1, memory_order_relaxed );
 
 				// Assign the pool
 				release->pool = self;
 
 				// Assign the reference
-				release->references = 1;
+				atomic_init( &release->references, 1 );
 
 				// Determine the ptr
 				ptr = ( char * )release + sizeof( struct mlt_release_s );
 			}
 		}
-
-		// Unlock the pool
-		pthread_mutex_unlock( &self->lock );
 	}
 
 	// Return the generated release object
@@ -205,16 +649,43 @@ static void pool_return( void *ptr )
 		// Get the pool
 		mlt_pool self = that->pool;
 
+		// Another reference remains
+		if ( atomic_fetch_sub_explicit( &that->references, 1, memory_order_acq_rel ) > 1 )
+			return;
+
 		if ( self != NULL )
 		{
-			// Lock the pool
-			pthread_mutex_lock( &self->lock );
+			thread_cache *cache = cache_get( );
+			int index = self->index;
 
-			// Push the that back back on to the stack
-			mlt_deque_push_back( self->stack, ptr );
-
-			// Unlock the pool
-			pthread_mutex_unlock( &self->lock );
+			if ( cache )
+			{
+				// Push it on to this thread's magazine
+				*next_block( ptr ) = cache->magazine[ index ].head;
+				cache->magazine[ index ].head = ptr;
+				cache->magazine[ index ].count ++;
+				atomic_store_explicit( &cache->held, atomic_load_explicit( &cache->held, memory_order_relaxed ) + self->size, memory_order_relaxed );
+
+				// When the magazine is full, move half of it to the shared stack
+				if ( cache->magazine[ index ].count > self->capacity )
+				{
+					int keep = self->capacity / 2;
+					int count = cache->magazine[ index ].count - keep;
+					void *head = cache->magazine[ index ].head;
+					void *tail = head;
+					int i;
+					for ( i = 1; i < count; i ++ )
+						tail = *next_block( tail );
+					cache->magazine[ index ].head = *next_block( tail );
+					cache->magazine[ index ].count = keep;
+					atomic_store_explicit( &cache->held, atomic_load_explicit( &cache->held, memory_order_relaxed ) - ( int64_t )count * self->size, memory_order_relaxed );
+					stack_push( self, head, tail, count );
+				}
+			}
+			else
+			{
+				stack_push( self, ptr, ptr, 1 );
+			}
 
 			return;
 		}
@@ -235,20 +706,7 @@ static void pool_close( mlt_pool self )
 	if ( self != NULL )
 	{
 		// We need to free up all items in the pool
-		void *release = NULL;
-
-		// Iterate through the stack until depleted
-		while ( ( release = mlt_deque_pop_back( self->stack ) ) != NULL )
-		{
-			// We'll free this item now
-			mlt_free( ( char * )release - sizeof( struct mlt_release_s ) );
-		}
-
-		// We can now close the stack
-		mlt_deque_close( self->stack );
-
-		// Destroy the mutex
-		pthread_mutex_destroy( &self->lock );
+		chain_free( stack_take( self, 0, NULL ) );
 
 		// Close the pool
 		free( self );
@@ -265,17 +723,20 @@ void mlt_pool_init( )
 	// Loop variable used to create the pools
 	int i = 0;
 
+	// Make sure each thread can have a cache
+	pthread_once( &cache_key_once, cache_key_init );
+
 	// Create the pools
 	pools = mlt_properties_new( );
 
 	// Create the pools
-	for ( i = 8; i < 31; i ++ )
+	for ( i = POOL_MIN_BITS; i < POOL_MIN_BITS + POOL_COUNT; i ++ )
 	{
 		// Each properties item needs a name
 		char name[ 32 ];
 
 		// Construct a pool
-		mlt_pool pool = pool_init( 1 << i );
+		mlt_pool pool = pool_init( i - POOL_MIN_BITS );
 
 		// Generate a name
 		sprintf( name, "%d", i );
@@ -297,7 +758,7 @@ void *mlt_pool_alloc( int size )
 	mlt_pool pool = NULL;
 
 	// Determines the index of the pool to use
-	int index = 8;
+	int index = POOL_MIN_BITS;
 
 	// Minimum size pooled is 256 bytes
 	size += sizeof( struct mlt_release_s );
@@ -305,7 +766,7 @@ void *mlt_pool_alloc( int size )
 		index ++;
 
 	// Now get the pool at the index
-	pool = mlt_properties_get_data_at( pools, index - 8, NULL );
+	pool = mlt_properties_get_data_at( pools, index - POOL_MIN_BITS, NULL );
 
 	// Now get the real item
 	return pool_fetch( pool );
@@ -329,14 +790,15 @@ void *mlt_pool_realloc( void *ptr, int size )
 		// Get the release pointer
 		mlt_release that = ( void * )(( char * )ptr - sizeof( struct mlt_release_s ));
 
-		// If the current pool this ptr belongs to is big enough
-		if ( size > that->pool->size - sizeof( struct mlt_release_s ) )
+		// If the current pool this ptr belongs to is big enough and nobody else uses it
+		if ( size > that->pool->size - sizeof( struct mlt_release_s ) || atomic_load( &that->references ) > 1 )
 		{
 			// Allocate
 			result = mlt_pool_alloc( size );
 
 			// Copy
-			memcpy( result, ptr, that->pool->size - sizeof( struct mlt_release_s ) );
+			int used = that->pool->size - sizeof( struct mlt_release_s );
+			memcpy( result, ptr, size < used ? size : used );
 
 			// Release
 			mlt_pool_release( ptr );
@@ -358,13 +820,30 @@ void *mlt_pool_realloc( void *ptr, int size )
 
 /** Purge unused items in the pool.
  *
- * A form of garbage collection.
+ * A form of garbage collection. This also empties the cache of the calling
+ * thread, and the other threads empty theirs when they next allocate or
+ * release a block.
  * \public \memberof mlt_pool_s
  */
 
 void mlt_pool_purge( )
 {
 	int i = 0;
+	thread_cache *cache;
+
+	pthread_once( &cache_key_once, cache_key_init );
+
+	// Free what this thread is holding and ask the others to do the same
+	pthread_mutex_lock( &caches_mutex );
+	for ( cache = caches; cache; cache = cache->next )
+		atomic_store( &cache->purge, 1 );
+	pthread_mutex_unlock( &caches_mutex );
+	cache = pthread_getspecific( cache_key );
+	if ( cache )
+	{
+		atomic_store( &cache->purge, 0 );
+		cache_drain( cache, 1 );
+	}
 
 	// For each pool
 	for ( i = 0; i < mlt_properties_count( pools ); i ++ )
@@ -372,21 +851,9 @@ void mlt_pool_purge( )
 		// Get the pool
 		mlt_pool self = mlt_properties_get_data_at( pools, i, NULL );
 
-		// Pointer to unused memory
-		void *release = NULL;
-
-		// Lock the pool
-		pthread_mutex_lock( &self->lock );
-
 		// We'll free all unused items now
-		while ( ( release = mlt_deque_pop_back( self->stack ) ) != NULL )
-		{
-			mlt_free( ( char * )release - sizeof( struct mlt_release_s ) );
-			self->count--;
-		}
-
-		// Unlock the pool
-		pthread_mutex_unlock( &self->lock );
+		int count = chain_free( stack_take( self, 0, NULL ) );
+		atomic_fetch_sub_explicit( &self->count, count, memory_order_relaxed );
 	}
 }
 
@@ -402,6 +869,39 @@ void mlt_pool_release( void *release )
 	pool_return( release );
 }
 
+/** Add a reference to an allocated block.
+ *
+ * The block is returned to the pool only when mlt_pool_release() has been
+ * called once for each reference. This lets several frames share an image
+ * without copying it; see mlt_pool_ref_count() to decide when to copy.
+ * \public \memberof mlt_pool_s
+ * \param ptr an opaque pointer of a block in the pool
+ * \return the new reference count
+ */
+
+int mlt_pool_inc_ref( void *ptr )
+{
+	if ( ptr == NULL )
+		return 0;
+	mlt_release that = ( void * )(( char * )ptr - sizeof( struct mlt_release_s ));
+	return atomic_fetch_add_explicit( &that->references, 1, memory_order_relaxed ) + 1;
+}
+
+/** Get the number of references to an allocated block.
+ *
+ * \public \memberof mlt_pool_s
+ * \param ptr an opaque pointer of a block in the pool
+ * \return the reference count, more than 1 if the block is shared
+ */
+
+int mlt_pool_ref_count( void *ptr )
+{
+	if ( ptr == NULL )
+		return 0;
+	mlt_release that = ( void * )(( char * )ptr - sizeof( struct mlt_release_s ));
+	return atomic_load_explicit( &that->references, memory_order_acquire );
+}
+
 /** Close the pool.
  *
  * \public \memberof mlt_pool_s
@@ -409,35 +909,62 @@ void mlt_pool_release( void *release )
 
 void mlt_pool_close( )
 {
+	thread_cache *cache = pthread_getspecific( cache_key );
+
 #ifdef _MLT_POOL_CHECKS_
 	mlt_pool_stat( );
 #endif
 
+	// Give back what this thread is holding
+	if ( cache )
+		cache_drain( cache, 0 );
+
+	// Make the other threads drop their caches instead of returning them
+	atomic_fetch_add( &generation, 1 );
+
 	// Close the properties
 	mlt_properties_close( pools );
+	pools = NULL;
 }
 
+/** Log statistics about the pools and the thread caches.
+ *
+ * The per-thread counters show how often a thread was served by its own
+ * cache (hits) versus the shared stacks or the system allocator (misses).
+ * \public \memberof mlt_pool_s
+ */
+
 void mlt_pool_stat( )
 {
 	// Stats dump
 	uint64_t allocated = 0, used = 0, s;
 	int i = 0, c = mlt_properties_count( pools );
+	thread_cache *cache;
 
 	mlt_log( NULL, MLT_LOG_VERBOSE, "%s: count %d\n", __FUNCTION__, c);
 
 	for ( i = 0; i < c; i ++ )
 	{
 		mlt_pool pool = mlt_properties_get_data_at( pools, i, NULL );
-		if ( pool->count )
+		int count = atomic_load( &pool->count );
+		int available = atomic_load( &pool->available );
+		if ( count )
 			mlt_log_verbose( NULL, "%s: size %d allocated %d returned %d %c\n", __FUNCTION__,
-				pool->size, pool->count, mlt_deque_count( pool->stack ),
-				pool->count !=  mlt_deque_count( pool->stack ) ? '*' : ' ' );
-		s = pool->size; s *= pool->count; allocated += s;
-		s = pool->count - mlt_deque_count( pool->stack ); s *= pool->size; used += s;
+				pool->size, count, available, count != available ? '*' : ' ' );
+		s = pool->size; s *= count; allocated += s;
+		s = count - available; s *= pool->size; used += s;
 	}
 
 	mlt_log_verbose( NULL, "%s: allocated %"PRIu64" bytes, used %"PRIu64" bytes \n",
 		__FUNCTION__, allocated, used );
+
+	pthread_mutex_lock( &caches_mutex );
+	for ( cache = caches; cache; cache = cache->next )
+	{
+		mlt_log_verbose( NULL, "%s: thread cache %p hits %d misses %d held %"PRId64" bytes\n", __FUNCTION__,
+			(void*) cache, atomic_load( &cache->hits ), atomic_load( &cache->misses ), atomic_load( &cache->held ) );
+	}
+	pthread_mutex_unlock( &caches_mutex );
 }
 
 #endif // NO_MLT_POOL
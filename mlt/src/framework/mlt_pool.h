@@ -27,6 +27,8 @@ extern void mlt_pool_init( );
 extern void *mlt_pool_alloc( int size );
 extern void *mlt_pool_realloc( void *ptr, int size );
 extern void mlt_pool_release( void *release );
+extern int mlt_pool_inc_ref( void *ptr );
+extern int mlt_pool_ref_count( void *ptr );
 extern void mlt_pool_purge( );
 extern void mlt_pool_close( );
 extern void mlt_pool_stat( );
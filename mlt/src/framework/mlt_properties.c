@@ -27,6 +27,7 @@
 
 #include "mlt_properties.h"
 #include "mlt_property.h"
+#include "mlt_atom.h"
 #include "mlt_deque.h"
 #include "mlt_log.h"
 #include "mlt_factory.h"
@@ -37,6 +38,7 @@
 #include <ctype.h>
 #include <stdarg.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <sys/types.h>
 #include <dirent.h>
 #include <sys/stat.h>
@@ -48,8 +50,10 @@
 
 typedef struct
 {
-	int hash[ 199 ];
-	char **name;
+	int *hash;
+	int hash_size;
+	mlt_atom *name;
+	char *owned;
 	mlt_property *value;
 	int count;
 	int size;
@@ -323,19 +327,53 @@ int mlt_properties_preset( mlt_properties self, const char *name )
 	}
 }
 
-/** Generate a hash key.
+static _Atomic( mlt_atom ) profile_atom = NULL;
+
+/** Get the profile of a properties list.
  *
+ * This is looked up by every conversion that needs a frame rate, so it uses
+ * the atom that mlt_atom_init() interns. Before that, it looks up the name.
  * \private \memberof mlt_properties_s
- * \param name a string
- * \return an integer
+ * \param self a properties list
+ * \return the profile or NULL
  */
 
-static inline int generate_hash( const char *name )
+static inline mlt_profile get_profile( mlt_properties self )
 {
-	unsigned int hash = 5381;
-	while ( *name )
-		hash = hash * 33 + (unsigned int) ( *name ++ );
-	return hash % 199;
+	mlt_atom atom = atomic_load_explicit( &profile_atom, memory_order_acquire );
+	if ( !atom )
+	{
+		atom = mlt_atom_find( "_profile" );
+		if ( !atom )
+			return mlt_properties_get_data( self, "_profile", NULL );
+		atomic_store_explicit( &profile_atom, atom, memory_order_release );
+	}
+	return mlt_properties_get_data_by_atom( self, atom, NULL );
+}
+
+/** Rebuild the hash table of a properties list.
+ *
+ * The table uses open addressing with linear probing. Each slot holds the
+ * index of a name plus one, and zero marks an empty slot.
+ * \private \memberof mlt_properties_s
+ * \param list a property list
+ * \param size the number of slots, a power of two
+ */
+
+static void rehash( property_list *list, int size )
+{
+	int i;
+
+	free( list->hash );
+	list->hash = calloc( size, sizeof( int ) );
+	list->hash_size = size;
+	for ( i = 0; i < list->count; i ++ )
+	{
+		int key = list->name[ i ]->hash & ( size - 1 );
+		while ( list->hash[ key ] )
+			key = ( key + 1 ) & ( size - 1 );
+		list->hash[ key ] = i + 1;
+	}
 }
 
 /** Copy a serializable property to a properties list that is mirroring this one.
@@ -501,6 +539,49 @@ int mlt_properties_pass( mlt_properties self, mlt_properties that, const char *p
 	return 0;
 }
 
+/** Determine if two atoms name the same property.
+ *
+ * A list holds interned atoms for the names that the framework interns and
+ * private atoms for all other names, so an interned atom may be compared with
+ * a private one of the same string.
+ * \private \memberof mlt_properties_s
+ * \param a an atom
+ * \param b another atom
+ * \return true if the names are equal
+ */
+
+static inline int same_atom( mlt_atom a, mlt_atom b )
+{
+	return a == b || ( a->hash == b->hash && !strcmp( a->name, b->name ) );
+}
+
+/** Get the atom for the name of a new property.
+ *
+ * Names are often built at run time, for example from a pointer or a unique
+ * ID, so interning every one would grow the atom table without bound. Only a
+ * name that was already interned is shared; otherwise the list owns a private
+ * atom that is freed with it.
+ * \private \memberof mlt_properties_s
+ * \param name the name of the property
+ * \param[out] owned set to true if the caller must free the atom
+ * \return an atom
+ */
+
+static mlt_atom name_atom( const char *name, char *owned )
+{
+	mlt_atom atom = mlt_atom_find( name );
+	*owned = atom == NULL;
+	if ( atom == NULL )
+	{
+		size_t length = strlen( name ) + 1;
+		struct mlt_atom_s *private_atom = malloc( sizeof( struct mlt_atom_s ) + length );
+		private_atom->hash = mlt_atom_hash( name );
+		private_atom->name = memcpy( private_atom + 1, name, length );
+		atom = private_atom;
+	}
+	return atom;
+}
+
 /** Locate a property by name.
  *
  * \private \memberof mlt_properties_s
@@ -514,23 +595,64 @@ static inline mlt_property mlt_properties_find( mlt_properties self, const char
 	if ( !self || !name ) return NULL;
 	property_list *list = self->local;
 	mlt_property value = NULL;
-	int key = generate_hash( name );
+	unsigned int hash = mlt_atom_hash( name );
 
 	mlt_properties_lock( self );
 
-	int i = list->hash[ key ] - 1;
-	if ( i >= 0 )
+	if ( list->hash )
 	{
-		// Check if we're hashed
-		if ( list->count > 0 && list->name[ i ] &&
-		 	!strcmp( list->name[ i ], name ) )
-			value = list->value[ i ];
+		int mask = list->hash_size - 1;
+		int key = hash & mask;
+		int i;
+		while ( ( i = list->hash[ key ] - 1 ) >= 0 )
+		{
+			mlt_atom atom = list->name[ i ];
+			if ( atom->hash == hash && !strcmp( atom->name, name ) )
+			{
+				value = list->value[ i ];
+				break;
+			}
+			key = ( key + 1 ) & mask;
+		}
+	}
 
-		// Locate the item
-		for ( i = list->count - 1; value == NULL && i >= 0; i -- )
-			if ( list->name[ i ] && !strcmp( list->name[ i ], name ) )
+	mlt_properties_unlock( self );
+
+	return value;
+}
+
+/** Locate a property by atom.
+ *
+ * \private \memberof mlt_properties_s
+ * \param self a properties list
+ * \param atom the property to lookup by interned name
+ * \return the property or NULL for failure
+ */
+
+static inline mlt_property mlt_properties_find_atom( mlt_properties self, mlt_atom atom )
+{
+	if ( !self || !atom ) return NULL;
+	property_list *list = self->local;
+	mlt_property value = NULL;
+
+	mlt_properties_lock( self );
+
+	if ( list->hash )
+	{
+		int mask = list->hash_size - 1;
+		int key = atom->hash & mask;
+		int i;
+		while ( ( i = list->hash[ key ] - 1 ) >= 0 )
+		{
+			if ( same_atom( list->name[ i ], atom ) )
+			{
 				value = list->value[ i ];
+				break;
+			}
+			key = ( key + 1 ) & mask;
+		}
 	}
+
 	mlt_properties_unlock( self );
 
 	return value;
@@ -547,29 +669,56 @@ static inline mlt_property mlt_properties_find( mlt_properties self, const char
 static mlt_property mlt_properties_add( mlt_properties self, const char *name )
 {
 	property_list *list = self->local;
-	int key = generate_hash( name );
-	mlt_property result;
+	char owned = 0;
+	mlt_atom atom = name_atom( name, &owned );
+	mlt_property result = NULL;
+	int mask, key, i;
 
 	mlt_properties_lock( self );
 
-	// Check that we have space and resize if necessary
-	if ( list->count == list->size )
+	// Keep the hash table at most half full
+	if ( ( list->count + 1 ) * 2 > list->hash_size )
+		rehash( list, list->hash_size? list->hash_size * 2 : 16 );
+
+	// Another thread may have added it since the caller looked
+	mask = list->hash_size - 1;
+	key = atom->hash & mask;
+	while ( ( i = list->hash[ key ] - 1 ) >= 0 )
 	{
-		list->size += 50;
-		list->name = realloc( list->name, list->size * sizeof( const char * ) );
-		list->value = realloc( list->value, list->size * sizeof( mlt_property ) );
+		if ( same_atom( list->name[ i ], atom ) )
+		{
+			result = list->value[ i ];
+			break;
+		}
+		key = ( key + 1 ) & mask;
 	}
 
-	// Assign name/value pair
-	list->name[ list->count ] = strdup( name );
-	list->value[ list->count ] = mlt_property_init( );
+	if ( result == NULL )
+	{
+		// Check that we have space and resize if necessary
+		if ( list->count == list->size )
+		{
+			list->size += 50;
+			list->name = realloc( list->name, list->size * sizeof( mlt_atom ) );
+			list->owned = realloc( list->owned, list->size * sizeof( char ) );
+			list->value = realloc( list->value, list->size * sizeof( mlt_property ) );
+		}
+
+		// Assign name/value pair
+		list->name[ list->count ] = atom;
+		list->owned[ list->count ] = owned;
+		list->value[ list->count ] = mlt_property_init( );
 
-	// Assign to hash table
-	if ( list->hash[ key ] == 0 )
+		// Assign to hash table
 		list->hash[ key ] = list->count + 1;
 
-	// Return and increment count accordingly
-	result = list->value[ list->count ++ ];
+		// Return and increment count accordingly
+		result = list->value[ list->count ++ ];
+	}
+	else if ( owned )
+	{
+		free( ( void* ) atom );
+	}
 
 	mlt_properties_unlock( self );
 
@@ -888,7 +1037,7 @@ char *mlt_properties_get_name( mlt_properties self, int index )
 	if ( !self ) return NULL;
 	property_list *list = self->local;
 	if ( index >= 0 && index < list->count )
-		return list->name[ index ];
+		return (char*) list->name[ index ]->name;
 	return NULL;
 }
 
@@ -1017,7 +1166,7 @@ int mlt_properties_get_int( mlt_properties self, const char *name )
 	mlt_property value = mlt_properties_find( self, name );
 	if ( value )
 	{
-		mlt_profile profile = mlt_properties_get_data( self, "_profile", NULL );
+		mlt_profile profile = get_profile( self );
 		double fps = mlt_profile_fps( profile );
 		property_list *list = self->local;
 		result = mlt_property_get_int( value, fps, list->locale );
@@ -1113,7 +1262,7 @@ double mlt_properties_get_double( mlt_properties self, const char *name )
 	mlt_property value = mlt_properties_find( self, name );
 	if ( value )
 	{
-		mlt_profile profile = mlt_properties_get_data( self, "_profile", NULL );
+		mlt_profile profile = get_profile( self );
 		double fps = mlt_profile_fps( profile );
 		property_list *list = self->local;
 		result = mlt_property_get_double( value, fps, list->locale );
@@ -1165,7 +1314,7 @@ mlt_position mlt_properties_get_position( mlt_properties self, const char *name
 	mlt_property value = mlt_properties_find( self, name );
 	if ( value )
 	{
-		mlt_profile profile = mlt_properties_get_data( self, "_profile", NULL );
+		mlt_profile profile = get_profile( self );
 		double fps = mlt_profile_fps( profile );
 		property_list *list = self->local;
 		result = mlt_property_get_position( value, fps, list->locale );
@@ -1219,6 +1368,124 @@ void *mlt_properties_get_data( mlt_properties self, const char *name, int *lengt
 	return value == NULL ? NULL : mlt_property_get_data( value, length );
 }
 
+/** Get the destructor of a binary data value associated to the name.
+ *
+ * This tells who owns the data, for example whether it is a block of mlt_pool.
+ * \public \memberof mlt_properties_s
+ * \param self a properties list
+ * \param name the property to get
+ * \return the destructor or NULL if there is none or the property is not binary data
+ */
+
+mlt_destructor mlt_properties_get_destructor( mlt_properties self, const char *name )
+{
+	mlt_property value = mlt_properties_find( self, name );
+	return value == NULL ? NULL : mlt_property_get_destructor( value );
+}
+
+/** Get a property's string value by atom.
+ *
+ * This is the same as mlt_properties_get() but avoids hashing and comparing
+ * the name, which makes it suitable for hot paths.
+ * \public \memberof mlt_properties_s
+ * \param self a properties list
+ * \param atom the interned name of the property, see mlt_atom_get()
+ * \return the property's string value or NULL if it does not exist
+ */
+
+char *mlt_properties_get_by_atom( mlt_properties self, mlt_atom atom )
+{
+	char *result = NULL;
+	mlt_property value = mlt_properties_find_atom( self, atom );
+	if ( value )
+	{
+		property_list *list = self->local;
+		result = mlt_property_get_string_l( value, list->locale );
+	}
+	return result;
+}
+
+/** Get an integer associated to an atom.
+ *
+ * \public \memberof mlt_properties_s
+ * \param self a properties list
+ * \param atom the interned name of the property, see mlt_atom_get()
+ * \return The integer value, 0 if not found (which may also be a legitimate value)
+ */
+
+int mlt_properties_get_int_by_atom( mlt_properties self, mlt_atom atom )
+{
+	int result = 0;
+	mlt_property value = mlt_properties_find_atom( self, atom );
+	if ( value )
+	{
+		mlt_profile profile = get_profile( self );
+		double fps = mlt_profile_fps( profile );
+		property_list *list = self->local;
+		result = mlt_property_get_int( value, fps, list->locale );
+	}
+	return result;
+}
+
+/** Get a floating point value associated to an atom.
+ *
+ * \public \memberof mlt_properties_s
+ * \param self a properties list
+ * \param atom the interned name of the property, see mlt_atom_get()
+ * \return the floating point, 0 if not found (which may also be a legitimate value)
+ */
+
+double mlt_properties_get_double_by_atom( mlt_properties self, mlt_atom atom )
+{
+	double result = 0;
+	mlt_property value = mlt_properties_find_atom( self, atom );
+	if ( value )
+	{
+		mlt_profile profile = get_profile( self );
+		double fps = mlt_profile_fps( profile );
+		property_list *list = self->local;
+		result = mlt_property_get_double( value, fps, list->locale );
+	}
+	return result;
+}
+
+/** Get a position value associated to an atom.
+ *
+ * \public \memberof mlt_properties_s
+ * \param self a properties list
+ * \param atom the interned name of the property, see mlt_atom_get()
+ * \return the position, 0 if not found (which may also be a legitimate value)
+ */
+
+mlt_position mlt_properties_get_position_by_atom( mlt_properties self, mlt_atom atom )
+{
+	mlt_position result = 0;
+	mlt_property value = mlt_properties_find_atom( self, atom );
+	if ( value )
+	{
+		mlt_profile profile = get_profile( self );
+		double fps = mlt_profile_fps( profile );
+		property_list *list = self->local;
+		result = mlt_property_get_position( value, fps, list->locale );
+	}
+	return result;
+}
+
+/** Get a binary data value associated to an atom.
+ *
+ * \public \memberof mlt_properties_s
+ * \param self a properties list
+ * \param atom the interned name of the property, see mlt_atom_get()
+ * \param[out] length The size of the binary data in bytes, if available (often it is not, you should know)
+ * \return the data pointer or NULL if not found
+ */
+
+void *mlt_properties_get_data_by_atom( mlt_properties self, mlt_atom atom, int *length )
+{
+	mlt_property value = mlt_properties_find_atom( self, atom );
+	return value == NULL ? NULL : mlt_property_get_data( value, length );
+}
+
 /** Store binary data as a property.
  *
  * \public \memberof mlt_properties_s
@@ -1267,19 +1534,28 @@ int mlt_properties_rename( mlt_properties self, const char *source, const char *
 		property_list *list = self->local;
 		int i = 0;
 
+		char owned = 0;
+		mlt_atom atom = name_atom( dest, &owned );
+
 		// Locate the item
 		mlt_properties_lock( self );
 		for ( i = 0; i < list->count; i ++ )
 		{
-			if ( list->name[ i ] && !strcmp( list->name[ i ], source ) )
+			if ( !strcmp( list->name[ i ]->name, source ) )
 			{
-				free( list->name[ i ] );
-				list->name[ i ] = strdup( dest );
-				list->hash[ generate_hash( dest ) ] = i + 1;
+				if ( list->owned[ i ] )
+					free( ( void* ) list->name[ i ] );
+				list->name[ i ] = atom;
+				list->owned[ i ] = owned;
+				atom = NULL;
+				rehash( list, list->hash_size );
 				break;
 			}
 		}
 		mlt_properties_unlock( self );
+
+		if ( atom && owned )
+			free( ( void* ) atom );
 	}
 
 	return value != NULL;
@@ -1298,8 +1574,8 @@ void mlt_properties_dump( mlt_properties self, FILE *output )
 	property_list *list = self->local;
 	int i = 0;
 	for ( i = 0; i < list->count; i ++ )
-		if ( mlt_properties_get( self, list->name[ i ] ) != NULL )
-			fprintf( output, "%s=%s\n", list->name[ i ], mlt_properties_get( self, list->name[ i ] ) );
+		if ( mlt_properties_get( self, list->name[ i ]->name ) != NULL )
+			fprintf( output, "%s=%s\n", list->name[ i ]->name, mlt_properties_get( self, list->name[ i ]->name ) );
 }
 
 /** Output the properties to a file handle.
@@ -1321,10 +1597,10 @@ void mlt_properties_debug( mlt_properties self, const char *title, FILE *output
 		int i = 0;
 		fprintf( output, "[ ref=%d", list->ref_count );
 		for ( i = 0; i < list->count; i ++ )
-			if ( mlt_properties_get( self, list->name[ i ] ) != NULL )
-				fprintf( output, ", %s=%s", list->name[ i ], mlt_properties_get( self, list->name[ i ] ) );
+			if ( mlt_properties_get( self, list->name[ i ]->name ) != NULL )
+				fprintf( output, ", %s=%s", list->name[ i ]->name, mlt_properties_get( self, list->name[ i ]->name ) );
 			else
-				fprintf( output, ", %s=%p", list->name[ i ], mlt_properties_get_data( self, list->name[ i ], NULL ) );
+				fprintf( output, ", %s=%p", list->name[ i ]->name, mlt_properties_get_data( self, list->name[ i ]->name, NULL ) );
 		fprintf( output, " ]" );
 	}
 	fprintf( output, "\n" );
@@ -1492,11 +1768,12 @@ void mlt_properties_close( mlt_properties self )
 			mlt_log( NULL, MLT_LOG_DEBUG, "Created %d, destroyed %d\n", properties_created, properties_destroyed );
 #endif
 
-			// Clean up names and values
+			// Clean up values
 			for ( index = list->count - 1; index >= 0; index -- )
 			{
 				mlt_property_close( list->value[ index ] );
-				free( list->name[ index ] );
+				if ( list->owned[ index ] )
+					free( ( void* ) list->name[ index ] );
 			}
 
 #if defined(__GLIBC__) || defined(__APPLE__)
@@ -1510,7 +1787,9 @@ void mlt_properties_close( mlt_properties self )
 
 			// Clear up the list
 			pthread_mutex_destroy( &list->mutex );
+			free( list->hash );
 			free( list->name );
+			free( list->owned );
 			free( list->value );
 			free( list );
 
@@ -2069,7 +2348,7 @@ static void serialise_yaml( mlt_properties self, strbuf output, int indent, int
 		// This implementation assumes that all data elements are property lists.
 		// Unfortunately, we do not have run time type identification.
 		mlt_properties child = mlt_property_get_data( list->value[ i ], NULL );
-		const char *name = list->name[i];
+		const char *name = list->name[i]->name;
 		const char *value = mlt_properties_get( self, name );
 
 		if ( is_sequence )
@@ -2277,7 +2556,7 @@ int mlt_properties_exists( mlt_properties self, const char *name )
 
 char *mlt_properties_get_time( mlt_properties self, const char* name, mlt_time_format format )
 {
-	mlt_profile profile = mlt_properties_get_data( self, "_profile", NULL );
+	mlt_profile profile = get_profile( self );
 	if ( profile )
 	{
 		double fps = mlt_profile_fps( profile );
@@ -2333,7 +2612,7 @@ mlt_position mlt_properties_time_to_frames( mlt_properties self, const char *tim
 
 mlt_color mlt_properties_get_color( mlt_properties self, const char* name )
 {
-	mlt_profile profile = mlt_properties_get_data( self, "_profile", NULL );
+	mlt_profile profile = get_profile( self );
 	double fps = mlt_profile_fps( profile );
 	property_list *list = self->local;
 	mlt_property value = mlt_properties_find( self, name );
@@ -2424,7 +2703,7 @@ int mlt_properties_set_color( mlt_properties self, const char *name, mlt_color c
 
 char* mlt_properties_anim_get( mlt_properties self, const char *name, int position, int length )
 {
-	mlt_profile profile = mlt_properties_get_data( self, "_profile", NULL );
+	mlt_profile profile = get_profile( self );
 	double fps = mlt_profile_fps( profile );
 	mlt_property value = mlt_properties_find( self, name );
 	property_list *list = self->local;
@@ -2458,7 +2737,7 @@ int mlt_properties_anim_set( mlt_properties self, const char *name, const char *
 	// Set it if not NULL
 	if ( property )
 	{
-		mlt_profile profile = mlt_properties_get_data( self, "_profile", NULL );
+		mlt_profile profile = get_profile( self );
 		double fps = mlt_profile_fps( profile );
 		property_list *list = self->local;
 		error = mlt_property_anim_set_string( property, value,
@@ -2484,7 +2763,7 @@ int mlt_properties_anim_set( mlt_properties self, const char *name, const char *
 
 int mlt_properties_anim_get_int( mlt_properties self, const char *name, int position, int length )
 {
-	mlt_profile profile = mlt_properties_get_data( self, "_profile", NULL );
+	mlt_profile profile = get_profile( self );
 	double fps = mlt_profile_fps( profile );
 	property_list *list = self->local;
 	mlt_property value = mlt_properties_find( self, name );
@@ -2517,7 +2796,7 @@ int mlt_properties_anim_set_int( mlt_properties self, const char *name, int valu
 	// Set it if not NULL
 	if ( property != NULL )
 	{
-		mlt_profile profile = mlt_properties_get_data( self, "_profile", NULL );
+		mlt_profile profile = get_profile( self );
 		double fps = mlt_profile_fps( profile );
 		property_list *list = self->local;
 		error = mlt_property_anim_set_int( property, value, fps, list->locale, position, length, keyframe_type );
@@ -2542,7 +2821,7 @@ int mlt_properties_anim_set_int( mlt_properties self, const char *name, int valu
 
 double mlt_properties_anim_get_double( mlt_properties self, const char *name, int position, int length )
 {
-	mlt_profile profile = mlt_properties_get_data( self, "_profile", NULL );
+	mlt_profile profile = get_profile( self );
 	double fps = mlt_profile_fps( profile );
 	property_list *list = self->local;
 	mlt_property value = mlt_properties_find( self, name );
@@ -2575,7 +2854,7 @@ int mlt_properties_anim_set_double( mlt_properties self, const char *name, doubl
 	// Set it if not NULL
 	if ( property != NULL )
 	{
-		mlt_profile profile = mlt_properties_get_data( self, "_profile", NULL );
+		mlt_profile profile = get_profile( self );
 		double fps = mlt_profile_fps( profile );
 		property_list *list = self->local;
 		error = mlt_property_anim_set_double( property, value, fps, list->locale, position, length, keyframe_type );
@@ -2673,7 +2952,7 @@ extern int mlt_properties_anim_set_rect( mlt_properties self, const char *name,
 	// Set it if not NULL
 	if ( property != NULL )
 	{
-		mlt_profile profile = mlt_properties_get_data( self, "_profile", NULL );
+		mlt_profile profile = get_profile( self );
 		double fps = mlt_profile_fps( profile );
 		property_list *list = self->local;
 		error = mlt_property_anim_set_rect( property, value, fps, list->locale, position, length, keyframe_type );
@@ -2698,7 +2977,7 @@ extern int mlt_properties_anim_set_rect( mlt_properties self, const char *name,
 
 extern mlt_rect mlt_properties_anim_get_rect( mlt_properties self, const char *name, int position, int length )
 {
-	mlt_profile profile = mlt_properties_get_data( self, "_profile", NULL );
+	mlt_profile profile = get_profile( self );
 	double fps = mlt_profile_fps( profile );
 	property_list *list = self->local;
 	mlt_property value = mlt_properties_find( self, name );
@@ -25,6 +25,7 @@
 
 #include "mlt_types.h"
 #include "mlt_events.h"
+#include "mlt_atom.h"
 #include <stdio.h>
 
 /** \brief Properties class
@@ -76,6 +77,12 @@ extern mlt_position mlt_properties_get_position( mlt_properties self, const char
 extern int mlt_properties_set_position( mlt_properties self, const char *name, mlt_position value );
 extern int mlt_properties_set_data( mlt_properties self, const char *name, void *value, int length, mlt_destructor, mlt_serialiser );
 extern void *mlt_properties_get_data( mlt_properties self, const char *name, int *length );
+extern mlt_destructor mlt_properties_get_destructor( mlt_properties self, const char *name );
+extern char *mlt_properties_get_by_atom( mlt_properties self, mlt_atom atom );
+extern int mlt_properties_get_int_by_atom( mlt_properties self, mlt_atom atom );
+extern double mlt_properties_get_double_by_atom( mlt_properties self, mlt_atom atom );
+extern mlt_position mlt_properties_get_position_by_atom( mlt_properties self, mlt_atom atom );
+extern void *mlt_properties_get_data_by_atom( mlt_properties self, mlt_atom atom, int *length );
 extern int mlt_properties_rename( mlt_properties self, const char *source, const char *dest );
 extern int mlt_properties_count( mlt_properties self );
 extern void mlt_properties_dump( mlt_properties self, FILE *output );
@@ -877,6 +877,21 @@ void *mlt_property_get_data( mlt_property self, int *length )
 	return result;
 }
 
+/** Get the destructor of the binary data of a property.
+ *
+ * \public \memberof mlt_property_s
+ * \param self a property
+ * \return the destructor or NULL if there is none or the property is not binary data
+ */
+
+mlt_destructor mlt_property_get_destructor( mlt_property self )
+{
+	pthread_mutex_lock( &self->mutex );
+	mlt_destructor result = ( self->types & mlt_prop_data ) ? self->destructor : NULL;
+	pthread_mutex_unlock( &self->mutex );
+	return result;
+}
+
 /** Destroy a property and free all related resources.
  *
  * \public \memberof mlt_property_s
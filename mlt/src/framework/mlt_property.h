@@ -59,6 +59,7 @@ extern char *mlt_property_get_string( mlt_property self );
 extern char *mlt_property_get_string_l_tf( mlt_property self, locale_t, mlt_time_format );
 extern char *mlt_property_get_string_l( mlt_property self, locale_t );
 extern void *mlt_property_get_data( mlt_property self, int *length );
+extern mlt_destructor mlt_property_get_destructor( mlt_property self );
 extern void mlt_property_close( mlt_property self );
 extern void mlt_property_pass( mlt_property self, mlt_property that );
 extern char *mlt_property_get_time( mlt_property self, mlt_time_format, double fps, locale_t );
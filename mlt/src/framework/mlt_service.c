@@ -27,6 +27,7 @@
 #include "mlt_factory.h"
 #include "mlt_log.h"
 #include "mlt_producer.h"
+#include "mlt_trace.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -577,6 +578,9 @@ void mlt_service_apply_filters( mlt_service self, mlt_frame frame, int index )
 int mlt_service_get_frame( mlt_service self, mlt_frame_ptr frame, int index )
 {
 	int result = 0;
+	int trace = mlt_trace_enabled;
+	int64_t trace_start = 0;
+	mlt_service trace_previous = NULL;
 
 	// Lock the service
 	mlt_service_lock( self );
@@ -592,6 +596,12 @@ int mlt_service_get_frame( mlt_service self, mlt_frame_ptr frame, int index )
 		mlt_position out = mlt_properties_get_position( properties, "out" );
 		mlt_position position = mlt_service_identify( self ) == producer_type ? mlt_producer_position( MLT_PRODUCER( self ) ) : -1;
 
+		if ( trace )
+		{
+			trace_start = mlt_trace_time( );
+			trace_previous = mlt_trace_enter( self );
+		}
+
 		result = self->get_frame( self, frame, index );
 
 		if ( result == 0 )
@@ -635,6 +645,13 @@ int mlt_service_get_frame( mlt_service self, mlt_frame_ptr frame, int index )
 				mlt_producer_seek( MLT_PRODUCER(self), new_position );
 			}
 		}
+
+		if ( trace )
+		{
+			mlt_trace_enter( trace_previous );
+			mlt_trace_span( "get_frame", mlt_trace_service_name( self ),
+				*frame ? mlt_frame_get_position( *frame ) : position, trace_start );
+		}
 	}
 
 	// Make sure we return a frame
@@ -24,11 +24,13 @@
 #include "mlt_properties.h"
 #include "mlt_log.h"
 #include "mlt_factory.h"
+#include "mlt_trace.h"
 
 #include <stdlib.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <sched.h>
+#include <stdatomic.h>
 #ifdef _WIN32
 #include <windows.h>
 #endif
@@ -46,21 +48,55 @@ mlt_schedule_policy;
 static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
 static mlt_slices globals[mlt_policy_nb] = {NULL, NULL, NULL};
 
+/** the task whose job the calling thread is running, if any */
+static pthread_key_t current_key;
+static pthread_once_t current_key_once = PTHREAD_ONCE_INIT;
+
+static void current_key_init( )
+{
+	pthread_key_create( &current_key, NULL );
+}
+
+
+/** \brief A parallel-for task of a sliced threading context
+ *
+ * The runtime lives on the stack of the thread that called mlt_slices_run().
+ * Any thread claims the next job with an atomic increment, so running a job
+ * does not require the context mutex. A thread that wants to claim jobs
+ * registers itself in \p users under the mutex, and the owner does not return
+ * until every job is done and every user has left.
+ */
 
 struct mlt_slices_runtime_s
 {
-	int jobs, done, curr;
+	int jobs;
+	atomic_int curr, done;
+	int users;
+	int linked;
 	mlt_slices_proc proc;
 	void* cookie;
-	struct mlt_slices_runtime_s* next;
+	struct mlt_slices_runtime_s *parent;
+	struct mlt_slices_runtime_s *prev, *next;
 };
 
+/** \brief Sliced threading context
+ *
+ * Tasks that still have unclaimed jobs are kept in a list in the order they
+ * were started. Idle pool threads steal jobs from the oldest task. The thread
+ * that started a task runs its jobs as well and, while it waits for the
+ * jobs that other threads took, helps only with tasks nested inside its own
+ * jobs. This way nested calls neither deadlock nor need more threads, and a
+ * thread that holds a lock while it waits never runs unrelated work that
+ * might need another lock.
+ */
+
 struct mlt_slices_s
 {
 	int f_exit;
 	int count;
 	int readys;
 	int ref;
+	int attached;
 	pthread_mutex_t cond_mutex;
 	pthread_cond_t cond_var_job;
 	pthread_cond_t cond_var_ready;
@@ -69,9 +105,130 @@ struct mlt_slices_s
 	const char* name;
 };
 
+/** Remove a task from the list of tasks with unclaimed jobs.
+ *
+ * The caller must hold the context mutex.
+ * \private \memberof mlt_slices_s
+ * \param ctx context pointer
+ * \param r a task
+ */
+
+static void unlink_runtime( mlt_slices ctx, struct mlt_slices_runtime_s* r )
+{
+	if ( !r->linked )
+		return;
+	if ( r->prev )
+		r->prev->next = r->next;
+	else
+		ctx->head = r->next;
+	if ( r->next )
+		r->next->prev = r->prev;
+	else
+		ctx->tail = r->prev;
+	r->prev = r->next = NULL;
+	r->linked = 0;
+}
+
+/** Determine whether a task was started from within the jobs of another.
+ *
+ * \private \memberof mlt_slices_s
+ * \param r a task
+ * \param ancestor another task
+ * \return true if \p r was started by a job of \p ancestor or of its descendants
+ */
+
+static int is_descendant( struct mlt_slices_runtime_s* r, struct mlt_slices_runtime_s* ancestor )
+{
+	for ( r = r->parent; r; r = r->parent )
+		if ( r == ancestor )
+			return 1;
+	return 0;
+}
+
+/** Find the oldest task with unclaimed jobs.
+ *
+ * The caller must hold the context mutex. Tasks found to have no more
+ * unclaimed jobs are removed from the list.
+ * \private \memberof mlt_slices_s
+ * \param ctx context pointer
+ * \param ancestor only consider tasks nested inside this task or NULL for any
+ * \return a task or NULL
+ */
+
+static struct mlt_slices_runtime_s* find_runtime( mlt_slices ctx, struct mlt_slices_runtime_s* ancestor )
+{
+	struct mlt_slices_runtime_s* r = ctx->head;
+	while ( r )
+	{
+		struct mlt_slices_runtime_s* next = r->next;
+		if ( atomic_load( &r->curr ) >= r->jobs )
+			unlink_runtime( ctx, r );
+		else if ( !ancestor || is_descendant( r, ancestor ) )
+			return r;
+		r = next;
+	}
+	return NULL;
+}
+
+/** Claim and run jobs of a task until there are none left to claim.
+ *
+ * \private \memberof mlt_slices_s
+ * \param ctx context pointer
+ * \param r a task for which the calling thread is registered as a user
+ * \param id the identifier of the calling thread passed to the job
+ */
+
+static void run_jobs( mlt_slices ctx, struct mlt_slices_runtime_s* r, int id )
+{
+	void *previous = pthread_getspecific( current_key );
+	int idx;
+
+	pthread_setspecific( current_key, r );
+	while ( ( idx = atomic_fetch_add( &r->curr, 1 ) ) < r->jobs )
+	{
+		mlt_log_debug( NULL, "%s:%d: running job: id=%d, idx=%d/%d, pool=[%s]\n", __FUNCTION__, __LINE__,
+			id, idx, r->jobs, ctx->name );
+		r->proc( id, idx, r->jobs, r->cookie );
+		atomic_fetch_add( &r->done, 1 );
+	}
+	pthread_setspecific( current_key, previous );
+}
+
+/** Determine whether a task is complete.
+ *
+ * \private \memberof mlt_slices_s
+ * \param r a task
+ * \return true if all jobs are done and no other thread is using the task
+ */
+
+static inline int is_complete( struct mlt_slices_runtime_s* r )
+{
+	return atomic_load( &r->done ) >= r->jobs && r->users == 0;
+}
+
+/** Help with a task as a registered user.
+ *
+ * The caller must hold the context mutex, which is released while running jobs.
+ * \private \memberof mlt_slices_s
+ * \param ctx context pointer
+ * \param r a task
+ * \param id the identifier of the calling thread passed to the job
+ */
+
+static void help_runtime( mlt_slices ctx, struct mlt_slices_runtime_s* r, int id )
+{
+	r->users++;
+	pthread_mutex_unlock( &ctx->cond_mutex );
+	run_jobs( ctx, r, id );
+	pthread_mutex_lock( &ctx->cond_mutex );
+	r->users--;
+	if ( is_complete( r ) )
+		pthread_cond_broadcast( &ctx->cond_var_ready );
+}
+
 static void* mlt_slices_worker( void* p )
 {
-	int id, idx;
+	int id;
 	struct mlt_slices_runtime_s* r;
 	mlt_slices ctx = (mlt_slices)p;
 
@@ -86,46 +243,15 @@ static void* mlt_slices_worker( void* p )
 	{
 		mlt_log_debug( NULL, "%s:%d: ctx=[%p][%s] waiting\n", __FUNCTION__, __LINE__ , ctx, ctx->name );
 
-		/* wait for new jobs */
-		while( !ctx->f_exit && !( r = ctx->head ) )
+		/* wait for new jobs, leaving the CPUs to attached threads */
+		r = NULL;
+		while ( !ctx->f_exit && ( id >= ctx->count - ctx->attached || !( r = find_runtime( ctx, NULL ) ) ) )
 			pthread_cond_wait( &ctx->cond_var_job, &ctx->cond_mutex );
 
 		if ( ctx->f_exit )
 			break;
 
-		if ( !r )
-			continue;
-
-		/* check if no new job */
-		if ( r->curr == r->jobs )
-		{
-			ctx->head = ctx->head->next;
-			if ( !ctx->head )
-				ctx->tail = NULL;
-			mlt_log_debug( NULL, "%s:%d: new ctx->head=%p\n", __FUNCTION__, __LINE__, ctx->head );
-			continue;
-		};
-
-		/* new job id */
-		idx = r->curr;
-		r->curr++;
-
-		/* run job */
-		pthread_mutex_unlock( &ctx->cond_mutex );
-		mlt_log_debug( NULL, "%s:%d: running job: id=%d, idx=%d/%d, pool=[%s]\n", __FUNCTION__, __LINE__,
-			id, idx, r->jobs, ctx->name );
-		r->proc( id, idx, r->jobs, r->cookie );
-		pthread_mutex_lock( &ctx->cond_mutex );
-
-		/* increase done jobs counter */
-		r->done++;
-
-		/* notify we fininished last job */
-		if ( r->done == r->jobs )
-		{
-			mlt_log_debug( NULL, "%s:%d: pthread_cond_signal( &ctx->cond_var_ready )\n", __FUNCTION__, __LINE__ );
-			pthread_cond_broadcast( &ctx->cond_var_ready );
-		}
+		help_runtime( ctx, r, id );
 	}
 
 	pthread_mutex_unlock( &ctx->cond_mutex );
@@ -191,6 +317,8 @@ mlt_slices mlt_slices_init( int threads, int policy, int priority )
 
 	ctx->count = threads;
 
+	pthread_once( &current_key_once, current_key_init );
+
 	/* init attributes */
 	pthread_mutex_init ( &ctx->cond_mutex, NULL );
 	pthread_cond_init ( &ctx->cond_var_job, NULL );
@@ -243,8 +371,8 @@ void mlt_slices_close( mlt_slices ctx )
 	pthread_mutex_unlock( &g_lock );
 
 	/* notify to exit */
-	ctx->f_exit = 1;
 	pthread_mutex_lock( &ctx->cond_mutex );
+	ctx->f_exit = 1;
 	pthread_cond_broadcast( &ctx->cond_var_job);
 	pthread_cond_broadcast( &ctx->cond_var_ready);
 	pthread_mutex_unlock( &ctx->cond_mutex );
@@ -263,6 +391,10 @@ void mlt_slices_close( mlt_slices ctx )
 }
 
 /** Run sliced execution
+ *
+ * The calling thread runs jobs too, with an \p id of -1. While it waits for
+ * jobs taken by other threads it runs jobs of tasks that those jobs started,
+ * so it is safe to call this from within a job.
  *
  * \public \memberof mlt_slices_s
  * \deprecated
@@ -273,7 +405,9 @@ void mlt_slices_close( mlt_slices ctx )
 
 void mlt_slices_run( mlt_slices ctx, int jobs, mlt_slices_proc proc, void* cookie )
 {
-	struct mlt_slices_runtime_s runtime, *r = &runtime;
+	struct mlt_slices_runtime_s runtime, *r = &runtime, *other;
+	int trace = mlt_trace_enabled;
+	int64_t trace_start = trace ? mlt_trace_time( ) : 0;
 
 	/* lock */
 	pthread_mutex_lock( &ctx->cond_mutex);
@@ -286,34 +420,47 @@ void mlt_slices_run( mlt_slices ctx, int jobs, mlt_slices_proc proc, void* cooki
 
 	/* setup runtime args */
 	r->jobs = jobs;
-	r->done = 0;
-	r->curr = 0;
+	atomic_init( &r->done, 0 );
+	atomic_init( &r->curr, 0 );
+	r->users = 0;
 	r->proc = proc;
 	r->cookie = cookie;
+	r->parent = pthread_getspecific( current_key );
 	r->next = NULL;
+	r->prev = ctx->tail;
+	r->linked = 1;
 
 	/* attach job */
 	if ( ctx->tail )
-	{
 		ctx->tail->next = r;
-		ctx->tail = r;
-	}
 	else
-	{
-		ctx->head = ctx->tail = r;
-	}
+		ctx->head = r;
+	ctx->tail = r;
 
-	/* notify workers */
+	/* notify workers and waiting owners of older tasks */
 	pthread_cond_broadcast( &ctx->cond_var_job );
+	pthread_cond_broadcast( &ctx->cond_var_ready );
 
-	/* wait for end of task */
-	while( !ctx->f_exit && ( r->done < r->jobs ) )
+	/* take part in our own task */
+	help_runtime( ctx, r, -1 );
+	unlink_runtime( ctx, r );
+
+	/* wait for end of task, helping with tasks nested inside ours */
+	while( !is_complete( r ) )
 	{
+		if ( ( other = find_runtime( ctx, r ) ) )
+		{
+			help_runtime( ctx, other, -1 );
+			continue;
+		}
 		pthread_cond_wait( &ctx->cond_var_ready, &ctx->cond_mutex );
 		mlt_log_debug( NULL, "%s:%d: ctx=[%p][%s] signalled\n", __FUNCTION__, __LINE__ , ctx, ctx->name );
 	}
 
 	pthread_mutex_unlock( &ctx->cond_mutex);
+
+	if ( trace )
+		mlt_trace_span( "slices_run", ctx->name, -1, trace_start );
 }
 
 /** Get a global shared sliced threading context.
@@ -394,6 +541,46 @@ int mlt_slices_count_fifo()
 		return 0;
 }
 
+/** Tell the normal policy context that the calling thread is busy.
+ *
+ * Threads outside of the context that do CPU intensive work, such as the
+ * consumer's parallel workers, call this before doing the work so that one
+ * fewer pool thread takes jobs, keeping the number of busy threads near the
+ * number of CPUs. Every call must be matched with mlt_slices_detach_normal().
+ *
+ * \public \memberof mlt_slices_s
+ */
+
+void mlt_slices_attach_normal()
+{
+	mlt_slices ctx = mlt_slices_get_global( mlt_policy_normal );
+	if ( ctx )
+	{
+		pthread_mutex_lock( &ctx->cond_mutex );
+		ctx->attached++;
+		pthread_mutex_unlock( &ctx->cond_mutex );
+	}
+}
+
+/** Tell the normal policy context that the calling thread is no longer busy.
+ *
+ * \public \memberof mlt_slices_s
+ * \see mlt_slices_attach_normal
+ */
+
+void mlt_slices_detach_normal()
+{
+	mlt_slices ctx = mlt_slices_get_global( mlt_policy_normal );
+	if ( ctx )
+	{
+		pthread_mutex_lock( &ctx->cond_mutex );
+		if ( ctx->attached > 0 )
+			ctx->attached--;
+		pthread_cond_broadcast( &ctx->cond_var_job );
+		pthread_mutex_unlock( &ctx->cond_mutex );
+	}
+}
+
 void mlt_slices_run_normal(int jobs, mlt_slices_proc proc, void *cookie)
 {
 	return mlt_slices_run( mlt_slices_get_global( mlt_policy_normal ),
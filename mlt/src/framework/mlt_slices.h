@@ -32,6 +32,9 @@
 
 struct mlt_slices_s;
 
+/** A job function. \p id is the index of the pool thread running the job or -1
+ * for the thread that called mlt_slices_run(), and \p idx is the index of the job.
+ */
 typedef int (*mlt_slices_proc)( int id, int idx, int jobs, void* cookie );
 
 extern mlt_slices mlt_slices_init( int threads, int policy, int priority );
@@ -52,4 +55,8 @@ extern void mlt_slices_run_rr( int jobs, mlt_slices_proc proc, void* cookie );
 
 extern void mlt_slices_run_fifo( int jobs, mlt_slices_proc proc, void* cookie );
 
+extern void mlt_slices_attach_normal();
+
+extern void mlt_slices_detach_normal();
+
 #endif
@@ -0,0 +1,398 @@
+/**
+ * \file mlt_trace.c
+ * \brief timing of the frame pipeline
+ * \see mlt_trace_open
+ *
+ * Copyright (C) 2020 Meltytech, LLC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "mlt_trace.h"
+#include "mlt_service.h"
+#include "mlt_frame.h"
+#include "mlt_deque.h"
+#include "mlt_properties.h"
+#include "mlt_log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+int mlt_trace_enabled = 0;
+
+/** \brief Per-thread trace state */
+
+typedef struct
+{
+	int id;              /**< the thread number written as the tid of events */
+	mlt_service current; /**< the service currently processing a frame on this thread */
+}
+trace_thread;
+
+/** \brief A closure and the service instance that pushed it */
+
+typedef struct
+{
+	void *closure;
+	int id;
+}
+trace_push;
+
+/** \brief The closures pushed onto the stacks of a frame, indexed by depth */
+
+typedef struct
+{
+	trace_push *pushes[ 2 ];
+	int size[ 2 ];
+}
+trace_stacks;
+
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t trace_key;
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static FILE *trace_file = NULL;
+static int trace_count = 0;
+static int trace_threads = 0;
+static int64_t trace_epoch = 0;
+static char **labels = NULL;
+static int labels_count = 0;
+static int labels_size = 0;
+static int labels_base = 0;
+
+static void trace_init( )
+{
+	pthread_key_create( &trace_key, free );
+}
+
+/** Get the trace state of the calling thread.
+ *
+ * \private \memberof mlt_trace
+ * \return the state
+ */
+
+static trace_thread *get_thread( )
+{
+	trace_thread *thread;
+
+	pthread_once( &trace_once, trace_init );
+	thread = pthread_getspecific( trace_key );
+	if ( !thread )
+	{
+		thread = calloc( 1, sizeof( *thread ) );
+		pthread_mutex_lock( &trace_mutex );
+		thread->id = ++trace_threads;
+		pthread_mutex_unlock( &trace_mutex );
+		pthread_setspecific( trace_key, thread );
+	}
+	return thread;
+}
+
+/** Start writing a trace.
+ *
+ * Spans are written as they end, so the file is usable even if the process
+ * does not call mlt_trace_close(). The file is closed by mlt_factory_close().
+ * \public \memberof mlt_trace
+ * \param filename the name of the file to write
+ * \return true if there was an error
+ */
+
+int mlt_trace_open( const char *filename )
+{
+	FILE *file = filename? fopen( filename, "w" ) : NULL;
+
+	if ( !file )
+	{
+		mlt_log_error( NULL, "[trace] failed to open %s\n", filename? filename : "(null)" );
+		return 1;
+	}
+
+	mlt_trace_close( );
+	pthread_mutex_lock( &trace_mutex );
+	trace_file = file;
+	trace_count = 0;
+	trace_epoch = 0;
+	trace_epoch = mlt_trace_time( );
+	fprintf( trace_file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n" );
+	mlt_trace_enabled = 1;
+	pthread_mutex_unlock( &trace_mutex );
+
+	return 0;
+}
+
+/** Finish and close the trace file.
+ *
+ * \public \memberof mlt_trace
+ */
+
+void mlt_trace_close( )
+{
+	pthread_mutex_lock( &trace_mutex );
+	mlt_trace_enabled = 0;
+	if ( trace_file )
+	{
+		fprintf( trace_file, "\n]}\n" );
+		fclose( trace_file );
+		trace_file = NULL;
+	}
+	// Numbers are not reused by the next trace in case a service still has one.
+	labels_base += labels_count;
+	while ( labels_count > 0 )
+		free( labels[ --labels_count ] );
+	free( labels );
+	labels = NULL;
+	labels_size = 0;
+	pthread_mutex_unlock( &trace_mutex );
+}
+
+/** Get the current time for a trace.
+ *
+ * This uses a monotonic clock, so spans are not skewed when the system time
+ * is adjusted.
+ * \public \memberof mlt_trace
+ * \return microseconds since the trace was opened
+ */
+
+int64_t mlt_trace_time( )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000 - trace_epoch;
+}
+
+/** Write a string as a JSON string.
+ *
+ * \private \memberof mlt_trace
+ * \param s a string
+ */
+
+static void write_string( const char *s )
+{
+	fputc( '"', trace_file );
+	for ( ; *s; s++ )
+	{
+		if ( *s == '"' || *s == '\\' )
+			fputc( '\\', trace_file );
+		if ( (unsigned char) *s >= ' ' )
+			fputc( *s, trace_file );
+	}
+	fputc( '"', trace_file );
+}
+
+/** Record a span that ends now.
+ *
+ * \public \memberof mlt_trace
+ * \param name the name of the operation
+ * \param service the name of the service doing it (optional)
+ * \param position the frame position or -1 if not applicable
+ * \param start the time returned by mlt_trace_time() when the operation began
+ */
+
+void mlt_trace_span( const char *name, const char *service, mlt_position position, int64_t start )
+{
+	int64_t end = mlt_trace_time( );
+	trace_thread *thread = get_thread( );
+
+	pthread_mutex_lock( &trace_mutex );
+	if ( trace_file )
+	{
+		fprintf( trace_file, "%s{\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld,\"name\":",
+			trace_count++? ",\n" : "", thread->id, (long long) start, (long long) ( end - start ) );
+		write_string( service? service : name );
+		fprintf( trace_file, ",\"cat\":" );
+		write_string( name );
+		fprintf( trace_file, ",\"args\":{\"position\":%d}}", position );
+	}
+	pthread_mutex_unlock( &trace_mutex );
+}
+
+/** Get the label of a service instance.
+ *
+ * The caller must hold the trace mutex.
+ * \private \memberof mlt_trace
+ * \param id a number returned by service_id()
+ * \return the label or NULL
+ */
+
+static const char *label_of( int id )
+{
+	return id > labels_base && id <= labels_base + labels_count ? labels[ id - labels_base - 1 ] : NULL;
+}
+
+/** Get the number that identifies a service instance in the trace.
+ *
+ * The first time a service is seen, it is given the next number, which is
+ * kept in its \p _trace_id property, and a label made of its name and that
+ * number. The labels belong to the trace and are freed when it is closed.
+ * \private \memberof mlt_trace
+ * \param service a service
+ * \return a number greater than 0 or 0 on error
+ */
+
+static int service_id( mlt_service service )
+{
+	mlt_properties properties = MLT_SERVICE_PROPERTIES( service );
+	int id = mlt_properties_get_int( properties, "_trace_id" );
+
+	if ( id <= labels_base || id > labels_base + labels_count )
+	{
+		const char *name = mlt_properties_get( properties, "mlt_service" );
+		char *label;
+
+		if ( !name )
+			name = mlt_properties_get( properties, "resource" );
+		if ( !name )
+			name = "service";
+		label = malloc( strlen( name ) + 16 );
+		if ( !label )
+			return 0;
+
+		pthread_mutex_lock( &trace_mutex );
+		id = mlt_properties_get_int( properties, "_trace_id" );
+		if ( id <= labels_base || id > labels_base + labels_count )
+		{
+			if ( labels_count == labels_size )
+			{
+				labels_size = labels_size ? labels_size * 2 : 64;
+				labels = realloc( labels, labels_size * sizeof( char* ) );
+			}
+			id = labels_base + labels_count + 1;
+			sprintf( label, "%s #%d", name, id );
+			labels[ labels_count++ ] = label;
+			label = NULL;
+			mlt_properties_set_int( properties, "_trace_id", id );
+		}
+		pthread_mutex_unlock( &trace_mutex );
+		free( label );
+	}
+	return id;
+}
+
+/** Get the name of a service instance for a trace.
+ *
+ * The name is the mlt_service property or resource followed by a number
+ * that is unique to the instance for the life of the trace.
+ * \public \memberof mlt_trace
+ * \param service a service
+ * \return the name, which remains valid until the trace is closed
+ */
+
+const char *mlt_trace_service_name( mlt_service service )
+{
+	int id = service_id( service );
+	const char *name;
+
+	pthread_mutex_lock( &trace_mutex );
+	name = label_of( id );
+	pthread_mutex_unlock( &trace_mutex );
+
+	return name;
+}
+
+/** Set the service that is processing a frame on the calling thread.
+ *
+ * Closures pushed onto a frame meanwhile are attributed to the service.
+ * \public \memberof mlt_trace
+ * \param service a service or NULL
+ * \return the previous service, which should be restored by passing it back
+ */
+
+mlt_service mlt_trace_enter( mlt_service service )
+{
+	trace_thread *thread = get_thread( );
+	mlt_service previous = thread->current;
+	thread->current = service;
+	return previous;
+}
+
+static void stacks_close( trace_stacks *stacks )
+{
+	free( stacks->pushes[ 0 ] );
+	free( stacks->pushes[ 1 ] );
+	free( stacks );
+}
+
+/** Attribute a closure about to be pushed onto a frame to the current service.
+ *
+ * The service is recorded with the frame at the depth of the stack where the
+ * closure goes, so each instance of a service gets its own spans.
+ * \public \memberof mlt_trace
+ * \param frame a frame
+ * \param audio false for the image stack, true for the audio stack
+ * \param closure a get_image or get_audio function
+ */
+
+void mlt_trace_closure( mlt_frame frame, int audio, void *closure )
+{
+	trace_thread *thread = get_thread( );
+	mlt_properties properties = MLT_FRAME_PROPERTIES( frame );
+	int depth = mlt_deque_count( audio ? frame->stack_audio : frame->stack_image );
+	trace_stacks *stacks;
+	int id;
+
+	audio = !!audio;
+	if ( !thread->current || !closure )
+		return;
+	id = service_id( thread->current );
+
+	stacks = mlt_properties_get_data( properties, "_trace_stacks", NULL );
+	if ( !stacks )
+	{
+		stacks = calloc( 1, sizeof( *stacks ) );
+		if ( !stacks )
+			return;
+		mlt_properties_set_data( properties, "_trace_stacks", stacks, 0, ( mlt_destructor )stacks_close, NULL );
+	}
+	if ( depth >= stacks->size[ audio ] )
+	{
+		int size = depth + 8;
+		trace_push *pushes = realloc( stacks->pushes[ audio ], size * sizeof( trace_push ) );
+		if ( !pushes )
+			return;
+		memset( pushes + stacks->size[ audio ], 0, ( size - stacks->size[ audio ] ) * sizeof( trace_push ) );
+		stacks->pushes[ audio ] = pushes;
+		stacks->size[ audio ] = size;
+	}
+	stacks->pushes[ audio ][ depth ].closure = closure;
+	stacks->pushes[ audio ][ depth ].id = id;
+}
+
+/** Get the name of the service that pushed a closure that was just popped.
+ *
+ * \public \memberof mlt_trace
+ * \param frame a frame
+ * \param audio false for the image stack, true for the audio stack
+ * \param closure a get_image or get_audio function
+ * \return the name of the service or NULL if unknown
+ */
+
+const char *mlt_trace_closure_name( mlt_frame frame, int audio, void *closure )
+{
+	trace_stacks *stacks = mlt_properties_get_data( MLT_FRAME_PROPERTIES( frame ), "_trace_stacks", NULL );
+	int depth = mlt_deque_count( audio ? frame->stack_audio : frame->stack_image );
+	const char *name = NULL;
+
+	audio = !!audio;
+	if ( stacks && depth < stacks->size[ audio ] && stacks->pushes[ audio ][ depth ].closure == closure )
+	{
+		pthread_mutex_lock( &trace_mutex );
+		name = label_of( stacks->pushes[ audio ][ depth ].id );
+		pthread_mutex_unlock( &trace_mutex );
+	}
+
+	return name;
+}
@@ -0,0 +1,47 @@
+/**
+ * \file mlt_trace.h
+ * \brief timing of the frame pipeline
+ * \see mlt_trace_open
+ *
+ * Copyright (C) 2020 Meltytech, LLC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef MLT_TRACE_H
+#define MLT_TRACE_H
+
+#include "mlt_types.h"
+#include <stdint.h>
+
+/**
+ * \envvar \em MLT_TRACE the name of a file to which to write a trace of the
+ * frame pipeline in the Chrome trace event format, which can be loaded into
+ * chrome://tracing or Perfetto
+ */
+
+/** Whether tracing is on. Check this before calling any other trace function. */
+extern int mlt_trace_enabled;
+
+extern int mlt_trace_open( const char *filename );
+extern void mlt_trace_close( );
+extern int64_t mlt_trace_time( );
+extern void mlt_trace_span( const char *name, const char *service, mlt_position position, int64_t start );
+extern const char *mlt_trace_service_name( mlt_service service );
+extern mlt_service mlt_trace_enter( mlt_service service );
+extern void mlt_trace_closure( mlt_frame frame, int audio, void *closure );
+extern const char *mlt_trace_closure_name( mlt_frame frame, int audio, void *closure );
+
+#endif
@@ -26,11 +26,13 @@
 #include "mlt_field.h"
 #include "mlt_log.h"
 #include "mlt_transition.h"
+#include "mlt_slices.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <pthread.h>
 
 /* Forward references to static methods.
 */
@@ -351,6 +353,663 @@ mlt_producer mlt_tractor_get_track( mlt_tractor self, int index )
 	return mlt_multitrack_track( mlt_tractor_multitrack( self ), index );
 }
 
+/** The number of frames a track is rendered serially after it was found to use the track below it. */
+#define TRACK_BACKOFF (25)
+
+/** \brief A request for the image or audio of a track frame
+ *
+ * For audio, width and height hold the frequency and channels.
+ */
+
+typedef struct
+{
+	int format;
+	int width;
+	int height;
+	int writable;
+	int samples;
+	mlt_properties values;   /**< the properties that were set above the track, NULL if they cannot be repeated */
+}
+track_request;
+
+/** \brief What the track frames of a track were last asked for
+ *
+ * This is kept on the track producer. A track is only rendered ahead when
+ * its request was the same for two frames in a row.
+ */
+
+typedef struct
+{
+	int image_hits;          /**< frames in a row with the same image request, negative to back off */
+	int audio_hits;          /**< frames in a row with the same audio request, negative to back off */
+	track_request image;
+	track_request audio;
+}
+track_state;
+
+/** \brief The image or audio stack of a track frame that may be rendered ahead */
+
+typedef struct
+{
+	int marked;              /**< whether the marker is on the stack */
+	int base;                /**< the number of items the tractor put below the track's own ones */
+	mlt_properties initial;  /**< the properties before the transitions ran */
+	int rendered;            /**< whether it was rendered ahead */
+	int requested;           /**< whether the marker was reached */
+	int valid;               /**< whether the result may be used */
+	track_request request;   /**< what it was rendered for */
+	int items_count;         /**< the number of the track's own items */
+	mlt_frame clone;         /**< the frame it was rendered on */
+	mlt_properties before;   /**< the properties of the clone before it was rendered */
+	int error;
+	void *buffer;
+	int format;
+	int width;
+	int height;
+	int count;               /**< the number of samples afterwards */
+}
+track_stack;
+
+/** \brief A track frame that may be rendered ahead */
+
+typedef struct
+{
+	mlt_frame frame;
+	track_state *state;
+	mlt_properties producer; /**< the properties of the track producer */
+	track_stack image;
+	track_stack audio;
+}
+track_frame;
+
+static pthread_mutex_t track_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void track_state_close( track_state *state )
+{
+	mlt_properties_close( state->image.values );
+	mlt_properties_close( state->audio.values );
+	free( state );
+}
+
+static void track_stack_close( track_stack *stack )
+{
+	mlt_properties_close( stack->initial );
+	mlt_properties_close( stack->request.values );
+	mlt_properties_close( stack->before );
+	mlt_frame_close( stack->clone );
+}
+
+static void track_frame_close( track_frame *track )
+{
+	track_stack_close( &track->image );
+	track_stack_close( &track->audio );
+	free( track );
+}
+
+/** Copy all the properties of a frame.
+ *
+ * Data properties are referenced without being owned, so that only their
+ * pointers may be compared later.
+ * \private \memberof mlt_tractor_s
+ * \param properties the properties to copy
+ * \param to the properties to copy to, which is created if NULL
+ * \return the properties copied to
+ */
+
+static mlt_properties track_snapshot( mlt_properties properties, mlt_properties to )
+{
+	int i, count = mlt_properties_count( properties );
+	if ( !to )
+		to = mlt_properties_new( );
+	for ( i = 0; i < count; i ++ )
+	{
+		char *name = mlt_properties_get_name( properties, i );
+		if ( mlt_properties_get_value( properties, i ) )
+			mlt_properties_pass_property( to, properties, name );
+		else
+			mlt_properties_set_data( to, name, mlt_properties_get_data_at( properties, i, NULL ), 0, NULL, NULL );
+	}
+	return to;
+}
+
+/** Compare a property of two property lists.
+ *
+ * Values must be the same as strings and as numbers, and data must be the same pointer.
+ * \private \memberof mlt_tractor_s
+ */
+
+static int track_value_equal( mlt_properties a, mlt_properties b, const char *name )
+{
+	const char *x = mlt_properties_get( a, name );
+	const char *y = mlt_properties_get( b, name );
+	if ( mlt_properties_exists( a, name ) != mlt_properties_exists( b, name ) )
+		return 0;
+	if ( x || y )
+		return x && y && !strcmp( x, y ) && mlt_properties_get_double( a, name ) == mlt_properties_get_double( b, name );
+	return mlt_properties_get_data( a, name, NULL ) == mlt_properties_get_data( b, name, NULL );
+}
+
+/** Get the properties of a frame that changed since a snapshot.
+ *
+ * \private \memberof mlt_tractor_s
+ * \return the values that changed, or NULL if a data property changed
+ */
+
+static mlt_properties track_values_changed( mlt_properties initial, mlt_properties properties )
+{
+	mlt_properties changed = mlt_properties_new( );
+	int i, count = mlt_properties_count( properties );
+	for ( i = 0; i < count; i ++ )
+	{
+		char *name = mlt_properties_get_name( properties, i );
+		if ( track_value_equal( initial, properties, name ) )
+			continue;
+		if ( !mlt_properties_get_value( properties, i ) && mlt_properties_get_data_at( properties, i, NULL ) )
+		{
+			mlt_properties_close( changed );
+			return NULL;
+		}
+		mlt_properties_pass_property( changed, properties, name );
+	}
+	return changed;
+}
+
+/** Compare two sets of changed properties.
+ *
+ * \private \memberof mlt_tractor_s
+ */
+
+static int track_values_equal( mlt_properties a, mlt_properties b )
+{
+	int i, count;
+	if ( !a || !b || ( count = mlt_properties_count( a ) ) != mlt_properties_count( b ) )
+		return 0;
+	for ( i = 0; i < count; i ++ )
+		if ( !track_value_equal( a, b, mlt_properties_get_name( a, i ) ) )
+			return 0;
+	return 1;
+}
+
+/** Check whether two requests are the same, other than the number of audio samples.
+ *
+ * \private \memberof mlt_tractor_s
+ */
+
+static int track_request_equal( track_request *a, track_request *b )
+{
+	return a->format == b->format && a->width == b->width && a->height == b->height &&
+		a->writable == b->writable && track_values_equal( a->values, b->values );
+}
+
+/** Remember what a track frame was asked for.
+ *
+ * \private \memberof mlt_tractor_s
+ * \param hits the number of frames in a row with the same request
+ * \param learned the last request
+ * \param request the current request, whose values are taken
+ */
+
+static void track_learn( int *hits, track_request *learned, track_request *request )
+{
+	pthread_mutex_lock( &track_mutex );
+	if ( request->values && track_request_equal( learned, request ) )
+	{
+		if ( *hits < 2 )
+			( *hits ) ++;
+		mlt_properties_close( request->values );
+	}
+	else
+	{
+		mlt_properties_close( learned->values );
+		*learned = *request;
+		if ( *hits > 0 )
+			*hits = 0;
+		else if ( *hits < 0 )
+			( *hits ) ++;
+	}
+	request->values = NULL;
+	pthread_mutex_unlock( &track_mutex );
+}
+
+/** Check whether a track frame is asked for exactly what it was rendered for.
+ *
+ * \private \memberof mlt_tractor_s
+ */
+
+static int track_match( track_stack *stack, track_request *request )
+{
+	return stack->rendered && stack->valid && request->values &&
+		stack->request.format == request->format && stack->request.width == request->width &&
+		stack->request.height == request->height && stack->request.writable >= request->writable &&
+		stack->request.samples == request->samples && track_values_equal( stack->request.values, request->values );
+}
+
+/** Give a track frame what rendering its clone changed.
+ *
+ * The clone stays open for as long as the track frame, which references its data.
+ * \private \memberof mlt_tractor_s
+ * \param stack the stack that was rendered
+ * \param frame the track frame
+ * \param deque the stack of the track frame, whose own items the clone used up
+ */
+
+static void track_merge( track_stack *stack, mlt_frame frame, mlt_deque deque )
+{
+	mlt_properties properties = MLT_FRAME_PROPERTIES( frame );
+	mlt_properties clone_properties = MLT_FRAME_PROPERTIES( stack->clone );
+	int i, count = mlt_properties_count( clone_properties );
+
+	for ( i = 0; i < count; i ++ )
+	{
+		char *name = mlt_properties_get_name( clone_properties, i );
+		if ( track_value_equal( stack->before, clone_properties, name ) )
+			continue;
+		if ( mlt_properties_get_value( clone_properties, i ) )
+			mlt_properties_pass_property( properties, clone_properties, name );
+		else
+			mlt_properties_set_data( properties, name, mlt_properties_get_data_at( clone_properties, i, NULL ), 0, NULL, NULL );
+	}
+	frame->convert_image = stack->clone->convert_image;
+	frame->convert_audio = stack->clone->convert_audio;
+	frame->get_alpha_mask = stack->clone->get_alpha_mask;
+
+	for ( i = 0; i < stack->items_count; i ++ )
+		mlt_deque_pop_back( deque );
+}
+
+/** Count a result of a track frame that was rendered ahead and used.
+ *
+ * \private \memberof mlt_tractor_s
+ * \param track the track frame
+ */
+
+static void track_count_hit( track_frame *track )
+{
+	pthread_mutex_lock( &track_mutex );
+	mlt_properties_set_int( track->producer, "track_ahead_hits", mlt_properties_get_int( track->producer, "track_ahead_hits" ) + 1 );
+	pthread_mutex_unlock( &track_mutex );
+}
+
+/** Stand in for the track below while a track is rendered ahead.
+ *
+ * Reaching this means that the track uses the track below it, so the
+ * result is discarded.
+ * \private \memberof mlt_tractor_s
+ */
+
+static int track_stop_image( mlt_frame frame, uint8_t **image, mlt_image_format *format, int *width, int *height, int writable )
+{
+	return 1;
+}
+
+static int track_stop_audio( mlt_frame frame, void **buffer, mlt_audio_format *format, int *frequency, int *channels, int *samples )
+{
+	return 1;
+}
+
+/** Get the image of a track frame.
+ *
+ * This marks the end of the track's own stack. It returns the image that
+ * was rendered ahead if it was rendered for exactly this request, or runs
+ * the track's own stack otherwise, which rendering ahead left untouched.
+ * \private \memberof mlt_tractor_s
+ */
+
+static int track_get_image( mlt_frame frame, uint8_t **image, mlt_image_format *format, int *width, int *height, int writable )
+{
+	track_frame *track = mlt_frame_pop_service( frame );
+	track_stack *stack = &track->image;
+	mlt_properties properties = MLT_FRAME_PROPERTIES( frame );
+	track_request request;
+
+	stack->requested = 1;
+
+	// mlt_frame_get_image() counted this marker as one of the frame's images.
+	mlt_properties_set_int( properties, "image_count", mlt_properties_get_int( properties, "image_count" ) + 1 );
+
+	memset( &request, 0, sizeof( request ) );
+	request.format = *format;
+	request.width = *width;
+	request.height = *height;
+	request.writable = writable;
+	request.values = track_values_changed( stack->initial, properties );
+
+	if ( track_match( stack, &request ) )
+	{
+		track_learn( &track->state->image_hits, &track->state->image, &request );
+		track_merge( stack, frame, MLT_FRAME_IMAGE_STACK( frame ) );
+		track_count_hit( track );
+		*image = stack->buffer;
+		*format = stack->format;
+		*width = stack->width;
+		*height = stack->height;
+		return stack->error;
+	}
+
+	track_learn( &track->state->image_hits, &track->state->image, &request );
+	return mlt_frame_get_image( frame, image, format, width, height, writable );
+}
+
+/** Get the audio of a track frame.
+ *
+ * \see track_get_image
+ * \private \memberof mlt_tractor_s
+ */
+
+static int track_get_audio( mlt_frame frame, void **buffer, mlt_audio_format *format, int *frequency, int *channels, int *samples )
+{
+	track_frame *track = mlt_frame_pop_audio( frame );
+	track_stack *stack = &track->audio;
+	track_request request;
+
+	stack->requested = 1;
+
+	memset( &request, 0, sizeof( request ) );
+	request.format = *format;
+	request.width = *frequency;
+	request.height = *channels;
+	request.samples = *samples;
+	request.values = track_values_changed( stack->initial, MLT_FRAME_PROPERTIES( frame ) );
+
+	if ( track_match( stack, &request ) )
+	{
+		track_learn( &track->state->audio_hits, &track->state->audio, &request );
+		track_merge( stack, frame, MLT_FRAME_AUDIO_STACK( frame ) );
+		track_count_hit( track );
+		*buffer = stack->buffer;
+		*format = stack->format;
+		*frequency = stack->width;
+		*channels = stack->height;
+		*samples = stack->count;
+		return stack->error;
+	}
+
+	track_learn( &track->state->audio_hits, &track->state->audio, &request );
+	return mlt_frame_get_audio( frame, buffer, format, frequency, channels, samples );
+}
+
+/** Put a marker at the end of the track's own items on a stack of a track frame.
+ *
+ * \private \memberof mlt_tractor_s
+ * \param deque the image or audio stack
+ * \param depth the number of items the track put on it
+ * \param track the track frame
+ * \param marker track_get_image() or track_get_audio()
+ * \return true if the marker was inserted
+ */
+
+static int track_insert_marker( mlt_deque deque, int depth, track_frame *track, void *marker )
+{
+	int above = mlt_deque_count( deque ) - depth;
+	void **lifted = NULL;
+	int i;
+
+	if ( depth <= 0 || above < 0 )
+		return 0;
+	if ( above > 0 )
+	{
+		lifted = malloc( above * sizeof( void* ) );
+		for ( i = above - 1; i >= 0; i -- )
+			lifted[ i ] = mlt_deque_pop_back( deque );
+	}
+	mlt_deque_push_back( deque, track );
+	mlt_deque_push_back( deque, marker );
+	for ( i = 0; i < above; i ++ )
+		mlt_deque_push_back( deque, lifted[ i ] );
+	free( lifted );
+	return 1;
+}
+
+/** Prepare a harvested track frame to be rendered ahead.
+ *
+ * Only the tracks whose producer sets \em track_ahead are rendered ahead,
+ * and only if the multitrack found all of the frame's services to be safe.
+ * \private \memberof mlt_tractor_s
+ * \param self the tractor frame
+ * \param frame the track frame
+ * \param track_producer the producer of the track
+ * \param image_base the number of items the tractor is about to put below the track's own image items
+ * \param audio_base the number of items the tractor is about to put below the track's own audio items
+ */
+
+static void track_mark( mlt_frame self, mlt_frame frame, mlt_producer track_producer, int image_base, int audio_base )
+{
+	mlt_properties properties = MLT_FRAME_PROPERTIES( frame );
+	mlt_properties self_properties = MLT_FRAME_PROPERTIES( self );
+	mlt_properties producer_properties = MLT_PRODUCER_PROPERTIES( track_producer );
+	int image_depth = mlt_properties_get_int( properties, "_track_image_depth" );
+	int audio_depth = mlt_properties_get_int( properties, "_track_audio_depth" );
+	mlt_deque frames = mlt_properties_get_data( self_properties, "_track_frames", NULL );
+	track_frame *track;
+
+	// A track of only filters processes the track below it.
+	if ( !track_producer || !mlt_properties_get_int( producer_properties, "track_ahead" ) ||
+		 ( image_depth <= 0 && audio_depth <= 0 ) || mlt_properties_get_int( properties, "fx_cut" ) )
+		return;
+
+	track = calloc( 1, sizeof( track_frame ) );
+	track->frame = frame;
+	track->producer = producer_properties;
+	pthread_mutex_lock( &track_mutex );
+	track->state = mlt_properties_get_data( producer_properties, "_track_state", NULL );
+	if ( !track->state )
+	{
+		track->state = calloc( 1, sizeof( track_state ) );
+		mlt_properties_set_data( producer_properties, "_track_state", track->state, 0, ( mlt_destructor )track_state_close, NULL );
+	}
+	pthread_mutex_unlock( &track_mutex );
+	mlt_properties_set_data( properties, "_track_frame", track, 0, ( mlt_destructor )track_frame_close, NULL );
+
+	track->image.marked = track_insert_marker( MLT_FRAME_IMAGE_STACK( frame ), image_depth, track, track_get_image );
+	if ( track->image.marked )
+	{
+		track->image.base = image_base;
+		track->image.initial = track_snapshot( properties, NULL );
+	}
+	track->audio.marked = track_insert_marker( MLT_FRAME_AUDIO_STACK( frame ), audio_depth, track, track_get_audio );
+	if ( track->audio.marked )
+	{
+		track->audio.base = audio_base;
+		track->audio.initial = track_snapshot( properties, NULL );
+	}
+
+	if ( !frames )
+	{
+		frames = mlt_deque_init( );
+		mlt_properties_set_data( self_properties, "_track_frames", frames, 0, ( mlt_destructor )mlt_deque_close, NULL );
+	}
+	mlt_deque_push_back( frames, track );
+}
+
+/** Render the track's own stack of a track frame ahead.
+ *
+ * The track's own items run on a clone of the track frame with the request
+ * learned from previous frames, so the track frame is left as it was until
+ * the result turns out to be the one it is asked for.
+ * \private \memberof mlt_tractor_s
+ * \param track the track frame
+ * \param audio whether to render audio instead of the image
+ * \param samples the number of audio samples
+ */
+
+static void track_render( track_frame *track, int audio, int samples )
+{
+	mlt_frame frame = track->frame;
+	track_stack *stack = audio ? &track->audio : &track->image;
+	mlt_deque deque = audio ? MLT_FRAME_AUDIO_STACK( frame ) : MLT_FRAME_IMAGE_STACK( frame );
+	void *marker = audio ? ( void* )track_get_audio : ( void* )track_get_image;
+	void *stop = audio ? ( void* )track_stop_audio : ( void* )track_stop_image;
+	track_request *learned = audio ? &track->state->audio : &track->state->image;
+	int *hits = audio ? &track->state->audio_hits : &track->state->image_hits;
+	int count = mlt_deque_count( deque );
+	mlt_properties clone_properties;
+	mlt_deque clone_deque;
+	int i, m;
+
+	// Find the marker, which is gone if the image was already requested.
+	for ( m = count - 1; m > 0; m -- )
+		if ( mlt_deque_peek( deque, m ) == marker && mlt_deque_peek( deque, m - 1 ) == track )
+			break;
+	if ( m <= 0 || stack->base > 2 || m - 1 < stack->base )
+		return;
+
+	pthread_mutex_lock( &track_mutex );
+	if ( *hits < 1 || !learned->values )
+	{
+		pthread_mutex_unlock( &track_mutex );
+		return;
+	}
+	stack->request = *learned;
+	stack->request.samples = samples;
+	stack->request.values = mlt_properties_new( );
+	track_snapshot( learned->values, stack->request.values );
+	pthread_mutex_unlock( &track_mutex );
+
+	// Copy the frame, with the properties that were set above the track before, and the track's own items.
+	stack->clone = mlt_frame_init( NULL );
+	clone_properties = MLT_FRAME_PROPERTIES( stack->clone );
+	clone_deque = audio ? MLT_FRAME_AUDIO_STACK( stack->clone ) : MLT_FRAME_IMAGE_STACK( stack->clone );
+	track_snapshot( stack->initial, clone_properties );
+	track_snapshot( stack->request.values, clone_properties );
+	stack->clone->convert_image = frame->convert_image;
+	stack->clone->convert_audio = frame->convert_audio;
+	stack->clone->get_alpha_mask = frame->get_alpha_mask;
+	if ( stack->base )
+		mlt_deque_push_back( clone_deque, stop );
+	stack->items_count = m - 1 - stack->base;
+	for ( i = 0; i < stack->items_count; i ++ )
+		mlt_deque_push_back( clone_deque, mlt_deque_peek( deque, stack->base + i ) );
+	stack->before = track_snapshot( clone_properties, NULL );
+
+	stack->width = stack->request.width;
+	stack->height = stack->request.height;
+	if ( audio )
+	{
+		mlt_audio_format format = stack->request.format;
+		stack->count = stack->request.samples;
+		stack->error = mlt_frame_get_audio( stack->clone, &stack->buffer, &format, &stack->width, &stack->height, &stack->count );
+		stack->format = format;
+	}
+	else
+	{
+		mlt_image_format format = stack->request.format;
+		uint8_t *image = NULL;
+		stack->error = mlt_frame_get_image( stack->clone, &image, &format, &stack->width, &stack->height, stack->request.writable );
+		stack->buffer = image;
+		stack->format = format;
+	}
+	stack->rendered = 1;
+
+	// Reaching the track below makes the result unusable.
+	stack->valid = !stack->base || ( mlt_deque_count( clone_deque ) > 0 && mlt_deque_peek_front( clone_deque ) == stop );
+	if ( !stack->valid )
+	{
+		pthread_mutex_lock( &track_mutex );
+		*hits = -TRACK_BACKOFF;
+		pthread_mutex_unlock( &track_mutex );
+	}
+}
+
+/** \brief The track frames being rendered ahead */
+
+typedef struct
+{
+	track_frame **tracks;
+	int count;
+	int audio;
+	int samples;
+}
+track_job;
+
+static int track_render_slice( int id, int idx, int jobs, void *cookie )
+{
+	track_job *job = cookie;
+	int i;
+	for ( i = idx; i < job->count; i += jobs )
+		track_render( job->tracks[ i ], job->audio, job->samples );
+	return 0;
+}
+
+/** Render the tracks of a tractor frame ahead and concurrently.
+ *
+ * \private \memberof mlt_tractor_s
+ * \param self the tractor frame
+ * \param audio whether to render audio instead of images
+ * \param samples the number of audio samples requested
+ */
+
+static void track_render_all( mlt_frame self, int audio, int samples )
+{
+	mlt_properties properties = MLT_FRAME_PROPERTIES( self );
+	mlt_deque frames = mlt_properties_get_data( properties, "_track_frames", NULL );
+	int threads = mlt_properties_get_int( properties, "_track_threads" );
+	int count = frames ? mlt_deque_count( frames ) : 0;
+	track_job job;
+	int i;
+
+	if ( !count || threads < 1 )
+		return;
+
+	job.tracks = malloc( count * sizeof( track_frame* ) );
+	job.count = 0;
+	job.audio = audio;
+	job.samples = samples;
+	for ( i = 0; i < count; i ++ )
+	{
+		track_frame *track = mlt_deque_peek( frames, i );
+		track_stack *stack = audio ? &track->audio : &track->image;
+		int hits;
+
+		if ( !stack->marked || stack->rendered || stack->requested )
+			continue;
+
+		// What is set from here on counts as set above the track, including
+		// what this tractor just set on its top frame.
+		mlt_properties_close( stack->initial );
+		stack->initial = track_snapshot( MLT_FRAME_PROPERTIES( track->frame ), NULL );
+
+		pthread_mutex_lock( &track_mutex );
+		hits = audio ? track->state->audio_hits : track->state->image_hits;
+		pthread_mutex_unlock( &track_mutex );
+		if ( hits >= 1 )
+			job.tracks[ job.count ++ ] = track;
+	}
+
+	if ( job.count > 1 )
+		mlt_slices_run_normal( MIN( threads, job.count ), track_render_slice, &job );
+	free( job.tracks );
+}
+
+/** Stop rendering ahead the tracks that were not asked for.
+ *
+ * A transition may not need a track at all, for example when the track
+ * above it hides it, so rendering it ahead would only waste time.
+ * \private \memberof mlt_tractor_s
+ * \param self the tractor frame
+ * \param audio whether to check audio instead of images
+ */
+
+static void track_render_unused( mlt_frame self, int audio )
+{
+	mlt_deque frames = mlt_properties_get_data( MLT_FRAME_PROPERTIES( self ), "_track_frames", NULL );
+	int i, count = frames ? mlt_deque_count( frames ) : 0;
+
+	for ( i = 0; i < count; i ++ )
+	{
+		track_frame *track = mlt_deque_peek( frames, i );
+		track_stack *stack = audio ? &track->audio : &track->image;
+		int *hits = audio ? &track->state->audio_hits : &track->state->image_hits;
+
+		if ( stack->rendered && !stack->requested )
+		{
+			pthread_mutex_lock( &track_mutex );
+			if ( *hits > 0 )
+				*hits = 0;
+			pthread_mutex_unlock( &track_mutex );
+		}
+	}
+}
+
 static int producer_get_image( mlt_frame self, uint8_t **buffer, mlt_image_format *format, int *width, int *height, int writable )
 {
 	uint8_t *data = NULL;
@@ -368,7 +1027,9 @@ static int producer_get_image( mlt_frame self, uint8_t **buffer, mlt_image_forma
 	// WebVfx uses this to setup a consumer-stopping event handler.
 	mlt_properties_set_data( frame_properties, "consumer", mlt_properties_get_data( properties, "consumer", NULL ), 0, NULL, NULL );
 
+	track_render_all( self, 0, 0 );
 	mlt_frame_get_image( frame, buffer, format, width, height, writable );
+	track_render_unused( self, 0 );
 	mlt_frame_set_image( self, *buffer, 0, NULL );
 
 	mlt_properties_set_int( properties, "width", *width );
@@ -399,12 +1060,17 @@ static int producer_get_image( mlt_frame self, uint8_t **buffer, mlt_image_forma
 		}
 	}
 
-	data = mlt_frame_get_alpha( frame );
+	int alpha_value = mlt_frame_get_alpha_value( frame );
+	data = alpha_value < 0 ? mlt_frame_get_alpha( frame ) : NULL;
 	if ( data )
 	{
 		mlt_properties_get_data( frame_properties, "alpha", &size );
 		mlt_frame_set_alpha( self, data, size, NULL );
-	};
+	}
+	else if ( alpha_value >= 0 && alpha_value < 255 )
+	{
+		mlt_frame_set_alpha_value( self, alpha_value );
+	}
 	self->convert_image = frame->convert_image;
 	self->convert_audio = frame->convert_audio;
 	return 0;
@@ -417,7 +1083,9 @@ static int producer_get_audio( mlt_frame self, void **buffer, mlt_audio_format *
 	mlt_properties frame_properties = MLT_FRAME_PROPERTIES( frame );
 	mlt_properties_set( frame_properties, "consumer_channel_layout", mlt_properties_get( properties, "consumer_channel_layout" ) );
 	mlt_properties_set( frame_properties, "producer_consumer_fps", mlt_properties_get( properties, "producer_consumer_fps" ) );
+	track_render_all( self, 1, *samples );
 	mlt_frame_get_audio( frame, buffer, format, frequency, channels, samples );
+	track_render_unused( self, 1 );
 	mlt_frame_set_audio( self, *buffer, *format, mlt_audio_format_size( *format, *samples, *channels ), NULL );
 	mlt_properties_set_int( properties, "audio_frequency", *frequency );
 	mlt_properties_set_int( properties, "audio_channels", *channels );
@@ -475,6 +1143,9 @@ static int producer_get_frame( mlt_producer parent, mlt_frame_ptr frame, int tra
 		// Determine whether this tractor feeds to the consumer or stops here
 		int global_feed = mlt_properties_get_int( properties, "global_feed" );
 
+		// Determine whether to render the tracks concurrently
+		int track_threads = mlt_properties_get_int( properties, "track_threads" );
+
 		// If we don't have one, we're in trouble...
 		if ( multitrack != NULL )
 		{
@@ -507,11 +1178,17 @@ static int producer_get_frame( mlt_producer parent, mlt_frame_ptr frame, int tra
 			mlt_producer_seek( target, mlt_producer_frame( parent ) );
 			mlt_producer_set_speed( target, mlt_producer_get_speed( parent ) );
 
+			// Ask the multitrack to note where the processing of each track ends
+			if ( mlt_properties_get_int( MLT_PRODUCER_PROPERTIES( target ), "_track_threads" ) != track_threads )
+				mlt_properties_set_int( MLT_PRODUCER_PROPERTIES( target ), "_track_threads", track_threads );
+
 			// We will create one frame and attach everything to it
 			*frame = mlt_frame_init( MLT_PRODUCER_SERVICE( parent ) );
 
 			// Get the properties of the frame
 			frame_properties = MLT_FRAME_PROPERTIES( *frame );
+			if ( track_threads > 0 )
+				mlt_properties_set_int( frame_properties, "_track_threads", track_threads );
 
 			// Loop through each of the tracks we're harvesting
 			for ( i = 0; !done; i ++ )
@@ -584,6 +1261,16 @@ static int producer_get_frame( mlt_producer parent, mlt_frame_ptr frame, int tra
 					}
 				}
 
+				// Prepare the track's own processing to run ahead, noting which
+				// track frames will have the previous one put below them
+				if ( track_threads > 0 && !done )
+				{
+					int hide = mlt_properties_get_int( temp_properties, "hide" );
+					int image_base = video && !mlt_frame_is_test_card( temp ) && !( hide & 1 ) ? 2 : 0;
+					int audio_base = audio && !mlt_frame_is_test_audio( temp ) && !( hide & 2 ) ? 2 : 0;
+					track_mark( *frame, temp, mlt_multitrack_track( multitrack, i ), image_base, audio_base );
+				}
+
 				// Pick up first video and audio frames
 				if ( !done && !mlt_frame_is_test_audio( temp ) && !( mlt_properties_get_int( temp_properties, "hide" ) & 2 ) )
 				{
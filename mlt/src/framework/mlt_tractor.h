@@ -37,6 +37,14 @@
  * \properties \em global_feed a flag to indicate whether this tractor feeds to the consumer or stops here
  * \properties \em global_queue is something for the data_feed functionality in the core module
  * \properties \em data_queue is something for the data_feed functionality in the core module
+ * \properties \em track_threads the number of tracks to render concurrently ahead of the transitions, 0 (default) to disable
+ *
+ * Only the tracks whose producer sets \em track_ahead are rendered ahead. A
+ * track that is asked for something other than what it was rendered for runs
+ * its filters and producers again. So a frame of a track is rendered serially
+ * unless every producer and filter that made it sets \em _track_ahead_safe to
+ * declare that it can do that. The producer of a track counts the images and
+ * audio that were rendered ahead and used in \em track_ahead_hits.
  */
 
 struct mlt_tractor_s
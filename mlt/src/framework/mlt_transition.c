@@ -24,6 +24,7 @@
 #include "mlt_frame.h"
 #include "mlt_log.h"
 #include "mlt_producer.h"
+#include "mlt_trace.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -320,6 +321,14 @@ mlt_frame mlt_transition_process( mlt_transition self, mlt_frame a_frame, mlt_fr
 {
 	if ( self->process == NULL )
 		return a_frame;
+	else if ( mlt_trace_enabled )
+	{
+		// Attribute the closures the transition pushes to it.
+		mlt_service previous = mlt_trace_enter( MLT_TRANSITION_SERVICE( self ) );
+		a_frame = self->process( self, a_frame, b_frame );
+		mlt_trace_enter( previous );
+		return a_frame;
+	}
 	else
 		return self->process( self, a_frame, b_frame );
 }
@@ -527,6 +527,7 @@ static void show_usage( char *program_name )
 "  -split relative-frame                    Split the last cut into two cuts\n"
 "  -swap                                    Rearrange the last two cuts\n"
 "  -track                                   Add a track\n"
+"  -trace filename                          Write a Chrome trace of frame processing\n"
 "  -transition id[:arg] [name=value]*       Add a transition\n"
 "  -verbose                                 Set the logging level to verbose\n"
 "  -timings                                 Set the logging level to timings\n"
@@ -872,6 +873,11 @@ query_all:
 		{
 			mlt_log_set_level( MLT_LOG_TIMINGS );
 		}
+		else if ( !strcmp( argv[ i ], "-trace" ) )
+		{
+			if ( i+1 < argc && argv[i+1][0] != '-' )
+				mlt_trace_open( argv[++i] );
+		}
 		else if ( !strcmp( argv[ i ], "-version" ) || !strcmp( argv[ i ], "--version" ) )
 		{
 			fprintf( stdout, "%s " VERSION "\n"
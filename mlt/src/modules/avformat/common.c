@@ -23,6 +23,16 @@
 #include <libavutil/pixdesc.h>
 #include <libavutil/samplefmt.h>
 
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+
 int mlt_get_sws_flags(int srcwidth, int srcheight, int srcformat, int dstwidth, int dstheight, int dstformat)
 {
 	// Use default flags unless there is a reason to use something different.
@@ -236,3 +246,151 @@ int mlt_set_luma_transfer( struct SwsContext *context, int src_colorspace,
 	return sws_setColorspaceDetails( context, src_coefficients, src_range, dst_coefficients, dst_range,
 		brightness, contrast, saturation );
 }
+
+/** Create a directory and its parents.
+*/
+
+static int make_directory( char *path )
+{
+	char *slash;
+
+	for ( slash = strchr( path + 1, '/' ); ; slash = strchr( slash + 1, '/' ) )
+	{
+		if ( slash )
+			*slash = '\0';
+#ifdef _WIN32
+		int error = mkdir( path ) && errno != EEXIST;
+#else
+		int error = mkdir( path, 0755 ) && errno != EEXIST;
+#endif
+		if ( slash )
+			*slash = '/';
+		if ( error )
+			return 1;
+		if ( !slash )
+			return 0;
+	}
+}
+
+/** Get the avformat cache directory of a kind of file and create it as needed.
+
+	The directory is MLT_AVFORMAT_CACHE_DIR or else mlt/avformat under the XDG cache directory.
+*/
+
+static int cache_directory( const char *kind, char *dir, size_t size )
+{
+	const char *base = getenv( "MLT_AVFORMAT_CACHE_DIR" );
+
+	if ( base && base[0] )
+		snprintf( dir, size, "%s/%s", base, kind );
+	else if ( getenv( "XDG_CACHE_HOME" ) && getenv( "XDG_CACHE_HOME" )[0] )
+		snprintf( dir, size, "%s/mlt/avformat/%s", getenv( "XDG_CACHE_HOME" ), kind );
+	else if ( getenv( "HOME" ) && getenv( "HOME" )[0] )
+		snprintf( dir, size, "%s/.cache/mlt/avformat/%s", getenv( "HOME" ), kind );
+	else
+		return 1;
+	return make_directory( dir );
+}
+
+/** Get the name of a file in the avformat cache directory that belongs to a media file.
+
+	The name is derived from the full path, size, and modification time of the media file,
+	so a changed file gets a new cache file. The directory is MLT_AVFORMAT_CACHE_DIR or else
+	mlt/avformat under the XDG cache directory, and it is created as needed.
+	Returns nonzero if the resource is not a local file or the directory is not available.
+*/
+
+int mlt_avformat_cache_file( const char *resource, const char *kind, char *path, size_t size )
+{
+	struct stat info;
+	char full[ PATH_MAX ];
+	char dir[ PATH_MAX ];
+	uint64_t hash = 14695981039346656037ULL;
+	const char *c;
+
+	if ( !resource || stat( resource, &info ) || !S_ISREG( info.st_mode ) )
+		return 1;
+#ifdef _WIN32
+	snprintf( full, sizeof( full ), "%s", resource );
+#else
+	if ( !realpath( resource, full ) )
+		return 1;
+#endif
+
+	if ( cache_directory( kind, dir, sizeof( dir ) ) )
+		return 1;
+
+	// FNV-1a of the path, size, and modification time
+	snprintf( full + strlen( full ), sizeof( full ) - strlen( full ), "\n%" PRId64 "\n%" PRId64,
+		(int64_t) info.st_size, (int64_t) info.st_mtime );
+	for ( c = full; *c; c++ )
+	{
+		hash ^= (unsigned char) *c;
+		hash *= 1099511628211ULL;
+	}
+	snprintf( path, size, "%s/%016" PRIx64, dir, hash );
+
+	return 0;
+}
+
+typedef struct
+{
+	char name[ 32 ];
+	time_t mtime;
+} cache_entry;
+
+static int compare_cache_entries( const void *a, const void *b )
+{
+	const cache_entry *x = a, *y = b;
+	return x->mtime < y->mtime ? -1 : x->mtime > y->mtime;
+}
+
+/** Remove the least recently written files of a kind from the avformat cache directory.
+
+	The cache files of media that changed or moved are never used again, so
+	this keeps at most max_files of them.
+*/
+
+void mlt_avformat_cache_trim( const char *kind, int max_files )
+{
+	char dir[ PATH_MAX ];
+	char path[ PATH_MAX ];
+	cache_entry *entries = NULL;
+	int count = 0, size = 0, i;
+	struct dirent *entry;
+	struct stat info;
+	DIR *d;
+
+	if ( cache_directory( kind, dir, sizeof( dir ) ) || !( d = opendir( dir ) ) )
+		return;
+	while ( ( entry = readdir( d ) ) )
+	{
+		if ( entry->d_name[0] == '.' || strlen( entry->d_name ) >= sizeof( entries->name ) )
+			continue;
+		snprintf( path, sizeof( path ), "%s/%s", dir, entry->d_name );
+		if ( stat( path, &info ) || !S_ISREG( info.st_mode ) )
+			continue;
+		if ( count == size )
+		{
+			cache_entry *bigger = realloc( entries, ( size ? size * 2 : 256 ) * sizeof( *entries ) );
+			if ( !bigger )
+				break;
+			entries = bigger;
+			size = size ? size * 2 : 256;
+		}
+		strcpy( entries[ count ].name, entry->d_name );
+		entries[ count++ ].mtime = info.st_mtime;
+	}
+	closedir( d );
+
+	if ( count > max_files )
+	{
+		qsort( entries, count, sizeof( *entries ), compare_cache_entries );
+		for ( i = 0; i < count - max_files; i++ )
+		{
+			snprintf( path, sizeof( path ), "%s/%s", dir, entries[i].name );
+			remove( path );
+		}
+	}
+	free( entries );
+}
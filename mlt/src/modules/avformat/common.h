@@ -30,5 +30,7 @@ mlt_channel_layout mlt_get_channel_layout_or_default( const char* name, int chan
 int mlt_set_luma_transfer( struct SwsContext *context, int src_colorspace,
 	int dst_colorspace, int src_full_range, int dst_full_range );
 int mlt_get_sws_flags(int srcwidth, int srcheight, int srcformat, int dstwidth, int dstheight, int dstformat);
+int mlt_avformat_cache_file( const char *resource, const char *kind, char *path, size_t size );
+void mlt_avformat_cache_trim( const char *kind, int max_files );
 
 #endif // COMMON_H
@@ -43,6 +43,7 @@
 #include <libavutil/mathematics.h>
 #include <libavutil/samplefmt.h>
 #include <libavutil/opt.h>
+#include <libavutil/cpu.h>
 #include <libavutil/imgutils.h>
 #include <libavutil/version.h>
 #ifdef AVFILTER
@@ -218,6 +219,7 @@ static int consumer_start( mlt_consumer consumer );
 static int consumer_stop( mlt_consumer consumer );
 static int consumer_is_stopped( mlt_consumer consumer );
 static void *consumer_thread( void *arg );
+static void *segments_thread( void *arg );
 static void consumer_close( mlt_consumer consumer );
 
 /** Initialise the consumer.
@@ -325,6 +327,24 @@ static void color_trc_from_colorspace( mlt_properties properties )
 	}
 }
 
+static int colorspace_to_avcol( int colorspace, int height, int other )
+{
+	switch ( colorspace )
+	{
+	case 170:
+		return AVCOL_SPC_SMPTE170M;
+	case 240:
+		return AVCOL_SPC_SMPTE240M;
+	case 470:
+		return AVCOL_SPC_BT470BG;
+	case 601:
+		return ( 576 % height ) ? AVCOL_SPC_SMPTE170M : AVCOL_SPC_BT470BG;
+	case 709:
+		return AVCOL_SPC_BT709;
+	}
+	return other;
+}
+
 static void color_primaries_from_colorspace( mlt_properties properties )
 {
 	// Default color transfer characteristic from colorspace.
@@ -508,11 +528,14 @@ static int consumer_start( mlt_consumer consumer )
 		// Assign the thread to properties
 		mlt_properties_set_data( properties, "thread", thread, sizeof( pthread_t ), free, NULL );
 
-		// Create the thread
-		pthread_create( thread, NULL, consumer_thread, consumer );
-
 		// Set the running state
 		mlt_properties_set_int( properties, "running", 1 );
+
+		// Create the thread
+		if ( mlt_properties_get_int( properties, "segments" ) > 1 || mlt_properties_get_int( properties, "smart_render" ) )
+			pthread_create( thread, NULL, segments_thread, consumer );
+		else
+			pthread_create( thread, NULL, consumer_thread, consumer );
 	}
 	return error;
 }
@@ -929,24 +952,7 @@ static AVStream *add_video_stream( mlt_consumer consumer, AVFormatContext *oc, A
 		}
 #endif
 
-		switch ( colorspace )
-		{
-		case 170:
-			c->colorspace = AVCOL_SPC_SMPTE170M;
-			break;
-		case 240:
-			c->colorspace = AVCOL_SPC_SMPTE240M;
-			break;
-		case 470:
-			c->colorspace = AVCOL_SPC_BT470BG;
-			break;
-		case 601:
-			c->colorspace = ( 576 % c->height ) ? AVCOL_SPC_SMPTE170M : AVCOL_SPC_BT470BG;
-			break;
-		case 709:
-			c->colorspace = AVCOL_SPC_BT709;
-			break;
-		}
+		c->colorspace = colorspace_to_avcol( colorspace, c->height, c->colorspace );
 
 		if ( mlt_properties_get( properties, "aspect" ) )
 		{
@@ -1120,6 +1126,67 @@ static AVFrame *alloc_picture( int pix_fmt, int width, int height )
 	return picture;
 }
 
+/** Convert the image of a frame to the pixel format of a video AVFrame.
+*/
+
+static void convert_image( mlt_properties properties, mlt_frame frame, uint8_t *image, mlt_image_format img_fmt,
+	int width, int height, AVFrame *avframe, int dst_colorspace, int dst_full_range )
+{
+	mlt_properties frame_properties = MLT_FRAME_PROPERTIES( frame );
+	AVFrame video_avframe;
+	int pix_fmt = avframe->format;
+	int i;
+
+	mlt_image_format_planes( img_fmt, width, height, image, video_avframe.data, video_avframe.linesize );
+
+	// Do the colour space conversion
+	int srcfmt = pick_pix_fmt( img_fmt );
+	int flags = mlt_get_sws_flags( width, height, srcfmt, width, height, pix_fmt);
+	struct SwsContext *context = sws_getContext( width, height, srcfmt,
+		width, height, pix_fmt, flags, NULL, NULL, NULL);
+	int src_colorspace = mlt_properties_get_int( frame_properties, "colorspace" );
+	int src_full_range = mlt_properties_get_int( frame_properties, "full_luma" );
+	if ( (src_colorspace && dst_colorspace != src_colorspace) || dst_full_range != src_full_range )
+		mlt_set_luma_transfer( context, src_colorspace, dst_colorspace, src_full_range, dst_full_range );
+	sws_scale( context, (const uint8_t* const*) video_avframe.data, video_avframe.linesize, 0, height,
+		avframe->data, avframe->linesize);
+	sws_freeContext( context );
+
+	mlt_events_fire( properties, "consumer-frame-show", frame, NULL );
+
+	// Apply the alpha if applicable
+	if ( !mlt_properties_get( properties, "mlt_image_format" ) ||
+	     strcmp( mlt_properties_get( properties, "mlt_image_format" ), "rgb24a" ) )
+	if ( pix_fmt == AV_PIX_FMT_RGBA ||
+	     pix_fmt == AV_PIX_FMT_ARGB ||
+	     pix_fmt == AV_PIX_FMT_BGRA )
+	{
+		uint8_t *p;
+		uint8_t *alpha = mlt_frame_get_alpha_mask( frame );
+		register int n;
+
+		for ( i = 0; i < height; i ++ )
+		{
+			n = ( width + 7 ) / 8;
+			p = avframe->data[ 0 ] + i * avframe->linesize[ 0 ] + 3;
+
+			switch( width % 8 )
+			{
+				case 0:	do { *p = *alpha++; p += 4;
+				case 7:		 *p = *alpha++; p += 4;
+				case 6:		 *p = *alpha++; p += 4;
+				case 5:		 *p = *alpha++; p += 4;
+				case 4:		 *p = *alpha++; p += 4;
+				case 3:		 *p = *alpha++; p += 4;
+				case 2:		 *p = *alpha++; p += 4;
+				case 1:		 *p = *alpha++; p += 4;
+						}
+						while( --n );
+			}
+		}
+	}
+}
+
 static int open_video( mlt_properties properties, AVFormatContext *oc, AVStream *st, const char *codec_name )
 {
 	// Get the codec
@@ -1239,9 +1306,75 @@ typedef struct encode_ctx_desc
 	AVFrame *audio_avframe;
 } encode_ctx_t;
 
-static int encode_audio(encode_ctx_t* ctx)
+/** Extract the channels of an output audio stream according to the channel mapping.
+*/
+
+static void remap_audio( encode_ctx_t* ctx, int i, int *j, int samples, uint8_t *src, uint8_t *dest )
 {
 	char key[27];
+	int dest_offset = 0; // channel offset into interleaved dest buffer
+
+	// Get the number of channels for this stream
+	sprintf( key, "channels.%d", i );
+	int current_channels = mlt_properties_get_int( ctx->properties, key );
+
+	// Clear the destination audio buffer.
+	memset( dest, 0, AUDIO_ENCODE_BUFFER_SIZE );
+
+	// For each output channel
+	while ( dest_offset < current_channels && *j < ctx->total_channels )
+	{
+		int map_start = -1, map_channels = 0;
+		int source_offset = 0;
+		int k;
+
+		// Look for a mapping that starts at j
+		for ( k = 0; k < (MAX_AUDIO_STREAMS * 2) && map_start != *j; k++ )
+		{
+			sprintf( key, "%d.channels", k );
+			map_channels = mlt_properties_get_int( ctx->frame_meta_properties, key );
+			sprintf( key, "%d.start", k );
+			if ( mlt_properties_get( ctx->frame_meta_properties, key ) )
+				map_start = mlt_properties_get_int( ctx->frame_meta_properties, key );
+			if ( map_start != *j )
+				source_offset += map_channels;
+		}
+
+		// If no mapping
+		if ( map_start != *j )
+		{
+			map_channels = current_channels;
+			source_offset = *j;
+		}
+
+		// Copy samples if source offset valid
+		if ( source_offset < ctx->channels )
+		{
+			// Interleave the audio buffer with the # channels for this stream/mapping.
+			for ( k = 0; k < map_channels; k++, (*j)++, source_offset++, dest_offset++ )
+			{
+				uint8_t *in = src + source_offset * ctx->sample_bytes;
+				uint8_t *out = dest + dest_offset * ctx->sample_bytes;
+				int s = samples + 1;
+
+				while ( --s ) {
+					memcpy( out, in, ctx->sample_bytes );
+					out += current_channels * ctx->sample_bytes;
+					in += ctx->channels * ctx->sample_bytes;
+				}
+			}
+		}
+		// Otherwise silence
+		else
+		{
+			*j += current_channels;
+			dest_offset += current_channels;
+		}
+	}
+}
+
+static int encode_audio(encode_ctx_t* ctx)
+{
 	int i, j = 0, samples = ctx->audio_input_frame_size;
 
 	int frame_length = ctx->audio_input_frame_size * ctx->channels * ctx->sample_bytes;
@@ -1326,66 +1459,7 @@ static int encode_audio(encode_ctx_t* ctx)
 		}
 		else
 		{
-			// Extract the audio channels according to channel mapping
-			int dest_offset = 0; // channel offset into interleaved dest buffer
-
-			// Get the number of channels for this stream
-			sprintf( key, "channels.%d", i );
-			int current_channels = mlt_properties_get_int( ctx->properties, key );
-
-			// Clear the destination audio buffer.
-			memset( ctx->audio_buf_2, 0, AUDIO_ENCODE_BUFFER_SIZE );
-
-			// For each output channel
-			while ( dest_offset < current_channels && j < ctx->total_channels )
-			{
-				int map_start = -1, map_channels = 0;
-				int source_offset = 0;
-				int k;
-
-				// Look for a mapping that starts at j
-				for ( k = 0; k < (MAX_AUDIO_STREAMS * 2) && map_start != j; k++ )
-				{
-					sprintf( key, "%d.channels", k );
-					map_channels = mlt_properties_get_int( ctx->frame_meta_properties, key );
-					sprintf( key, "%d.start", k );
-					if ( mlt_properties_get( ctx->frame_meta_properties, key ) )
-						map_start = mlt_properties_get_int( ctx->frame_meta_properties, key );
-					if ( map_start != j )
-						source_offset += map_channels;
-				}
-
-				// If no mapping
-				if ( map_start != j )
-				{
-					map_channels = current_channels;
-					source_offset = j;
-				}
-
-				// Copy samples if source offset valid
-				if ( source_offset < ctx->channels )
-				{
-					// Interleave the audio buffer with the # channels for this stream/mapping.
-					for ( k = 0; k < map_channels; k++, j++, source_offset++, dest_offset++ )
-					{
-						void *src = ctx->audio_buf_1 + source_offset * ctx->sample_bytes;
-						void *dest = ctx->audio_buf_2 + dest_offset * ctx->sample_bytes;
-						int s = samples + 1;
-
-						while ( --s ) {
-							memcpy( dest, src, ctx->sample_bytes );
-							dest += current_channels * ctx->sample_bytes;
-							src += ctx->channels * ctx->sample_bytes;
-						}
-					}
-				}
-				// Otherwise silence
-				else
-				{
-					j += current_channels;
-					dest_offset += current_channels;
-				}
-			}
+			remap_audio( ctx, i, &j, samples, ctx->audio_buf_1, ctx->audio_buf_2 );
 			ctx->audio_avframe->nb_samples = FFMAX( samples, ctx->audio_input_frame_size );
 			ctx->audio_avframe->pts = ctx->sample_count[i];
 			ctx->sample_count[i] += ctx->audio_avframe->nb_samples;
@@ -1453,899 +1527,2478 @@ receive_audio_packet:
 	return 0;
 }
 
-/** The main thread - the argument is simply the consumer.
+#if LIBAVCODEC_VERSION_INT >= ((57<<16)+(37<<8)+0)
+
+/** A packet or encoding error produced by a job of the encoding pipeline.
 */
 
-static void *consumer_thread( void *arg )
+typedef struct
 {
-	int i;
+	AVStream *stream;
+	AVPacket *pkt;
+	char *stats;
+	int error;
+} pipeline_packet_t;
 
-	// Encoding content
-	encode_ctx_t* enc_ctx = mlt_pool_alloc(sizeof(encode_ctx_t));
-	memset(enc_ctx, 0, sizeof(encode_ctx_t));
+/** A job of the encoding pipeline: one video frame or one audio frame for each audio stream.
+*/
 
-	// Map the argument to the object
-	mlt_consumer consumer = enc_ctx->consumer = arg;
+typedef struct
+{
+	int done;
+	int frame_count;
 
-	// Get the properties
-	mlt_properties properties = enc_ctx->properties = MLT_CONSUMER_PROPERTIES( consumer );
+	// Video
+	mlt_frame frame;
+	uint8_t *image;
+	mlt_image_format img_fmt;
+	AVFrame *avframe;
+	int progressive;
+	int top_field_first;
 
-	// Get the terminate on pause property
-	enc_ctx->terminate_on_pause = mlt_properties_get_int( enc_ctx->properties, "terminate_on_pause" );
+	// Audio
+	int samples;
+	int channels;
+	int nb_samples;
+	int streams;
+	int remapped;
+	uint8_t *audio[ MAX_AUDIO_STREAMS ];
+	int64_t pts[ MAX_AUDIO_STREAMS ];
 
-	// Determine if feed is slow (for realtime stuff)
-	int real_time_output = mlt_properties_get_int( properties, "real_time" );
+	// The packets in the order to write them
+	mlt_deque packets;
+} pipeline_job_t;
 
-	// Time structures
-	struct timeval ante;
+/** The encoding pipeline.
+ *
+ * The consumer thread decides when to encode audio or video exactly as it
+ * does without the pipeline and queues a job for each decision. It also
+ * gets the images, so the services are never asked for one on another
+ * thread. The images are converted, the video encoded, and the audio
+ * encoded on their own threads, and the mux thread writes the packets of
+ * the jobs in the order they were queued. Therefore, the output is the same
+ * as without it.
+*/
 
-	// Get the frame rate
-	double fps = mlt_properties_get_double( properties, "fps" );
+typedef struct pipeline_s
+{
+	encode_ctx_t *ctx;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t threads[4];
+	int thread_count;
+	mlt_deque convert_queue;
+	mlt_deque video_queue;
+	mlt_deque audio_queue;
+	mlt_deque mux_queue;
+	int depth;
+	int closing;
+	int converted;
+	int error;
+
+	// Owned by the consumer thread
+	mlt_image_format img_fmt;
+	int img_width;
+	int img_height;
+	int has_image;
+
+	// Owned by the convert thread
+	int width;
+	int height;
+	enum AVPixelFormat pix_fmt;
+	int dst_colorspace;
+	int dst_full_range;
+	AVFrame *last;
+} pipeline_t;
 
-	// Get width and height
-	int width = mlt_properties_get_int( properties, "width" );
-	int height = mlt_properties_get_int( properties, "height" );
-	int img_width = width;
-	int img_height = height;
+static pipeline_job_t *pipeline_job_init( encode_ctx_t *ctx )
+{
+	pipeline_job_t *job = calloc( 1, sizeof( pipeline_job_t ) );
+	job->frame_count = ctx->frame_count;
+	job->packets = mlt_deque_init();
+	return job;
+}
 
-	// Get default audio properties
-	enc_ctx->total_channels = enc_ctx->channels = mlt_properties_get_int( properties, "channels" );
-	enc_ctx->frequency = mlt_properties_get_int( properties, "frequency" );
-	void *pcm = NULL;
-	int samples = 0;
+static void pipeline_job_close( pipeline_job_t *job )
+{
+	pipeline_packet_t *packet;
+	int i;
 
-	// AVFormat audio buffer and frame size
-	enc_ctx->audio_outbuf_size = AUDIO_BUFFER_SIZE;
+	while ( ( packet = mlt_deque_pop_front( job->packets ) ) )
+	{
+		av_packet_free( &packet->pkt );
+		free( packet->stats );
+		free( packet );
+	}
+	mlt_deque_close( job->packets );
+	for ( i = 0; i < MAX_AUDIO_STREAMS; i++ )
+		mlt_pool_release( job->audio[i] );
+	av_frame_free( &job->avframe );
+	mlt_frame_close( job->frame );
+	free( job );
+}
 
-	// AVFormat video buffer and frame count
-	int video_outbuf_size = VIDEO_BUFFER_SIZE;
-	uint8_t *video_outbuf = av_malloc( video_outbuf_size );
+static void pipeline_add_packet( pipeline_job_t *job, AVStream *stream, AVPacket *pkt, char *stats, int error )
+{
+	pipeline_packet_t *packet = calloc( 1, sizeof( pipeline_packet_t ) );
+	packet->stream = stream;
+	packet->pkt = pkt;
+	packet->stats = stats;
+	packet->error = error;
+	mlt_deque_push_back( job->packets, packet );
+}
 
-	// Used for the frame properties
-	mlt_frame frame = NULL;
-	mlt_properties frame_properties = NULL;
+/** Encode a frame and collect all of the packets the encoder returns for it.
+*/
 
-	// Get the queues
-	mlt_deque queue = mlt_properties_get_data( properties, "frame_queue", NULL );
-	enc_ctx->fifo = mlt_properties_get_data( properties, "sample_fifo", NULL );
+static void pipeline_encode( pipeline_job_t *job, AVStream *stream, AVFrame *avframe, int stats )
+{
+	AVCodecContext *codec = stream->codec;
+	int ret = avcodec_send_frame( codec, avframe );
 
-	// For receiving images from an mlt_frame
-	uint8_t *image;
-	mlt_image_format img_fmt = mlt_image_yuv422;
+	while ( ret >= 0 )
+	{
+		AVPacket *pkt = av_packet_alloc();
 
-	// Need two av pictures for converting
-	AVFrame *converted_avframe = NULL;
-	AVFrame *avframe = NULL;
+		ret = avcodec_receive_packet( codec, pkt );
+		if ( ret >= 0 && pkt->size > 0 )
+		{
+			pipeline_add_packet( job, stream, pkt, stats && codec->stats_out ? strdup( codec->stats_out ) : NULL, 0 );
+		}
+		else
+		{
+			av_packet_free( &pkt );
+			if ( ret == AVERROR(EAGAIN) || ret == AVERROR_EOF )
+				ret = 0;
+			break;
+		}
+	}
+	if ( ret < 0 )
+		pipeline_add_packet( job, stream, NULL, NULL, ret );
+}
 
-	// For receiving audio samples back from the fifo
-	int count = 0;
+static void pipeline_convert( pipeline_t *self, pipeline_job_t *job )
+{
+	mlt_properties frame_properties = MLT_FRAME_PROPERTIES( job->frame );
 
-	// Frames dispatched
-	long int frames = 0;
-	long int total_time = 0;
+	if ( job->image )
+	{
+		job->avframe = av_frame_alloc();
+		job->avframe->format = self->pix_fmt;
+		job->avframe->width = self->width;
+		job->avframe->height = self->height;
+		av_frame_get_buffer( job->avframe, IMAGE_ALIGN );
+		convert_image( self->ctx->properties, job->frame, job->image, job->img_fmt, self->width, self->height,
+			job->avframe, self->dst_colorspace, self->dst_full_range );
+		av_frame_unref( self->last );
+		av_frame_ref( self->last, job->avframe );
+	}
+	else
+	{
+		// Repeat the last image
+		job->avframe = av_frame_clone( self->last );
+	}
+	job->progressive = mlt_properties_get_int( frame_properties, "progressive" );
+	job->top_field_first = mlt_properties_get_int( frame_properties, "top_field_first" );
+	mlt_frame_close( job->frame );
+	job->frame = NULL;
+}
 
-	// Determine the format
-	AVOutputFormat *fmt = NULL;
-	const char *filename = mlt_properties_get( properties, "target" );
-	char *format = mlt_properties_get( properties, "f" );
-	char *vcodec = mlt_properties_get( properties, "vcodec" );
-	char *acodec = mlt_properties_get( properties, "acodec" );
-	AVCodec *audio_codec = NULL;
-	AVCodec *video_codec = NULL;
+static void pipeline_encode_video( pipeline_t *self, pipeline_job_t *job )
+{
+	AVCodecContext *c = self->ctx->video_st->codec;
+	AVFrame *avframe = job->avframe;
+
+	// Set the quality
+	avframe->quality = c->global_quality;
+	avframe->pts = job->frame_count;
+
+	// Set frame interlace hints
+	avframe->interlaced_frame = !job->progressive;
+	avframe->top_field_first = job->top_field_first;
+	if ( job->progressive )
+		c->field_order = AV_FIELD_PROGRESSIVE;
+	else if ( c->codec_id == AV_CODEC_ID_MJPEG )
+		c->field_order = job->top_field_first ? AV_FIELD_TT : AV_FIELD_BB;
+	else
+		c->field_order = job->top_field_first ? AV_FIELD_TB : AV_FIELD_BT;
 
+	pipeline_encode( job, self->ctx->video_st, avframe, 1 );
+	av_frame_free( &job->avframe );
+}
 
-	// Misc
-	char key[27];
-	enc_ctx->frame_meta_properties = mlt_properties_new();
-	int header_written = 0;
-	int dst_colorspace = mlt_properties_get_int( properties, "colorspace" );
-	const char* color_range = mlt_properties_get( properties, "color_range" );
-	int dst_full_range = color_range && (!strcmp("pc", color_range) || !strcmp("jpeg", color_range));
+static void pipeline_encode_audio( pipeline_t *self, pipeline_job_t *job )
+{
+	encode_ctx_t *ctx = self->ctx;
+	int i;
 
-	// Check for user selected format first
-	if ( format != NULL )
-		fmt = av_guess_format( format, NULL, NULL );
+	for ( i = 0; i < job->streams; i++ )
+	{
+		AVStream *stream = ctx->audio_st[i];
+		AVCodecContext *codec = stream->codec;
+		void *p = job->audio[i];
 
-	// Otherwise check on the filename
-	if ( fmt == NULL && filename != NULL )
-		fmt = av_guess_format( NULL, filename, NULL );
+		if ( !job->remapped )
+		{
+			if ( codec->sample_fmt == AV_SAMPLE_FMT_FLTP )
+				p = interleaved_to_planar( job->samples, job->channels, p, sizeof( float ) );
+			else if ( codec->sample_fmt == AV_SAMPLE_FMT_S16P )
+				p = interleaved_to_planar( job->samples, job->channels, p, sizeof( int16_t ) );
+			else if ( codec->sample_fmt == AV_SAMPLE_FMT_S32P )
+				p = interleaved_to_planar( job->samples, job->channels, p, sizeof( int32_t ) );
+			else if ( codec->sample_fmt == AV_SAMPLE_FMT_U8P )
+				p = interleaved_to_planar( job->samples, job->channels, p, sizeof( uint8_t ) );
+		}
+		ctx->audio_avframe->nb_samples = job->nb_samples;
+		ctx->audio_avframe->pts = job->pts[i];
+		avcodec_fill_audio_frame( ctx->audio_avframe, codec->channels, codec->sample_fmt,
+			(const uint8_t*) p, AUDIO_ENCODE_BUFFER_SIZE, 0 );
+		pipeline_encode( job, stream, job->samples ? ctx->audio_avframe : NULL, 0 );
+		if ( p != job->audio[i] )
+			mlt_pool_release( p );
+	}
+}
 
-	// Otherwise default to mpeg
-	if ( fmt == NULL )
-		fmt = av_guess_format( "mpeg", NULL, NULL );
+/** Write a packet of a job or account for an encoding error.
+ *
+ * \return true if the consumer must stop on a fatal error
+*/
 
-	// We need a filename - default to stdout?
-	if ( filename == NULL || !strcmp( filename, "" ) )
-		filename = "pipe:";
+static int pipeline_write_packet( pipeline_t *self, pipeline_job_t *job, pipeline_packet_t *packet )
+{
+	encode_ctx_t *ctx = self->ctx;
+	AVStream *stream = packet->stream;
+	AVCodecContext *codec = stream->codec;
+	AVPacket *pkt = packet->pkt;
+	int video = stream == ctx->video_st;
+	int ret;
+
+	if ( packet->error )
+	{
+		mlt_log_warning( MLT_CONSUMER_SERVICE( ctx->consumer ), "error with %s encode: %d (frame %d)\n",
+			video ? "video" : "audio", packet->error, job->frame_count );
+		return ++ctx->error_count > 2;
+	}
 
-#if defined(FFUDIV)
-	avformat_alloc_output_context2( &enc_ctx->oc, fmt, format, filename );
-#else
-	enc_ctx->oc = avformat_alloc_context( );
-	enc_ctx->oc->oformat = fmt;
-	snprintf( enc_ctx->oc->filename, sizeof(enc_ctx->oc->filename), "%s", filename );
+	if ( pkt->pts != AV_NOPTS_VALUE )
+		pkt->pts = av_rescale_q( pkt->pts, codec->time_base, stream->time_base );
+	if ( pkt->dts != AV_NOPTS_VALUE )
+		pkt->dts = av_rescale_q( pkt->dts, codec->time_base, stream->time_base );
+	if ( !video && pkt->duration > 0 )
+		pkt->duration = av_rescale_q( pkt->duration, codec->time_base, stream->time_base );
+	pkt->stream_index = stream->index;
+
+	// Write the compressed frame in the media file
+	ret = av_interleaved_write_frame( ctx->oc, pkt );
+	if ( video )
+	{
+		FILE *logfile = mlt_properties_get_data( ctx->properties, "_logfile", NULL );
 
-	if ( enc_ctx->oc->oformat && enc_ctx->oc->oformat->priv_class && !enc_ctx->oc->priv_data && enc_ctx->oc->oformat->priv_data_size ) {
-		enc_ctx->oc->priv_data = av_mallocz( enc_ctx->oc->oformat->priv_data_size );
-		if ( enc_ctx->oc->priv_data ) {
-			*(const AVClass**)enc_ctx->oc->priv_data = enc_ctx->oc->oformat->priv_class;
-			av_opt_set_defaults( enc_ctx->oc->priv_data );
-		}
+		mlt_log_debug( MLT_CONSUMER_SERVICE( ctx->consumer ), " frame_size %d\n", codec->frame_size );
+
+		// Dual pass logging
+		if ( logfile && packet->stats )
+			fprintf( logfile, "%s", packet->stats );
 	}
-#endif
+	if ( ret )
+	{
+		if ( video )
+			mlt_log_fatal( MLT_CONSUMER_SERVICE( ctx->consumer ), "error writing video frame: %d\n", ret );
+		else
+			mlt_log_fatal( MLT_CONSUMER_SERVICE( ctx->consumer ), "error writing audio frame\n" );
+		mlt_events_fire( ctx->properties, "consumer-fatal-error", NULL );
+		return 1;
+	}
+	ctx->error_count = 0;
+	if ( !video )
+		mlt_log_debug( MLT_CONSUMER_SERVICE( ctx->consumer ), "audio stream %d pkt pts %"PRId64" frame_size %d\n",
+			stream->index, pkt->pts, codec->frame_size );
 
-	// Get the codec ids selected
-	enc_ctx->audio_codec_id = fmt->audio_codec;
-	enc_ctx->video_codec_id = fmt->video_codec;
+	return 0;
+}
 
-	// Check for audio codec overrides
-	if ( ( acodec && strcmp( acodec, "none" ) == 0 ) || mlt_properties_get_int( properties, "an" ) )
-		enc_ctx->audio_codec_id = AV_CODEC_ID_NONE;
-	else if ( acodec )
+static void *pipeline_convert_thread( void *arg )
+{
+	pipeline_t *self = arg;
+	pipeline_job_t *job;
+
+	pthread_mutex_lock( &self->mutex );
+	while ( 1 )
 	{
-		audio_codec = avcodec_find_encoder_by_name( acodec );
-		if ( audio_codec )
-		{
-			enc_ctx->audio_codec_id = audio_codec->id;
-			if ( enc_ctx->audio_codec_id == AV_CODEC_ID_AC3 && avcodec_find_encoder_by_name( "ac3_fixed" ) )
-			{
-				mlt_properties_set( enc_ctx->properties, "_acodec", "ac3_fixed" );
-				acodec = mlt_properties_get( enc_ctx->properties, "_acodec" );
-				audio_codec = avcodec_find_encoder_by_name( acodec );
-			}
-			else if ( !strcmp( acodec, "aac" ) || !strcmp( acodec, "vorbis" ) )
-			{
-				mlt_properties_set( enc_ctx->properties, "astrict", "experimental" );
-			}
-		}
-		else
-		{
-			enc_ctx->audio_codec_id = AV_CODEC_ID_NONE;
-			mlt_log_warning( MLT_CONSUMER_SERVICE( consumer ), "audio codec %s unrecognised - ignoring\n", acodec );
-		}
+		while ( !mlt_deque_count( self->convert_queue ) && !self->closing )
+			pthread_cond_wait( &self->cond, &self->mutex );
+		if ( !( job = mlt_deque_pop_front( self->convert_queue ) ) )
+			break;
+		pthread_mutex_unlock( &self->mutex );
+		pipeline_convert( self, job );
+		pthread_mutex_lock( &self->mutex );
+		mlt_deque_push_back( self->video_queue, job );
+		pthread_cond_broadcast( &self->cond );
 	}
-	else
+	self->converted = 1;
+	pthread_cond_broadcast( &self->cond );
+	pthread_mutex_unlock( &self->mutex );
+
+	return NULL;
+}
+
+static void *pipeline_video_thread( void *arg )
+{
+	pipeline_t *self = arg;
+	pipeline_job_t *job;
+
+	pthread_mutex_lock( &self->mutex );
+	while ( 1 )
 	{
-		audio_codec = avcodec_find_encoder( enc_ctx->audio_codec_id );
+		while ( !mlt_deque_count( self->video_queue ) && !self->converted )
+			pthread_cond_wait( &self->cond, &self->mutex );
+		if ( !( job = mlt_deque_pop_front( self->video_queue ) ) )
+			break;
+		pthread_mutex_unlock( &self->mutex );
+		pipeline_encode_video( self, job );
+		pthread_mutex_lock( &self->mutex );
+		job->done = 1;
+		pthread_cond_broadcast( &self->cond );
 	}
+	pthread_mutex_unlock( &self->mutex );
 
-	// Check for video codec overrides
-	if ( ( vcodec && strcmp( vcodec, "none" ) == 0 ) || mlt_properties_get_int( properties, "vn" ) )
-		enc_ctx->video_codec_id = AV_CODEC_ID_NONE;
-	else if ( vcodec )
+	return NULL;
+}
+
+static void *pipeline_audio_thread( void *arg )
+{
+	pipeline_t *self = arg;
+	pipeline_job_t *job;
+
+	pthread_mutex_lock( &self->mutex );
+	while ( 1 )
 	{
-		video_codec = avcodec_find_encoder_by_name( vcodec );
-		if ( video_codec )
+		while ( !mlt_deque_count( self->audio_queue ) && !self->closing )
+			pthread_cond_wait( &self->cond, &self->mutex );
+		if ( !( job = mlt_deque_pop_front( self->audio_queue ) ) )
+			break;
+		pthread_mutex_unlock( &self->mutex );
+		pipeline_encode_audio( self, job );
+		pthread_mutex_lock( &self->mutex );
+		job->done = 1;
+		pthread_cond_broadcast( &self->cond );
+	}
+	pthread_mutex_unlock( &self->mutex );
+
+	return NULL;
+}
+
+static void *pipeline_mux_thread( void *arg )
+{
+	pipeline_t *self = arg;
+	pipeline_job_t *job;
+
+	pthread_mutex_lock( &self->mutex );
+	while ( ( job = mlt_deque_peek_front( self->mux_queue ) ) || !self->closing )
+	{
+		if ( !job || !job->done )
 		{
-			enc_ctx->video_codec_id = video_codec->id;
+			pthread_cond_wait( &self->cond, &self->mutex );
+			continue;
 		}
-		else
+		pthread_mutex_unlock( &self->mutex );
+
+		// After a fatal error, the remaining jobs are only discarded.
+		pipeline_packet_t *packet;
+		int error = self->error;
+		while ( ( packet = mlt_deque_peek_front( job->packets ) ) && !error )
 		{
-			enc_ctx->video_codec_id = AV_CODEC_ID_NONE;
-			mlt_log_warning( MLT_CONSUMER_SERVICE( consumer ), "video codec %s unrecognised - ignoring\n", vcodec );
+			error = pipeline_write_packet( self, job, packet );
+			mlt_deque_pop_front( job->packets );
+			av_packet_free( &packet->pkt );
+			free( packet->stats );
+			free( packet );
 		}
+		pipeline_job_close( job );
+
+		pthread_mutex_lock( &self->mutex );
+		mlt_deque_pop_front( self->mux_queue );
+		self->error = error;
+		pthread_cond_broadcast( &self->cond );
 	}
-	else
+	pthread_mutex_unlock( &self->mutex );
+
+	return NULL;
+}
+
+/** Start the encoding pipeline.
+ *
+ * \return the pipeline or NULL if the output must be encoded without it
+*/
+
+static pipeline_t *pipeline_init( encode_ctx_t *ctx, int depth, enum AVPixelFormat pix_fmt, int width, int height,
+	mlt_image_format img_fmt, int dst_colorspace, int dst_full_range )
+{
+	pipeline_t *self;
+
+#if defined(AVFILTER) && LIBAVUTIL_VERSION_MAJOR >= 56
+	if ( ctx->video_st && ctx->video_st->codec->pix_fmt == AV_PIX_FMT_VAAPI )
 	{
-		video_codec = avcodec_find_encoder( enc_ctx->video_codec_id );
+		mlt_log_info( MLT_CONSUMER_SERVICE( ctx->consumer ), "the encoding pipeline does not support vaapi\n" );
+		return NULL;
 	}
-
-	// Write metadata
-	for ( i = 0; i < mlt_properties_count( properties ); i++ )
+#endif
+#ifdef AVFMT_RAWPICTURE
+	if ( ctx->oc->oformat->flags & AVFMT_RAWPICTURE )
 	{
-		char *name = mlt_properties_get_name( properties, i );
-		if ( name && !strncmp( name, "meta.attr.", 10 ) )
-		{
-			char *key = strdup( name + 10 );
-			char *markup = strrchr( key, '.' );
-			if ( markup && !strcmp( markup, ".markup") )
-			{
-				markup[0] = '\0';
-				if ( !strstr( key, ".stream." ) )
-					av_dict_set( &enc_ctx->oc->metadata, key, mlt_properties_get_value( properties, i ), 0 );
-			}
-			free( key );
-		}
+		mlt_log_info( MLT_CONSUMER_SERVICE( ctx->consumer ), "the encoding pipeline does not support raw pictures\n" );
+		return NULL;
 	}
+#endif
 
-	// Add audio and video streams
-	if ( enc_ctx->video_codec_id != AV_CODEC_ID_NONE )
+	self = calloc( 1, sizeof( pipeline_t ) );
+	self->ctx = ctx;
+	self->depth = depth;
+	self->convert_queue = mlt_deque_init();
+	self->video_queue = mlt_deque_init();
+	self->audio_queue = mlt_deque_init();
+	self->mux_queue = mlt_deque_init();
+	self->width = self->img_width = width;
+	self->height = self->img_height = height;
+	self->pix_fmt = pix_fmt;
+	self->img_fmt = img_fmt;
+	self->dst_colorspace = dst_colorspace;
+	self->dst_full_range = dst_full_range;
+	self->last = av_frame_alloc();
+	self->converted = !ctx->video_st;
+	pthread_mutex_init( &self->mutex, NULL );
+	pthread_cond_init( &self->cond, NULL );
+
+	pthread_create( &self->threads[ self->thread_count++ ], NULL, pipeline_mux_thread, self );
+	if ( ctx->video_st )
 	{
-		if ( ( enc_ctx->video_st = add_video_stream( consumer, enc_ctx->oc, video_codec ) ) )
-		{
-			const char* img_fmt_name = mlt_properties_get( properties, "mlt_image_format" );
-			if ( img_fmt_name )
-			{
-				// Set the mlt_image_format from explicit property.
-				mlt_image_format f = mlt_image_format_id( img_fmt_name );
-				if ( mlt_image_invalid != f )
-					img_fmt = f;
-			}
-			else
-			{
-				// Set the mlt_image_format from the selected pix_fmt.
-				const char *pix_fmt_name = av_get_pix_fmt_name( enc_ctx->video_st->codec->pix_fmt );
-				if ( !strcmp( pix_fmt_name, "rgba" ) ||
-					 !strcmp( pix_fmt_name, "argb" ) ||
-					 !strcmp( pix_fmt_name, "bgra" ) ) {
-					mlt_properties_set( properties, "mlt_image_format", "rgb24a" );
-					img_fmt = mlt_image_rgb24a;
-				} else if ( strstr( pix_fmt_name, "rgb" ) ||
-							strstr( pix_fmt_name, "bgr" ) ) {
-					mlt_properties_set( properties, "mlt_image_format", "rgb24" );
-					img_fmt = mlt_image_rgb24;
-				}
-			}
-		}
+		pthread_create( &self->threads[ self->thread_count++ ], NULL, pipeline_convert_thread, self );
+		pthread_create( &self->threads[ self->thread_count++ ], NULL, pipeline_video_thread, self );
 	}
-	if ( enc_ctx->audio_codec_id != AV_CODEC_ID_NONE )
-	{
-		int is_multi = 0;
+	if ( ctx->audio_st[0] )
+		pthread_create( &self->threads[ self->thread_count++ ], NULL, pipeline_audio_thread, self );
 
-		enc_ctx->total_channels = 0;
-		// multitrack audio
-		for ( i = 0; i < MAX_AUDIO_STREAMS; i++ )
-		{
-			sprintf( key, "channels.%d", i );
-			int j = mlt_properties_get_int( properties, key );
-			if ( j )
-			{
-				is_multi = 1;
-				enc_ctx->total_channels += j;
-				enc_ctx->audio_st[i] = add_audio_stream( consumer, enc_ctx->oc, audio_codec, j, av_get_default_channel_layout( j ) );
-			}
-		}
-		// single track
-		if ( !is_multi )
-		{
-			mlt_channel_layout layout = mlt_audio_channel_layout_id( mlt_properties_get( properties, "channel_layout" ) );
-			if( layout == mlt_channel_auto ||
-				layout == mlt_channel_independent ||
-				mlt_audio_channel_layout_channels( layout ) != enc_ctx->channels )
-			{
-				layout = mlt_audio_channel_layout_default( enc_ctx->channels );
-			}
-			enc_ctx->audio_st[0] = add_audio_stream( consumer, enc_ctx->oc, audio_codec, enc_ctx->channels, mlt_to_av_channel_layout( layout ) );
-			enc_ctx->total_channels = enc_ctx->channels;
-		}
-	}
-	mlt_properties_set_int( properties, "channels", enc_ctx->total_channels );
+	return self;
+}
 
-	// Audio format is determined when adding the audio stream
-	mlt_audio_format aud_fmt = mlt_audio_none;
-	if ( enc_ctx->audio_st[0] )
-		aud_fmt = get_mlt_audio_format( enc_ctx->audio_st[0]->codec->sample_fmt );
-	enc_ctx->sample_bytes = mlt_audio_format_size( aud_fmt, 1, 1 );
-	enc_ctx->sample_bytes = enc_ctx->sample_bytes ? enc_ctx->sample_bytes : 1; // prevent divide by zero
+/** Wait for all queued jobs to be written and stop the pipeline.
+ *
+ * \return true if there was a fatal error
+*/
 
-	// Set the parameters (even though we have none...)
-	{
-		if ( mlt_properties_get( properties, "muxpreload" ) && ! mlt_properties_get( properties, "preload" ) )
-			mlt_properties_set_double( properties, "preload", mlt_properties_get_double( properties, "muxpreload" ) );
-		enc_ctx->oc->max_delay= ( int )( mlt_properties_get_double( properties, "muxdelay" ) * AV_TIME_BASE );
+static int pipeline_close( pipeline_t *self )
+{
+	int i, error;
+
+	pthread_mutex_lock( &self->mutex );
+	self->closing = 1;
+	pthread_cond_broadcast( &self->cond );
+	pthread_mutex_unlock( &self->mutex );
+	for ( i = 0; i < self->thread_count; i++ )
+		pthread_join( self->threads[i], NULL );
+
+	error = self->error;
+	mlt_deque_close( self->convert_queue );
+	mlt_deque_close( self->video_queue );
+	mlt_deque_close( self->audio_queue );
+	mlt_deque_close( self->mux_queue );
+	av_frame_free( &self->last );
+	pthread_cond_destroy( &self->cond );
+	pthread_mutex_destroy( &self->mutex );
+	free( self );
 
-		// Process properties as AVOptions
-		char *fpre = mlt_properties_get( properties, "fpre" );
-		if ( fpre )
-		{
-			mlt_properties p = mlt_properties_load( fpre );
-			apply_properties( enc_ctx->oc, p, AV_OPT_FLAG_ENCODING_PARAM );
-			if ( enc_ctx->oc->oformat && enc_ctx->oc->oformat->priv_class && enc_ctx->oc->priv_data )
-				apply_properties( enc_ctx->oc->priv_data, p, AV_OPT_FLAG_ENCODING_PARAM );
-			mlt_properties_close( p );
-		}
-		apply_properties( enc_ctx->oc, properties, AV_OPT_FLAG_ENCODING_PARAM );
-		if ( enc_ctx->oc->oformat && enc_ctx->oc->oformat->priv_class && enc_ctx->oc->priv_data )
-			apply_properties( enc_ctx->oc->priv_data, properties, AV_OPT_FLAG_ENCODING_PARAM );
+	return error;
+}
 
-		if ( enc_ctx->video_st && !open_video( properties, enc_ctx->oc, enc_ctx->video_st, vcodec? vcodec : NULL ) )
-			enc_ctx->video_st = NULL;
-		for ( i = 0; i < MAX_AUDIO_STREAMS && enc_ctx->audio_st[i]; i++ )
-		{
-			enc_ctx->audio_input_frame_size = open_audio( properties, enc_ctx->oc, enc_ctx->audio_st[i], enc_ctx->audio_outbuf_size,
-				acodec? acodec : NULL );
-			if ( !enc_ctx->audio_input_frame_size )
-			{
-				// Remove the audio stream from the output context
-				int j;
-				for ( j = 0; j < enc_ctx->oc->nb_streams; j++ )
-				{
-					if ( enc_ctx->oc->streams[j] == enc_ctx->audio_st[i] )
-						av_freep( &enc_ctx->oc->streams[j] );
-				}
-				--enc_ctx->oc->nb_streams;
-				enc_ctx->audio_st[i] = NULL;
-			}
-		}
+/** Queue a job, waiting while the pipeline is full.
+*/
 
-		// Setup custom I/O if redirecting
-		if ( mlt_properties_get_int( properties, "redirect" ) )
-		{
-			int buffer_size = 32768;
-			unsigned char *buffer = av_malloc( buffer_size );
-			AVIOContext* io = avio_alloc_context( buffer, buffer_size, 1, properties, NULL, mlt_write, NULL );
-			if ( buffer && io )
-			{
-				enc_ctx->oc->pb = io;
-				enc_ctx->oc->flags |= AVFMT_FLAG_CUSTOM_IO;
-				mlt_properties_set_data( properties, "avio_buffer", buffer, buffer_size, av_free, NULL );
-				mlt_properties_set_data( properties, "avio_context", io, 0, av_free, NULL );
-				mlt_events_register( properties, "avformat-write", (mlt_transmitter) write_transmitter );
-			}
-			else
-			{
-				av_free( buffer );
-				mlt_log_error( MLT_CONSUMER_SERVICE(consumer), "failed to setup output redirection\n" );
-			}
-		}
-		// Open the output file, if needed
-		else if ( !( fmt->flags & AVFMT_NOFILE ) )
-		{
-			if ( avio_open( &enc_ctx->oc->pb, filename, AVIO_FLAG_WRITE ) < 0 )
-			{
-				mlt_log_error( MLT_CONSUMER_SERVICE( consumer ), "Could not open '%s'\n", filename );
-				mlt_events_fire( properties, "consumer-fatal-error", NULL );
-				goto on_fatal_error;
-			}
-		}
+static int pipeline_push( pipeline_t *self, pipeline_job_t *job, mlt_deque queue )
+{
+	int error;
 
+	pthread_mutex_lock( &self->mutex );
+	while ( mlt_deque_count( self->mux_queue ) >= self->depth && !self->error )
+		pthread_cond_wait( &self->cond, &self->mutex );
+	error = self->error;
+	if ( !error )
+	{
+		mlt_deque_push_back( self->mux_queue, job );
+		mlt_deque_push_back( queue, job );
+		pthread_cond_broadcast( &self->cond );
 	}
+	pthread_mutex_unlock( &self->mutex );
+	if ( error )
+		pipeline_job_close( job );
 
-	// Last check - need at least one stream
-	if ( !enc_ctx->audio_st[0] && !enc_ctx->video_st )
+	return error ? -1 : 0;
+}
+
+/** Queue the encoding of the next video frame.
+ *
+ * Like the serial path, this gets the image of a rendered frame here and
+ * otherwise repeats the last one.
+*/
+
+static int pipeline_video( pipeline_t *self, mlt_frame frame )
+{
+	encode_ctx_t *ctx = self->ctx;
+	pipeline_job_t *job = pipeline_job_init( ctx );
+
+	if ( mlt_properties_get_int( MLT_FRAME_PROPERTIES( frame ), "rendered" ) || !self->has_image )
 	{
-		mlt_events_fire( properties, "consumer-fatal-error", NULL );
-		goto on_fatal_error;
+		mlt_frame_get_image( frame, &job->image, &self->img_fmt, &self->img_width, &self->img_height, 0 );
+		job->img_fmt = self->img_fmt;
+		self->has_image = 1;
 	}
+	job->frame = frame;
+	ctx->frame_count++;
+	ctx->video_pts = (double) ctx->frame_count * av_q2d( ctx->video_st->codec->time_base );
 
-	// Allocate picture
-	enum AVPixelFormat pix_fmt;
-	if ( enc_ctx->video_st ) {
-#if defined(AVFILTER) && LIBAVUTIL_VERSION_MAJOR >= 56
-		pix_fmt = enc_ctx->video_st->codec->pix_fmt == AV_PIX_FMT_VAAPI ?
-				   AV_PIX_FMT_NV12 : enc_ctx->video_st->codec->pix_fmt;
-#else
-		pix_fmt = enc_ctx->video_st->codec->pix_fmt;
-#endif
-		converted_avframe = alloc_picture( pix_fmt, width, height );
-		if ( !converted_avframe ) {
-			mlt_log_error( MLT_CONSUMER_SERVICE( consumer ), "failed to allocate video AVFrame\n" );
-			mlt_events_fire( properties, "consumer-fatal-error", NULL );
-			goto on_fatal_error;
-		}
-	}
+	return pipeline_push( self, job, self->convert_queue );
+}
 
-	// Allocate audio AVFrame
-	if ( enc_ctx->audio_st[0] )
+/** Queue the encoding of the next audio frame like encode_audio().
+*/
+
+static int pipeline_audio( pipeline_t *self )
+{
+	encode_ctx_t *ctx = self->ctx;
+	int i, j = 0, samples = ctx->audio_input_frame_size;
+	int frame_length = ctx->audio_input_frame_size * ctx->channels * ctx->sample_bytes;
+	uint8_t *buffer;
+	pipeline_job_t *job;
+
+	// Get samples count to fetch from fifo
+	if ( sample_fifo_used( ctx->fifo ) < frame_length )
+	{
+		samples = sample_fifo_used( ctx->fifo ) / ( ctx->channels * ctx->sample_bytes );
+	}
+	else if ( ctx->audio_input_frame_size == 1 )
+	{
+		// PCM consumes as much as possible.
+		samples = FFMIN( sample_fifo_used( ctx->fifo ), AUDIO_ENCODE_BUFFER_SIZE ) / frame_length;
+	}
+
+	if ( samples <= 0 && ctx->audio_codec_id == AV_CODEC_ID_VORBIS && ctx->terminated )
+	{
+		ctx->audio_pts = ctx->video_pts;
+		return 1;
+	}
+
+	// Get the audio samples
+	buffer = mlt_pool_alloc( AUDIO_ENCODE_BUFFER_SIZE );
+	if ( samples > 0 )
+		sample_fifo_fetch( ctx->fifo, buffer, samples * ctx->sample_bytes * ctx->channels );
+	else
+		memset( buffer, 0, AUDIO_ENCODE_BUFFER_SIZE );
+
+	job = pipeline_job_init( ctx );
+	job->samples = samples;
+	job->channels = ctx->channels;
+	job->nb_samples = FFMAX( samples, ctx->audio_input_frame_size );
+	job->remapped = ctx->audio_st[1] || mlt_properties_count( ctx->frame_meta_properties );
+
+	// For each output stream
+	for ( i = 0; i < MAX_AUDIO_STREAMS && ctx->audio_st[i] && j < ctx->total_channels; i++ )
+	{
+		if ( job->remapped )
+		{
+			job->audio[i] = mlt_pool_alloc( AUDIO_ENCODE_BUFFER_SIZE );
+			remap_audio( ctx, i, &j, samples, buffer, job->audio[i] );
+		}
+		else
+		{
+			job->audio[i] = buffer;
+			buffer = NULL;
+		}
+		job->pts[i] = ctx->sample_count[i];
+		ctx->sample_count[i] += job->nb_samples;
+		if ( i == 0 )
+			ctx->audio_pts = (double) ctx->sample_count[0] * av_q2d( ctx->audio_st[0]->codec->time_base );
+	}
+	job->streams = i;
+	mlt_pool_release( buffer );
+
+	return pipeline_push( self, job, self->audio_queue );
+}
+
+#else
+
+typedef struct pipeline_s pipeline_t;
+
+static pipeline_t *pipeline_init( encode_ctx_t *ctx, int depth, enum AVPixelFormat pix_fmt, int width, int height,
+	mlt_image_format img_fmt, int dst_colorspace, int dst_full_range )
+{
+	mlt_log_info( MLT_CONSUMER_SERVICE( ctx->consumer ), "the encoding pipeline requires a newer libavcodec\n" );
+	return NULL;
+}
+
+static int pipeline_close( pipeline_t *self )
+{
+	return 0;
+}
+
+static int pipeline_video( pipeline_t *self, mlt_frame frame )
+{
+	return -1;
+}
+
+static int pipeline_audio( pipeline_t *self )
+{
+	return -1;
+}
+
+#endif
+
+/** The main thread - the argument is simply the consumer.
+*/
+
+static void *consumer_thread( void *arg )
+{
+	int i;
+
+	// Encoding content
+	encode_ctx_t* enc_ctx = mlt_pool_alloc(sizeof(encode_ctx_t));
+	memset(enc_ctx, 0, sizeof(encode_ctx_t));
+
+	// Map the argument to the object
+	mlt_consumer consumer = enc_ctx->consumer = arg;
+
+	// Get the properties
+	mlt_properties properties = enc_ctx->properties = MLT_CONSUMER_PROPERTIES( consumer );
+
+	// Get the terminate on pause property
+	enc_ctx->terminate_on_pause = mlt_properties_get_int( enc_ctx->properties, "terminate_on_pause" );
+
+	// Determine if feed is slow (for realtime stuff)
+	int real_time_output = mlt_properties_get_int( properties, "real_time" );
+
+	// Time structures
+	struct timeval ante;
+
+	// Get the frame rate
+	double fps = mlt_properties_get_double( properties, "fps" );
+
+	// Get width and height
+	int width = mlt_properties_get_int( properties, "width" );
+	int height = mlt_properties_get_int( properties, "height" );
+	int img_width = width;
+	int img_height = height;
+
+	// Get default audio properties
+	enc_ctx->total_channels = enc_ctx->channels = mlt_properties_get_int( properties, "channels" );
+	enc_ctx->frequency = mlt_properties_get_int( properties, "frequency" );
+	void *pcm = NULL;
+	int samples = 0;
+
+	// AVFormat audio buffer and frame size
+	enc_ctx->audio_outbuf_size = AUDIO_BUFFER_SIZE;
+
+	// AVFormat video buffer and frame count
+	int video_outbuf_size = VIDEO_BUFFER_SIZE;
+	uint8_t *video_outbuf = av_malloc( video_outbuf_size );
+
+	// Used for the frame properties
+	mlt_frame frame = NULL;
+	mlt_properties frame_properties = NULL;
+
+	// Get the queues
+	mlt_deque queue = mlt_properties_get_data( properties, "frame_queue", NULL );
+	enc_ctx->fifo = mlt_properties_get_data( properties, "sample_fifo", NULL );
+
+	// For receiving images from an mlt_frame
+	uint8_t *image;
+	mlt_image_format img_fmt = mlt_image_yuv422;
+
+	// Need two av pictures for converting
+	AVFrame *converted_avframe = NULL;
+	AVFrame *avframe = NULL;
+
+	// Optional pipeline of encoding threads
+	pipeline_t *pipeline = NULL;
+
+	// For receiving audio samples back from the fifo
+	int count = 0;
+
+	// Frames dispatched
+	long int frames = 0;
+	long int total_time = 0;
+
+	// Determine the format
+	AVOutputFormat *fmt = NULL;
+	const char *filename = mlt_properties_get( properties, "target" );
+	char *format = mlt_properties_get( properties, "f" );
+	char *vcodec = mlt_properties_get( properties, "vcodec" );
+	char *acodec = mlt_properties_get( properties, "acodec" );
+	AVCodec *audio_codec = NULL;
+	AVCodec *video_codec = NULL;
+
+
+	// Misc
+	char key[27];
+	enc_ctx->frame_meta_properties = mlt_properties_new();
+	int header_written = 0;
+	int dst_colorspace = mlt_properties_get_int( properties, "colorspace" );
+	const char* color_range = mlt_properties_get( properties, "color_range" );
+	int dst_full_range = color_range && (!strcmp("pc", color_range) || !strcmp("jpeg", color_range));
+
+	// Check for user selected format first
+	if ( format != NULL )
+		fmt = av_guess_format( format, NULL, NULL );
+
+	// Otherwise check on the filename
+	if ( fmt == NULL && filename != NULL )
+		fmt = av_guess_format( NULL, filename, NULL );
+
+	// Otherwise default to mpeg
+	if ( fmt == NULL )
+		fmt = av_guess_format( "mpeg", NULL, NULL );
+
+	// We need a filename - default to stdout?
+	if ( filename == NULL || !strcmp( filename, "" ) )
+		filename = "pipe:";
+
+#if defined(FFUDIV)
+	avformat_alloc_output_context2( &enc_ctx->oc, fmt, format, filename );
+#else
+	enc_ctx->oc = avformat_alloc_context( );
+	enc_ctx->oc->oformat = fmt;
+	snprintf( enc_ctx->oc->filename, sizeof(enc_ctx->oc->filename), "%s", filename );
+
+	if ( enc_ctx->oc->oformat && enc_ctx->oc->oformat->priv_class && !enc_ctx->oc->priv_data && enc_ctx->oc->oformat->priv_data_size ) {
+		enc_ctx->oc->priv_data = av_mallocz( enc_ctx->oc->oformat->priv_data_size );
+		if ( enc_ctx->oc->priv_data ) {
+			*(const AVClass**)enc_ctx->oc->priv_data = enc_ctx->oc->oformat->priv_class;
+			av_opt_set_defaults( enc_ctx->oc->priv_data );
+		}
+	}
+#endif
+
+	// Get the codec ids selected
+	enc_ctx->audio_codec_id = fmt->audio_codec;
+	enc_ctx->video_codec_id = fmt->video_codec;
+
+	// Check for audio codec overrides
+	if ( ( acodec && strcmp( acodec, "none" ) == 0 ) || mlt_properties_get_int( properties, "an" ) )
+		enc_ctx->audio_codec_id = AV_CODEC_ID_NONE;
+	else if ( acodec )
+	{
+		audio_codec = avcodec_find_encoder_by_name( acodec );
+		if ( audio_codec )
+		{
+			enc_ctx->audio_codec_id = audio_codec->id;
+			if ( enc_ctx->audio_codec_id == AV_CODEC_ID_AC3 && avcodec_find_encoder_by_name( "ac3_fixed" ) )
+			{
+				mlt_properties_set( enc_ctx->properties, "_acodec", "ac3_fixed" );
+				acodec = mlt_properties_get( enc_ctx->properties, "_acodec" );
+				audio_codec = avcodec_find_encoder_by_name( acodec );
+			}
+			else if ( !strcmp( acodec, "aac" ) || !strcmp( acodec, "vorbis" ) )
+			{
+				mlt_properties_set( enc_ctx->properties, "astrict", "experimental" );
+			}
+		}
+		else
+		{
+			enc_ctx->audio_codec_id = AV_CODEC_ID_NONE;
+			mlt_log_warning( MLT_CONSUMER_SERVICE( consumer ), "audio codec %s unrecognised - ignoring\n", acodec );
+		}
+	}
+	else
+	{
+		audio_codec = avcodec_find_encoder( enc_ctx->audio_codec_id );
+	}
+
+	// Check for video codec overrides
+	if ( ( vcodec && strcmp( vcodec, "none" ) == 0 ) || mlt_properties_get_int( properties, "vn" ) )
+		enc_ctx->video_codec_id = AV_CODEC_ID_NONE;
+	else if ( vcodec )
+	{
+		video_codec = avcodec_find_encoder_by_name( vcodec );
+		if ( video_codec )
+		{
+			enc_ctx->video_codec_id = video_codec->id;
+		}
+		else
+		{
+			enc_ctx->video_codec_id = AV_CODEC_ID_NONE;
+			mlt_log_warning( MLT_CONSUMER_SERVICE( consumer ), "video codec %s unrecognised - ignoring\n", vcodec );
+		}
+	}
+	else
+	{
+		video_codec = avcodec_find_encoder( enc_ctx->video_codec_id );
+	}
+
+	// Write metadata
+	for ( i = 0; i < mlt_properties_count( properties ); i++ )
+	{
+		char *name = mlt_properties_get_name( properties, i );
+		if ( name && !strncmp( name, "meta.attr.", 10 ) )
+		{
+			char *key = strdup( name + 10 );
+			char *markup = strrchr( key, '.' );
+			if ( markup && !strcmp( markup, ".markup") )
+			{
+				markup[0] = '\0';
+				if ( !strstr( key, ".stream." ) )
+					av_dict_set( &enc_ctx->oc->metadata, key, mlt_properties_get_value( properties, i ), 0 );
+			}
+			free( key );
+		}
+	}
+
+	// Add audio and video streams
+	if ( enc_ctx->video_codec_id != AV_CODEC_ID_NONE )
+	{
+		if ( ( enc_ctx->video_st = add_video_stream( consumer, enc_ctx->oc, video_codec ) ) )
+		{
+			const char* img_fmt_name = mlt_properties_get( properties, "mlt_image_format" );
+			if ( img_fmt_name )
+			{
+				// Set the mlt_image_format from explicit property.
+				mlt_image_format f = mlt_image_format_id( img_fmt_name );
+				if ( mlt_image_invalid != f )
+					img_fmt = f;
+			}
+			else
+			{
+				// Set the mlt_image_format from the selected pix_fmt.
+				const char *pix_fmt_name = av_get_pix_fmt_name( enc_ctx->video_st->codec->pix_fmt );
+				if ( !strcmp( pix_fmt_name, "rgba" ) ||
+					 !strcmp( pix_fmt_name, "argb" ) ||
+					 !strcmp( pix_fmt_name, "bgra" ) ) {
+					mlt_properties_set( properties, "mlt_image_format", "rgb24a" );
+					img_fmt = mlt_image_rgb24a;
+				} else if ( strstr( pix_fmt_name, "rgb" ) ||
+							strstr( pix_fmt_name, "bgr" ) ) {
+					mlt_properties_set( properties, "mlt_image_format", "rgb24" );
+					img_fmt = mlt_image_rgb24;
+				}
+			}
+		}
+	}
+	if ( enc_ctx->audio_codec_id != AV_CODEC_ID_NONE )
+	{
+		int is_multi = 0;
+
+		enc_ctx->total_channels = 0;
+		// multitrack audio
+		for ( i = 0; i < MAX_AUDIO_STREAMS; i++ )
+		{
+			sprintf( key, "channels.%d", i );
+			int j = mlt_properties_get_int( properties, key );
+			if ( j )
+			{
+				is_multi = 1;
+				enc_ctx->total_channels += j;
+				enc_ctx->audio_st[i] = add_audio_stream( consumer, enc_ctx->oc, audio_codec, j, av_get_default_channel_layout( j ) );
+			}
+		}
+		// single track
+		if ( !is_multi )
+		{
+			mlt_channel_layout layout = mlt_audio_channel_layout_id( mlt_properties_get( properties, "channel_layout" ) );
+			if( layout == mlt_channel_auto ||
+				layout == mlt_channel_independent ||
+				mlt_audio_channel_layout_channels( layout ) != enc_ctx->channels )
+			{
+				layout = mlt_audio_channel_layout_default( enc_ctx->channels );
+			}
+			enc_ctx->audio_st[0] = add_audio_stream( consumer, enc_ctx->oc, audio_codec, enc_ctx->channels, mlt_to_av_channel_layout( layout ) );
+			enc_ctx->total_channels = enc_ctx->channels;
+		}
+	}
+	mlt_properties_set_int( properties, "channels", enc_ctx->total_channels );
+
+	// Audio format is determined when adding the audio stream
+	mlt_audio_format aud_fmt = mlt_audio_none;
+	if ( enc_ctx->audio_st[0] )
+		aud_fmt = get_mlt_audio_format( enc_ctx->audio_st[0]->codec->sample_fmt );
+	enc_ctx->sample_bytes = mlt_audio_format_size( aud_fmt, 1, 1 );
+	enc_ctx->sample_bytes = enc_ctx->sample_bytes ? enc_ctx->sample_bytes : 1; // prevent divide by zero
+
+	// Set the parameters (even though we have none...)
+	{
+		if ( mlt_properties_get( properties, "muxpreload" ) && ! mlt_properties_get( properties, "preload" ) )
+			mlt_properties_set_double( properties, "preload", mlt_properties_get_double( properties, "muxpreload" ) );
+		enc_ctx->oc->max_delay= ( int )( mlt_properties_get_double( properties, "muxdelay" ) * AV_TIME_BASE );
+
+		// Process properties as AVOptions
+		char *fpre = mlt_properties_get( properties, "fpre" );
+		if ( fpre )
+		{
+			mlt_properties p = mlt_properties_load( fpre );
+			apply_properties( enc_ctx->oc, p, AV_OPT_FLAG_ENCODING_PARAM );
+			if ( enc_ctx->oc->oformat && enc_ctx->oc->oformat->priv_class && enc_ctx->oc->priv_data )
+				apply_properties( enc_ctx->oc->priv_data, p, AV_OPT_FLAG_ENCODING_PARAM );
+			mlt_properties_close( p );
+		}
+		apply_properties( enc_ctx->oc, properties, AV_OPT_FLAG_ENCODING_PARAM );
+		if ( enc_ctx->oc->oformat && enc_ctx->oc->oformat->priv_class && enc_ctx->oc->priv_data )
+			apply_properties( enc_ctx->oc->priv_data, properties, AV_OPT_FLAG_ENCODING_PARAM );
+
+		if ( enc_ctx->video_st && !open_video( properties, enc_ctx->oc, enc_ctx->video_st, vcodec? vcodec : NULL ) )
+			enc_ctx->video_st = NULL;
+		for ( i = 0; i < MAX_AUDIO_STREAMS && enc_ctx->audio_st[i]; i++ )
+		{
+			enc_ctx->audio_input_frame_size = open_audio( properties, enc_ctx->oc, enc_ctx->audio_st[i], enc_ctx->audio_outbuf_size,
+				acodec? acodec : NULL );
+			if ( !enc_ctx->audio_input_frame_size )
+			{
+				// Remove the audio stream from the output context
+				int j;
+				for ( j = 0; j < enc_ctx->oc->nb_streams; j++ )
+				{
+					if ( enc_ctx->oc->streams[j] == enc_ctx->audio_st[i] )
+						av_freep( &enc_ctx->oc->streams[j] );
+				}
+				--enc_ctx->oc->nb_streams;
+				enc_ctx->audio_st[i] = NULL;
+			}
+		}
+
+		// Setup custom I/O if redirecting
+		if ( mlt_properties_get_int( properties, "redirect" ) )
+		{
+			int buffer_size = 32768;
+			unsigned char *buffer = av_malloc( buffer_size );
+			AVIOContext* io = avio_alloc_context( buffer, buffer_size, 1, properties, NULL, mlt_write, NULL );
+			if ( buffer && io )
+			{
+				enc_ctx->oc->pb = io;
+				enc_ctx->oc->flags |= AVFMT_FLAG_CUSTOM_IO;
+				mlt_properties_set_data( properties, "avio_buffer", buffer, buffer_size, av_free, NULL );
+				mlt_properties_set_data( properties, "avio_context", io, 0, av_free, NULL );
+				mlt_events_register( properties, "avformat-write", (mlt_transmitter) write_transmitter );
+			}
+			else
+			{
+				av_free( buffer );
+				mlt_log_error( MLT_CONSUMER_SERVICE(consumer), "failed to setup output redirection\n" );
+			}
+		}
+		// Open the output file, if needed
+		else if ( !( fmt->flags & AVFMT_NOFILE ) )
+		{
+			if ( avio_open( &enc_ctx->oc->pb, filename, AVIO_FLAG_WRITE ) < 0 )
+			{
+				mlt_log_error( MLT_CONSUMER_SERVICE( consumer ), "Could not open '%s'\n", filename );
+				mlt_events_fire( properties, "consumer-fatal-error", NULL );
+				goto on_fatal_error;
+			}
+		}
+
+	}
+
+	// Last check - need at least one stream
+	if ( !enc_ctx->audio_st[0] && !enc_ctx->video_st )
+	{
+		mlt_events_fire( properties, "consumer-fatal-error", NULL );
+		goto on_fatal_error;
+	}
+
+	// Allocate picture
+	enum AVPixelFormat pix_fmt = AV_PIX_FMT_NONE;
+	if ( enc_ctx->video_st ) {
+#if defined(AVFILTER) && LIBAVUTIL_VERSION_MAJOR >= 56
+		pix_fmt = enc_ctx->video_st->codec->pix_fmt == AV_PIX_FMT_VAAPI ?
+				   AV_PIX_FMT_NV12 : enc_ctx->video_st->codec->pix_fmt;
+#else
+		pix_fmt = enc_ctx->video_st->codec->pix_fmt;
+#endif
+		converted_avframe = alloc_picture( pix_fmt, width, height );
+		if ( !converted_avframe ) {
+			mlt_log_error( MLT_CONSUMER_SERVICE( consumer ), "failed to allocate video AVFrame\n" );
+			mlt_events_fire( properties, "consumer-fatal-error", NULL );
+			goto on_fatal_error;
+		}
+	}
+
+	// Allocate audio AVFrame
+	if ( enc_ctx->audio_st[0] )
+	{
+		enc_ctx->audio_avframe = av_frame_alloc();
+		if ( enc_ctx->audio_avframe ) {
+			AVCodecContext *c = enc_ctx->audio_st[0]->codec;
+			enc_ctx->audio_avframe->format = c->sample_fmt;
+			enc_ctx->audio_avframe->nb_samples = enc_ctx->audio_input_frame_size;
+			enc_ctx->audio_avframe->channel_layout = c->channel_layout;
+#if LIBAVCODEC_VERSION_INT >= ((57<<16)+(96<<8)) && LIBAVCODEC_VERSION_MICRO >= 100
+			enc_ctx->audio_avframe->channels = c->channels;
+#endif
+		} else {
+			mlt_log_error( MLT_CONSUMER_SERVICE(consumer), "failed to allocate audio AVFrame\n" );
+			mlt_events_fire( properties, "consumer-fatal-error", NULL );
+			goto on_fatal_error;
+		}
+	}
+
+	// Start the encoding pipeline
+	if ( mlt_properties_get_int( properties, "pipeline" ) > 0 )
+		pipeline = pipeline_init( enc_ctx, mlt_properties_get_int( properties, "pipeline" ), pix_fmt,
+			width, height, img_fmt, dst_colorspace, dst_full_range );
+
+	// Get the starting time (can ignore the times above)
+	gettimeofday( &ante, NULL );
+
+	// Loop while running
+	while( mlt_properties_get_int( properties, "running" ) &&
+	       ( !enc_ctx->terminated || ( enc_ctx->video_st && mlt_deque_count( queue ) ) ) )
+	{
+		if ( !frame )
+			frame = mlt_consumer_rt_frame( consumer );
+
+		// Check that we have a frame to work with
+		if ( frame != NULL )
+		{
+			// Default audio args
+			frame_properties = MLT_FRAME_PROPERTIES( frame );
+
+			// Write the stream header.
+			if ( !header_written )
+			{
+				// set timecode from first frame if not been set from metadata
+				if( !mlt_properties_get( properties, "timecode" ) )
+				{
+					char *vitc = mlt_properties_get( frame_properties, "meta.attr.vitc.markup" );
+					if ( vitc && vitc[0] )
+					{
+						mlt_log_debug( MLT_CONSUMER_SERVICE( consumer ), "timecode=[%s]\n", vitc );
+						av_dict_set( &enc_ctx->oc->metadata, "timecode", vitc, 0 );
+
+						if ( enc_ctx->video_st )
+							av_dict_set( &enc_ctx->video_st->metadata, "timecode", vitc, 0 );
+					};
+				};
+
+				if ( avformat_write_header( enc_ctx->oc, NULL ) < 0 )
+				{
+					mlt_log_error( MLT_CONSUMER_SERVICE( consumer ), "Could not write header '%s'\n", filename );
+					mlt_events_fire( properties, "consumer-fatal-error", NULL );
+					goto on_fatal_error;
+				}
+
+				header_written = 1;
+			}
+
+			// Increment frames dispatched
+			frames ++;
+
+			// Check for the terminated condition
+			enc_ctx->terminated = enc_ctx->terminate_on_pause && mlt_properties_get_double( frame_properties, "_speed" ) == 0.0;
+
+			// Get audio and append to the fifo
+			if ( !enc_ctx->terminated && enc_ctx->audio_st[0] )
+			{
+				samples = mlt_audio_calculate_frame_samples( fps, enc_ctx->frequency, count ++ );
+				enc_ctx->channels = enc_ctx->total_channels;
+				mlt_frame_get_audio( frame, &pcm, &aud_fmt, &enc_ctx->frequency, &enc_ctx->channels, &samples );
+
+				// Save the audio channel remap properties for later
+				mlt_properties_pass( enc_ctx->frame_meta_properties, frame_properties, "meta.map.audio." );
+
+				// Create the fifo if we don't have one
+				if ( enc_ctx->fifo == NULL )
+				{
+					enc_ctx->fifo = sample_fifo_init( enc_ctx->frequency, enc_ctx->channels );
+					mlt_properties_set_data( properties, "sample_fifo", enc_ctx->fifo, 0, ( mlt_destructor )sample_fifo_close, NULL );
+				}
+				if ( pcm )
+				{
+					// Silence if not normal forward speed
+					if ( mlt_properties_get_double( frame_properties, "_speed" ) != 1.0 )
+						memset( pcm, 0, samples * enc_ctx->channels * enc_ctx->sample_bytes );
+
+					// Append the samples
+					sample_fifo_append( enc_ctx->fifo, pcm, samples * enc_ctx->channels * enc_ctx->sample_bytes );
+					total_time += ( samples * 1000000 ) / enc_ctx->frequency;
+				}
+				if ( !enc_ctx->video_st )
+					mlt_events_fire( properties, "consumer-frame-show", frame, NULL );
+			}
+
+			// Encode the image
+			if ( !enc_ctx->terminated && enc_ctx->video_st )
+				mlt_deque_push_back( queue, frame );
+			else
+				mlt_frame_close( frame );
+			frame = NULL;
+		}
+
+		// While we have stuff to process, process...
+		while ( 1 )
+		{
+			// Write interleaved audio and video frames
+			if ( !enc_ctx->video_st || ( enc_ctx->video_st && enc_ctx->audio_st[0] && enc_ctx->audio_pts < enc_ctx->video_pts ) )
+			{
+				// Write audio
+				int fifo_frames = sample_fifo_used( enc_ctx->fifo ) /
+					( enc_ctx->audio_input_frame_size * enc_ctx->channels * enc_ctx->sample_bytes );
+				if ( ( enc_ctx->video_st && enc_ctx->terminated ) || fifo_frames )
+				{
+					int r = pipeline ? pipeline_audio( pipeline ) : encode_audio( enc_ctx );
+
+					if ( r > 0 )
+						break;
+					else if ( r < 0 )
+						goto on_fatal_error;
+				}
+				else
+				{
+					break;
+				}
+			}
+			else if ( pipeline && mlt_deque_count( queue ) )
+			{
+				// Queue video
+				if ( pipeline_video( pipeline, mlt_deque_pop_front( queue ) ) )
+					goto on_fatal_error;
+			}
+			else if ( enc_ctx->video_st )
+			{
+				// Write video
+				if ( mlt_deque_count( queue ) )
+				{
+					int ret = 0;
+					AVCodecContext *c = enc_ctx->video_st->codec;
+
+					frame = mlt_deque_pop_front( queue );
+					frame_properties = MLT_FRAME_PROPERTIES( frame );
+
+					if ( mlt_properties_get_int( frame_properties, "rendered" ) || !avframe )
+					{
+						mlt_frame_get_image( frame, &image, &img_fmt, &img_width, &img_height, 0 );
+						convert_image( properties, frame, image, img_fmt, width, height, converted_avframe,
+							dst_colorspace, dst_full_range );
+
+#if defined(AVFILTER) && LIBAVUTIL_VERSION_MAJOR >= 56
+						if (AV_PIX_FMT_VAAPI == c->pix_fmt) {
+							AVFilterContext *vfilter_in = mlt_properties_get_data(properties, "vfilter_in", NULL);
+							AVFilterContext *vfilter_out = mlt_properties_get_data(properties, "vfilter_out", NULL);
+							if (vfilter_in && vfilter_out) {
+								if (!avframe)
+									avframe = av_frame_alloc();									
+								ret = av_buffersrc_add_frame(vfilter_in, converted_avframe);
+								ret = av_buffersink_get_frame(vfilter_out, avframe);
+								if (ret < 0) {
+									mlt_log_warning(MLT_CONSUMER_SERVICE(consumer), "error with hwupload: %d (frame %d)\n", ret, enc_ctx->frame_count);
+									if (++enc_ctx->error_count > 2)
+										goto on_fatal_error;
+									ret = 0;
+								}
+							}
+						} else {
+							avframe = converted_avframe;
+						}
+#else
+						avframe = converted_avframe;
+#endif
+					}
+
+#ifdef AVFMT_RAWPICTURE
+					if (enc_ctx->oc->oformat->flags & AVFMT_RAWPICTURE)
+					{
+	 					// raw video case. The API will change slightly in the near future for that
+						AVPacket pkt;
+						av_init_packet(&pkt);
+
+						// Set frame interlace hints
+						if ( mlt_properties_get_int( frame_properties, "progressive" ) )
+							c->field_order = AV_FIELD_PROGRESSIVE;
+						else
+							c->field_order = (mlt_properties_get_int( frame_properties, "top_field_first" )) ? AV_FIELD_TB : AV_FIELD_BT;
+						pkt.flags |= AV_PKT_FLAG_KEY;
+						pkt.stream_index = enc_ctx->video_st->index;
+						pkt.data = (uint8_t*) avframe;
+						pkt.size = sizeof(AVPicture);
+
+						ret = av_write_frame(enc_ctx->oc, &pkt);
+					} 
+					else 
+#endif
+					{
+						AVPacket pkt;
+						av_init_packet( &pkt );
+						if ( c->codec->id == AV_CODEC_ID_RAWVIDEO ) {
+							pkt.data = NULL;
+							pkt.size = 0;
+						} else {
+							pkt.data = video_outbuf;
+							pkt.size = video_outbuf_size;
+						}
+
+						// Set the quality
+						avframe->quality = c->global_quality;
+						avframe->pts = enc_ctx->frame_count;
+
+						// Set frame interlace hints
+						avframe->interlaced_frame = !mlt_properties_get_int( frame_properties, "progressive" );
+						avframe->top_field_first = mlt_properties_get_int( frame_properties, "top_field_first" );
+						if ( mlt_properties_get_int( frame_properties, "progressive" ) )
+							c->field_order = AV_FIELD_PROGRESSIVE;
+						else if ( c->codec_id == AV_CODEC_ID_MJPEG )
+							c->field_order = (mlt_properties_get_int( frame_properties, "top_field_first" )) ? AV_FIELD_TT : AV_FIELD_BB;
+						else
+							c->field_order = (mlt_properties_get_int( frame_properties, "top_field_first" )) ? AV_FIELD_TB : AV_FIELD_BT;
+
+	 					// Encode the image
+#if LIBAVCODEC_VERSION_INT >= ((57<<16)+(37<<8)+0)
+						ret = avcodec_send_frame( c, avframe );
+						if ( ret < 0 ) {
+							pkt.size = ret;
+						} else {
+receive_video_packet:
+							ret = avcodec_receive_packet( c, &pkt );
+							if ( ret == AVERROR(EAGAIN) || ret == AVERROR_EOF )
+								pkt.size = ret = 0;
+							else if ( ret < 0 )
+								pkt.size = ret;
+						}
+#else
+						int got_packet;
+						ret = avcodec_encode_video2( c, &pkt, avframe, &got_packet );
+						if ( ret < 0 )
+							pkt.size = ret;
+						else if ( !got_packet )
+							pkt.size = 0;
+#endif
+
+	 					// If zero size, it means the image was buffered
+						if ( pkt.size > 0 )
+						{
+							if ( pkt.pts != AV_NOPTS_VALUE )
+								pkt.pts = av_rescale_q( pkt.pts, c->time_base, enc_ctx->video_st->time_base );
+							if ( pkt.dts != AV_NOPTS_VALUE )
+								pkt.dts = av_rescale_q( pkt.dts, c->time_base, enc_ctx->video_st->time_base );
+							pkt.stream_index = enc_ctx->video_st->index;
+
+							// write the compressed frame in the media file
+							ret = av_interleaved_write_frame(enc_ctx->oc, &pkt);
+							mlt_log_debug( MLT_CONSUMER_SERVICE( consumer ), " frame_size %d\n", c->frame_size );
+							
+							// Dual pass logging
+							if ( mlt_properties_get_data( properties, "_logfile", NULL ) && c->stats_out )
+								fprintf( mlt_properties_get_data( properties, "_logfile", NULL ), "%s", c->stats_out );
+
+							enc_ctx->error_count = 0;
+
+#if LIBAVCODEC_VERSION_INT >= ((57<<16)+(37<<8)+0)
+							if ( !ret )
+								goto receive_video_packet;
+#endif
+						}
+						else if ( pkt.size < 0 )
+						{
+							mlt_log_warning( MLT_CONSUMER_SERVICE(consumer), "error with video encode: %d (frame %d)\n", pkt.size, enc_ctx->frame_count );
+							if ( ++enc_ctx->error_count > 2 )
+								goto on_fatal_error;
+							ret = 0;
+						}
+ 					}
+					enc_ctx->frame_count++;
+					enc_ctx->video_pts = (double) enc_ctx->frame_count * av_q2d( enc_ctx->video_st->codec->time_base );
+					if ( ret )
+					{
+						mlt_log_fatal( MLT_CONSUMER_SERVICE(consumer), "error writing video frame: %d\n", ret );
+						mlt_events_fire( properties, "consumer-fatal-error", NULL );
+						goto on_fatal_error;
+					}
+					mlt_frame_close( frame );
+					frame = NULL;
+#if defined(AVFILTER) && LIBAVUTIL_VERSION_MAJOR >= 56
+					if (AV_PIX_FMT_VAAPI == c->pix_fmt)
+						av_frame_unref( avframe );
+#endif
+				}
+				else
+				{
+					break;
+				}
+			}
+			if ( enc_ctx->audio_st[0] )
+				mlt_log_debug( MLT_CONSUMER_SERVICE( consumer ), "audio pts %f ", enc_ctx->audio_pts );
+			if ( enc_ctx->video_st )
+				mlt_log_debug( MLT_CONSUMER_SERVICE( consumer ), "video pts %f ", enc_ctx->video_pts );
+			mlt_log_debug( MLT_CONSUMER_SERVICE( consumer ), "\n" );
+		}
+
+		if ( real_time_output == 1 && frames % 2 == 0 )
+		{
+			long passed = time_difference( &ante );
+			if ( enc_ctx->fifo != NULL )
+			{
+				long pending = ( ( ( long )sample_fifo_used( enc_ctx->fifo ) / enc_ctx->sample_bytes * 1000 ) / enc_ctx->frequency ) * 1000;
+				passed -= pending;
+			}
+			if ( passed < total_time )
+			{
+				long total = ( total_time - passed );
+				struct timespec t = { total / 1000000, ( total % 1000000 ) * 1000 };
+				nanosleep( &t, NULL );
+			}
+		}
+	}
+
+	// Finish writing the queued frames before flushing
+	if ( pipeline )
 	{
-		enc_ctx->audio_avframe = av_frame_alloc();
-		if ( enc_ctx->audio_avframe ) {
-			AVCodecContext *c = enc_ctx->audio_st[0]->codec;
-			enc_ctx->audio_avframe->format = c->sample_fmt;
-			enc_ctx->audio_avframe->nb_samples = enc_ctx->audio_input_frame_size;
-			enc_ctx->audio_avframe->channel_layout = c->channel_layout;
-#if LIBAVCODEC_VERSION_INT >= ((57<<16)+(96<<8)) && LIBAVCODEC_VERSION_MICRO >= 100
-			enc_ctx->audio_avframe->channels = c->channels;
+		int error = pipeline_close( pipeline );
+		pipeline = NULL;
+		if ( error )
+			goto on_fatal_error;
+	}
+
+	// Flush the encoder buffers
+	if ( real_time_output <= 0 )
+	{
+		// Flush audio fifo
+		// TODO: flush all audio streams
+		if ( enc_ctx->fifo && enc_ctx->audio_st[0] ) for (;;)
+		{
+			int sz = sample_fifo_used( enc_ctx->fifo );
+			int ret = encode_audio( enc_ctx );
+
+			mlt_log_debug( MLT_CONSUMER_SERVICE( consumer ), "flushing audio: sz=%d, ret=%d\n", sz, ret );
+
+			if ( !sz || ret < 0 )
+				break;
+		}
+
+		// Flush video
+#ifdef AVFMT_RAWPICTURE
+        if ( enc_ctx->video_st && !( enc_ctx->oc->oformat->flags & AVFMT_RAWPICTURE ) ) for (;;)
+#else
+        if ( enc_ctx->video_st ) for (;;)
 #endif
-		} else {
-			mlt_log_error( MLT_CONSUMER_SERVICE(consumer), "failed to allocate audio AVFrame\n" );
-			mlt_events_fire( properties, "consumer-fatal-error", NULL );
-			goto on_fatal_error;
+		{
+			AVCodecContext *c = enc_ctx->video_st->codec;
+			AVPacket pkt;
+			av_init_packet( &pkt );
+			if ( c->codec->id == AV_CODEC_ID_RAWVIDEO ) {
+				pkt.data = NULL;
+				pkt.size = 0;
+			} else {
+				pkt.data = video_outbuf;
+				pkt.size = video_outbuf_size;
+			}
+
+			// Encode the image
+#if LIBAVCODEC_VERSION_INT >= ((57<<16)+(37<<8)+0)
+			int ret;
+			while ( (ret = avcodec_receive_packet( c, &pkt )) == AVERROR(EAGAIN) ) {
+				ret = avcodec_send_frame( c, NULL );
+				if ( ret < 0 ) {
+					mlt_log_warning( MLT_CONSUMER_SERVICE(consumer), "error with video encode: %d\n", ret );
+					break;
+				}
+			}
+#else
+			int got_packet = 0;
+			int ret = avcodec_encode_video2( c, &pkt, NULL, &got_packet );
+			if ( ret < 0 )
+				pkt.size = ret;
+			else if ( !got_packet )
+				pkt.size = 0;
+#endif
+			mlt_log_debug( MLT_CONSUMER_SERVICE( consumer ), "flushing video size %d\n", pkt.size );
+			if ( pkt.size < 0 )
+				break;
+			// Dual pass logging
+			if ( mlt_properties_get_data( properties, "_logfile", NULL ) && c->stats_out )
+				fprintf( mlt_properties_get_data( properties, "_logfile", NULL ), "%s", c->stats_out );
+			if ( !pkt.size )
+				break;
+
+			if ( pkt.pts != AV_NOPTS_VALUE )
+				pkt.pts = av_rescale_q( pkt.pts, c->time_base, enc_ctx->video_st->time_base );
+			if ( pkt.dts != AV_NOPTS_VALUE )
+				pkt.dts = av_rescale_q( pkt.dts, c->time_base, enc_ctx->video_st->time_base );
+			pkt.stream_index = enc_ctx->video_st->index;
+
+			// write the compressed frame in the media file
+			if ( av_interleaved_write_frame( enc_ctx->oc, &pkt ) != 0 )
+			{
+				mlt_log_fatal( MLT_CONSUMER_SERVICE(consumer), "error writing flushed video frame\n" );
+				mlt_events_fire( properties, "consumer-fatal-error", NULL );
+				goto on_fatal_error;
+			}
 		}
 	}
 
-	// Get the starting time (can ignore the times above)
-	gettimeofday( &ante, NULL );
+on_fatal_error:
 
-	// Loop while running
-	while( mlt_properties_get_int( properties, "running" ) &&
-	       ( !enc_ctx->terminated || ( enc_ctx->video_st && mlt_deque_count( queue ) ) ) )
+	if ( pipeline )
+		pipeline_close( pipeline );
+	if ( frame )
+		mlt_frame_close( frame );
+
+	// Write the trailer, if any
+	if ( frames )
+		av_write_trailer( enc_ctx->oc );
+
+	// Clean up input and output frames
+	if ( converted_avframe )
+		av_free( converted_avframe->data[0] );
+	av_free( converted_avframe );
+#if defined(AVFILTER) && LIBAVUTIL_VERSION_MAJOR >= 56
+	if (enc_ctx->video_st && enc_ctx->video_st->codec && AV_PIX_FMT_VAAPI == enc_ctx->video_st->codec->pix_fmt)
+		av_frame_free(&avframe);
+#endif
+	av_free( video_outbuf );
+	av_free( enc_ctx->audio_avframe );
+
+	// close each codec
+	if ( enc_ctx->video_st )
+		close_video(enc_ctx->oc, enc_ctx->video_st);
+	for ( i = 0; i < MAX_AUDIO_STREAMS && enc_ctx->audio_st[i]; i++ )
+		close_audio( enc_ctx->oc, enc_ctx->audio_st[i] );
+
+	// Free the streams
+	for ( i = 0; i < enc_ctx->oc->nb_streams; i++ )
+		av_freep( &enc_ctx->oc->streams[i] );
+
+	// Close the output file
+	if ( !( fmt->flags & AVFMT_NOFILE ) &&
+		!mlt_properties_get_int( properties, "redirect" ) )
 	{
-		if ( !frame )
-			frame = mlt_consumer_rt_frame( consumer );
+		if ( enc_ctx->oc->pb  ) avio_close( enc_ctx->oc->pb );
+	}
 
-		// Check that we have a frame to work with
-		if ( frame != NULL )
+	// Free the stream
+	av_free( enc_ctx->oc );
+
+	// Just in case we terminated on pause
+	mlt_consumer_stopped( consumer );
+	mlt_properties_close( enc_ctx->frame_meta_properties );
+
+	if ( mlt_properties_get_int( properties, "pass" ) > 1 )
+	{
+		// Remove the dual pass log file
+		if ( mlt_properties_get( properties, "_logfilename" ) )
+			remove( mlt_properties_get( properties, "_logfilename" ) );
+
+		// Remove the x264 dual pass logs
+		char *cwd = getcwd( NULL, 0 );
+		const char *file = "x264_2pass.log";
+		char *full = malloc( strlen( cwd ) + strlen( file ) + 2 );
+		sprintf( full, "%s/%s", cwd, file );
+		remove( full );
+		free( full );
+		file = "x264_2pass.log.temp";
+		full = malloc( strlen( cwd ) + strlen( file ) + 2 );
+		sprintf( full, "%s/%s", cwd, file );
+		remove( full );
+		free( full );
+		file = "x264_2pass.log.mbtree";
+		full = malloc( strlen( cwd ) + strlen( file ) + 2 );
+		sprintf( full, "%s/%s", cwd, file );
+		remove( full );
+		free( full );
+		free( cwd );
+		remove( "x264_2pass.log.temp" );
+
+		// Recent versions of libavcodec/x264 support passlogfile and need cleanup if specified.
+		if ( !mlt_properties_get( properties, "_logfilename" ) &&
+		      mlt_properties_get( properties, "passlogfile" ) )
 		{
-			// Default audio args
-			frame_properties = MLT_FRAME_PROPERTIES( frame );
+			mlt_properties_get( properties, "passlogfile" );
+			file = mlt_properties_get( properties, "passlogfile" );
+			remove( file );
+			full = malloc( strlen( file ) + strlen( ".mbtree" ) + 1 );
+			sprintf( full, "%s.mbtree", file );
+			remove( full );
+			free( full );
+		}
+	}
 
-			// Write the stream header.
-			if ( !header_written )
-			{
-				// set timecode from first frame if not been set from metadata
-				if( !mlt_properties_get( properties, "timecode" ) )
-				{
-					char *vitc = mlt_properties_get( frame_properties, "meta.attr.vitc.markup" );
-					if ( vitc && vitc[0] )
-					{
-						mlt_log_debug( MLT_CONSUMER_SERVICE( consumer ), "timecode=[%s]\n", vitc );
-						av_dict_set( &enc_ctx->oc->metadata, "timecode", vitc, 0 );
+	while ( ( frame = mlt_deque_pop_back( queue ) ) )
+		mlt_frame_close( frame );
 
-						if ( enc_ctx->video_st )
-							av_dict_set( &enc_ctx->video_st->metadata, "timecode", vitc, 0 );
-					};
-				};
+	mlt_pool_release( enc_ctx );
 
-				if ( avformat_write_header( enc_ctx->oc, NULL ) < 0 )
-				{
-					mlt_log_error( MLT_CONSUMER_SERVICE( consumer ), "Could not write header '%s'\n", filename );
-					mlt_events_fire( properties, "consumer-fatal-error", NULL );
-					goto on_fatal_error;
-				}
+	return NULL;
+}
 
-				header_written = 1;
+#if LIBAVCODEC_VERSION_INT >= ((57<<16)+(37<<8)+0)
+
+static int segments_open( const char *filename, AVFormatContext **context, int *video_index )
+{
+	if ( avformat_open_input( context, filename, NULL, NULL ) < 0 )
+		return 1;
+	if ( avformat_find_stream_info( *context, NULL ) < 0 )
+		return 1;
+	if ( video_index )
+		*video_index = av_find_best_stream( *context, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0 );
+	return video_index && *video_index < 0;
+}
+
+static AVStream *segments_add_stream( AVFormatContext *oc, AVStream *in, AVCodecParameters *par )
+{
+	AVStream *st = avformat_new_stream( oc, NULL );
+
+	if ( st )
+	{
+		avcodec_parameters_copy( st->codecpar, par );
+		st->codecpar->codec_tag = 0;
+		st->time_base = in->time_base;
+		st->avg_frame_rate = in->avg_frame_rate;
+		st->sample_aspect_ratio = in->sample_aspect_ratio;
+		av_dict_copy( &st->metadata, in->metadata, 0 );
+	}
+	return st;
+}
+
+/** A range of the output whose video is either rendered or copied from a source.
+*/
+
+typedef struct
+{
+	// The position of the first frame relative to the start of the render
+	mlt_position start;
+	mlt_position length;
+	// The rendered segment or the source of the copied packets
+	char *file;
+	int copy;
+	// The video stream of the source and the timestamps of the key frame
+	// that starts the range and the one after it (AV_NOPTS_VALUE at the end)
+	int index;
+	int64_t from;
+	int64_t to;
+} segment_t;
+
+static void segments_append( segment_t **segments, int *count, segment_t *segment )
+{
+	*segments = realloc( *segments, ( *count + 1 ) * sizeof( segment_t ) );
+	( *segments )[ ( *count )++ ] = *segment;
+}
+
+/** Check whether H.264 or HEVC video has length prefixed NAL units as in MP4.
+*/
+
+static int segments_is_avcc( AVCodecParameters *par )
+{
+	return ( par->codec_id == AV_CODEC_ID_H264 || par->codec_id == AV_CODEC_ID_HEVC ) &&
+		par->extradata_size > 0 && par->extradata[0] == 1;
+}
+
+/** Check whether H.264 or HEVC video has start codes (Annex B).
+*/
+
+static int segments_is_annexb( AVCodecParameters *par )
+{
+	return ( par->codec_id == AV_CODEC_ID_H264 || par->codec_id == AV_CODEC_ID_HEVC ) && !segments_is_avcc( par );
+}
+
+/** Create the bitstream filter that converts the packets of a stream to the framing of the output.
+ *
+ * Formats without global headers need H.264 and HEVC with start codes.
+ * \return 0 with a NULL filter if no conversion is needed, or a negative error
+*/
+
+static int segments_filter( AVStream *st, AVOutputFormat *fmt, AVBSFContext **bsf )
+{
+	AVCodecParameters *par = st->codecpar;
+	const AVBitStreamFilter *filter;
+	int ret;
+
+	*bsf = NULL;
+	if ( ( fmt->flags & AVFMT_GLOBALHEADER ) || !segments_is_avcc( par ) )
+		return 0;
+	filter = av_bsf_get_by_name( par->codec_id == AV_CODEC_ID_H264 ? "h264_mp4toannexb" : "hevc_mp4toannexb" );
+	if ( !filter )
+		return AVERROR_BSF_NOT_FOUND;
+	if ( ( ret = av_bsf_alloc( filter, bsf ) ) < 0 )
+		return ret;
+	avcodec_parameters_copy( ( *bsf )->par_in, par );
+	( *bsf )->time_base_in = st->time_base;
+	if ( ( ret = av_bsf_init( *bsf ) ) < 0 )
+		av_bsf_free( bsf );
+	return ret;
+}
+
+static int segments_open_segment( segment_t *segment, AVOutputFormat *fmt, AVFormatContext **context,
+	int *video_index, int64_t *start_time, AVBSFContext **bsf )
+{
+	AVStream *st;
+
+	*bsf = NULL;
+	if ( segments_open( segment->file, context, segment->copy ? NULL : video_index ) )
+		return 1;
+	if ( segment->copy )
+	{
+		*video_index = segment->index;
+		if ( *video_index < 0 || *video_index >= ( *context )->nb_streams )
+			return 1;
+		av_seek_frame( *context, *video_index, segment->from, AVSEEK_FLAG_BACKWARD );
+		*start_time = segment->from;
+	}
+	else
+	{
+		st = ( *context )->streams[ *video_index ];
+		*start_time = st->start_time != AV_NOPTS_VALUE ? st->start_time : 0;
+	}
+	return segments_filter( ( *context )->streams[ *video_index ], fmt, bsf ) < 0;
+}
+
+/** Read the next video packet of a segment.
+ *
+ * The packets of a copied range start with its key frame and stop before
+ * the key frame that follows it. Returns 0 at the end of the segment.
+*/
+
+static int segments_read( segment_t *segment, AVFormatContext *context, int video_index, int *started, AVPacket *pkt )
+{
+	while ( av_read_frame( context, pkt ) >= 0 )
+	{
+		int key = pkt->flags & AV_PKT_FLAG_KEY;
+
+		if ( pkt->stream_index == video_index && !segment->copy )
+			return 1;
+		if ( pkt->stream_index == video_index && pkt->pts != AV_NOPTS_VALUE )
+		{
+			if ( key && pkt->pts == segment->from )
+				*started = 1;
+			else if ( *started && key && pkt->pts == segment->to )
+			{
+				av_packet_unref( pkt );
+				return 0;
 			}
+			if ( *started && pkt->pts >= segment->from )
+				return 1;
+		}
+		av_packet_unref( pkt );
+	}
+	return 0;
+}
 
-			// Increment frames dispatched
-			frames ++;
+/** Check that the video of every segment can share one stream of the output.
+ *
+ * Packets from different encodings can only share a stream if all of the
+ * parameters that the stream header carries are the same, including the
+ * codec profile and level and the decoder configuration (extradata), as
+ * the players initialize the decoder only once. The parameters of a copied
+ * segment are compared after converting it to the framing of the output.
+ * \return 1 if a segment cannot be read, 2 if they differ, or 0
+*/
 
-			// Check for the terminated condition
-			enc_ctx->terminated = enc_ctx->terminate_on_pause && mlt_properties_get_double( frame_properties, "_speed" ) == 0.0;
+static int segments_check( segment_t *segments, int count, AVOutputFormat *fmt )
+{
+	AVFormatContext *first = NULL;
+	AVBSFContext *first_bsf = NULL;
+	AVCodecParameters *expected;
+	int64_t start_time;
+	int i, index = -1, error = 0;
+
+	if ( segments_open_segment( &segments[0], fmt, &first, &index, &start_time, &first_bsf ) )
+	{
+		avformat_close_input( &first );
+		return 1;
+	}
+	expected = first_bsf ? first_bsf->par_out : first->streams[ index ]->codecpar;
+	for ( i = 1; i < count && !error; i++ )
+	{
+		AVFormatContext *other = NULL;
+		AVBSFContext *bsf = NULL;
+		AVCodecParameters *par;
+		int other_index = -1;
+
+		if ( segments_open_segment( &segments[i], fmt, &other, &other_index, &start_time, &bsf ) )
+		{
+			error = 1;
+		}
+		else
+		{
+			par = bsf ? bsf->par_out : other->streams[ other_index ]->codecpar;
+			if ( par->codec_id != expected->codec_id || par->format != expected->format ||
+			     par->width != expected->width || par->height != expected->height ||
+			     av_cmp_q( par->sample_aspect_ratio, expected->sample_aspect_ratio ) ||
+			     par->field_order != expected->field_order || par->color_range != expected->color_range ||
+			     par->color_primaries != expected->color_primaries || par->color_trc != expected->color_trc ||
+			     par->color_space != expected->color_space ||
+			     par->profile != expected->profile || par->level != expected->level ||
+			     par->extradata_size != expected->extradata_size ||
+			     ( par->extradata_size && memcmp( par->extradata, expected->extradata, par->extradata_size ) ) )
+				error = 2;
+		}
+		av_bsf_free( &bsf );
+		avformat_close_input( &other );
+	}
+	av_bsf_free( &first_bsf );
+	avformat_close_input( &first );
+
+	return error;
+}
 
-			// Get audio and append to the fifo
-			if ( !enc_ctx->terminated && enc_ctx->audio_st[0] )
-			{
-				samples = mlt_audio_calculate_frame_samples( fps, enc_ctx->frequency, count ++ );
-				enc_ctx->channels = enc_ctx->total_channels;
-				mlt_frame_get_audio( frame, &pcm, &aud_fmt, &enc_ctx->frequency, &enc_ctx->channels, &samples );
+/** Join the video of the segments and the audio into the output without encoding again.
+ *
+ * The timestamps of each segment are moved to follow the previous one
+ * according to the position of its first frame. Returns 2 if the streams
+ * have different parameters, which the output cannot carry in one stream,
+ * or if the timestamps do not increase across a boundary.
+*/
 
-				// Save the audio channel remap properties for later
-				mlt_properties_pass( enc_ctx->frame_meta_properties, frame_properties, "meta.map.audio." );
+static int segments_join( mlt_consumer consumer, AVOutputFormat *fmt, const char *filename,
+	segment_t *segments, int count, const char *audio_file )
+{
+	mlt_properties properties = MLT_CONSUMER_PROPERTIES( consumer );
+	mlt_profile profile = mlt_service_profile( MLT_CONSUMER_SERVICE( consumer ) );
+	AVRational frame_duration = { profile->frame_rate_den, profile->frame_rate_num };
+	AVFormatContext *oc = NULL;
+	AVFormatContext *video = NULL;
+	AVFormatContext *audio = NULL;
+	AVBSFContext *bsf = NULL;
+	AVStream *video_st = NULL;
+	AVStream *audio_st[ MAX_AUDIO_STREAMS ];
+	AVPacket video_pkt, audio_pkt;
+	int have_video = 0, have_audio = 0, started = 0;
+	int video_index = -1, segment = 0;
+	int64_t first_start = 0, start_time = 0, delta = 0, last_dts = AV_NOPTS_VALUE;
+	AVRational first_time_base;
+	int i, error = 1;
+
+	memset( audio_st, 0, sizeof( audio_st ) );
+	av_init_packet( &video_pkt );
+	av_init_packet( &audio_pkt );
+
+	if ( ( error = segments_check( segments, count, fmt ) ) )
+		goto on_error;
+	error = 1;
+	if ( segments_open_segment( &segments[0], fmt, &video, &video_index, &first_start, &bsf ) )
+		goto on_error;
+	if ( audio_file && segments_open( audio_file, &audio, NULL ) )
+		goto on_error;
+	first_time_base = video->streams[ video_index ]->time_base;
+
+	// Create the output with the streams of the first segment and the audio
+	avformat_alloc_output_context2( &oc, fmt, NULL, filename );
+	if ( !oc )
+		goto on_error;
+	oc->max_delay = ( int )( mlt_properties_get_double( properties, "muxdelay" ) * AV_TIME_BASE );
+	apply_properties( oc, properties, AV_OPT_FLAG_ENCODING_PARAM );
+	if ( oc->oformat->priv_class && oc->priv_data )
+		apply_properties( oc->priv_data, properties, AV_OPT_FLAG_ENCODING_PARAM );
+	if ( !segments[0].copy )
+		av_dict_copy( &oc->metadata, video->metadata, 0 );
+	if ( !( video_st = segments_add_stream( oc, video->streams[ video_index ],
+			bsf ? bsf->par_out : video->streams[ video_index ]->codecpar ) ) )
+		goto on_error;
+	for ( i = 0; audio && i < audio->nb_streams && i < MAX_AUDIO_STREAMS; i++ )
+		if ( audio->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO )
+			audio_st[i] = segments_add_stream( oc, audio->streams[i], audio->streams[i]->codecpar );
+	if ( !( fmt->flags & AVFMT_NOFILE ) && avio_open( &oc->pb, filename, AVIO_FLAG_WRITE ) < 0 )
+	{
+		mlt_log_error( MLT_CONSUMER_SERVICE( consumer ), "Could not open '%s'\n", filename );
+		goto on_error;
+	}
+	if ( avformat_write_header( oc, NULL ) < 0 )
+	{
+		mlt_log_error( MLT_CONSUMER_SERVICE( consumer ), "Could not write header '%s'\n", filename );
+		goto on_error;
+	}
 
-				// Create the fifo if we don't have one
-				if ( enc_ctx->fifo == NULL )
+	// Copy the packets interleaved by their decoding timestamps
+	while ( 1 )
+	{
+		while ( !have_video && video )
+		{
+			AVStream *in = video->streams[ video_index ];
+
+			if ( segments_read( &segments[ segment ], video, video_index, &started, &video_pkt ) )
+			{
+				if ( bsf && ( av_bsf_send_packet( bsf, &video_pkt ) < 0 || av_bsf_receive_packet( bsf, &video_pkt ) < 0 ) )
+					goto on_error;
+				if ( video_pkt.pts != AV_NOPTS_VALUE )
+					video_pkt.pts += delta;
+				if ( video_pkt.dts != AV_NOPTS_VALUE )
+					video_pkt.dts += delta;
+				av_packet_rescale_ts( &video_pkt, in->time_base, video_st->time_base );
+				video_pkt.stream_index = video_st->index;
+
+				// The reordering delay of the encodings may differ at a boundary, which cannot be joined
+				if ( ( video_pkt.dts != AV_NOPTS_VALUE && last_dts != AV_NOPTS_VALUE && video_pkt.dts <= last_dts ) ||
+				     ( video_pkt.pts != AV_NOPTS_VALUE && video_pkt.dts != AV_NOPTS_VALUE && video_pkt.pts < video_pkt.dts ) )
 				{
-					enc_ctx->fifo = sample_fifo_init( enc_ctx->frequency, enc_ctx->channels );
-					mlt_properties_set_data( properties, "sample_fifo", enc_ctx->fifo, 0, ( mlt_destructor )sample_fifo_close, NULL );
+					mlt_log_info( MLT_CONSUMER_SERVICE( consumer ), "the timestamps of segment %d do not follow the previous one\n", segment );
+					error = 2;
+					goto on_error;
 				}
-				if ( pcm )
+				if ( video_pkt.dts != AV_NOPTS_VALUE )
+					last_dts = video_pkt.dts;
+				have_video = 1;
+			}
+			else
+			{
+				// Move on to the next segment
+				avformat_close_input( &video );
+				av_bsf_free( &bsf );
+				started = 0;
+				if ( ++segment < count )
 				{
-					// Silence if not normal forward speed
-					if ( mlt_properties_get_double( frame_properties, "_speed" ) != 1.0 )
-						memset( pcm, 0, samples * enc_ctx->channels * enc_ctx->sample_bytes );
-
-					// Append the samples
-					sample_fifo_append( enc_ctx->fifo, pcm, samples * enc_ctx->channels * enc_ctx->sample_bytes );
-					total_time += ( samples * 1000000 ) / enc_ctx->frequency;
+					if ( segments_open_segment( &segments[ segment ], fmt, &video, &video_index, &start_time, &bsf ) )
+						goto on_error;
+					in = video->streams[ video_index ];
+					delta = av_rescale_q( segments[ segment ].start, frame_duration, in->time_base ) +
+						av_rescale_q( first_start, first_time_base, in->time_base ) - start_time;
 				}
-				if ( !enc_ctx->video_st )
-					mlt_events_fire( properties, "consumer-frame-show", frame, NULL );
 			}
-
-			// Encode the image
-			if ( !enc_ctx->terminated && enc_ctx->video_st )
-				mlt_deque_push_back( queue, frame );
-			else
-				mlt_frame_close( frame );
-			frame = NULL;
 		}
-
-		// While we have stuff to process, process...
-		while ( 1 )
+		while ( !have_audio && audio )
 		{
-			// Write interleaved audio and video frames
-			if ( !enc_ctx->video_st || ( enc_ctx->video_st && enc_ctx->audio_st[0] && enc_ctx->audio_pts < enc_ctx->video_pts ) )
+			if ( av_read_frame( audio, &audio_pkt ) >= 0 )
 			{
-				// Write audio
-				int fifo_frames = sample_fifo_used( enc_ctx->fifo ) /
-					( enc_ctx->audio_input_frame_size * enc_ctx->channels * enc_ctx->sample_bytes );
-				if ( ( enc_ctx->video_st && enc_ctx->terminated ) || fifo_frames )
-				{
-					int r = encode_audio(enc_ctx);
-
-					if ( r > 0 )
-						break;
-					else if ( r < 0 )
-						goto on_fatal_error;
-				}
-				else
+				AVStream *out = audio_pkt.stream_index < MAX_AUDIO_STREAMS ? audio_st[ audio_pkt.stream_index ] : NULL;
+				if ( !out )
 				{
-					break;
+					av_packet_unref( &audio_pkt );
+					continue;
 				}
+				av_packet_rescale_ts( &audio_pkt, audio->streams[ audio_pkt.stream_index ]->time_base, out->time_base );
+				audio_pkt.stream_index = out->index;
+				have_audio = 1;
 			}
-			else if ( enc_ctx->video_st )
+			else
 			{
-				// Write video
-				if ( mlt_deque_count( queue ) )
-				{
-					int ret = 0;
-					AVCodecContext *c = enc_ctx->video_st->codec;
-
-					frame = mlt_deque_pop_front( queue );
-					frame_properties = MLT_FRAME_PROPERTIES( frame );
-
-					if ( mlt_properties_get_int( frame_properties, "rendered" ) )
-					{
-						AVFrame video_avframe;
-						mlt_frame_get_image( frame, &image, &img_fmt, &img_width, &img_height, 0 );
-
-						mlt_image_format_planes( img_fmt, width, height, image, video_avframe.data, video_avframe.linesize );
-
-						// Do the colour space conversion
-						int srcfmt = pick_pix_fmt( img_fmt );
-						int flags = mlt_get_sws_flags( width, height, srcfmt, width, height, pix_fmt);
-						struct SwsContext *context = sws_getContext( width, height, srcfmt,
-							width, height, pix_fmt, flags, NULL, NULL, NULL);
-						int src_colorspace = mlt_properties_get_int( frame_properties, "colorspace" );
-						int src_full_range = mlt_properties_get_int( frame_properties, "full_luma" );
-						if ( (src_colorspace && dst_colorspace != src_colorspace) || dst_full_range != src_full_range )
-							mlt_set_luma_transfer( context, src_colorspace, dst_colorspace, src_full_range, dst_full_range );
-						sws_scale( context, (const uint8_t* const*) video_avframe.data, video_avframe.linesize, 0, height,
-							converted_avframe->data, converted_avframe->linesize);
-						sws_freeContext( context );
-
-						mlt_events_fire( properties, "consumer-frame-show", frame, NULL );
-
-						// Apply the alpha if applicable
-						if ( !mlt_properties_get( properties, "mlt_image_format" ) ||
-						     strcmp( mlt_properties_get( properties, "mlt_image_format" ), "rgb24a" ) )
-						if ( c->pix_fmt == AV_PIX_FMT_RGBA ||
-						     c->pix_fmt == AV_PIX_FMT_ARGB ||
-						     c->pix_fmt == AV_PIX_FMT_BGRA )
-						{
-							uint8_t *p;
-							uint8_t *alpha = mlt_frame_get_alpha_mask( frame );
-							register int n;
-
-							for ( i = 0; i < height; i ++ )
-							{
-								n = ( width + 7 ) / 8;
-								p = converted_avframe->data[ 0 ] + i * converted_avframe->linesize[ 0 ] + 3;
-
-								switch( width % 8 )
-								{
-									case 0:	do { *p = *alpha++; p += 4;
-									case 7:		 *p = *alpha++; p += 4;
-									case 6:		 *p = *alpha++; p += 4;
-									case 5:		 *p = *alpha++; p += 4;
-									case 4:		 *p = *alpha++; p += 4;
-									case 3:		 *p = *alpha++; p += 4;
-									case 2:		 *p = *alpha++; p += 4;
-									case 1:		 *p = *alpha++; p += 4;
-											}
-											while( --n );
-								}
-							}
-						}
+				avformat_close_input( &audio );
+			}
+		}
+		if ( !have_video && !have_audio )
+			break;
 
-#if defined(AVFILTER) && LIBAVUTIL_VERSION_MAJOR >= 56
-						if (AV_PIX_FMT_VAAPI == c->pix_fmt) {
-							AVFilterContext *vfilter_in = mlt_properties_get_data(properties, "vfilter_in", NULL);
-							AVFilterContext *vfilter_out = mlt_properties_get_data(properties, "vfilter_out", NULL);
-							if (vfilter_in && vfilter_out) {
-								if (!avframe)
-									avframe = av_frame_alloc();									
-								ret = av_buffersrc_add_frame(vfilter_in, converted_avframe);
-								ret = av_buffersink_get_frame(vfilter_out, avframe);
-								if (ret < 0) {
-									mlt_log_warning(MLT_CONSUMER_SERVICE(consumer), "error with hwupload: %d (frame %d)\n", ret, enc_ctx->frame_count);
-									if (++enc_ctx->error_count > 2)
-										goto on_fatal_error;
-									ret = 0;
-								}
-							}
-						} else {
-							avframe = converted_avframe;
-						}
-#else
-						avframe = converted_avframe;
-#endif
-					}
+		if ( have_video && ( !have_audio || av_compare_ts( video_pkt.dts, video_st->time_base,
+				audio_pkt.dts, oc->streams[ audio_pkt.stream_index ]->time_base ) <= 0 ) )
+		{
+			have_video = 0;
+			if ( av_interleaved_write_frame( oc, &video_pkt ) < 0 )
+				goto on_error;
+		}
+		else
+		{
+			have_audio = 0;
+			if ( av_interleaved_write_frame( oc, &audio_pkt ) < 0 )
+				goto on_error;
+		}
+	}
+	if ( av_write_trailer( oc ) >= 0 )
+		error = 0;
+
+on_error:
+	if ( error == 1 )
+		mlt_log_error( MLT_CONSUMER_SERVICE( consumer ), "failed to join the segments into '%s'\n", filename );
+	av_packet_unref( &video_pkt );
+	av_packet_unref( &audio_pkt );
+	av_bsf_free( &bsf );
+	avformat_close_input( &video );
+	avformat_close_input( &audio );
+	if ( oc )
+	{
+		if ( !( fmt->flags & AVFMT_NOFILE ) )
+			avio_closep( &oc->pb );
+		avformat_free_context( oc );
+	}
 
-#ifdef AVFMT_RAWPICTURE
-					if (enc_ctx->oc->oformat->flags & AVFMT_RAWPICTURE)
-					{
-	 					// raw video case. The API will change slightly in the near future for that
-						AVPacket pkt;
-						av_init_packet(&pkt);
+	return error;
+}
 
-						// Set frame interlace hints
-						if ( mlt_properties_get_int( frame_properties, "progressive" ) )
-							c->field_order = AV_FIELD_PROGRESSIVE;
-						else
-							c->field_order = (mlt_properties_get_int( frame_properties, "top_field_first" )) ? AV_FIELD_TB : AV_FIELD_BT;
-						pkt.flags |= AV_PKT_FLAG_KEY;
-						pkt.stream_index = enc_ctx->video_st->index;
-						pkt.data = (uint8_t*) avframe;
-						pkt.size = sizeof(AVPicture);
+/** Check whether a service has filters other than those attached by the loader.
+*/
 
-						ret = av_write_frame(enc_ctx->oc, &pkt);
-					} 
-					else 
-#endif
-					{
-						AVPacket pkt;
-						av_init_packet( &pkt );
-						if ( c->codec->id == AV_CODEC_ID_RAWVIDEO ) {
-							pkt.data = NULL;
-							pkt.size = 0;
-						} else {
-							pkt.data = video_outbuf;
-							pkt.size = video_outbuf_size;
-						}
+static int smart_filtered( mlt_service service )
+{
+	mlt_filter filter;
+	int i;
 
-						// Set the quality
-						avframe->quality = c->global_quality;
-						avframe->pts = enc_ctx->frame_count;
+	for ( i = 0; ( filter = mlt_service_filter( service, i ) ); i++ )
+	{
+		mlt_properties properties = MLT_FILTER_PROPERTIES( filter );
+		if ( !mlt_properties_get_int( properties, "_loader" ) && !mlt_properties_get_int( properties, "disable" ) )
+			return 1;
+	}
+	return 0;
+}
 
-						// Set frame interlace hints
-						avframe->interlaced_frame = !mlt_properties_get_int( frame_properties, "progressive" );
-						avframe->top_field_first = mlt_properties_get_int( frame_properties, "top_field_first" );
-						if ( mlt_properties_get_int( frame_properties, "progressive" ) )
-							c->field_order = AV_FIELD_PROGRESSIVE;
-						else if ( c->codec_id == AV_CODEC_ID_MJPEG )
-							c->field_order = (mlt_properties_get_int( frame_properties, "top_field_first" )) ? AV_FIELD_TT : AV_FIELD_BB;
-						else
-							c->field_order = (mlt_properties_get_int( frame_properties, "top_field_first" )) ? AV_FIELD_TB : AV_FIELD_BT;
+/** Check whether a clip shows the frames of an avformat producer unaltered.
+*/
 
-	 					// Encode the image
-#if LIBAVCODEC_VERSION_INT >= ((57<<16)+(37<<8)+0)
-						ret = avcodec_send_frame( c, avframe );
-						if ( ret < 0 ) {
-							pkt.size = ret;
-						} else {
-receive_video_packet:
-							ret = avcodec_receive_packet( c, &pkt );
-							if ( ret == AVERROR(EAGAIN) || ret == AVERROR_EOF )
-								pkt.size = ret = 0;
-							else if ( ret < 0 )
-								pkt.size = ret;
-						}
-#else
-						int got_packet;
-						ret = avcodec_encode_video2( c, &pkt, avframe, &got_packet );
-						if ( ret < 0 )
-							pkt.size = ret;
-						else if ( !got_packet )
-							pkt.size = 0;
-#endif
+static int smart_clip( mlt_producer cut, mlt_producer parent, int repeat )
+{
+	mlt_properties properties = MLT_PRODUCER_PROPERTIES( parent );
+	const char *service = mlt_properties_get( properties, "mlt_service" );
+	char key[200];
+
+	snprintf( key, sizeof( key ), "meta.media.%d.codec.rotate", mlt_properties_get_int( properties, "video_index" ) );
+	return service && !strncmp( service, "avformat", 8 ) && repeat <= 1 &&
+		!smart_filtered( MLT_PRODUCER_SERVICE( cut ) ) && !smart_filtered( MLT_PRODUCER_SERVICE( parent ) ) &&
+		!mlt_properties_get( properties, "force_aspect_ratio" ) && !mlt_properties_get( properties, "force_fps" ) &&
+		!mlt_properties_get( properties, "force_progressive" ) && !mlt_properties_get( properties, "force_tff" ) &&
+		!mlt_properties_get( properties, "force_colorspace" ) && !mlt_properties_get_double( properties, "video_delay" ) &&
+		!( mlt_properties_get_int( properties, key ) &&
+		   ( !mlt_properties_get( properties, "autorotate" ) || mlt_properties_get_int( properties, "autorotate" ) ) );
+}
 
-	 					// If zero size, it means the image was buffered
-						if ( pkt.size > 0 )
-						{
-							if ( pkt.pts != AV_NOPTS_VALUE )
-								pkt.pts = av_rescale_q( pkt.pts, c->time_base, enc_ctx->video_st->time_base );
-							if ( pkt.dts != AV_NOPTS_VALUE )
-								pkt.dts = av_rescale_q( pkt.dts, c->time_base, enc_ctx->video_st->time_base );
-							pkt.stream_index = enc_ctx->video_st->index;
+/** Find the frames of a clip whose video packets can be copied as they are.
+ *
+ * The range starts with a key frame and ends before another key frame, or at
+ * the end of the file, such that the packets in between are exactly its frames.
+ * Returns 0 if the video is not what the consumer would encode or no such
+ * range exists within frame_in and frame_out. The profile, level, and
+ * extradata of the encoder are only known after encoding, so those are
+ * checked by segments_check() before joining.
+*/
 
-							// write the compressed frame in the media file
-							ret = av_interleaved_write_frame(enc_ctx->oc, &pkt);
-							mlt_log_debug( MLT_CONSUMER_SERVICE( consumer ), " frame_size %d\n", c->frame_size );
-							
-							// Dual pass logging
-							if ( mlt_properties_get_data( properties, "_logfile", NULL ) && c->stats_out )
-								fprintf( mlt_properties_get_data( properties, "_logfile", NULL ), "%s", c->stats_out );
+static int smart_copy_range( mlt_producer parent, AVOutputFormat *fmt, AVCodecParameters *expected, AVRational frame_rate,
+	mlt_position frame_in, mlt_position frame_out, segment_t *segment, mlt_position *first, mlt_position *last )
+{
+	mlt_properties properties = MLT_PRODUCER_PROPERTIES( parent );
+	AVRational frame_duration = av_inv_q( frame_rate );
+	AVFormatContext *context = NULL;
+	AVPacket pkt;
+	int index = mlt_properties_get_int( properties, "video_index" );
+	mlt_position count = 0, max = -1;
+	int eof = 1;
+
+	*first = *last = -1;
+	memset( segment, 0, sizeof( *segment ) );
+	av_init_packet( &pkt );
+	if ( !mlt_properties_get( properties, "resource" ) ||
+	     segments_open( mlt_properties_get( properties, "resource" ), &context, NULL ) ||
+	     index < 0 || index >= context->nb_streams )
+	{
+		avformat_close_input( &context );
+		return 0;
+	}
 
-							enc_ctx->error_count = 0;
+	AVStream *st = context->streams[ index ];
+	AVCodecParameters *par = st->codecpar;
+	int64_t start_time = st->start_time != AV_NOPTS_VALUE ? st->start_time : 0;
+	AVRational sar = par->sample_aspect_ratio.num ? par->sample_aspect_ratio : av_make_q( 1, 1 );
+
+	// The video must be what the encoder would produce, framed as the output needs it
+	if ( par->codec_type != AVMEDIA_TYPE_VIDEO || par->codec_id != expected->codec_id ||
+	     par->format != expected->format || par->width != expected->width || par->height != expected->height ||
+	     av_cmp_q( sar, expected->sample_aspect_ratio ) ||
+	     ( par->field_order != expected->field_order &&
+	       ( expected->field_order != AV_FIELD_PROGRESSIVE || par->field_order != AV_FIELD_UNKNOWN ) ) ||
+	     par->color_primaries != expected->color_primaries || par->color_trc != expected->color_trc ||
+	     par->color_space != expected->color_space ||
+	     ( ( fmt->flags & AVFMT_GLOBALHEADER ) && segments_is_annexb( par ) ) ||
+	     av_cmp_q( st->avg_frame_rate, frame_rate ) || ( st->disposition & AV_DISPOSITION_ATTACHED_PIC ) )
+	{
+		avformat_close_input( &context );
+		return 0;
+	}
 
-#if LIBAVCODEC_VERSION_INT >= ((57<<16)+(37<<8)+0)
-							if ( !ret )
-								goto receive_video_packet;
-#endif
-						}
-						else if ( pkt.size < 0 )
-						{
-							mlt_log_warning( MLT_CONSUMER_SERVICE(consumer), "error with video encode: %d (frame %d)\n", pkt.size, enc_ctx->frame_count );
-							if ( ++enc_ctx->error_count > 2 )
-								goto on_fatal_error;
-							ret = 0;
-						}
- 					}
-					enc_ctx->frame_count++;
-					enc_ctx->video_pts = (double) enc_ctx->frame_count * av_q2d( enc_ctx->video_st->codec->time_base );
-					if ( ret )
-					{
-						mlt_log_fatal( MLT_CONSUMER_SERVICE(consumer), "error writing video frame: %d\n", ret );
-						mlt_events_fire( properties, "consumer-fatal-error", NULL );
-						goto on_fatal_error;
-					}
-					mlt_frame_close( frame );
-					frame = NULL;
-#if defined(AVFILTER) && LIBAVUTIL_VERSION_MAJOR >= 56
-					if (AV_PIX_FMT_VAAPI == c->pix_fmt)
-						av_frame_unref( avframe );
-#endif
-				}
-				else
-				{
-					break;
-				}
-			}
-			if ( enc_ctx->audio_st[0] )
-				mlt_log_debug( MLT_CONSUMER_SERVICE( consumer ), "audio pts %f ", enc_ctx->audio_pts );
-			if ( enc_ctx->video_st )
-				mlt_log_debug( MLT_CONSUMER_SERVICE( consumer ), "video pts %f ", enc_ctx->video_pts );
-			mlt_log_debug( MLT_CONSUMER_SERVICE( consumer ), "\n" );
-		}
+	av_seek_frame( context, index, start_time + av_rescale_q( frame_in, frame_duration, st->time_base ), AVSEEK_FLAG_BACKWARD );
+	while ( av_read_frame( context, &pkt ) >= 0 )
+	{
+		int stop = 0;
 
-		if ( real_time_output == 1 && frames % 2 == 0 )
-		{
-			long passed = time_difference( &ante );
-			if ( enc_ctx->fifo != NULL )
+		if ( pkt.stream_index == index )
+		{
+			int key = pkt.flags & AV_PKT_FLAG_KEY;
+			mlt_position frame = av_rescale_q_rnd( pkt.pts - start_time, st->time_base, frame_duration, AV_ROUND_NEAR_INF );
+
+			if ( pkt.pts == AV_NOPTS_VALUE )
 			{
-				long pending = ( ( ( long )sample_fifo_used( enc_ctx->fifo ) / enc_ctx->sample_bytes * 1000 ) / enc_ctx->frequency ) * 1000;
-				passed -= pending;
+				stop = 1;
 			}
-			if ( passed < total_time )
+			else if ( *first < 0 )
 			{
-				long total = ( total_time - passed );
-				struct timespec t = { total / 1000000, ( total % 1000000 ) * 1000 };
-				nanosleep( &t, NULL );
+				stop = key && frame > frame_out;
+				if ( key && frame >= frame_in && !stop )
+				{
+					*first = frame;
+					segment->from = pkt.pts;
+				}
+			}
+			else if ( key )
+			{
+				// A key frame ends the range when all of the frames before it have been read
+				if ( frame <= frame_out + 1 && count == frame - *first && max < frame )
+				{
+					*last = frame;
+					segment->to = pkt.pts;
+				}
+				stop = frame > frame_out;
+			}
+			if ( *first >= 0 && frame >= *first && !stop )
+			{
+				count++;
+				max = FFMAX( max, frame );
 			}
 		}
+		av_packet_unref( &pkt );
+		if ( stop )
+		{
+			eof = 0;
+			break;
+		}
 	}
 
-	// Flush the encoder buffers
-	if ( real_time_output <= 0 )
+	// Or the end of the file
+	if ( eof && *first >= 0 && max <= frame_out && count == max + 1 - *first )
 	{
-		// Flush audio fifo
-		// TODO: flush all audio streams
-		if ( enc_ctx->fifo && enc_ctx->audio_st[0] ) for (;;)
-		{
-			int sz = sample_fifo_used( enc_ctx->fifo );
-			int ret = encode_audio( enc_ctx );
+		*last = max + 1;
+		segment->to = AV_NOPTS_VALUE;
+	}
+	avformat_close_input( &context );
+
+	if ( *last <= *first )
+		return 0;
+	segment->copy = 1;
+	segment->index = index;
+	segment->file = strdup( mlt_properties_get( properties, "resource" ) );
+	return 1;
+}
 
-			mlt_log_debug( MLT_CONSUMER_SERVICE( consumer ), "flushing audio: sz=%d, ret=%d\n", sz, ret );
+static void smart_encode( segment_t **segments, int *count, mlt_position start, mlt_position length )
+{
+	segment_t segment;
 
-			if ( !sz || ret < 0 )
-				break;
-		}
+	if ( length <= 0 )
+		return;
+	if ( *count && !( *segments )[ *count - 1 ].copy &&
+	     ( *segments )[ *count - 1 ].start + ( *segments )[ *count - 1 ].length == start )
+	{
+		( *segments )[ *count - 1 ].length += length;
+		return;
+	}
+	memset( &segment, 0, sizeof( segment ) );
+	segment.start = start;
+	segment.length = length;
+	segments_append( segments, count, &segment );
+}
 
-		// Flush video
-#ifdef AVFMT_RAWPICTURE
-        if ( enc_ctx->video_st && !( enc_ctx->oc->oformat->flags & AVFMT_RAWPICTURE ) ) for (;;)
-#else
-        if ( enc_ctx->video_st ) for (;;)
-#endif
-		{
-			AVCodecContext *c = enc_ctx->video_st->codec;
-			AVPacket pkt;
-			av_init_packet( &pkt );
-			if ( c->codec->id == AV_CODEC_ID_RAWVIDEO ) {
-				pkt.data = NULL;
-				pkt.size = 0;
-			} else {
-				pkt.data = video_outbuf;
-				pkt.size = video_outbuf_size;
-			}
+/** Divide a render into the ranges whose video packets can be copied and those to encode.
+ *
+ * Only a producer or a playlist, alone or as the single track of a tractor
+ * without transitions, is examined; anything else is encoded entirely.
+*/
 
-			// Encode the image
-#if LIBAVCODEC_VERSION_INT >= ((57<<16)+(37<<8)+0)
-			int ret;
-			while ( (ret = avcodec_receive_packet( c, &pkt )) == AVERROR(EAGAIN) ) {
-				ret = avcodec_send_frame( c, NULL );
-				if ( ret < 0 ) {
-					mlt_log_warning( MLT_CONSUMER_SERVICE(consumer), "error with video encode: %d\n", ret );
-					break;
-				}
-			}
-#else
-			int got_packet = 0;
-			int ret = avcodec_encode_video2( c, &pkt, NULL, &got_packet );
-			if ( ret < 0 )
-				pkt.size = ret;
-			else if ( !got_packet )
-				pkt.size = 0;
-#endif
-			mlt_log_debug( MLT_CONSUMER_SERVICE( consumer ), "flushing video size %d\n", pkt.size );
-			if ( pkt.size < 0 )
-				break;
-			// Dual pass logging
-			if ( mlt_properties_get_data( properties, "_logfile", NULL ) && c->stats_out )
-				fprintf( mlt_properties_get_data( properties, "_logfile", NULL ), "%s", c->stats_out );
-			if ( !pkt.size )
+static segment_t *smart_segments( mlt_consumer consumer, AVOutputFormat *fmt, mlt_producer producer,
+	mlt_position start, mlt_position length, int *count )
+{
+	mlt_properties properties = MLT_CONSUMER_PROPERTIES( consumer );
+	mlt_profile profile = mlt_service_profile( MLT_CONSUMER_SERVICE( consumer ) );
+	AVRational frame_rate = { profile->frame_rate_num, profile->frame_rate_den };
+	const char *vcodec = mlt_properties_get( properties, "vcodec" );
+	const char *pix_fmt = mlt_properties_get( properties, "pix_fmt" );
+	AVCodec *codec = vcodec ? avcodec_find_encoder_by_name( vcodec ) : avcodec_find_encoder( fmt->video_codec );
+	AVCodecParameters expected;
+	mlt_service service = MLT_PRODUCER_SERVICE( producer );
+	mlt_producer track = NULL;
+	mlt_playlist playlist = NULL;
+	segment_t *segments = NULL;
+	mlt_position from = mlt_producer_get_in( producer ) + start;
+	mlt_position to = from + length;
+	mlt_position end = from;
+	int i, n = 0;
+
+	*count = 0;
+
+	// Mirror how the consumer chooses its codec and pixel format
+	memset( &expected, 0, sizeof( expected ) );
+	expected.codec_id = codec ? codec->id : AV_CODEC_ID_NONE;
+	expected.format = pix_fmt ? av_get_pix_fmt( pix_fmt ) : codec ?
+		( codec->pix_fmts ? codec->pix_fmts[0] : AV_PIX_FMT_YUV422P ): AV_PIX_FMT_YUV420P;
+	expected.width = mlt_properties_get_int( properties, "width" );
+	expected.height = mlt_properties_get_int( properties, "height" );
+	if ( mlt_properties_get( properties, "aspect" ) )
+		expected.sample_aspect_ratio = av_d2q( mlt_properties_get_double( properties, "aspect" ) * expected.height / expected.width, 255 );
+	else
+		expected.sample_aspect_ratio = av_make_q( mlt_properties_get_int( properties, "sample_aspect_num" ),
+			mlt_properties_get_int( properties, "sample_aspect_den" ) );
+	if ( !expected.sample_aspect_ratio.num || !expected.sample_aspect_ratio.den )
+		expected.sample_aspect_ratio = av_make_q( 1, 1 );
+	expected.color_primaries = mlt_properties_get_int( properties, "color_primaries" );
+	expected.color_trc = mlt_properties_get_int( properties, "color_trc" );
+	expected.color_space = colorspace_to_avcol( mlt_properties_get_int( properties, "colorspace" ), expected.height, AVCOL_SPC_UNSPECIFIED );
+
+	// Interlaced frames follow the field order of the consumer only if it has one
+	if ( mlt_properties_get_int( properties, "progressive" ) )
+		expected.field_order = AV_FIELD_PROGRESSIVE;
+	else if ( !mlt_properties_get( properties, "top_field_first" ) )
+		expected.codec_id = AV_CODEC_ID_NONE;
+	else if ( expected.codec_id == AV_CODEC_ID_MJPEG )
+		expected.field_order = mlt_properties_get_int( properties, "top_field_first" ) ? AV_FIELD_TT : AV_FIELD_BB;
+	else
+		expected.field_order = mlt_properties_get_int( properties, "top_field_first" ) ? AV_FIELD_TB : AV_FIELD_BT;
+
+	if ( mlt_service_identify( service ) == tractor_type )
+	{
+		mlt_multitrack multitrack = mlt_tractor_multitrack( MLT_TRACTOR( producer ) );
+		if ( !smart_filtered( service ) && mlt_multitrack_count( multitrack ) == 1 &&
+		     mlt_service_producer( service ) == MLT_MULTITRACK_SERVICE( multitrack ) &&
+		     !smart_filtered( MLT_MULTITRACK_SERVICE( multitrack ) ) )
+			track = mlt_multitrack_track( multitrack, 0 );
+		if ( track && mlt_service_identify( MLT_PRODUCER_SERVICE( track ) ) != playlist_type )
+			track = NULL;
+	}
+	else
+	{
+		track = producer;
+	}
+	if ( track && !smart_filtered( MLT_PRODUCER_SERVICE( track ) ) && expected.codec_id != AV_CODEC_ID_NONE )
+	{
+		if ( mlt_service_identify( MLT_PRODUCER_SERVICE( track ) ) == playlist_type )
+			playlist = MLT_PLAYLIST( track );
+		n = playlist ? mlt_playlist_count( playlist ) : 1;
+	}
+
+	for ( i = 0; i < n && end < to; i++ )
+	{
+		mlt_playlist_clip_info info;
+		segment_t copy;
+		mlt_position first, last;
+
+		if ( playlist )
+		{
+			if ( mlt_playlist_get_clip_info( playlist, &info, i ) )
 				break;
+		}
+		else
+		{
+			memset( &info, 0, sizeof( info ) );
+			info.cut = track;
+			info.producer = mlt_producer_cut_parent( track );
+			info.start = mlt_producer_get_in( track );
+			info.frame_in = mlt_producer_get_in( track );
+			info.frame_count = mlt_producer_get_playtime( track );
+			info.repeat = 1;
+		}
 
-			if ( pkt.pts != AV_NOPTS_VALUE )
-				pkt.pts = av_rescale_q( pkt.pts, c->time_base, enc_ctx->video_st->time_base );
-			if ( pkt.dts != AV_NOPTS_VALUE )
-				pkt.dts = av_rescale_q( pkt.dts, c->time_base, enc_ctx->video_st->time_base );
-			pkt.stream_index = enc_ctx->video_st->index;
+		// The part of the clip within the render
+		mlt_position a = FFMAX( info.start, from );
+		mlt_position b = FFMIN( info.start + info.frame_count, to );
+		if ( a >= b )
+			continue;
+		mlt_position frame_in = info.frame_in + a - info.start;
+		mlt_position frame_out = info.frame_in + b - info.start - 1;
 
-			// write the compressed frame in the media file
-			if ( av_interleaved_write_frame( enc_ctx->oc, &pkt ) != 0 )
-			{
-				mlt_log_fatal( MLT_CONSUMER_SERVICE(consumer), "error writing flushed video frame\n" );
-				mlt_events_fire( properties, "consumer-fatal-error", NULL );
-				goto on_fatal_error;
-			}
+		if ( smart_clip( info.cut, info.producer, info.repeat ) &&
+		     smart_copy_range( info.producer, fmt, &expected, frame_rate, frame_in, frame_out, &copy, &first, &last ) )
+		{
+			smart_encode( &segments, count, a - from, first - frame_in );
+			copy.start = a - from + first - frame_in;
+			copy.length = last - first;
+			segments_append( &segments, count, &copy );
+			smart_encode( &segments, count, copy.start + copy.length, frame_out + 1 - last );
+		}
+		else
+		{
+			smart_encode( &segments, count, a - from, b - a );
 		}
+		end = b;
 	}
+	smart_encode( &segments, count, end - from, to - end );
 
-on_fatal_error:
+	return segments;
+}
+
+static void on_segment_error( mlt_properties owner, mlt_consumer consumer )
+{
+	mlt_properties_set_int( MLT_CONSUMER_PROPERTIES( consumer ), "_segment_error", 1 );
+}
+
+/** The progress of a segmented render, shared by the consumers of the segments.
+*/
+
+typedef struct
+{
+	mlt_consumer consumer;
+	mlt_producer producer;
+	pthread_mutex_t mutex;
+	mlt_position start;
+	mlt_position length;
+	mlt_position done;
+} segments_progress_t;
+
+/** Show a frame of a segment as a frame of the render.
+ *
+ * The frame is passed on with its position in the producer of the render,
+ * one segment at a time, and the producer is moved to the number of frames
+ * done so far, so that the progress can be followed as without segments.
+*/
 
+static void on_segment_frame_show( mlt_properties owner, segments_progress_t *progress, mlt_frame frame )
+{
 	if ( frame )
-		mlt_frame_close( frame );
+	{
+		mlt_position position = mlt_frame_get_position( frame );
+
+		pthread_mutex_lock( &progress->mutex );
+		mlt_frame_set_position( frame, mlt_properties_get_position( owner, "_segment_in" ) + position );
+		mlt_events_fire( MLT_CONSUMER_PROPERTIES( progress->consumer ), "consumer-frame-show", frame, NULL );
+		mlt_frame_set_position( frame, position );
+		if ( ++progress->done < progress->length )
+			mlt_producer_seek( progress->producer, progress->start + progress->done );
+		pthread_mutex_unlock( &progress->mutex );
+	}
+}
 
-	// Write the trailer, if any
-	if ( frames )
-		av_write_trailer( enc_ctx->oc );
+/** Start the render of a part of the producer cloned from XML.
+*/
 
-	// Clean up input and output frames
-	if ( converted_avframe )
-		av_free( converted_avframe->data[0] );
-	av_free( converted_avframe );
-#if defined(AVFILTER) && LIBAVUTIL_VERSION_MAJOR >= 56
-	if (enc_ctx->video_st && enc_ctx->video_st->codec && AV_PIX_FMT_VAAPI == enc_ctx->video_st->codec->pix_fmt)
-		av_frame_free(&avframe);
-#endif
-	av_free( video_outbuf );
-	av_free( enc_ctx->audio_avframe );
+static int segments_start( mlt_consumer consumer, const char *xml_string, AVOutputFormat *fmt, const char *file,
+	mlt_position in, mlt_position length, segments_progress_t *progress,
+	mlt_profile *profile, mlt_producer *producer, mlt_consumer *segment )
+{
+	mlt_properties properties = MLT_CONSUMER_PROPERTIES( consumer );
+	mlt_properties segment_properties;
+	int is_audio = !progress;
 
-	// close each codec
-	if ( enc_ctx->video_st )
-		close_video(enc_ctx->oc, enc_ctx->video_st);
-	for ( i = 0; i < MAX_AUDIO_STREAMS && enc_ctx->audio_st[i]; i++ )
-		close_audio( enc_ctx->oc, enc_ctx->audio_st[i] );
+	*profile = mlt_profile_clone( mlt_service_profile( MLT_CONSUMER_SERVICE( consumer ) ) );
+	*producer = mlt_factory_producer( *profile, "xml-string", xml_string );
+	*segment = mlt_factory_consumer( *profile, "avformat", file );
+	if ( !*producer || !*segment )
+		return 1;
+	segment_properties = MLT_CONSUMER_PROPERTIES( *segment );
+	mlt_properties_set_position( segment_properties, "_segment_in", in );
+	in += mlt_producer_get_in( *producer );
+	mlt_producer_set_in_and_out( *producer, in, in + length - 1 );
+
+	mlt_properties_inherit( segment_properties, properties );
+	mlt_properties_set( segment_properties, "target", file );
+	mlt_properties_set( segment_properties, "f", fmt->name );
+	mlt_properties_set_int( segment_properties, "segments", 0 );
+	mlt_properties_set_int( segment_properties, "smart_render", 0 );
+	mlt_properties_set_int( segment_properties, "running", 0 );
+	mlt_properties_set_int( segment_properties, is_audio ? "vn" : "an", 1 );
+	mlt_events_listen( segment_properties, consumer, "consumer-fatal-error", ( mlt_listener )on_segment_error );
+	if ( progress )
+		mlt_events_listen( segment_properties, progress, "consumer-frame-show", ( mlt_listener )on_segment_frame_show );
+	mlt_consumer_connect( *segment, MLT_PRODUCER_SERVICE( *producer ) );
+	return mlt_consumer_start( *segment );
+}
 
-	// Free the streams
-	for ( i = 0; i < enc_ctx->oc->nb_streams; i++ )
-		av_freep( &enc_ctx->oc->streams[i] );
+/** The thread of a segmented or smart render - the argument is simply the consumer.
+ *
+ * With smart_render, the video packets of unaltered ranges of clips that
+ * already match the output are copied, and only the rest is encoded.
+ * The producer is cloned through XML for each segment to encode, which is
+ * rendered by another avformat consumer with up to "segments", but no
+ * more than the number of CPUs, at a time. Their frames are shown as frames
+ * of this consumer.
+ * Segments start on a multiple of the GOP size so that the key frames fall
+ * where they would without segments. The audio is rendered in one piece
+ * alongside them to keep it continuous.
+*/
 
-	// Close the output file
-	if ( !( fmt->flags & AVFMT_NOFILE ) &&
-		!mlt_properties_get_int( properties, "redirect" ) )
+static void *segments_thread( void *arg )
+{
+	mlt_consumer consumer = arg;
+	mlt_properties properties = MLT_CONSUMER_PROPERTIES( consumer );
+	mlt_service service = mlt_service_producer( MLT_CONSUMER_SERVICE( consumer ) );
+	mlt_profile profile = mlt_service_profile( MLT_CONSUMER_SERVICE( consumer ) );
+	const char *filename = mlt_properties_get( properties, "target" );
+	const char *format = mlt_properties_get( properties, "f" );
+	const char *vcodec = mlt_properties_get( properties, "vcodec" );
+	const char *acodec = mlt_properties_get( properties, "acodec" );
+	int limit = FFMAX( FFMIN( mlt_properties_get_int( properties, "segments" ), av_cpu_count() ), 1 );
+	int smart = mlt_properties_get_int( properties, "smart_render" );
+	int gop = mlt_properties_get_int( properties, "g" );
+	int audio = !mlt_properties_get_int( properties, "an" ) && !( acodec && !strcmp( acodec, "none" ) );
+	mlt_service_type type = service ? mlt_service_identify( service ) : invalid_type;
+	AVOutputFormat *fmt = NULL;
+	mlt_consumer xml = NULL;
+	char *xml_string = NULL;
+	char *audio_file = NULL;
+	segment_t *ranges = NULL;
+	segment_t *segments = NULL;
+	mlt_profile *profiles = NULL;
+	mlt_producer *producers = NULL;
+	mlt_consumer *consumers = NULL;
+	segments_progress_t progress;
+	int i, ranges_count = 0, count = 0, encoded = 0, next = 0, error = 0;
+
+	if ( format )
+		fmt = av_guess_format( format, NULL, NULL );
+	if ( !fmt && filename )
+		fmt = av_guess_format( NULL, filename, NULL );
+	if ( !fmt )
+		fmt = av_guess_format( "mpeg", NULL, NULL );
+
+	// Render in this thread when the output cannot be segmented
+	if ( ( type != producer_type && type != playlist_type && type != tractor_type ) ||
+	     !filename || !strcmp( filename, "" ) || !strncmp( filename, "pipe:", 5 ) ||
+	     ( fmt->flags & AVFMT_NOFILE ) || mlt_properties_get_int( properties, "redirect" ) ||
+	     mlt_properties_get_int( properties, "pass" ) || mlt_properties_get_int( properties, "vn" ) ||
+	     ( vcodec && !strcmp( vcodec, "none" ) ) )
+		return consumer_thread( arg );
+
+	// Find the ranges to copy and to encode
+	mlt_producer producer = ( mlt_producer ) service;
+	mlt_position start = mlt_producer_position( producer );
+	mlt_position length = mlt_producer_get_playtime( producer ) - start;
+	if ( smart && length > 0 )
 	{
-		if ( enc_ctx->oc->pb  ) avio_close( enc_ctx->oc->pb );
+		ranges = smart_segments( consumer, fmt, producer, start, length, &ranges_count );
+	}
+	else if ( length > 0 )
+	{
+		ranges = calloc( 1, sizeof( segment_t ) );
+		ranges->length = length;
+		ranges_count = 1;
 	}
 
-	// Free the stream
-	av_free( enc_ctx->oc );
-
-	// Just in case we terminated on pause
-	mlt_consumer_stopped( consumer );
-	mlt_properties_close( enc_ctx->frame_meta_properties );
+	// Divide the ranges to encode into segments
+	mlt_position size = ( length + limit - 1 ) / limit;
+	if ( gop > 0 )
+		size = ( size + gop - 1 ) / gop * gop;
+	for ( i = 0; i < ranges_count; i++ )
+	{
+		segment_t segment = ranges[i];
+		mlt_position offset;
 
-	if ( mlt_properties_get_int( properties, "pass" ) > 1 )
+		for ( offset = 0; !segment.copy && offset < ranges[i].length; offset += size )
+		{
+			segment.start = ranges[i].start + offset;
+			segment.length = FFMIN( size, ranges[i].length - offset );
+			segment.file = malloc( strlen( filename ) + 20 );
+			sprintf( segment.file, "%s.segment%d", filename, count );
+			segments_append( &segments, &count, &segment );
+			encoded++;
+		}
+		if ( segment.copy )
+			segments_append( &segments, &count, &segment );
+	}
+	free( ranges );
+	if ( count == encoded && count < 2 )
 	{
-		// Remove the dual pass log file
-		if ( mlt_properties_get( properties, "_logfilename" ) )
-			remove( mlt_properties_get( properties, "_logfilename" ) );
+		for ( i = 0; i < count; i++ )
+			free( segments[i].file );
+		free( segments );
+		return consumer_thread( arg );
+	}
 
-		// Remove the x264 dual pass logs
-		char *cwd = getcwd( NULL, 0 );
-		const char *file = "x264_2pass.log";
-		char *full = malloc( strlen( cwd ) + strlen( file ) + 2 );
-		sprintf( full, "%s/%s", cwd, file );
-		remove( full );
-		free( full );
-		file = "x264_2pass.log.temp";
-		full = malloc( strlen( cwd ) + strlen( file ) + 2 );
-		sprintf( full, "%s/%s", cwd, file );
-		remove( full );
-		free( full );
-		file = "x264_2pass.log.mbtree";
-		full = malloc( strlen( cwd ) + strlen( file ) + 2 );
-		sprintf( full, "%s/%s", cwd, file );
-		remove( full );
-		free( full );
-		free( cwd );
-		remove( "x264_2pass.log.temp" );
+	// Clone the producer through XML
+	xml = mlt_factory_consumer( profile, "xml", "string" );
+	if ( xml )
+	{
+		mlt_properties_set_int( MLT_CONSUMER_PROPERTIES( xml ), "no_meta", 1 );
+		mlt_consumer_connect( xml, service );
+		mlt_consumer_start( xml );
+		if ( mlt_properties_get( MLT_CONSUMER_PROPERTIES( xml ), "string" ) )
+			xml_string = strdup( mlt_properties_get( MLT_CONSUMER_PROPERTIES( xml ), "string" ) );
+		mlt_consumer_close( xml );
+	}
+	if ( !xml_string )
+	{
+		for ( i = 0; i < count; i++ )
+			free( segments[i].file );
+		free( segments );
+		return consumer_thread( arg );
+	}
+	mlt_log_info( MLT_CONSUMER_SERVICE( consumer ), "rendering %d segments of %d frames and copying %d ranges\n",
+		encoded, size, count - encoded );
+
+	// The copied ranges count as done
+	memset( &progress, 0, sizeof( progress ) );
+	progress.consumer = consumer;
+	progress.producer = producer;
+	progress.start = start;
+	progress.length = length;
+	for ( i = 0; i < count; i++ )
+		if ( segments[i].copy )
+			progress.done += segments[i].length;
+	pthread_mutex_init( &progress.mutex, NULL );
+
+	// Start a consumer for all of the audio, and for the segments with up to limit consumers at a time
+	profiles = calloc( count + 1, sizeof( mlt_profile ) );
+	producers = calloc( count + 1, sizeof( mlt_producer ) );
+	consumers = calloc( count + 1, sizeof( mlt_consumer ) );
+	mlt_properties_set_int( properties, "_segment_error", 0 );
+	if ( audio )
+	{
+		audio_file = malloc( strlen( filename ) + 20 );
+		sprintf( audio_file, "%s.audio", filename );
+		error = segments_start( consumer, xml_string, fmt, audio_file, start, length, NULL,
+			&profiles[ count ], &producers[ count ], &consumers[ count ] );
+	}
+	while ( !error )
+	{
+		struct timespec tm = { 0, 100000000 };
+		int running = 0, video_running = 0;
 
-		// Recent versions of libavcodec/x264 support passlogfile and need cleanup if specified.
-		if ( !mlt_properties_get( properties, "_logfilename" ) &&
-		      mlt_properties_get( properties, "passlogfile" ) )
+		for ( i = 0; i <= count; i++ )
 		{
-			mlt_properties_get( properties, "passlogfile" );
-			file = mlt_properties_get( properties, "passlogfile" );
-			remove( file );
-			full = malloc( strlen( file ) + strlen( ".mbtree" ) + 1 );
-			sprintf( full, "%s.mbtree", file );
-			remove( full );
-			free( full );
+			if ( consumers[i] && !mlt_consumer_is_stopped( consumers[i] ) )
+			{
+				running++;
+				video_running += i < count;
+			}
+		}
+		for ( ; next < count && ( running < limit || !video_running ) && !error; next++ )
+		{
+			if ( segments[ next ].copy )
+				continue;
+			error = segments_start( consumer, xml_string, fmt, segments[ next ].file, start + segments[ next ].start,
+				segments[ next ].length, &progress, &profiles[ next ], &producers[ next ], &consumers[ next ] );
+			running++;
+			video_running++;
 		}
+		if ( !running && next >= count )
+			break;
+		if ( !mlt_properties_get_int( properties, "running" ) || mlt_properties_get_int( properties, "_segment_error" ) )
+			error = 1;
+		else
+			nanosleep( &tm, NULL );
+	}
+	for ( i = 0; i <= count; i++ )
+	{
+		if ( consumers[i] )
+			mlt_consumer_stop( consumers[i] );
+		mlt_consumer_close( consumers[i] );
+		mlt_producer_close( producers[i] );
+		mlt_profile_close( profiles[i] );
 	}
+	pthread_mutex_destroy( &progress.mutex );
+	if ( mlt_properties_get_int( properties, "_segment_error" ) )
+		error = 1;
 
-	while ( ( frame = mlt_deque_pop_back( queue ) ) )
-		mlt_frame_close( frame );
+	// Join the segments
+	if ( !error )
+		error = segments_join( consumer, fmt, filename, segments, count, audio_file );
+	if ( error == 1 )
+		mlt_events_fire( properties, "consumer-fatal-error", NULL );
 
-	mlt_pool_release( enc_ctx );
+	for ( i = 0; i < count; i++ )
+	{
+		if ( !segments[i].copy )
+			remove( segments[i].file );
+		free( segments[i].file );
+	}
+	if ( audio_file )
+		remove( audio_file );
+	free( audio_file );
+	free( segments );
+	free( consumers );
+	free( producers );
+	free( profiles );
+	free( xml_string );
+
+	// Encode everything if the copied packets cannot be joined
+	if ( error == 2 )
+	{
+		mlt_log_info( MLT_CONSUMER_SERVICE( consumer ), "the segments have different stream headers, encoding instead\n" );
+		return consumer_thread( arg );
+	}
+
+	mlt_consumer_stopped( consumer );
 
 	return NULL;
 }
 
+#else
+
+static void *segments_thread( void *arg )
+{
+	return consumer_thread( arg );
+}
+
+#endif
+
 /** Close the consumer.
 */
 
@@ -684,7 +684,7 @@ static int filter_get_image( mlt_frame frame, uint8_t **image, mlt_image_format
 		*format = get_supported_image_format(*format);
 	}
 
-	mlt_frame_get_image( frame, image, format, width, height, 0 );
+	mlt_frame_get_image( frame, image, format, width, height, 1 );
 
 	mlt_service_lock( MLT_FILTER_SERVICE( filter ) );
 
@@ -117,7 +117,8 @@ static int filter_scale( mlt_frame frame, uint8_t **image, mlt_image_format *for
 	int out_stride[4];
 	uint8_t *outbuf = mlt_pool_alloc( out_size );
 
-	av_image_fill_arrays(in_data, in_stride, *image, avformat, iwidth, iheight, IMAGE_ALIGN);
+	// The input may have padded lines, such as a cropped region of a larger image
+	mlt_frame_get_image_planes( frame, in_data, in_stride );
 	av_image_fill_arrays(out_data, out_stride, outbuf, avformat, owidth, oheight, IMAGE_ALIGN);
 
 	// Create the context and output image
@@ -196,8 +197,9 @@ mlt_filter filter_swscale_init( mlt_profile profile, void *arg )
 		// Set the inerpolation
 		mlt_properties_set( properties, "interpolation", "bilinear" );
 
-		// Set the method
+		// Set the method, which honors the planes of the image
 		mlt_properties_set_data( properties, "method", filter_scale, 0, NULL, NULL );
+		mlt_properties_set_int( properties, "_strided", 1 );
 	}
 
 	return filter;
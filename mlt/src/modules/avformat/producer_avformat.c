@@ -67,6 +67,18 @@
 #define MAX_AUDIO_FRAME_SIZE (192000) // 1 second of 48khz 32bit audio
 #define IMAGE_ALIGN (1)
 #define VFR_THRESHOLD (3) // The minimum number of video frames with differing durations to be considered VFR.
+#define INDEX_VERSION (1)
+#define PROBE_VERSION (1)
+#define PROBE_CACHE_FILES (1000) // The maximum number of files in the probe cache directory.
+
+/** A keyframe of the video stream
+*/
+
+typedef struct
+{
+	int64_t pts;
+	int64_t pos; // the byte offset of its packet or -1
+} index_entry;
 
 struct producer_avformat_s
 {
@@ -138,6 +150,40 @@ struct producer_avformat_s
 #endif
 	int autorotate;
 	int is_audio_synchronizing;
+	pthread_t ahead_thread;
+	pthread_cond_t ahead_cond;
+	mlt_deque ahead_frames;   // decoded AVFrames in position order
+	int64_t ahead_position;   // the next position to decode ahead or POSITION_INVALID
+	int ahead_running;
+	atomic_int ahead_waiting; // the number of threads waiting to get an image
+	pthread_cond_t packets_cond; // signalled when packets are read ahead or taken
+	pthread_t demux_thread[2];   // reads packets ahead from video_format into vpackets or audio_format into apackets
+	int demux_running[2];
+	int demux_quit[2];
+	int demux_result[2];         // the error that stopped reading ahead or 0
+	int64_t demux_bytes[2];      // the size of the packets read ahead
+	int64_t demux_limit;
+	mlt_deque gop_frames;     // decoded AVFrames of whole GOPs in position order for reverse play
+	mlt_deque gop_prefetch;   // decoded AVFrames of the previous GOP while it is decoded ahead
+	int64_t gop_bytes;
+	int64_t gop_position;     // the position last taken from gop_frames
+	int64_t gop_prefetch_position; // the last position of the previous GOP or POSITION_INVALID
+	int gop_prefetch_state;   // 0 to seek, 1 to decode, or -1 if the previous GOP cannot be prefetched
+	index_entry *index;       // keyframes in pts order, protected by packets_mutex
+	int index_count;
+	int index_size;
+	int64_t index_end;        // every keyframe up to this pts is in the index
+	int index_state;          // 0 if not initialised, -1 if disabled, or 1
+	int index_contiguous;     // whether packets are being read on from indexed data
+	int index_complete;
+	int index_dirty;
+	int index_vfr;
+	mlt_properties probe_cache; // the results of probing the file, or NULL if not cached
+	char *probe_path;
+	int probe_dirty;
+	char *pool_key;           // what must match to reuse this while it is in the decoder pool
+	mlt_properties pool_properties; // the media properties the decoders were opened with
+	struct producer_avformat_s *pool_next;
 };
 typedef struct producer_avformat_s *producer_avformat;
 
@@ -687,7 +733,7 @@ static int get_basic_info( producer_avformat self, mlt_profile profile, const ch
 		self->dummy_context = format;
 		self->video_format = NULL;
 		avformat_open_input( &self->video_format, filename, NULL, NULL );
-		avformat_find_stream_info( self->video_format, NULL );
+		find_stream_info( self, self->video_format );
 		format = self->video_format;
 	}
 	self->video_seekable = self->seekable;
@@ -767,6 +813,261 @@ static int insert_filter(AVFilterGraph *graph, AVFilterContext **last_filter, co
 }
 #endif
 
+/** Load the cached results of probing a file if the cache is enabled.
+
+	The cache file is named after the path, size, and modification time of the
+	file, so it does not survive changes to the file. Whatever is in it is also
+	checked against the streams found in the header before it is used, and any
+	difference probes the file as if there were no cache.
+*/
+
+static void probe_cache_init( producer_avformat self, AVInputFormat *format, const char *filename )
+{
+	mlt_properties properties = MLT_PRODUCER_PROPERTIES( self->parent );
+	char path[ PATH_MAX ];
+
+	if ( self->probe_cache )
+		return;
+	if ( format || !mlt_properties_get_int( properties, "probe_cache" ) ||
+		 mlt_avformat_cache_file( filename, "probe", path, sizeof( path ) ) )
+		return;
+
+	self->probe_path = strdup( path );
+	self->probe_cache = mlt_properties_load( path );
+	if ( self->probe_cache && mlt_properties_get_int( self->probe_cache, "version" ) != PROBE_VERSION )
+	{
+		mlt_properties_close( self->probe_cache );
+		self->probe_cache = NULL;
+	}
+	if ( !self->probe_cache )
+		self->probe_cache = mlt_properties_new();
+}
+
+static void probe_cache_save( producer_avformat self )
+{
+	char temp[ PATH_MAX ];
+
+	if ( !self->probe_cache || !self->probe_dirty )
+		return;
+
+	// Write a temporary file and rename it so that readers never see a partial cache.
+	mlt_properties_set_int( self->probe_cache, "version", PROBE_VERSION );
+	snprintf( temp, sizeof( temp ), "%s.%p", self->probe_path, (void*) self );
+	if ( mlt_properties_save( self->probe_cache, temp ) || rename( temp, self->probe_path ) )
+		remove( temp );
+	else
+		mlt_avformat_cache_trim( "probe", PROBE_CACHE_FILES );
+	self->probe_dirty = 0;
+}
+
+#if LIBAVCODEC_VERSION_INT >= ((57<<16)+(37<<8)+0)
+
+static void probe_cache_set( mlt_properties cache, int index, const char *name, int64_t value )
+{
+	char key[ 64 ];
+	snprintf( key, sizeof( key ), "stream.%d.%s", index, name );
+	mlt_properties_set_int64( cache, key, value );
+}
+
+static int64_t probe_cache_get( mlt_properties cache, int index, const char *name )
+{
+	char key[ 64 ];
+	snprintf( key, sizeof( key ), "stream.%d.%s", index, name );
+	return mlt_properties_get_int64( cache, key );
+}
+
+/** Record what avformat_find_stream_info() found.
+*/
+
+static void probe_cache_store( mlt_properties cache, AVFormatContext *context )
+{
+	int i;
+
+	mlt_properties_set_int( cache, "nb_streams", context->nb_streams );
+	mlt_properties_set_int64( cache, "start_time", context->start_time );
+	mlt_properties_set_int64( cache, "duration", context->duration );
+	mlt_properties_set_int64( cache, "bit_rate", context->bit_rate );
+	for ( i = 0; i < context->nb_streams; i++ )
+	{
+		AVStream *st = context->streams[i];
+		AVCodecParameters *par = st->codecpar;
+
+		probe_cache_set( cache, i, "codec_type", par->codec_type );
+		probe_cache_set( cache, i, "codec_id", par->codec_id );
+		probe_cache_set( cache, i, "extradata_size", par->extradata_size );
+		probe_cache_set( cache, i, "time_base.num", st->time_base.num );
+		probe_cache_set( cache, i, "time_base.den", st->time_base.den );
+		probe_cache_set( cache, i, "start_time", st->start_time );
+		probe_cache_set( cache, i, "duration", st->duration );
+		probe_cache_set( cache, i, "nb_frames", st->nb_frames );
+		probe_cache_set( cache, i, "avg_frame_rate.num", st->avg_frame_rate.num );
+		probe_cache_set( cache, i, "avg_frame_rate.den", st->avg_frame_rate.den );
+		probe_cache_set( cache, i, "r_frame_rate.num", st->r_frame_rate.num );
+		probe_cache_set( cache, i, "r_frame_rate.den", st->r_frame_rate.den );
+		probe_cache_set( cache, i, "sample_aspect_ratio.num", st->sample_aspect_ratio.num );
+		probe_cache_set( cache, i, "sample_aspect_ratio.den", st->sample_aspect_ratio.den );
+		probe_cache_set( cache, i, "format", par->format );
+		probe_cache_set( cache, i, "bit_rate", par->bit_rate );
+		probe_cache_set( cache, i, "bits_per_coded_sample", par->bits_per_coded_sample );
+		probe_cache_set( cache, i, "bits_per_raw_sample", par->bits_per_raw_sample );
+		probe_cache_set( cache, i, "profile", par->profile );
+		probe_cache_set( cache, i, "level", par->level );
+		probe_cache_set( cache, i, "width", par->width );
+		probe_cache_set( cache, i, "height", par->height );
+		probe_cache_set( cache, i, "codec.sample_aspect_ratio.num", par->sample_aspect_ratio.num );
+		probe_cache_set( cache, i, "codec.sample_aspect_ratio.den", par->sample_aspect_ratio.den );
+		probe_cache_set( cache, i, "field_order", par->field_order );
+		probe_cache_set( cache, i, "color_range", par->color_range );
+		probe_cache_set( cache, i, "color_primaries", par->color_primaries );
+		probe_cache_set( cache, i, "color_trc", par->color_trc );
+		probe_cache_set( cache, i, "color_space", par->color_space );
+		probe_cache_set( cache, i, "chroma_location", par->chroma_location );
+		probe_cache_set( cache, i, "video_delay", par->video_delay );
+		probe_cache_set( cache, i, "channel_layout", par->channel_layout );
+		probe_cache_set( cache, i, "channels", par->channels );
+		probe_cache_set( cache, i, "sample_rate", par->sample_rate );
+		probe_cache_set( cache, i, "block_align", par->block_align );
+		probe_cache_set( cache, i, "frame_size", par->frame_size );
+		probe_cache_set( cache, i, "initial_padding", par->initial_padding );
+	}
+}
+
+/** Check that a parameter the header already gives has the recorded value.
+*/
+
+static int probe_cache_differs( mlt_properties cache, int index, const char *name, int64_t value, int64_t unknown )
+{
+	char key[ 64 ];
+	snprintf( key, sizeof( key ), "stream.%d.%s", index, name );
+	return !mlt_properties_get( cache, key ) || ( value != unknown && value != mlt_properties_get_int64( cache, key ) );
+}
+
+/** Apply recorded results of avformat_find_stream_info() to a context opened on the same file.
+
+	Returns nonzero without changing anything if the streams in the header do not match,
+	so that the caller probes the file instead.
+*/
+
+static int probe_cache_restore( mlt_properties cache, AVFormatContext *context )
+{
+	int i;
+
+	if ( !mlt_properties_get( cache, "nb_streams" ) || mlt_properties_get_int( cache, "nb_streams" ) != context->nb_streams )
+		return 1;
+	for ( i = 0; i < context->nb_streams; i++ )
+	{
+		AVStream *st = context->streams[i];
+		AVCodecParameters *par = st->codecpar;
+
+		if ( probe_cache_differs( cache, i, "codec_type", par->codec_type, INT64_MIN ) ||
+			 probe_cache_differs( cache, i, "codec_id", par->codec_id, INT64_MIN ) ||
+			 probe_cache_differs( cache, i, "time_base.num", st->time_base.num, INT64_MIN ) ||
+			 probe_cache_differs( cache, i, "time_base.den", st->time_base.den, INT64_MIN ) ||
+			 probe_cache_differs( cache, i, "extradata_size", par->extradata_size, 0 ) ||
+			 ( probe_cache_get( cache, i, "extradata_size" ) > 0 && par->extradata_size <= 0 ) ||
+			 probe_cache_differs( cache, i, "format", par->format, -1 ) ||
+			 probe_cache_differs( cache, i, "width", par->width, 0 ) ||
+			 probe_cache_differs( cache, i, "height", par->height, 0 ) ||
+			 probe_cache_differs( cache, i, "profile", par->profile, FF_PROFILE_UNKNOWN ) ||
+			 probe_cache_differs( cache, i, "level", par->level, FF_LEVEL_UNKNOWN ) ||
+			 probe_cache_differs( cache, i, "channels", par->channels, 0 ) ||
+			 probe_cache_differs( cache, i, "sample_rate", par->sample_rate, 0 ) ||
+			 probe_cache_differs( cache, i, "start_time", st->start_time, AV_NOPTS_VALUE ) ||
+			 probe_cache_differs( cache, i, "duration", st->duration, AV_NOPTS_VALUE ) ||
+			 probe_cache_differs( cache, i, "nb_frames", st->nb_frames, 0 ) )
+			return 1;
+
+		// A stream that the cache still leaves without the essentials needs probing
+		if ( ( par->codec_type == AVMEDIA_TYPE_VIDEO && ( probe_cache_get( cache, i, "width" ) <= 0 ||
+			   probe_cache_get( cache, i, "height" ) <= 0 || probe_cache_get( cache, i, "format" ) < 0 ) ) ||
+			 ( par->codec_type == AVMEDIA_TYPE_AUDIO && ( probe_cache_get( cache, i, "channels" ) <= 0 ||
+			   probe_cache_get( cache, i, "sample_rate" ) <= 0 ) ) )
+			return 1;
+	}
+
+	context->start_time = mlt_properties_get_int64( cache, "start_time" );
+	context->duration = mlt_properties_get_int64( cache, "duration" );
+	context->bit_rate = mlt_properties_get_int64( cache, "bit_rate" );
+	for ( i = 0; i < context->nb_streams; i++ )
+	{
+		AVStream *st = context->streams[i];
+		AVCodecParameters *par = st->codecpar;
+
+		st->start_time = probe_cache_get( cache, i, "start_time" );
+		st->duration = probe_cache_get( cache, i, "duration" );
+		st->nb_frames = probe_cache_get( cache, i, "nb_frames" );
+		st->avg_frame_rate = av_make_q( probe_cache_get( cache, i, "avg_frame_rate.num" ), probe_cache_get( cache, i, "avg_frame_rate.den" ) );
+		st->r_frame_rate = av_make_q( probe_cache_get( cache, i, "r_frame_rate.num" ), probe_cache_get( cache, i, "r_frame_rate.den" ) );
+		st->sample_aspect_ratio = av_make_q( probe_cache_get( cache, i, "sample_aspect_ratio.num" ), probe_cache_get( cache, i, "sample_aspect_ratio.den" ) );
+		par->format = probe_cache_get( cache, i, "format" );
+		par->bit_rate = probe_cache_get( cache, i, "bit_rate" );
+		par->bits_per_coded_sample = probe_cache_get( cache, i, "bits_per_coded_sample" );
+		par->bits_per_raw_sample = probe_cache_get( cache, i, "bits_per_raw_sample" );
+		par->profile = probe_cache_get( cache, i, "profile" );
+		par->level = probe_cache_get( cache, i, "level" );
+		par->width = probe_cache_get( cache, i, "width" );
+		par->height = probe_cache_get( cache, i, "height" );
+		par->sample_aspect_ratio = av_make_q( probe_cache_get( cache, i, "codec.sample_aspect_ratio.num" ), probe_cache_get( cache, i, "codec.sample_aspect_ratio.den" ) );
+		par->field_order = probe_cache_get( cache, i, "field_order" );
+		par->color_range = probe_cache_get( cache, i, "color_range" );
+		par->color_primaries = probe_cache_get( cache, i, "color_primaries" );
+		par->color_trc = probe_cache_get( cache, i, "color_trc" );
+		par->color_space = probe_cache_get( cache, i, "color_space" );
+		par->chroma_location = probe_cache_get( cache, i, "chroma_location" );
+		par->video_delay = probe_cache_get( cache, i, "video_delay" );
+		par->channel_layout = probe_cache_get( cache, i, "channel_layout" );
+		par->channels = probe_cache_get( cache, i, "channels" );
+		par->sample_rate = probe_cache_get( cache, i, "sample_rate" );
+		par->block_align = probe_cache_get( cache, i, "block_align" );
+		par->frame_size = probe_cache_get( cache, i, "frame_size" );
+		par->initial_padding = probe_cache_get( cache, i, "initial_padding" );
+
+		// The rest of this producer still uses the codec context of the stream
+		avcodec_parameters_to_context( st->codec, par );
+	}
+	return 0;
+}
+
+#endif
+
+/** Get the first timestamp of the video from the probe cache.
+*/
+
+static void probe_cache_first_pts( producer_avformat self )
+{
+	int video_index = self->video_index != -1 ? self->video_index : first_video_index( self );
+	char key[ 64 ];
+
+	snprintf( key, sizeof( key ), "stream.%d.first_pts", video_index );
+	if ( !self->probe_cache || video_index < 0 || !mlt_properties_get( self->probe_cache, key ) )
+		return;
+	self->first_pts = mlt_properties_get_int64( self->probe_cache, key );
+	snprintf( key, sizeof( key ), "stream.%d.variable_frame_rate", video_index );
+	if ( mlt_properties_get_int( self->probe_cache, key ) )
+		mlt_properties_set_int( MLT_PRODUCER_PROPERTIES( self->parent ), "meta.media.variable_frame_rate", 1 );
+}
+
+/** Get the stream info of a context from the probe cache or else by probing.
+*/
+
+static int find_stream_info( producer_avformat self, AVFormatContext *context )
+{
+#if LIBAVCODEC_VERSION_INT >= ((57<<16)+(37<<8)+0)
+	if ( self->probe_cache && !probe_cache_restore( self->probe_cache, context ) )
+		return 0;
+	if ( avformat_find_stream_info( context, NULL ) < 0 )
+		return -1;
+	if ( self->probe_cache )
+	{
+		probe_cache_store( self->probe_cache, context );
+		self->probe_dirty = 1;
+	}
+	return 0;
+#else
+	return avformat_find_stream_info( context, NULL );
+#endif
+}
+
 /** Open the file.
 */
 
@@ -782,6 +1083,8 @@ static int producer_open(producer_avformat self, mlt_profile profile, const char
 		pthread_mutex_init( &self->video_mutex, NULL );
 		pthread_mutex_init( &self->packets_mutex, NULL );
 		pthread_mutex_init( &self->open_mutex, NULL );
+		pthread_cond_init( &self->ahead_cond, NULL );
+		pthread_cond_init( &self->packets_cond, NULL );
 		self->is_mutex_init = 1;
 	}
 
@@ -818,7 +1121,8 @@ static int producer_open(producer_avformat self, mlt_profile profile, const char
 	if ( !error && self->video_format )
 	{
 		// Get the stream info
-		error = avformat_find_stream_info( self->video_format, NULL ) < 0;
+		probe_cache_init( self, format, filename );
+		error = find_stream_info( self, self->video_format ) < 0;
 
 		// Continue if no error
 		if ( !error && self->video_format )
@@ -845,7 +1149,7 @@ static int producer_open(producer_avformat self, mlt_profile profile, const char
 						apply_properties( self->audio_format, properties, AV_OPT_FLAG_DECODING_PARAM );
 						if ( self->audio_format->iformat && self->audio_format->iformat->priv_class && self->audio_format->priv_data )
 							apply_properties( self->audio_format->priv_data, properties, AV_OPT_FLAG_DECODING_PARAM );
-						avformat_find_stream_info( self->audio_format, NULL );
+						find_stream_info( self, self->audio_format );
 					}
 					else
 					{
@@ -904,6 +1208,8 @@ static int producer_open(producer_avformat self, mlt_profile profile, const char
 	{
 		self->apackets = mlt_deque_init();
 		self->vpackets = mlt_deque_init();
+		probe_cache_first_pts( self );
+		probe_cache_save( self );
 	}
 
 	if ( self->dummy_context )
@@ -994,6 +1300,311 @@ static int64_t best_pts( producer_avformat self, int64_t pts, int64_t dts )
 		return dts;
 }
 
+/** Get the name of the keyframe index file of the video stream.
+*/
+
+static int keyframe_index_file( producer_avformat self, char *path, size_t size )
+{
+	const char *resource = mlt_properties_get( MLT_PRODUCER_PROPERTIES( self->parent ), "resource" );
+	if ( mlt_avformat_cache_file( resource, "index", path, size ) )
+		return 1;
+	snprintf( path + strlen( path ), size - strlen( path ), ".%d", self->video_index );
+	return 0;
+}
+
+/** Load the keyframe index if it is enabled.
+
+	The caller must hold packets_mutex.
+*/
+
+static void keyframe_index_init( producer_avformat self )
+{
+	char path[ PATH_MAX ];
+	FILE *file;
+	int version = 0, complete = 0, vfr = 0;
+	int64_t first_pts = AV_NOPTS_VALUE, end = AV_NOPTS_VALUE;
+	index_entry entry;
+
+	if ( self->index_state )
+		return;
+	if ( !self->video_seekable || self->video_index < 0 ||
+		 !mlt_properties_get_int( MLT_PRODUCER_PROPERTIES( self->parent ), "keyframe_index" ) )
+	{
+		self->index_state = -1;
+		return;
+	}
+	self->index_state = 1;
+	self->index_end = AV_NOPTS_VALUE;
+	self->index_contiguous = self->last_position == POSITION_INITIAL;
+
+	if ( keyframe_index_file( self, path, sizeof( path ) ) || !( file = fopen( path, "r" ) ) )
+		return;
+	if ( fscanf( file, "mlt keyframe index %d first_pts %" SCNd64 " variable_frame_rate %d end %" SCNd64 " complete %d",
+			&version, &first_pts, &vfr, &end, &complete ) == 5 && version == INDEX_VERSION )
+	{
+		while ( fscanf( file, "%" SCNd64 " %" SCNd64, &entry.pts, &entry.pos ) == 2 )
+		{
+			if ( self->index_count == self->index_size )
+			{
+				int size = self->index_size? self->index_size * 2 : 256;
+				index_entry *index = realloc( self->index, size * sizeof( *index ) );
+				if ( !index )
+					break;
+				self->index = index;
+				self->index_size = size;
+			}
+			self->index[ self->index_count++ ] = entry;
+		}
+		self->index_end = self->index_count? end : AV_NOPTS_VALUE;
+		self->index_complete = self->index_count && complete;
+		self->index_vfr = vfr;
+		if ( self->first_pts == AV_NOPTS_VALUE )
+			self->first_pts = first_pts;
+		if ( vfr )
+			mlt_properties_set_int( MLT_PRODUCER_PROPERTIES( self->parent ), "meta.media.variable_frame_rate", 1 );
+		mlt_log_verbose( MLT_PRODUCER_SERVICE( self->parent ), "loaded %d keyframes from %s\n", self->index_count, path );
+	}
+	fclose( file );
+}
+
+/** Save the keyframe index if it has changed.
+*/
+
+static void keyframe_index_save( producer_avformat self )
+{
+	char path[ PATH_MAX ];
+	char temp[ PATH_MAX ];
+	FILE *file;
+	int i;
+
+	if ( self->index_state <= 0 || !self->index_dirty || !self->index_count || self->first_pts == AV_NOPTS_VALUE ||
+		 !self->parent || keyframe_index_file( self, path, sizeof( path ) ) )
+		return;
+
+	// Write a temporary file and rename it so that readers never see a partial index.
+	snprintf( temp, sizeof( temp ), "%s.%p", path, (void*) self );
+	if ( !( file = fopen( temp, "w" ) ) )
+		return;
+	fprintf( file, "mlt keyframe index %d\nfirst_pts %" PRId64 "\nvariable_frame_rate %d\nend %" PRId64 "\ncomplete %d\n",
+		INDEX_VERSION, self->first_pts, self->index_vfr, self->index_end, self->index_complete );
+	for ( i = 0; i < self->index_count; i++ )
+		fprintf( file, "%" PRId64 " %" PRId64 "\n", self->index[i].pts, self->index[i].pos );
+	if ( fclose( file ) || rename( temp, path ) )
+		remove( temp );
+	self->index_dirty = 0;
+}
+
+/** Add a packet of the video stream that was read on from indexed data.
+
+	The caller must hold packets_mutex.
+*/
+
+static void keyframe_index_add( producer_avformat self, AVPacket *pkt )
+{
+	int64_t pts = pkt->pts != AV_NOPTS_VALUE? pkt->pts : pkt->dts;
+
+	if ( self->index_state <= 0 || !self->index_contiguous || self->index_complete || pts == AV_NOPTS_VALUE )
+		return;
+	if ( ( pkt->flags & AV_PKT_FLAG_KEY ) && ( !self->index_count || pts > self->index[ self->index_count - 1 ].pts ) )
+	{
+		if ( self->index_count == self->index_size )
+		{
+			int size = self->index_size? self->index_size * 2 : 256;
+			index_entry *index = realloc( self->index, size * sizeof( *index ) );
+			if ( !index )
+			{
+				self->index_contiguous = 0;
+				return;
+			}
+			self->index = index;
+			self->index_size = size;
+		}
+		self->index[ self->index_count ].pts = pts;
+		self->index[ self->index_count ].pos = pkt->pos;
+		self->index_count++;
+		self->index_dirty = 1;
+	}
+	if ( self->index_end == AV_NOPTS_VALUE || pts > self->index_end )
+	{
+		self->index_end = pts;
+		self->index_dirty = 1;
+	}
+}
+
+/** Find the last keyframe at or before a timestamp if the index covers it.
+
+	The caller must hold packets_mutex.
+*/
+
+static index_entry *keyframe_index_find( producer_avformat self, int64_t timestamp )
+{
+	int low = 0, high = self->index_count;
+
+	if ( self->index_state <= 0 || !self->index_count || self->index[0].pts > timestamp ||
+		 ( !self->index_complete && timestamp > self->index_end ) )
+		return NULL;
+
+	// Binary search for the first keyframe after the timestamp
+	while ( low < high )
+	{
+		int middle = ( low + high ) / 2;
+		if ( self->index[ middle ].pts <= timestamp )
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return &self->index[ low - 1 ];
+}
+
+/** Determine whether a demux thread wants a packet of a stream.
+*/
+
+static int demux_wanted( producer_avformat self, int which, int index )
+{
+	if ( !which )
+		return index == self->video_index;
+	return index == self->audio_index || ( self->audio_index == INT_MAX && index < MAX_AUDIO_STREAMS
+		&& self->audio_format->streams[ index ]->codec->codec_type == AVMEDIA_TYPE_AUDIO );
+}
+
+/** Read packets ahead until there are demux_ahead megabytes of them or reading fails.
+*/
+
+static void demux_run( producer_avformat self, int which )
+{
+	AVFormatContext *context = which? self->audio_format : self->video_format;
+	mlt_deque queue = which? self->apackets : self->vpackets;
+	AVPacket pkt;
+	int ret = 0;
+
+	pthread_mutex_lock( &self->packets_mutex );
+	while ( !self->demux_quit[ which ] && ret >= 0 )
+	{
+		if ( mlt_deque_count( queue ) && self->demux_bytes[ which ] >= self->demux_limit )
+		{
+			pthread_cond_wait( &self->packets_cond, &self->packets_mutex );
+			continue;
+		}
+		pthread_mutex_unlock( &self->packets_mutex );
+		av_init_packet( &pkt );
+		ret = av_read_frame( context, &pkt );
+		if ( ret >= 0 && ( !demux_wanted( self, which, pkt.stream_index ) || av_dup_packet( &pkt ) ) )
+		{
+			av_free_packet( &pkt );
+			pthread_mutex_lock( &self->packets_mutex );
+			continue;
+		}
+		pthread_mutex_lock( &self->packets_mutex );
+		AVPacket *tmp = ret >= 0? malloc( sizeof( AVPacket ) ) : NULL;
+		if ( tmp )
+		{
+			if ( !which )
+				keyframe_index_add( self, &pkt );
+			*tmp = pkt;
+			mlt_deque_push_back( queue, tmp );
+			self->demux_bytes[ which ] += pkt.size;
+		}
+		else
+		{
+			if ( ret >= 0 )
+			{
+				av_free_packet( &pkt );
+				ret = AVERROR( ENOMEM );
+			}
+			self->demux_result[ which ] = ret;
+		}
+		pthread_cond_broadcast( &self->packets_cond );
+	}
+	pthread_mutex_unlock( &self->packets_mutex );
+}
+
+static void *demux_video_thread( void *arg )
+{
+	demux_run( arg, 0 );
+	return NULL;
+}
+
+static void *demux_audio_thread( void *arg )
+{
+	demux_run( arg, 1 );
+	return NULL;
+}
+
+/** Stop reading packets ahead and discard those already read.
+
+	This must be done before seeking or otherwise using the format context directly.
+	The caller must hold packets_mutex, which is released while the thread finishes.
+*/
+
+static void demux_stop( producer_avformat self, int which )
+{
+	mlt_deque queue = which? self->apackets : self->vpackets;
+	AVPacket *pkt;
+
+	if ( self->demux_running[ which ] )
+	{
+		self->demux_quit[ which ] = 1;
+		pthread_cond_broadcast( &self->packets_cond );
+		pthread_mutex_unlock( &self->packets_mutex );
+		pthread_join( self->demux_thread[ which ], NULL );
+		pthread_mutex_lock( &self->packets_mutex );
+		self->demux_running[ which ] = 0;
+		self->demux_quit[ which ] = 0;
+		while ( queue && ( pkt = mlt_deque_pop_front( queue ) ) )
+		{
+			av_free_packet( pkt );
+			free( pkt );
+		}
+	}
+	self->demux_result[ which ] = 0;
+	self->demux_bytes[ which ] = 0;
+}
+
+/** Take the next packet read ahead for the video (0) or audio (1) decoder.
+
+	This starts reading ahead if it is enabled and the file has separate video
+	and audio format contexts, which are only used by their own decoder.
+	The caller must hold packets_mutex.
+	Returns 1 with a packet, 0 if packets are not read ahead, or the error that
+	stopped reading ahead.
+*/
+
+static int demux_take( producer_avformat self, int which, AVPacket *pkt )
+{
+	mlt_deque queue = which? self->apackets : self->vpackets;
+
+	if ( !self->demux_running[ which ] )
+	{
+		mlt_properties properties = MLT_PRODUCER_PROPERTIES( self->parent );
+		AVFormatContext *context = which? self->audio_format : self->video_format;
+		AVFormatContext *other = which? self->video_format : self->audio_format;
+
+		self->demux_limit = (int64_t) mlt_properties_get_int( properties, "demux_ahead" ) * 1024 * 1024;
+		// find_first_pts() uses the video format context directly.
+		int seekable = which? self->seekable : ( self->video_seekable && self->first_pts != AV_NOPTS_VALUE );
+
+		if ( self->demux_limit <= 0 || !context || context == other || !queue || !seekable )
+			return 0;
+		self->demux_result[ which ] = 0;
+		self->demux_running[ which ] = !pthread_create( &self->demux_thread[ which ], NULL,
+			which? demux_audio_thread : demux_video_thread, self );
+		if ( !self->demux_running[ which ] )
+			return 0;
+	}
+	while ( !mlt_deque_count( queue ) && !self->demux_result[ which ] )
+		pthread_cond_wait( &self->packets_cond, &self->packets_mutex );
+	if ( mlt_deque_count( queue ) )
+	{
+		AVPacket *tmp = mlt_deque_pop_front( queue );
+		*pkt = *tmp;
+		free( tmp );
+		self->demux_bytes[ which ] -= pkt->size;
+		pthread_cond_broadcast( &self->packets_cond );
+		return 1;
+	}
+	return self->demux_result[ which ];
+}
+
 static void find_first_pts( producer_avformat self, int video_index )
 {
 	// find initial PTS
@@ -1045,6 +1656,91 @@ static void find_first_pts( producer_avformat self, int video_index )
 	if ( vfr_counter >= VFR_THRESHOLD )
 		mlt_properties_set_int( MLT_PRODUCER_PROPERTIES(self->parent), "meta.media.variable_frame_rate", 1 );
 	av_seek_frame( context, -1, 0, AVSEEK_FLAG_BACKWARD );
+	if ( self->index_state > 0 && video_index == self->video_index )
+	{
+		self->index_vfr = vfr_counter >= VFR_THRESHOLD;
+		self->index_dirty = 1;
+	}
+	if ( self->probe_cache && self->first_pts != AV_NOPTS_VALUE )
+	{
+		char key[ 64 ];
+		snprintf( key, sizeof( key ), "stream.%d.first_pts", video_index );
+		mlt_properties_set_int64( self->probe_cache, key, self->first_pts );
+		snprintf( key, sizeof( key ), "stream.%d.variable_frame_rate", video_index );
+		mlt_properties_set_int( self->probe_cache, key, vfr_counter >= VFR_THRESHOLD );
+		self->probe_dirty = 1;
+		probe_cache_save( self );
+	}
+}
+
+/** Discard the pictures decoded ahead and stop decoding ahead until the next decode.
+*/
+
+static void decode_ahead_flush( producer_avformat self )
+{
+	AVFrame *frame;
+	while ( self->ahead_frames && ( frame = mlt_deque_pop_front( self->ahead_frames ) ) )
+		av_frame_free( &frame );
+	self->ahead_position = POSITION_INVALID;
+}
+
+/** Seek the video to the keyframe at or before a source frame position.
+
+	The caller must hold packets_mutex.
+*/
+
+static void seek_video_position( producer_avformat self, int64_t req_position, int preseek )
+{
+	mlt_properties properties = MLT_PRODUCER_PROPERTIES( self->parent );
+	AVFormatContext *context = self->video_format;
+	AVCodecContext *codec_context = context->streams[ self->video_index ]->codec;
+
+	// We may want to use the source fps if available
+	double source_fps = mlt_properties_get_double( properties, "meta.media.frame_rate_num" ) /
+		mlt_properties_get_double( properties, "meta.media.frame_rate_den" );
+
+	// Calculate the timestamp for the requested frame
+	int64_t timestamp = req_position / ( av_q2d( self->video_time_base ) * source_fps );
+	if ( req_position <= 0 )
+		timestamp = 0;
+	else if ( self->first_pts != AV_NOPTS_VALUE )
+		timestamp += self->first_pts;
+	else if ( context->start_time != AV_NOPTS_VALUE )
+		timestamp += context->start_time;
+
+	demux_stop( self, 0 );
+
+	// Seek exactly to the keyframe if it is indexed
+	index_entry *keyframe = keyframe_index_find( self, timestamp );
+	codec_context->skip_loop_filter = AVDISCARD_NONREF;
+	if ( keyframe )
+	{
+		mlt_log_debug( MLT_PRODUCER_SERVICE(self->parent), "seeking keyframe %"PRId64" req_pos %"PRId64"\n", keyframe->pts, req_position );
+		if ( ( context->iformat->flags & AVFMT_TS_DISCONT ) && keyframe->pos >= 0 )
+			av_seek_frame( context, self->video_index, keyframe->pos, AVSEEK_FLAG_BYTE );
+		else
+			av_seek_frame( context, self->video_index, keyframe->pts, AVSEEK_FLAG_BACKWARD );
+		self->index_contiguous = 1;
+	}
+	else
+	{
+		if ( preseek && av_q2d( self->video_time_base ) != 0 )
+			timestamp -= 2 / av_q2d( self->video_time_base );
+		if ( timestamp < 0 )
+			timestamp = 0;
+		mlt_log_debug( MLT_PRODUCER_SERVICE(self->parent), "seeking timestamp %"PRId64" req_pos %"PRId64"\n", timestamp, req_position );
+
+		// Seek to the timestamp
+		av_seek_frame( context, self->video_index, timestamp, AVSEEK_FLAG_BACKWARD );
+		self->index_contiguous = timestamp == 0;
+	}
+
+	// flush any pictures still in decode buffer
+	avcodec_flush_buffers( codec_context );
+
+	// Remove the cached info relating to the previous position
+	self->current_position = POSITION_INVALID;
+	self->last_position = POSITION_INVALID;
 }
 
 static int seek_video( producer_avformat self, mlt_position position,
@@ -1057,23 +1753,10 @@ static int seek_video( producer_avformat self, mlt_position position,
 	if ( seek_threshold <= 0 ) seek_threshold = 12;
 
 	pthread_mutex_lock( &self->packets_mutex );
+	keyframe_index_init( self );
 
 	if ( self->video_seekable && ( position != self->video_expected || self->last_position < 0 ) )
 	{
-
-		// Fetch the video format context
-		AVFormatContext *context = self->video_format;
-
-		// Get the video stream
-		AVStream *stream = context->streams[ self->video_index ];
-
-		// Get codec context
-		AVCodecContext *codec_context = stream->codec;
-
-		// We may want to use the source fps if available
-		double source_fps = mlt_properties_get_double( properties, "meta.media.frame_rate_num" ) /
-			mlt_properties_get_double( properties, "meta.media.frame_rate_den" );
-	
 		if ( self->first_pts == AV_NOPTS_VALUE && self->last_position == POSITION_INITIAL )
 			find_first_pts( self, self->video_index );
 
@@ -1084,32 +1767,11 @@ static int seek_video( producer_avformat self, mlt_position position,
 		}
 		else if ( position < self->video_expected || position - self->video_expected >= seek_threshold || self->last_position < 0 )
 		{
-			// Calculate the timestamp for the requested frame
-			int64_t timestamp = req_position / ( av_q2d( self->video_time_base ) * source_fps );
-			if ( req_position <= 0 )
-				timestamp = 0;
-			else if ( self->first_pts != AV_NOPTS_VALUE )
-				timestamp += self->first_pts;
-			else if ( context->start_time != AV_NOPTS_VALUE )
-				timestamp += context->start_time;
-			if ( preseek && av_q2d( self->video_time_base ) != 0 )
-				timestamp -= 2 / av_q2d( self->video_time_base );
-			if ( timestamp < 0 )
-				timestamp = 0;
-			mlt_log_debug( MLT_PRODUCER_SERVICE(producer), "seeking timestamp %"PRId64" position " MLT_POSITION_FMT " expected "MLT_POSITION_FMT" last_pos %"PRId64"\n",
-				timestamp, position, self->video_expected, self->last_position );
-
-			// Seek to the timestamp
-			codec_context->skip_loop_filter = AVDISCARD_NONREF;
-			av_seek_frame( context, self->video_index, timestamp, AVSEEK_FLAG_BACKWARD );
-
-			// flush any pictures still in decode buffer
-			avcodec_flush_buffers( codec_context );
-
-			// Remove the cached info relating to the previous position
-			self->current_position = POSITION_INVALID;
-			self->last_position = POSITION_INVALID;
-			av_freep( &self->video_frame );
+			mlt_log_debug( MLT_PRODUCER_SERVICE(producer), "seeking position " MLT_POSITION_FMT " expected "MLT_POSITION_FMT" last_pos %"PRId64"\n",
+				position, self->video_expected, self->last_position );
+			seek_video_position( self, req_position, preseek );
+			av_frame_free( &self->video_frame );
+			decode_ahead_flush( self );
 		}
 	}
 	pthread_mutex_unlock( &self->packets_mutex );
@@ -1556,14 +2218,684 @@ static int allocate_buffer( mlt_frame frame, AVCodecContext *codec_context, uint
 	return size;
 }
 
-/** Get an image from a frame.
+static void free_picture( void *picture )
+{
+	AVFrame *frame = picture;
+	av_frame_free( &frame );
+}
+
+/** Set the decoded picture as the image of the frame without copying it.
+
+	This is only possible when the picture is already laid out as the MLT image
+	format and it needs no colorspace or range conversion. Lines padded by the
+	decoder are described with mlt_frame_set_image_planes() and only packed if
+	a consumer of the image does not honor the strides. The frame keeps a
+	reference to the picture until it is closed.
+	Returns the size of the image or 0 if the picture must be converted.
 */
 
-static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_format *format, int *width, int *height, int writable )
+static int reference_image( producer_avformat self, mlt_frame frame, AVFrame *picture, int pix_fmt,
+	mlt_image_format format, int width, int height, uint8_t **buffer )
 {
-	// Get the producer
-	producer_avformat self = mlt_frame_pop_service( frame );
-	mlt_producer producer = self->parent;
+	mlt_profile profile = mlt_service_profile( MLT_PRODUCER_SERVICE( self->parent ) );
+	int same_space = self->yuv_colorspace == profile->colorspace;
+	int size = mlt_image_format_size( format, width, height, NULL );
+	uint8_t *planes[4];
+	int strides[4];
+	int packed = 1;
+	int match = 0;
+	int i;
+
+	if ( !picture || !picture->buf[0] || picture->format != pix_fmt
+		 || picture->width != width || picture->height != height )
+		return 0;
+
+	mlt_image_format_planes( format, width, height, picture->data[0], planes, strides );
+	for ( i = 0; i < 4; i++ )
+	{
+		if ( strides[i] && picture->linesize[i] < strides[i] )
+			return 0;
+		if ( strides[i] && ( picture->linesize[i] != strides[i] || picture->data[i] != planes[i] ) )
+			packed = 0;
+	}
+
+	switch ( format )
+	{
+	case mlt_image_yuv420p:
+		// convert_image() keeps the full range for yuv420p
+		match = ( pix_fmt == ( self->full_luma ? AV_PIX_FMT_YUVJ420P : AV_PIX_FMT_YUV420P ) )
+			&& same_space && !( width % 2 ) && !( height % 2 );
+		break;
+	case mlt_image_yuv422:
+		match = pix_fmt == AV_PIX_FMT_YUYV422 && !self->full_luma && same_space;
+		break;
+	case mlt_image_rgb24:
+		match = pix_fmt == AV_PIX_FMT_RGB24;
+		break;
+	case mlt_image_rgb24a:
+	case mlt_image_opengl:
+		match = pix_fmt == AV_PIX_FMT_RGBA;
+		break;
+	default:
+		break;
+	}
+	if ( match && packed && ( picture->data[0] < picture->buf[0]->data
+		 || picture->data[0] + size > picture->buf[0]->data + picture->buf[0]->size ) )
+		match = 0;
+	if ( match && ( picture = av_frame_clone( picture ) ) )
+	{
+		*buffer = picture->data[0];
+		mlt_frame_set_image( frame, *buffer, size, NULL );
+		if ( !packed )
+		{
+			for ( i = 0; i < 4; i++ )
+			{
+				planes[i] = strides[i] ? picture->data[i] : NULL;
+				strides[i] = strides[i] ? picture->linesize[i] : 0;
+			}
+			mlt_frame_set_image_planes( frame, planes, strides );
+		}
+		mlt_properties_set_data( MLT_FRAME_PROPERTIES( frame ), "avformat.picture", picture, 0, free_picture, NULL );
+		return size;
+	}
+	return 0;
+}
+
+/** Clone a frame for error concealment.
+
+	An image from reference_image() is referenced again rather than copied,
+	along with the layout of its planes.
+*/
+
+static mlt_frame clone_frame( mlt_frame frame )
+{
+	mlt_properties properties = MLT_FRAME_PROPERTIES( frame );
+	AVFrame *picture = mlt_properties_get_data( properties, "avformat.picture", NULL );
+	int size = 0;
+	uint8_t *image = mlt_properties_get_data( properties, "image", &size );
+
+	if ( picture && image == picture->data[0] && ( picture = av_frame_clone( picture ) ) )
+	{
+		mlt_frame clone = mlt_frame_init( NULL );
+		mlt_properties clone_properties = MLT_FRAME_PROPERTIES( clone );
+
+		mlt_properties_inherit( clone_properties, properties );
+		mlt_properties_set_data( clone_properties, "avformat.picture", picture, 0, free_picture, NULL );
+		mlt_properties_set_data( clone_properties, "image", image, size, NULL, NULL );
+		if ( mlt_properties_get_data( properties, "_image_planes", NULL ) )
+		{
+			uint8_t *planes[4];
+			int strides[4];
+			mlt_frame_get_image_planes( frame, planes, strides );
+			mlt_frame_set_image_planes( clone, planes, strides );
+		}
+		return clone;
+	}
+	return mlt_frame_clone( frame, 1 );
+}
+
+/** Read and decode video packets until there is a picture at or after a position.
+
+	Pictures before min_position are skipped, which is usually req_position.
+	The caller must hold video_mutex. Returns 1 if a picture was decoded, 0 if not,
+	or -1 if the source was closed to be reopened.
+*/
+
+static int decode_video( producer_avformat self, AVFrame *frame, int64_t req_position, int64_t min_position, int64_t *position )
+{
+	mlt_producer producer = self->parent;
+	mlt_properties properties = MLT_PRODUCER_PROPERTIES( producer );
+	AVFormatContext *context = self->video_format;
+	AVCodecContext *codec_context = context->streams[ self->video_index ]->codec;
+	int ret = 0;
+	int got_picture = 0;
+	int64_t int_position = 0;
+	int decode_errors = 0;
+
+	// We may want to use the source fps if available
+	double source_fps = mlt_properties_get_double( properties, "meta.media.frame_rate_num" ) /
+		mlt_properties_get_double( properties, "meta.media.frame_rate_den" );
+
+	// Determines if we have to decode all frames in a sequence - when there temporal compression is used.
+	const AVCodecDescriptor *descriptor = codec_context->codec? avcodec_descriptor_get( codec_context->codec->id ) : NULL;
+	int must_decode = descriptor && !( descriptor->props & AV_CODEC_PROP_INTRA_ONLY );
+
+	double delay = mlt_properties_get_double( properties, "video_delay" );
+
+	while( ret >= 0 && !got_picture )
+	{
+		// Read a packet
+		if ( self->pkt.stream_index == self->video_index )
+			av_free_packet( &self->pkt );
+		av_init_packet( &self->pkt );
+		pthread_mutex_lock( &self->packets_mutex );
+		int demuxed = demux_take( self, 0, &self->pkt );
+		if ( !demuxed && mlt_deque_count( self->vpackets ) )
+		{
+			AVPacket *tmp = (AVPacket*) mlt_deque_pop_front( self->vpackets );
+			self->pkt = *tmp;
+			free( tmp );
+		}
+		else if ( demuxed <= 0 )
+		{
+			ret = demuxed? demuxed : av_read_frame( context, &self->pkt );
+			if ( ret >= 0 && self->pkt.stream_index == self->video_index )
+				keyframe_index_add( self, &self->pkt );
+			if ( ret == AVERROR_EOF && self->index_contiguous && !self->index_complete && self->index_count )
+			{
+				self->index_complete = 1;
+				self->index_dirty = 1;
+			}
+			if ( ret >= 0 && !self->video_seekable && self->pkt.stream_index == self->audio_index )
+			{
+				if ( !av_dup_packet( &self->pkt ) )
+				{
+					AVPacket *tmp = malloc( sizeof(AVPacket) );
+					*tmp = self->pkt;
+					mlt_deque_push_back( self->apackets, tmp );
+				}
+			}
+			else if ( ret < 0 )
+			{
+				if ( ret != AVERROR_EOF )
+					mlt_log_verbose( MLT_PRODUCER_SERVICE(producer), "av_read_frame returned error %d inside get_image\n", ret );
+				if ( !self->video_seekable && mlt_properties_get_int( properties, "reconnect" ) )
+				{
+					// Try to reconnect to live sources by closing context and codecs,
+					// and letting next call to get_frame() reopen.
+					prepare_reopen( self );
+					pthread_mutex_unlock( &self->packets_mutex );
+					return -1;
+				}
+				if ( !self->video_seekable && mlt_properties_get_int( properties, "exit_on_disconnect" ) )
+				{
+					mlt_log_fatal( MLT_PRODUCER_SERVICE(producer), "Exiting with error due to disconnected source.\n" );
+					exit( EXIT_FAILURE );
+				}
+				// Send null packets to drain decoder.
+				self->pkt.size = 0;
+				self->pkt.data = NULL;
+			}
+		}
+		pthread_mutex_unlock( &self->packets_mutex );
+
+		// We only deal with video from the selected video_index
+		if ( self->pkt.stream_index == self->video_index )
+		{
+			int64_t pts = best_pts( self, self->pkt.pts, self->pkt.dts );
+			if ( pts != AV_NOPTS_VALUE )
+			{
+				if ( !self->video_seekable && self->first_pts == AV_NOPTS_VALUE )
+					self->first_pts = pts;
+				if ( self->first_pts != AV_NOPTS_VALUE )
+					pts -= self->first_pts;
+				else if ( context->start_time != AV_NOPTS_VALUE )
+					pts -= context->start_time;
+				int_position = ( int64_t )( ( av_q2d( self->video_time_base ) * pts + delay ) * source_fps + 0.5 );
+				if ( int_position == self->last_position )
+					int_position = self->last_position + 1;
+			}
+			mlt_log_debug( MLT_PRODUCER_SERVICE(producer),
+				"V pkt.pts %"PRId64" pkt.dts %"PRId64" req_pos %"PRId64" cur_pos %"PRId64" pkt_pos %"PRId64"\n",
+				self->pkt.pts, self->pkt.dts, req_position, self->current_position, int_position );
+
+			// Make a dumb assumption on streams that contain wild timestamps
+			if ( llabs( req_position - int_position ) > 999 )
+			{
+				mlt_log_verbose( MLT_PRODUCER_SERVICE(producer), " WILD TIMESTAMP: "
+					"pkt.pts=[%"PRId64"], pkt.dts=[%"PRId64"], req_position=[%"PRId64"], "
+					"current_position=[%"PRId64"], int_position=[%"PRId64"], pts=[%"PRId64"] \n",
+					self->pkt.pts, self->pkt.dts, req_position,
+					self->current_position, int_position, pts );
+				int_position = req_position;
+			}
+			self->last_position = int_position;
+
+			// Decode the image
+			if ( must_decode  || int_position >= min_position || !self->pkt.data )
+			{
+#ifdef VDPAU
+				if ( self->vdpau )
+				{
+					if ( self->vdpau->decoder == VDP_INVALID_HANDLE )
+					{
+						vdpau_decoder_init( self );
+					}
+					self->vdpau->is_decoded = 0;
+				}
+#endif
+				codec_context->reordered_opaque = int_position;
+				if ( int_position >= req_position )
+					codec_context->skip_loop_filter = AVDISCARD_NONE;
+				av_frame_unref( frame );
+				ret = avcodec_decode_video2( codec_context, frame, &got_picture, &self->pkt );
+				mlt_log_debug( MLT_PRODUCER_SERVICE(producer), "decoded packet with size %d => %d\n", self->pkt.size, ret );
+				// Note: decode may fail at the beginning of MPEGfile (B-frames referencing before first I-frame), so allow a few errors.
+				if ( ret < 0 )
+				{
+					if ( ++decode_errors <= 10 ) {
+						ret = 0;
+					} else {
+						mlt_log_warning( MLT_PRODUCER_SERVICE(producer), "video decoding error %d\n", ret );
+						self->last_good_position = POSITION_INVALID;
+					}
+				}
+				else
+				{
+					decode_errors = 0;
+				}
+			}
+
+			if ( got_picture )
+			{
+				// Get position of reordered frame
+				int_position = frame->reordered_opaque;
+				pts = best_pts( self, frame->pkt_pts, frame->pkt_dts );
+				if ( pts != AV_NOPTS_VALUE )
+				{
+					// Some streams are not marking their key frames even though
+					// there are I frames, and find_first_pts() fails as a result.
+					// Try to set first_pts here after getting pict_type.
+					if ( self->first_pts == AV_NOPTS_VALUE &&
+						(frame->key_frame || frame->pict_type == AV_PICTURE_TYPE_I) )
+						 self->first_pts = pts;
+					if ( self->first_pts != AV_NOPTS_VALUE )
+						pts -= self->first_pts;
+					else if ( context->start_time != AV_NOPTS_VALUE )
+						pts -= context->start_time;
+					int_position = ( int64_t )( ( av_q2d( self->video_time_base ) * pts + delay ) * source_fps + 0.5 );
+				}
+
+				if ( int_position < min_position )
+					got_picture = 0;
+				else if ( int_position >= req_position )
+					codec_context->skip_loop_filter = AVDISCARD_NONE;
+			}
+			else if ( !self->pkt.data ) // draining decoder with null packets
+			{
+				ret = -1;
+			}
+			mlt_log_debug( MLT_PRODUCER_SERVICE(producer), " got_pic %d key %d ret %d pkt_pos %"PRId64"\n",
+						   got_picture, self->pkt.flags & AV_PKT_FLAG_KEY, ret, int_position );
+		}
+
+		// Free packet data if not video and not live audio packet
+		if ( self->pkt.stream_index != self->video_index &&
+			 !( !self->video_seekable && self->pkt.stream_index == self->audio_index ) )
+			av_free_packet( &self->pkt );
+	}
+	*position = int_position;
+
+	return got_picture;
+}
+
+/** Take the first picture decoded ahead at or after a position.
+
+	This is the picture decode_video() would have returned. Older pictures are discarded.
+	The caller must hold video_mutex.
+*/
+
+static int decode_ahead_take( producer_avformat self, int64_t req_position, int64_t *position )
+{
+	AVFrame *frame;
+
+	while ( self->ahead_frames && ( frame = mlt_deque_pop_front( self->ahead_frames ) ) )
+	{
+		if ( frame->reordered_opaque >= req_position )
+		{
+			*position = frame->reordered_opaque;
+			av_frame_unref( self->video_frame );
+			av_frame_move_ref( self->video_frame, frame );
+			av_frame_free( &frame );
+			return 1;
+		}
+		av_frame_free( &frame );
+	}
+	return 0;
+}
+
+/** Get the number of bytes in the buffers of a picture.
+*/
+
+static int64_t frame_bytes( AVFrame *frame )
+{
+	int64_t bytes = 0;
+	int i;
+	for ( i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; i++ )
+		bytes += frame->buf[i]->size;
+	return bytes;
+}
+
+/** Discard the pictures kept for reverse play.
+*/
+
+static void gop_flush( producer_avformat self )
+{
+	AVFrame *frame;
+	while ( self->gop_frames && ( frame = mlt_deque_pop_front( self->gop_frames ) ) )
+		av_frame_free( &frame );
+	while ( self->gop_prefetch && ( frame = mlt_deque_pop_front( self->gop_prefetch ) ) )
+		av_frame_free( &frame );
+	self->gop_bytes = 0;
+	self->gop_prefetch_position = POSITION_INVALID;
+	self->gop_prefetch_state = 0;
+}
+
+/** Keep the pictures for reverse play within the reverse_cache budget.
+
+	Pictures after a position have already been shown in reverse, so they go
+	first. If keep_front is false, the earliest pictures go next.
+	Returns true if the cache fits in the budget.
+*/
+
+static int gop_trim( producer_avformat self, int64_t position, int keep_front )
+{
+	mlt_properties properties = MLT_PRODUCER_PROPERTIES( self->parent );
+	int64_t budget = (int64_t) mlt_properties_get_int( properties, "reverse_cache" ) * 1024 * 1024;
+	AVFrame *frame;
+
+	while ( self->gop_bytes > budget && mlt_deque_count( self->gop_frames ) > 1 )
+	{
+		frame = mlt_deque_peek_back( self->gop_frames );
+		if ( frame->reordered_opaque > position )
+			mlt_deque_pop_back( self->gop_frames );
+		else if ( !keep_front )
+			frame = mlt_deque_pop_front( self->gop_frames );
+		else
+			break;
+		self->gop_bytes -= frame_bytes( frame );
+		av_frame_free( &frame );
+	}
+	return self->gop_bytes <= budget;
+}
+
+/** Add a copy of a picture to a list of pictures for reverse play.
+*/
+
+static int gop_push( producer_avformat self, mlt_deque deque, AVFrame *frame, int64_t position )
+{
+	AVFrame *copy = av_frame_clone( frame );
+	if ( copy )
+	{
+		copy->reordered_opaque = position;
+		mlt_deque_push_back( deque, copy );
+		self->gop_bytes += frame_bytes( copy );
+	}
+	return copy != NULL;
+}
+
+/** Determine whether a picture for a position can be taken from the reverse play cache.
+*/
+
+static int gop_contains( producer_avformat self, int64_t req_position )
+{
+	AVFrame *first = self->gop_frames? mlt_deque_peek_front( self->gop_frames ) : NULL;
+	AVFrame *last = self->gop_frames? mlt_deque_peek_back( self->gop_frames ) : NULL;
+	return first && first->reordered_opaque <= req_position && last->reordered_opaque >= req_position;
+}
+
+/** Reference the picture for a position from the reverse play cache in video_frame.
+
+	The caller must hold video_mutex.
+*/
+
+static int gop_take( producer_avformat self, int64_t req_position, int64_t *position )
+{
+	int i, n = self->gop_frames? mlt_deque_count( self->gop_frames ) : 0;
+
+	if ( !gop_contains( self, req_position ) )
+		return 0;
+	for ( i = 0; i < n; i++ )
+	{
+		AVFrame *frame = mlt_deque_peek( self->gop_frames, i );
+		if ( frame->reordered_opaque >= req_position )
+		{
+			*position = frame->reordered_opaque;
+			av_frame_unref( self->video_frame );
+			if ( av_frame_ref( self->video_frame, frame ) < 0 )
+				return 0;
+			self->gop_position = req_position;
+
+			// Prefetch the previous GOP while this one is shown
+			frame = mlt_deque_peek_front( self->gop_frames );
+			if ( self->gop_prefetch_position == POSITION_INVALID && self->gop_prefetch_state >= 0 &&
+				 frame->reordered_opaque > 0 )
+			{
+				self->gop_prefetch_position = frame->reordered_opaque - 1;
+				self->gop_prefetch_state = 0;
+			}
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/** Decode the GOP that ends with a position into the reverse play cache.
+
+	seek_video() must have already sought to the keyframe before the position.
+	The caller must hold video_mutex. Returns the same as decode_video().
+*/
+
+static int gop_decode( producer_avformat self, int64_t req_position )
+{
+	AVFrame *frame = av_frame_alloc();
+	int64_t position = 0;
+	int result = 0;
+
+	gop_flush( self );
+	if ( !frame )
+		return 0;
+
+	// Every picture will be shown, so do not skip the loop filter for any.
+	self->video_codec->skip_loop_filter = AVDISCARD_NONE;
+	while ( ( result = decode_video( self, frame, req_position, 0, &position ) ) > 0 )
+	{
+		gop_push( self, self->gop_frames, frame, position );
+		av_frame_unref( frame );
+		gop_trim( self, req_position, 0 );
+		if ( position >= req_position )
+			break;
+	}
+	av_frame_free( &frame );
+
+	return result;
+}
+
+/** Decode the next picture of the previous GOP for reverse play.
+
+	This runs on the decode ahead thread, which holds video_mutex.
+*/
+
+static void gop_prefetch_next( producer_avformat self )
+{
+	AVFrame *frame;
+	int64_t position = 0;
+	int result;
+
+	if ( !self->gop_prefetch_state )
+	{
+		pthread_mutex_lock( &self->packets_mutex );
+		seek_video_position( self, self->gop_prefetch_position, 0 );
+		pthread_mutex_unlock( &self->packets_mutex );
+		self->video_codec->skip_loop_filter = AVDISCARD_NONE;
+		decode_ahead_flush( self );
+		self->gop_prefetch_state = 1;
+		return;
+	}
+
+	frame = av_frame_alloc();
+	result = frame? decode_video( self, frame, self->gop_prefetch_position, 0, &position ) : 0;
+	if ( result > 0 && position <= self->gop_prefetch_position )
+	{
+		if ( !gop_push( self, self->gop_prefetch, frame, position ) || !gop_trim( self, self->gop_position, 1 ) )
+			result = 0;
+	}
+	av_frame_free( &frame );
+
+	if ( result <= 0 || ( position >= self->gop_prefetch_position && !mlt_deque_count( self->gop_prefetch ) ) )
+	{
+		// Give up and leave it to producer_get_image()
+		while ( ( frame = mlt_deque_pop_front( self->gop_prefetch ) ) )
+		{
+			self->gop_bytes -= frame_bytes( frame );
+			av_frame_free( &frame );
+		}
+		self->gop_prefetch_position = POSITION_INVALID;
+		self->gop_prefetch_state = -1;
+	}
+	else if ( position >= self->gop_prefetch_position )
+	{
+		// The previous GOP is complete, so put it before the current one.
+		while ( ( frame = mlt_deque_pop_back( self->gop_prefetch ) ) )
+			mlt_deque_push_front( self->gop_frames, frame );
+		self->gop_prefetch_position = POSITION_INVALID;
+		self->gop_prefetch_state = 0;
+	}
+}
+
+/** Determine whether the decode ahead thread should decode more of the previous GOP.
+*/
+
+static int gop_prefetch_wanted( producer_avformat self )
+{
+	return self->gop_prefetch_position >= 0 && self->video_format && self->video_codec
+		&& mlt_producer_get_speed( self->parent ) <= 0.0;
+}
+
+/** Determine whether the decode ahead thread should decode another picture.
+
+	Only forward playback at normal speed of a seekable source is decoded ahead.
+*/
+
+static int decode_ahead_wanted( producer_avformat self )
+{
+	mlt_properties properties = MLT_PRODUCER_PROPERTIES( self->parent );
+	return self->ahead_position >= 0 && self->video_format && self->video_codec && self->video_seekable
+#ifdef VDPAU
+		&& !self->vdpau
+#endif
+		&& mlt_deque_count( self->ahead_frames ) < mlt_properties_get_int( properties, "decode_ahead" )
+		&& mlt_producer_get_speed( self->parent ) == 1.0;
+}
+
+/** The decode ahead thread.
+
+	It decodes one picture at a time holding video_mutex, and gives way whenever
+	producer_get_image() is waiting for the mutex. During reverse play it
+	decodes the previous GOP instead.
+*/
+
+static void *decode_ahead_thread( void *arg )
+{
+	producer_avformat self = arg;
+	AVFrame *frame = av_frame_alloc();
+
+	pthread_mutex_lock( &self->video_mutex );
+	while ( self->ahead_running )
+	{
+		int64_t position = 0;
+
+		if ( self->ahead_waiting || !( decode_ahead_wanted( self ) || gop_prefetch_wanted( self ) ) )
+		{
+			pthread_cond_wait( &self->ahead_cond, &self->video_mutex );
+			continue;
+		}
+		if ( !decode_ahead_wanted( self ) )
+		{
+			gop_prefetch_next( self );
+			continue;
+		}
+		if ( decode_video( self, frame, self->ahead_position, self->ahead_position, &position ) > 0 )
+		{
+			// The decoder may own the picture, so keep a reference or copy.
+			AVFrame *copy = av_frame_clone( frame );
+			if ( copy )
+			{
+				copy->reordered_opaque = position;
+				mlt_deque_push_back( self->ahead_frames, copy );
+				self->ahead_position = position + 1;
+			}
+			else
+			{
+				self->ahead_position = POSITION_INVALID;
+			}
+		}
+		else
+		{
+			// End of stream or error - let producer_get_image() deal with it.
+			self->ahead_position = POSITION_INVALID;
+		}
+		av_frame_unref( frame );
+	}
+	pthread_mutex_unlock( &self->video_mutex );
+	av_frame_free( &frame );
+
+	return NULL;
+}
+
+/** Start the decode ahead thread if decoding ahead or reverse play caching is enabled.
+
+	The caller must hold video_mutex.
+*/
+
+static void decode_ahead_start( producer_avformat self )
+{
+	mlt_properties properties = MLT_PRODUCER_PROPERTIES( self->parent );
+
+	if ( !self->ahead_running && ( mlt_properties_get_int( properties, "decode_ahead" ) > 0 ||
+		 mlt_properties_get_int( properties, "reverse_cache" ) > 0 ) )
+	{
+		if ( !self->ahead_frames )
+		{
+			self->ahead_frames = mlt_deque_init();
+			self->gop_frames = mlt_deque_init();
+			self->gop_prefetch = mlt_deque_init();
+			self->ahead_position = POSITION_INVALID;
+			self->gop_prefetch_position = POSITION_INVALID;
+		}
+		self->ahead_running = 1;
+		if ( pthread_create( &self->ahead_thread, NULL, decode_ahead_thread, self ) )
+		{
+			mlt_log_warning( MLT_PRODUCER_SERVICE( self->parent ), "failed to start the decode ahead thread\n" );
+			self->ahead_running = 0;
+		}
+	}
+}
+
+/** Stop the decode ahead thread and discard its pictures and those for reverse play.
+*/
+
+static void decode_ahead_stop( producer_avformat self )
+{
+	if ( self->ahead_running )
+	{
+		pthread_mutex_lock( &self->video_mutex );
+		self->ahead_running = 0;
+		pthread_cond_broadcast( &self->ahead_cond );
+		pthread_mutex_unlock( &self->video_mutex );
+		pthread_join( self->ahead_thread, NULL );
+	}
+	decode_ahead_flush( self );
+	if ( self->ahead_frames )
+		mlt_deque_close( self->ahead_frames );
+	self->ahead_frames = NULL;
+	gop_flush( self );
+	if ( self->gop_frames )
+		mlt_deque_close( self->gop_frames );
+	if ( self->gop_prefetch )
+		mlt_deque_close( self->gop_prefetch );
+	self->gop_frames = NULL;
+	self->gop_prefetch = NULL;
+}
+
+/** Get an image from a frame.
+*/
+
+static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_format *format, int *width, int *height, int writable )
+{
+	// Get the producer
+	producer_avformat self = mlt_frame_pop_service( frame );
+	mlt_producer producer = self->parent;
 
 	// Get the properties from the frame
 	mlt_properties frame_properties = MLT_FRAME_PROPERTIES( frame );
@@ -1574,7 +2906,11 @@ static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_form
 	// Get the producer properties
 	mlt_properties properties = MLT_PRODUCER_PROPERTIES( producer );
 
+	// Ask the decode ahead thread to give way
+	self->ahead_waiting++;
 	pthread_mutex_lock( &self->video_mutex );
+	self->ahead_waiting--;
+	decode_ahead_start( self );
 
 	uint8_t *alpha = NULL;
 	int got_picture = 0;
@@ -1659,12 +2995,19 @@ static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_form
 	const AVCodecDescriptor *descriptor = codec_context->codec? avcodec_descriptor_get( codec_context->codec->id ) : NULL;
 	int must_decode = descriptor && !( descriptor->props & AV_CODEC_PROP_INTRA_ONLY );
 
-	double delay = mlt_properties_get_double( properties, "video_delay" );
+	// Reverse play and stepping back decode whole GOPs into a cache
+	double speed = mlt_producer_get_speed(producer);
+	int reverse = must_decode && self->gop_frames && self->video_seekable
+		&& mlt_properties_get_int( properties, "reverse_cache" ) > 0
+		&& ( speed < 0.0 || position + 2 == self->video_expected );
+#ifdef VDPAU
+	reverse = reverse && !self->vdpau;
+#endif
+	int gop_hit = reverse && gop_contains( self, req_position );
 
 	// Seek if necessary
-	double speed = mlt_producer_get_speed(producer);
 	int preseek = must_decode && codec_context->has_b_frames && speed >= 0.0 && speed <= 1.0;
-	int paused = seek_video( self, position, req_position, preseek );
+	int paused = gop_hit? 0 : seek_video( self, position, req_position, preseek );
 
 	// Seek might have reopened the file
 	context = self->video_format;
@@ -1693,13 +3036,19 @@ static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_form
 		*format = mlt_image_rgb24a;
 
 	// Duplicate the last image if necessary
-	if ( self->video_frame && self->video_frame->linesize[0]
+	if ( !gop_hit && self->video_frame && self->video_frame->linesize[0]
 		 && (self->pkt.stream_index == self->video_index )
 		 && ( paused || self->current_position >= req_position ) )
 	{
 		// Duplicate it
 		set_image_size( self, width, height );
-		if ( ( image_size = allocate_buffer( frame, codec_context, buffer, *format, *width, *height ) ) )
+		if ( !writable && ( image_size = reference_image( self, frame, self->video_frame,
+				codec_context->pix_fmt, *format, *width, *height, buffer ) ) )
+		{
+			mlt_properties_set_int( frame_properties, "colorspace", self->yuv_colorspace );
+			got_picture = 1;
+		}
+		else if ( ( image_size = allocate_buffer( frame, codec_context, buffer, *format, *width, *height ) ) )
 		{
 			int yuv_colorspace;
 #ifdef VDPAU
@@ -1725,244 +3074,130 @@ static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_form
 	}
 	else
 	{
-		int ret = 0;
 		int64_t int_position = 0;
-		int decode_errors = 0;
 
 		// Construct an AVFrame for YUV422 conversion
 		if ( !self->video_frame )
 			self->video_frame = av_frame_alloc();
 
-		while( ret >= 0 && !got_picture )
+		while ( !got_picture )
 		{
-			// Read a packet
-			if ( self->pkt.stream_index == self->video_index )
-				av_free_packet( &self->pkt );
-			av_init_packet( &self->pkt );
-			pthread_mutex_lock( &self->packets_mutex );
-			if ( mlt_deque_count( self->vpackets ) )
+			// Use a picture decoded ahead or else decode one
+			if ( reverse )
 			{
-				AVPacket *tmp = (AVPacket*) mlt_deque_pop_front( self->vpackets );
-				self->pkt = *tmp;
-				free( tmp );
-			}
-			else
-			{
-				ret = av_read_frame( context, &self->pkt );
-				if ( ret >= 0 && !self->video_seekable && self->pkt.stream_index == self->audio_index )
-				{
-					if ( !av_dup_packet( &self->pkt ) )
-					{
-						AVPacket *tmp = malloc( sizeof(AVPacket) );
-						*tmp = self->pkt;
-						mlt_deque_push_back( self->apackets, tmp );
-					}
-				}
-				else if ( ret < 0 )
+				if ( !gop_hit && gop_decode( self, req_position ) < 0 )
+					goto exit_get_image;
+				got_picture = gop_take( self, req_position, &int_position );
+				if ( !got_picture )
+					break;
+				// The decoder is not at this position if the picture was cached.
+				if ( gop_hit )
 				{
-					if ( ret != AVERROR_EOF )
-						mlt_log_verbose( MLT_PRODUCER_SERVICE(producer), "av_read_frame returned error %d inside get_image\n", ret );
-					if ( !self->video_seekable && mlt_properties_get_int( properties, "reconnect" ) )
-					{
-						// Try to reconnect to live sources by closing context and codecs,
-						// and letting next call to get_frame() reopen.
-						prepare_reopen( self );
-						pthread_mutex_unlock( &self->packets_mutex );
-						goto exit_get_image;
-					}
-					if ( !self->video_seekable && mlt_properties_get_int( properties, "exit_on_disconnect" ) )
-					{
-						mlt_log_fatal( MLT_PRODUCER_SERVICE(producer), "Exiting with error due to disconnected source.\n" );
-						exit( EXIT_FAILURE );
-					}
-					// Send null packets to drain decoder.
-					self->pkt.size = 0;
-					self->pkt.data = NULL;
+					self->last_position = POSITION_INVALID;
+					mlt_properties_set_int( properties, "reverse_cache_hits",
+						mlt_properties_get_int( properties, "reverse_cache_hits" ) + 1 );
 				}
 			}
-			pthread_mutex_unlock( &self->packets_mutex );
-
-			// We only deal with video from the selected video_index
-			if ( self->pkt.stream_index == self->video_index )
+			else
 			{
-				int64_t pts = best_pts( self, self->pkt.pts, self->pkt.dts );
-				if ( pts != AV_NOPTS_VALUE )
-				{
-					if ( !self->video_seekable && self->first_pts == AV_NOPTS_VALUE )
-						self->first_pts = pts;
-					if ( self->first_pts != AV_NOPTS_VALUE )
-						pts -= self->first_pts;
-					else if ( context->start_time != AV_NOPTS_VALUE )
-						pts -= context->start_time;
-					int_position = ( int64_t )( ( av_q2d( self->video_time_base ) * pts + delay ) * source_fps + 0.5 );
-					if ( int_position == self->last_position )
-						int_position = self->last_position + 1;
-				}
-				mlt_log_debug( MLT_PRODUCER_SERVICE(producer),
-					"V pkt.pts %"PRId64" pkt.dts %"PRId64" req_pos %"PRId64" cur_pos %"PRId64" pkt_pos %"PRId64"\n",
-					self->pkt.pts, self->pkt.dts, req_position, self->current_position, int_position );
-
-				// Make a dumb assumption on streams that contain wild timestamps
-				if ( llabs( req_position - int_position ) > 999 )
-				{
-					mlt_log_verbose( MLT_PRODUCER_SERVICE(producer), " WILD TIMESTAMP: "
-						"pkt.pts=[%"PRId64"], pkt.dts=[%"PRId64"], req_position=[%"PRId64"], "
-						"current_position=[%"PRId64"], int_position=[%"PRId64"], pts=[%"PRId64"] \n",
-						self->pkt.pts, self->pkt.dts, req_position,
-						self->current_position, int_position, pts );
-					int_position = req_position;
-				}
-				self->last_position = int_position;
-
-				// Decode the image
-				if ( must_decode  || int_position >= req_position || !self->pkt.data )
-				{
-#ifdef VDPAU
-					if ( self->vdpau )
-					{
-						if ( self->vdpau->decoder == VDP_INVALID_HANDLE )
-						{
-							vdpau_decoder_init( self );
-						}
-						self->vdpau->is_decoded = 0;
-					}
-#endif
-					codec_context->reordered_opaque = int_position;
-					if ( int_position >= req_position )
-						codec_context->skip_loop_filter = AVDISCARD_NONE;
-					ret = avcodec_decode_video2( codec_context, self->video_frame, &got_picture, &self->pkt );
-					mlt_log_debug( MLT_PRODUCER_SERVICE(producer), "decoded packet with size %d => %d\n", self->pkt.size, ret );
-					// Note: decode may fail at the beginning of MPEGfile (B-frames referencing before first I-frame), so allow a few errors.
-					if ( ret < 0 )
-					{
-						if ( ++decode_errors <= 10 ) {
-							ret = 0;
-						} else {
-							mlt_log_warning( MLT_PRODUCER_SERVICE(producer), "video decoding error %d\n", ret );
-							self->last_good_position = POSITION_INVALID;
-						}
-					}
-					else
-					{
-						decode_errors = 0;
-					}
-				}
-
+				gop_flush( self );
+				got_picture = decode_ahead_take( self, req_position, &int_position );
 				if ( got_picture )
+					mlt_properties_set_int( properties, "decode_ahead_taken",
+						mlt_properties_get_int( properties, "decode_ahead_taken" ) + 1 );
+			}
+			if ( !got_picture )
+			{
+				got_picture = decode_video( self, self->video_frame, req_position, req_position, &int_position );
+				if ( got_picture < 0 )
 				{
-					// Get position of reordered frame
-					int_position = self->video_frame->reordered_opaque;
-					pts = best_pts( self, self->video_frame->pkt_pts, self->video_frame->pkt_dts );
-					if ( pts != AV_NOPTS_VALUE )
-					{
-						// Some streams are not marking their key frames even though
-						// there are I frames, and find_first_pts() fails as a result.
-						// Try to set first_pts here after getting pict_type.
-						if ( self->first_pts == AV_NOPTS_VALUE &&
-							(self->video_frame->key_frame || self->video_frame->pict_type == AV_PICTURE_TYPE_I) )
-							 self->first_pts = pts;
-						if ( self->first_pts != AV_NOPTS_VALUE )
-							pts -= self->first_pts;
-						else if ( context->start_time != AV_NOPTS_VALUE )
-							pts -= context->start_time;
-						int_position = ( int64_t )( ( av_q2d( self->video_time_base ) * pts + delay ) * source_fps + 0.5 );
-					}
-
-					if ( int_position < req_position )
-						got_picture = 0;
-					else if ( int_position >= req_position )
-						codec_context->skip_loop_filter = AVDISCARD_NONE;
-				}
-				else if ( !self->pkt.data ) // draining decoder with null packets
-				{
-					ret = -1;
+					got_picture = 0;
+					goto exit_get_image;
 				}
-				mlt_log_debug( MLT_PRODUCER_SERVICE(producer), " got_pic %d key %d ret %d pkt_pos %"PRId64"\n",
-							   got_picture, self->pkt.flags & AV_PKT_FLAG_KEY, ret, int_position );
+				if ( !got_picture )
+					break;
+				self->ahead_position = int_position + 1;
 			}
 
-			// Now handle the picture if we have one
-			if ( got_picture )
-			{
+			// Now handle the picture
 #ifdef AVFILTER
-				if (self->autorotate && self->vfilter_graph) {
-					ret = av_buffersrc_add_frame(self->vfilter_in, self->video_frame);
+			if (self->autorotate && self->vfilter_graph) {
+				int ret = av_buffersrc_add_frame(self->vfilter_in, self->video_frame);
+				if (ret < 0) {
+					got_picture = 0;
+					break;
+				}
+				while (ret >= 0) {
+					ret = av_buffersink_get_frame_flags(self->vfilter_out, self->video_frame, 0);
 					if (ret < 0) {
-						got_picture = 0;
+						ret = 0;
 						break;
 					}
-					while (ret >= 0) {
-						ret = av_buffersink_get_frame_flags(self->vfilter_out, self->video_frame, 0);
-						if (ret < 0) {
-							ret = 0;
-							break;
-						}
-					}
 				}
+			}
 #endif
-				set_image_size( self, width, height );
-				if ( ( image_size = allocate_buffer( frame, codec_context, buffer, *format, *width, *height ) ) )
-				{
-					int yuv_colorspace;
+			set_image_size( self, width, height );
+			int referenced = !writable && ( image_size = reference_image( self, frame, self->video_frame,
+				codec_context->pix_fmt, *format, *width, *height, buffer ) );
+			if ( referenced || ( image_size = allocate_buffer( frame, codec_context, buffer, *format, *width, *height ) ) )
+			{
+				int yuv_colorspace = self->yuv_colorspace;
 #ifdef VDPAU
-					if ( self->vdpau )
+				if ( self->vdpau )
+				{
+					if ( self->vdpau->is_decoded )
 					{
-						if ( self->vdpau->is_decoded )
+						struct vdpau_render_state *render = (struct vdpau_render_state*) self->video_frame->data[0];
+						void *planes[3];
+						uint32_t pitches[3];
+						VdpYCbCrFormat dest_format = VDP_YCBCR_FORMAT_YV12;
+						
+						if ( !self->vdpau->buffer )
+							self->vdpau->buffer = mlt_pool_alloc( codec_context->width * codec_context->height * 3 / 2 );
+						self->video_frame->data[0] = planes[0] = self->vdpau->buffer;
+						self->video_frame->data[2] = planes[1] = self->vdpau->buffer + codec_context->width * codec_context->height;
+						self->video_frame->data[1] = planes[2] = self->vdpau->buffer + codec_context->width * codec_context->height * 5 / 4;
+						self->video_frame->linesize[0] = pitches[0] = codec_context->width;
+						self->video_frame->linesize[1] = pitches[1] = codec_context->width / 2;
+						self->video_frame->linesize[2] = pitches[2] = codec_context->width / 2;
+
+						VdpStatus status = vdp_surface_get_bits( render->surface, dest_format, planes, pitches );
+						if ( status == VDP_STATUS_OK )
 						{
-							struct vdpau_render_state *render = (struct vdpau_render_state*) self->video_frame->data[0];
-							void *planes[3];
-							uint32_t pitches[3];
-							VdpYCbCrFormat dest_format = VDP_YCBCR_FORMAT_YV12;
-							
-							if ( !self->vdpau->buffer )
-								self->vdpau->buffer = mlt_pool_alloc( codec_context->width * codec_context->height * 3 / 2 );
-							self->video_frame->data[0] = planes[0] = self->vdpau->buffer;
-							self->video_frame->data[2] = planes[1] = self->vdpau->buffer + codec_context->width * codec_context->height;
-							self->video_frame->data[1] = planes[2] = self->vdpau->buffer + codec_context->width * codec_context->height * 5 / 4;
-							self->video_frame->linesize[0] = pitches[0] = codec_context->width;
-							self->video_frame->linesize[1] = pitches[1] = codec_context->width / 2;
-							self->video_frame->linesize[2] = pitches[2] = codec_context->width / 2;
-
-							VdpStatus status = vdp_surface_get_bits( render->surface, dest_format, planes, pitches );
-							if ( status == VDP_STATUS_OK )
-							{
-								yuv_colorspace = convert_image( self, self->video_frame, *buffer, AV_PIX_FMT_YUV420P,
-									format, *width, *height, &alpha );
-								mlt_properties_set_int( frame_properties, "colorspace", yuv_colorspace );
-							}
-							else
-							{
-								mlt_log_error( MLT_PRODUCER_SERVICE(producer), "VDPAU Error: %s\n", vdp_get_error_string( status ) );
-								image_size = self->vdpau->is_decoded = 0;
-							}
+							yuv_colorspace = convert_image( self, self->video_frame, *buffer, AV_PIX_FMT_YUV420P,
+								format, *width, *height, &alpha );
+							mlt_properties_set_int( frame_properties, "colorspace", yuv_colorspace );
 						}
 						else
 						{
-							mlt_log_error( MLT_PRODUCER_SERVICE(producer), "VDPAU error in VdpDecoderRender\n" );
-							image_size = got_picture = 0;
-							self->last_good_position = POSITION_INVALID;
+							mlt_log_error( MLT_PRODUCER_SERVICE(producer), "VDPAU Error: %s\n", vdp_get_error_string( status ) );
+							image_size = self->vdpau->is_decoded = 0;
 						}
 					}
 					else
+					{
+						mlt_log_error( MLT_PRODUCER_SERVICE(producer), "VDPAU error in VdpDecoderRender\n" );
+						image_size = got_picture = 0;
+						self->last_good_position = POSITION_INVALID;
+					}
+				}
+				else
 #endif
+				if ( !referenced )
 					yuv_colorspace = convert_image( self, self->video_frame, *buffer, codec_context->pix_fmt,
 						format, *width, *height, &alpha );
-					mlt_properties_set_int( frame_properties, "colorspace", yuv_colorspace );
-					self->top_field_first |= self->video_frame->top_field_first;
-					self->top_field_first |= codec_context->field_order == AV_FIELD_TT;
-					self->top_field_first |= codec_context->field_order == AV_FIELD_TB;
-					self->current_position = int_position;
-				}
-				else
-				{
-					got_picture = 0;
-				}
+				mlt_properties_set_int( frame_properties, "colorspace", yuv_colorspace );
+				self->top_field_first |= self->video_frame->top_field_first;
+				self->top_field_first |= codec_context->field_order == AV_FIELD_TT;
+				self->top_field_first |= codec_context->field_order == AV_FIELD_TB;
+				self->current_position = int_position;
+			}
+			else
+			{
+				got_picture = 0;
+				if ( reverse )
+					break;
 			}
-
-			// Free packet data if not video and not live audio packet
-			if ( self->pkt.stream_index != self->video_index &&
-				 !( !self->video_seekable && self->pkt.stream_index == self->audio_index ) )
-				av_free_packet( &self->pkt );
 		}
 	}
 
@@ -1989,7 +3224,7 @@ static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_form
 			self->last_good_position = self->current_position;
 			if ( self->last_good_frame )
 				mlt_frame_close( self->last_good_frame );
-			self->last_good_frame = mlt_frame_clone( frame, 1 );
+			self->last_good_frame = clone_frame( frame );
 		}
 	}
 	else if ( self->last_good_frame )
@@ -2015,6 +3250,8 @@ static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_form
 
 exit_get_image:
 
+	if ( self->ahead_running )
+		pthread_cond_signal( &self->ahead_cond );
 	pthread_mutex_unlock( &self->video_mutex );
 
 	// Set the progressive flag
@@ -2114,6 +3351,13 @@ static int video_codec_init( producer_avformat self, int index, mlt_properties p
 		if ( thread_count >= 0 )
 			codec_context->thread_count = thread_count;
 
+		// Decoded pictures may outlive the next call to the decoder, so they
+		// can be queued and set as frame images without copying them.
+#ifdef VDPAU
+		if ( !self->vdpau )
+#endif
+		codec_context->refcounted_frames = 1;
+
 		// If we don't have a codec and we can't initialise it, we can't do much more...
 		pthread_mutex_lock( &self->open_mutex );
 		if ( codec && avcodec_open2( codec_context, codec, NULL ) >= 0 )
@@ -2384,6 +3628,7 @@ static int seek_audio( producer_avformat self, mlt_position position, double tim
 	int paused = 0;
 
 	pthread_mutex_lock( &self->packets_mutex );
+	keyframe_index_init( self );
 
 	// Seek if necessary
 	if ( self->seekable && ( position != self->audio_expected || self->last_position < 0 ) )
@@ -2413,6 +3658,7 @@ static int seek_audio( producer_avformat self, mlt_position position, double tim
 				timestamp = 0;
 
 			// Set to the real timecode
+			demux_stop( self, 1 );
 			if ( av_seek_frame( context, -1, timestamp, AVSEEK_FLAG_BACKWARD ) != 0 )
 				paused = 1;
 
@@ -2681,15 +3927,16 @@ static int producer_get_audio( mlt_frame frame, void **buffer, mlt_audio_format
 
 			// Read a packet
 			pthread_mutex_lock( &self->packets_mutex );
-			if ( mlt_deque_count( self->apackets ) )
+			int demuxed = demux_take( self, 1, &pkt );
+			if ( !demuxed && mlt_deque_count( self->apackets ) )
 			{
 				AVPacket *tmp = (AVPacket*) mlt_deque_pop_front( self->apackets );
 				pkt = *tmp;
 				free( tmp );
 			}
-			else
+			else if ( demuxed <= 0 )
 			{
-				ret = av_read_frame( context, &pkt );
+				ret = demuxed? demuxed : av_read_frame( context, &pkt );
 				if ( ret >= 0 && !self->seekable && pkt.stream_index == self->video_index )
 				{
 					if ( !av_dup_packet( &pkt ) )
@@ -2973,6 +4220,227 @@ static void producer_set_up_audio( producer_avformat self, mlt_frame frame )
 	}
 }
 
+/** Opened files and decoders that are no longer in the cache of any producer.
+
+	Another producer of the same file can take one over instead of opening
+	the file again. They are kept in the order they were last used.
+*/
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static producer_avformat pool_head = NULL;
+static int pool_count = 0;
+static int pool_registered = 0;
+
+static int decoder_pool_size( mlt_producer producer )
+{
+	mlt_properties properties = MLT_PRODUCER_PROPERTIES( producer );
+	char *size = getenv( "MLT_AVFORMAT_DECODER_POOL" );
+
+	if ( mlt_properties_get( properties, "decoder_pool" ) )
+		return mlt_properties_get_int( properties, "decoder_pool" );
+	return size? atoi( size ) : 0;
+}
+
+static void pass_media_properties( mlt_properties dest, mlt_properties src )
+{
+	int i;
+	for ( i = 0; i < mlt_properties_count( src ); i++ )
+	{
+		const char *name = mlt_properties_get_name( src, i );
+		if ( name && !strncmp( name, "meta.media.", 11 ) )
+			mlt_properties_pass_property( dest, src, name );
+	}
+}
+
+static char *append_key( char *key, const char *name, const char *value )
+{
+	size_t length = key? strlen( key ) : 0;
+	char *result = realloc( key, length + strlen( name ) + strlen( value ) + 3 );
+	if ( result )
+		sprintf( result + length, "%s=%s\n", name, value );
+	else
+		free( key );
+	return result;
+}
+
+/** Describe everything that a producer sets up differently on the files and decoders it opens.
+
+	That is the resource, the frame rate of positions, and the properties that
+	either this producer or libavformat and libavcodec options read.
+*/
+
+static char *decoder_pool_key( mlt_producer producer )
+{
+	static const char *names[] = { "resource", "audio_index", "video_index", "vcodec", "acodec", "autorotate",
+		"force_fps", "force_colorspace", "force_color_trc", "set.force_full_luma", "keyframe_index", NULL };
+	mlt_properties properties = MLT_PRODUCER_PROPERTIES( producer );
+	mlt_profile profile = mlt_service_profile( MLT_PRODUCER_SERVICE( producer ) );
+	const AVClass *format_class = avformat_get_class();
+	const AVClass *codec_class = avcodec_get_class();
+	int search_flags = AV_OPT_SEARCH_CHILDREN | AV_OPT_SEARCH_FAKE_OBJ;
+	char fps[ 32 ];
+	char *key;
+	int i, j;
+
+	snprintf( fps, sizeof( fps ), "%d/%d", profile? profile->frame_rate_num : 0, profile? profile->frame_rate_den : 0 );
+	key = append_key( NULL, "fps", fps );
+	for ( i = 0; key && i < mlt_properties_count( properties ); i++ )
+	{
+		const char *name = mlt_properties_get_name( properties, i );
+		const char *value = mlt_properties_get_value( properties, i );
+		int match = 0;
+
+		if ( !name || !value || !strcmp( name, "seekable" ) )
+			continue;
+		for ( j = 0; names[j] && !match; j++ )
+			match = !strcmp( name, names[j] );
+		if ( match
+			 || av_opt_find( &format_class, name, NULL, AV_OPT_FLAG_DECODING_PARAM, search_flags )
+			 || av_opt_find( &codec_class, name, NULL, AV_OPT_FLAG_DECODING_PARAM, search_flags ) )
+			key = append_key( key, name, value );
+	}
+	return key;
+}
+
+static void decoder_pool_close( void *unused )
+{
+	producer_avformat self;
+
+	pthread_mutex_lock( &pool_mutex );
+	while ( ( self = pool_head ) )
+	{
+		pool_head = self->pool_next;
+		pool_count--;
+		pthread_mutex_unlock( &pool_mutex );
+		producer_avformat_close( self );
+		pthread_mutex_lock( &pool_mutex );
+	}
+	pthread_mutex_unlock( &pool_mutex );
+}
+
+/** Keep the opened file and decoders of a producer that is leaving the producer cache.
+
+	Returns true if it went into the pool, in which case the producer no longer owns it.
+*/
+
+static int decoder_pool_put( producer_avformat self )
+{
+	int size = self->parent? decoder_pool_size( self->parent ) : 0;
+	producer_avformat evicted = NULL, *last;
+
+	if ( size <= 0 || !self->is_mutex_init || !self->seekable
+		 || !self->video_format || !self->video_codec )
+		return 0;
+#ifdef VDPAU
+	if ( self->vdpau )
+		return 0;
+#endif
+	if ( !( self->pool_key = decoder_pool_key( self->parent ) ) )
+		return 0;
+	self->pool_properties = mlt_properties_new();
+	pass_media_properties( self->pool_properties, MLT_PRODUCER_PROPERTIES( self->parent ) );
+
+	// Release what is only useful to the producer that is leaving.
+	decode_ahead_stop( self );
+	pthread_mutex_lock( &self->packets_mutex );
+	demux_stop( self, 0 );
+	demux_stop( self, 1 );
+	pthread_mutex_unlock( &self->packets_mutex );
+	keyframe_index_save( self );
+	mlt_cache_close( self->image_cache );
+	self->image_cache = NULL;
+	if ( self->last_good_frame )
+		mlt_frame_close( self->last_good_frame );
+	self->last_good_frame = NULL;
+	self->last_good_position = POSITION_INVALID;
+	self->parent = NULL;
+
+	pthread_mutex_lock( &pool_mutex );
+	if ( !pool_registered )
+	{
+		mlt_factory_register_for_clean_up( &pool_head, decoder_pool_close );
+		pool_registered = 1;
+	}
+	self->pool_next = pool_head;
+	pool_head = self;
+	pool_count++;
+
+	// Producers may ask for pools of different sizes; the one leaving decides.
+	if ( pool_count > size )
+	{
+		for ( last = &pool_head; size--; last = &( *last )->pool_next );
+		evicted = *last;
+		*last = NULL;
+		for ( self = evicted; self; self = self->pool_next )
+			pool_count--;
+	}
+	pthread_mutex_unlock( &pool_mutex );
+
+	while ( ( self = evicted ) )
+	{
+		evicted = self->pool_next;
+		producer_avformat_close( self );
+	}
+	return 1;
+}
+
+/** Take the opened file and decoders that are nearest before a position from the pool.
+
+	Continuing to decode from an earlier position is cheaper than seeking, so
+	those come first. Returns NULL if nothing in the pool suits the producer.
+*/
+
+static producer_avformat decoder_pool_get( mlt_producer producer, mlt_position position )
+{
+	producer_avformat self, *best = NULL, *entry;
+	mlt_position distance = 0;
+	char *key;
+
+	pthread_mutex_lock( &pool_mutex );
+	int empty = !pool_head;
+	pthread_mutex_unlock( &pool_mutex );
+	if ( empty || decoder_pool_size( producer ) <= 0 || !( key = decoder_pool_key( producer ) ) )
+		return NULL;
+
+	pthread_mutex_lock( &pool_mutex );
+	for ( entry = &pool_head; *entry; entry = &( *entry )->pool_next )
+	{
+		if ( !strcmp( ( *entry )->pool_key, key ) )
+		{
+			mlt_position d = position - ( *entry )->video_expected;
+			if ( d < 0 )
+				d = INT_MAX;
+			if ( !best || d < distance )
+			{
+				best = entry;
+				distance = d;
+			}
+		}
+	}
+	self = best? *best : NULL;
+	if ( self )
+	{
+		*best = self->pool_next;
+		pool_count--;
+		self->pool_next = NULL;
+		free( self->pool_key );
+		self->pool_key = NULL;
+		self->parent = producer;
+	}
+	pthread_mutex_unlock( &pool_mutex );
+	free( key );
+
+	// The producer may not have opened the decoders itself yet.
+	if ( self )
+	{
+		pass_media_properties( MLT_PRODUCER_PROPERTIES( producer ), self->pool_properties );
+		mlt_properties_close( self->pool_properties );
+		self->pool_properties = NULL;
+	}
+
+	return self;
+}
+
 /** Our get frame implementation.
 */
 
@@ -2986,7 +4454,12 @@ static int producer_get_frame( mlt_producer producer, mlt_frame_ptr frame, int i
 	// If cache miss
 	if ( !self )
 	{
-		self = calloc( 1, sizeof( struct producer_avformat_s ) );
+		self = decoder_pool_get( producer, mlt_producer_frame( producer ) );
+		if ( self )
+			mlt_properties_set_int( MLT_PRODUCER_PROPERTIES( producer ), "decoder_pool_taken",
+				mlt_properties_get_int( MLT_PRODUCER_PROPERTIES( producer ), "decoder_pool_taken" ) + 1 );
+		else
+			self = calloc( 1, sizeof( struct producer_avformat_s ) );
 		producer->child = self;
 		self->parent = producer;
 		mlt_service_cache_put( service, "producer_avformat", self, 0, (mlt_destructor) producer_avformat_close );
@@ -3029,9 +4502,28 @@ static void producer_avformat_close( producer_avformat self )
 {
 	mlt_log_debug( NULL, "producer_avformat_close\n" );
 
+	if ( decoder_pool_put( self ) )
+		return;
+
+	// Stop decoding and reading ahead before the decoder and file are closed
+	if ( self->is_mutex_init )
+	{
+		decode_ahead_stop( self );
+		pthread_mutex_lock( &self->packets_mutex );
+		demux_stop( self, 0 );
+		demux_stop( self, 1 );
+		pthread_mutex_unlock( &self->packets_mutex );
+	}
+	keyframe_index_save( self );
+	free( self->index );
+	mlt_properties_close( self->probe_cache );
+	free( self->probe_path );
+	free( self->pool_key );
+	mlt_properties_close( self->pool_properties );
+
 	// Cleanup av contexts
 	av_free_packet( &self->pkt );
-	av_free( self->video_frame );
+	av_frame_free( &self->video_frame );
 	av_free( self->audio_frame );
 	if ( self->is_mutex_init )
 		pthread_mutex_lock( &self->open_mutex );
@@ -3075,6 +4567,8 @@ static void producer_avformat_close( producer_avformat self )
 		pthread_mutex_destroy( &self->video_mutex );
 		pthread_mutex_destroy( &self->packets_mutex );
 		pthread_mutex_destroy( &self->open_mutex );
+		pthread_cond_destroy( &self->ahead_cond );
+		pthread_cond_destroy( &self->packets_cond );
 	}
 
 	// Cleanup the packet queues
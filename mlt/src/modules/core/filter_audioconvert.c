@@ -576,7 +576,12 @@ mlt_filter filter_audioconvert_init( mlt_profile profile, mlt_service_type type,
 {
 	mlt_filter filter = calloc( 1, sizeof( struct mlt_filter_s ) );
 	if ( mlt_filter_init( filter, filter ) == 0 )
+	{
 		filter->process = filter_process;
+
+		// This only sets the converter, so a tractor may render the frames again
+		mlt_properties_set_int( MLT_FILTER_PROPERTIES( filter ), "_track_ahead_safe", 1 );
+	}
 	return filter;
 }
 
@@ -130,6 +130,9 @@ mlt_filter filter_brightness_init( mlt_profile profile, mlt_service_type type, c
 		filter->process = filter_process;
 		mlt_properties_set( MLT_FILTER_PROPERTIES( filter ), "start", arg == NULL ? "1" : arg );
 		mlt_properties_set( MLT_FILTER_PROPERTIES( filter ), "level", NULL );
+
+		// A tractor may render the frames again on a copy
+		mlt_properties_set_int( MLT_FILTER_PROPERTIES( filter ), "_track_ahead_safe", 1 );
 	}
 	return filter;
 }
@@ -49,6 +49,8 @@ static int filter_get_image( mlt_frame frame, uint8_t **image, mlt_image_format
 {
 	int error = 0;
 	mlt_profile profile = mlt_frame_pop_service( frame );
+	uint8_t *planes[4];
+	int strides[4];
 
 	// Get the properties from the frame
 	mlt_properties properties = MLT_FRAME_PROPERTIES( frame );
@@ -72,8 +74,9 @@ static int filter_get_image( mlt_frame frame, uint8_t **image, mlt_image_format
 		mlt_properties_set_int( properties, "rescale_height", mlt_properties_get_int( properties, "crop.original_height" ) );
 	}
 
-	// Now get the image
-	error = mlt_frame_get_image( frame, image, format, width, height, writable );
+	// Now get the image without packing it
+	error = mlt_frame_get_image_strided( frame, planes, strides, format, width, height, writable );
+	*image = planes[0];
 
 	int owidth  = *width - left - right;
 	int oheight = *height - top - bottom;
@@ -88,8 +91,9 @@ static int filter_get_image( mlt_frame frame, uint8_t **image, mlt_image_format
 		// Subsampled YUV is messy and less precise.
 		if (*format == mlt_image_yuv422 && frame->convert_image && (left & 1 || right & 1))
 		{
-			mlt_image_format requested_format = mlt_image_rgb24;
-			frame->convert_image( frame, image, format, requested_format );
+			*format = mlt_image_rgb24;
+			mlt_frame_get_image( frame, image, format, width, height, writable );
+			mlt_frame_get_image_planes( frame, planes, strides );
 		}
 	
 		mlt_log_debug( NULL, "[filter crop] %s %dx%d -> %dx%d\n", mlt_image_format_name(*format),
@@ -98,21 +102,32 @@ static int filter_get_image( mlt_frame frame, uint8_t **image, mlt_image_format
 		if ( top % 2 )
 			mlt_properties_set_int( properties, "top_field_first", !mlt_properties_get_int( properties, "top_field_first" ) );
 		
-		// Create the output image
 		int size = mlt_image_format_size( *format, owidth, oheight, &bpp );
-		uint8_t *output = mlt_pool_alloc( size );
-		if ( output )
+		if ( !planes[1] && bpp )
 		{
-			// Call the generic resize
-			crop( *image, output, bpp, *width, *height, left, right, top, bottom );
+			// Reference the region of a packed format instead of copying it
+			planes[0] += top * strides[0] + left * bpp;
+			mlt_frame_set_image_planes( frame, planes, strides );
+			*image = planes[0];
+		}
+		else
+		{
+			// Create the output image
+			uint8_t *output = mlt_pool_alloc( size );
+			mlt_frame_get_image( frame, image, format, width, height, writable );
+			if ( output )
+			{
+				// Call the generic resize
+				crop( *image, output, bpp, *width, *height, left, right, top, bottom );
 
-			// Now update the frame
-			mlt_frame_set_image( frame, output, size, mlt_pool_release );
-			*image = output;
+				// Now update the frame
+				mlt_frame_set_image( frame, output, size, mlt_pool_release );
+				*image = output;
+			}
 		}
 
-		// We should resize the alpha too
-		uint8_t *alpha = mlt_frame_get_alpha( frame );
+		// We should resize the alpha too, unless it is constant
+		uint8_t *alpha = mlt_frame_get_alpha_value( frame ) < 0 ? mlt_frame_get_alpha( frame ) : NULL;
 		int alpha_size = 0;
 		mlt_properties_get_data( properties, "alpha", &alpha_size );
 		if ( alpha && alpha_size >= ( *width * *height ) )
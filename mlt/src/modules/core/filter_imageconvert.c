@@ -17,253 +17,338 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#include <framework/mlt_cpu.h>
 #include <framework/mlt_filter.h>
 #include <framework/mlt_frame.h>
 #include <framework/mlt_log.h>
 #include <framework/mlt_pool.h>
+#include <framework/mlt_producer.h>
+#include <framework/mlt_profile.h>
+#include <framework/mlt_slices.h>
+#include "filter_imageconvert.h"
 
+#include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
 
-/** This macro converts a YUV value to the RGB color space. */
-#define RGB2YUV_601_UNSCALED(r, g, b, y, u, v)\
-  y = (299*r + 587*g + 114*b) >> 10;\
-  u = ((-169*r - 331*g + 500*b) >> 10) + 128;\
-  v = ((500*r - 419*g - 81*b) >> 10) + 128;\
-  y = y < 16 ? 16 : y;\
-  u = u < 16 ? 16 : u;\
-  v = v < 16 ? 16 : v;\
-  y = y > 235 ? 235 : y;\
-  u = u > 240 ? 240 : u;\
-  v = v > 240 ? 240 : v
-
-/** This macro converts a YUV value to the RGB color space. */
-#define YUV2RGB_601_UNSCALED( y, u, v, r, g, b ) \
-  r = ((1024 * y + 1404 * ( v - 128 ) ) >> 10 ); \
-  g = ((1024 * y - 715 * ( v - 128 ) - 345 * ( u - 128 ) ) >> 10 ); \
-  b = ((1024 * y + 1774 * ( u - 128 ) ) >> 10 ); \
-  r = r < 0 ? 0 : r > 255 ? 255 : r; \
-  g = g < 0 ? 0 : g > 255 ? 255 : g; \
-  b = b < 0 ? 0 : b > 255 ? 255 : b;
-
-#define SCALED 1
-#if SCALED
-#define RGB2YUV_601 RGB2YUV_601_SCALED
-#define YUV2RGB_601 YUV2RGB_601_SCALED
-#else
-#define RGB2YUV_601 RGB2YUV_601_UNSCALED
-#define YUV2RGB_601 YUV2RGB_601_UNSCALED
+// Images smaller than this many pixels are not worth splitting across threads
+#define MIN_SLICE_PIXELS ( 64 * 1024 )
+
+static const yuv_coefficients bt601 =
+{
+	263, 516, 100, 16,
+	-152, -300, 450,
+	450, -377, -73,
+	1192, 1634, -401, -832, 2066
+};
+
+static const yuv_coefficients bt601_full =
+{
+	306, 601, 117, 0,
+	-173, -339, 512,
+	512, -429, -83,
+	1024, 1436, -352, -731, 1815
+};
+
+static const yuv_coefficients bt709 =
+{
+	187, 629, 63, 16,
+	-103, -347, 450,
+	450, -409, -41,
+	1192, 1836, -218, -546, 2163
+};
+
+static const yuv_coefficients bt709_full =
+{
+	218, 732, 74, 0,
+	-117, -395, 512,
+	512, -465, -47,
+	1024, 1613, -192, -479, 1900
+};
+
+static const yuv_coefficients *get_coefficients( int colorspace, int full_range )
+{
+	if ( colorspace == 709 )
+		return full_range ? &bt709_full : &bt709;
+	return full_range ? &bt601_full : &bt601;
+}
+
+/** The SIMD line converters chosen for this CPU.
+*/
+
+static struct
+{
+	convert_line_simd yuv422_to_rgb24a;
+	convert_line_simd yuv422_to_rgb24;
+	convert_line_simd rgb24a_to_yuv422;
+	convert_line_simd rgb24_to_yuv422;
+} simd;
+
+static pthread_once_t simd_once = PTHREAD_ONCE_INIT;
+
+static void init_simd()
+{
+#if defined(USE_SSE2) && defined(ARCH_X86_64)
+	mlt_cpu_register( "imageconvert.yuv422_to_rgb24a", mlt_cpu_sse2, convert_yuv422_to_rgb24a_sse2 );
+	mlt_cpu_register( "imageconvert.yuv422_to_rgb24a", mlt_cpu_avx2, convert_yuv422_to_rgb24a_avx2 );
+	mlt_cpu_register( "imageconvert.yuv422_to_rgb24", mlt_cpu_sse2, convert_yuv422_to_rgb24_sse2 );
+	mlt_cpu_register( "imageconvert.yuv422_to_rgb24", mlt_cpu_avx2, convert_yuv422_to_rgb24_avx2 );
+	mlt_cpu_register( "imageconvert.rgb24a_to_yuv422", mlt_cpu_sse2, convert_rgb24a_to_yuv422_sse2 );
+	mlt_cpu_register( "imageconvert.rgb24a_to_yuv422", mlt_cpu_avx2, convert_rgb24a_to_yuv422_avx2 );
+	mlt_cpu_register( "imageconvert.rgb24_to_yuv422", mlt_cpu_avx2, convert_rgb24_to_yuv422_avx2 );
 #endif
+	simd.yuv422_to_rgb24a = mlt_cpu_select( "imageconvert.yuv422_to_rgb24a" );
+	simd.yuv422_to_rgb24 = mlt_cpu_select( "imageconvert.yuv422_to_rgb24" );
+	simd.rgb24a_to_yuv422 = mlt_cpu_select( "imageconvert.rgb24a_to_yuv422" );
+	simd.rgb24_to_yuv422 = mlt_cpu_select( "imageconvert.rgb24_to_yuv422" );
+}
 
-static int convert_yuv422_to_rgb24a( uint8_t *yuv, uint8_t *rgba, uint8_t *alpha, int width, int height )
+static inline void rgb_to_yuv( const yuv_coefficients *c, const uint8_t *rgb, int *y, int *u, int *v )
 {
-	int ret = 0;
-	int yy, uu, vv;
-	int r,g,b;
-	int total = width * height / 2 + 1;
+	int r = rgb[0], g = rgb[1], b = rgb[2];
+	*y = ( ( c->yr * r + c->yg * g + c->yb * b ) >> 10 ) + c->y_offset;
+	*u = ( ( c->ur * r + c->ug * g + c->ub * b ) >> 10 ) + 128;
+	*v = ( ( c->vr * r + c->vg * g + c->vb * b ) >> 10 ) + 128;
+}
 
-	while ( --total )
-	{
-		yy = yuv[0];
-		uu = yuv[1];
-		vv = yuv[3];
-		YUV2RGB_601( yy, uu, vv, r, g, b );
-		rgba[0] = r;
-		rgba[1] = g;
-		rgba[2] = b;
-		rgba[3] = *alpha++;
-		yy = yuv[2];
-		YUV2RGB_601( yy, uu, vv, r, g, b );
-		rgba[4] = r;
-		rgba[5] = g;
-		rgba[6] = b;
-		rgba[7] = *alpha++;
-		yuv += 4;
-		rgba += 8;
-	}
-	return ret;
+static inline void yuv_to_rgb( const yuv_coefficients *c, int y, int u, int v, uint8_t *rgb )
+{
+	int r, g, b;
+	y = c->ry * ( y - c->y_offset );
+	u -= 128;
+	v -= 128;
+	r = ( y + c->rv * v ) >> 10;
+	g = ( y + c->gv * v + c->gu * u ) >> 10;
+	b = ( y + c->bu * u ) >> 10;
+	rgb[0] = CLAMP( r, 0, 255 );
+	rgb[1] = CLAMP( g, 0, 255 );
+	rgb[2] = CLAMP( b, 0, 255 );
 }
 
-static int convert_yuv422_to_rgb24( uint8_t *yuv, uint8_t *rgb, uint8_t *alpha, int width, int height )
+/** Convert a line of RGB with bpp bytes per pixel to yuv422, extracting the alpha if requested.
+*/
+
+static void rgb_to_yuv422( const yuv_coefficients *c, const uint8_t *s, int bpp, uint8_t *d, uint8_t *alpha, int width )
 {
-	int ret = 0;
-	int yy, uu, vv;
-	int r,g,b;
-	int total = width * height / 2 + 1;
+	int y0, y1, u0, u1, v0, v1;
 
-	while ( --total )
+	for ( ; width > 1; width -= 2 )
 	{
-		yy = yuv[0];
-		uu = yuv[1];
-		vv = yuv[3];
-		YUV2RGB_601( yy, uu, vv, r, g, b );
-		rgb[0] = r;
-		rgb[1] = g;
-		rgb[2] = b;
-		yy = yuv[2];
-		YUV2RGB_601( yy, uu, vv, r, g, b );
-		rgb[3] = r;
-		rgb[4] = g;
-		rgb[5] = b;
-		yuv += 4;
-		rgb += 6;
+		rgb_to_yuv( c, s, &y0, &u0, &v0 );
+		rgb_to_yuv( c, s + bpp, &y1, &u1, &v1 );
+		if ( alpha )
+		{
+			*alpha++ = s[3];
+			*alpha++ = s[bpp + 3];
+		}
+		*d++ = y0;
+		*d++ = ( u0 + u1 ) >> 1;
+		*d++ = y1;
+		*d++ = ( v0 + v1 ) >> 1;
+		s += bpp * 2;
+	}
+	if ( width )
+	{
+		rgb_to_yuv( c, s, &y0, &u0, &v0 );
+		if ( alpha )
+			*alpha = s[3];
+		*d++ = y0;
+		*d++ = u0;
 	}
-	return ret;
 }
 
-static int convert_rgb24a_to_yuv422( uint8_t *rgba, uint8_t *yuv, uint8_t *alpha, int width, int height )
+/** Convert a line of yuv422 to RGB with bpp bytes per pixel from pixel start,
+ * merging the alpha if 4.
+*/
+
+static void yuv422_to_rgb( const yuv_coefficients *c, const uint8_t *s, uint8_t *d, int bpp, const uint8_t *alpha, int start, int width )
 {
-	int ret = 0;
-	int stride = width * 4;
-	int y0, y1, u0, u1, v0, v1;
-	int r, g, b;
-	uint8_t *s, *d = yuv;
-	int i, j, n = width / 2 + 1;
+	int n;
 
+	s += start * 2;
+	d += start * bpp;
 	if ( alpha )
-	for ( i = 0; i < height; i++ )
+		alpha += start;
+	for ( n = width - start; n > 1; n -= 2 )
 	{
-		s = rgba + ( stride * i );
-		j = n;
-		while ( --j )
+		yuv_to_rgb( c, s[0], s[1], s[3], d );
+		yuv_to_rgb( c, s[2], s[1], s[3], d + bpp );
+		if ( bpp == 4 )
 		{
-			r = *s++;
-			g = *s++;
-			b = *s++;
-			*alpha++ = *s++;
-			RGB2YUV_601( r, g, b, y0, u0 , v0 );
-			r = *s++;
-			g = *s++;
-			b = *s++;
-			*alpha++ = *s++;
-			RGB2YUV_601( r, g, b, y1, u1 , v1 );
-			*d++ = y0;
-			*d++ = (u0+u1) >> 1;
-			*d++ = y1;
-			*d++ = (v0+v1) >> 1;
-		}
-		if ( width % 2 )
-		{
-			r = *s++;
-			g = *s++;
-			b = *s++;
-			*alpha++ = *s++;
-			RGB2YUV_601( r, g, b, y0, u0 , v0 );
-			*d++ = y0;
-			*d++ = u0;
+			d[3] = alpha ? *alpha++ : 0xff;
+			d[7] = alpha ? *alpha++ : 0xff;
 		}
+		s += 4;
+		d += bpp * 2;
 	}
-	else
-	for ( i = 0; i < height; i++ )
+	if ( n )
 	{
-		s = rgba + ( stride * i );
-		j = n;
-		while ( --j )
-		{
-			r = *s++;
-			g = *s++;
-			b = *s++;
-			s++;
-			RGB2YUV_601( r, g, b, y0, u0 , v0 );
-			r = *s++;
-			g = *s++;
-			b = *s++;
-			s++;
-			RGB2YUV_601( r, g, b, y1, u1 , v1 );
-			*d++ = y0;
-			*d++ = (u0+u1) >> 1;
-			*d++ = y1;
-			*d++ = (v0+v1) >> 1;
-		}
-		if ( width % 2 )
-		{
-			r = *s++;
-			g = *s++;
-			b = *s++;
-			s++;
-			RGB2YUV_601( r, g, b, y0, u0 , v0 );
-			*d++ = y0;
-			*d++ = u0;
-		}
+		// The last odd pixel has no Cr of its own
+		yuv_to_rgb( c, s[0], s[1], width > 1 ? s[-1] : 128, d );
+		if ( bpp == 4 )
+			d[3] = alpha ? *alpha : 0xff;
 	}
+}
+
+struct convert_context_s;
+typedef struct convert_context_s *convert_context;
+
+/** Convert a line between a format and packed yuv422.
+ * Conversions between RGB formats ignore the yuv422 line.
+*/
+
+typedef void ( *convert_line )( convert_context ctx, int row, uint8_t *yuv );
 
-	return ret;
+struct convert_context_s
+{
+	const yuv_coefficients *to_yuv;
+	const yuv_coefficients *from_yuv;
+	uint8_t *src[4];
+	int src_strides[4];
+	uint8_t *dst[4];
+	int dst_strides[4];
+	uint8_t *alpha;
+	int alpha_value;
+	int width;
+	int height;
+	convert_line read_line;
+	convert_line write_line;
+};
+
+#define SRC_LINE( ctx, plane, row ) ( ( ctx )->src[ plane ] + ( row ) * ( ctx )->src_strides[ plane ] )
+#define DST_LINE( ctx, plane, row ) ( ( ctx )->dst[ plane ] + ( row ) * ( ctx )->dst_strides[ plane ] )
+#define ALPHA_LINE( ctx, row ) ( ( ctx )->alpha ? ( ctx )->alpha + ( row ) * ( ctx )->width : NULL )
+
+static void rgb24_to_yuv422_line( convert_context ctx, int row, uint8_t *yuv )
+{
+	uint8_t *s = SRC_LINE( ctx, 0, row );
+	int j = simd.rgb24_to_yuv422 ? simd.rgb24_to_yuv422( ctx->to_yuv, s, yuv, NULL, ctx->width ) : 0;
+	rgb_to_yuv422( ctx->to_yuv, s + j * 3, 3, yuv + j * 2, NULL, ctx->width - j );
 }
 
-static int convert_rgb24_to_yuv422( uint8_t *rgb, uint8_t *yuv, uint8_t *alpha, int width, int height )
+static void rgb24a_to_yuv422_line( convert_context ctx, int row, uint8_t *yuv )
 {
-	int ret = 0;
-	int stride = width * 3;
-	int y0, y1, u0, u1, v0, v1;
-	int r, g, b;
-	uint8_t *s, *d = yuv;
-	int i, j, n = width / 2 + 1;
+	uint8_t *s = SRC_LINE( ctx, 0, row );
+	uint8_t *alpha = ALPHA_LINE( ctx, row );
+	int j = simd.rgb24a_to_yuv422 ? simd.rgb24a_to_yuv422( ctx->to_yuv, s, yuv, alpha, ctx->width ) : 0;
+	rgb_to_yuv422( ctx->to_yuv, s + j * 4, 4, yuv + j * 2, alpha ? alpha + j : NULL, ctx->width - j );
+}
 
-	for ( i = 0; i < height; i++ )
+static void yuv420p_to_yuv422_line( convert_context ctx, int row, uint8_t *yuv )
+{
+	uint8_t *y = SRC_LINE( ctx, 0, row );
+	uint8_t *u = SRC_LINE( ctx, 1, row / 2 );
+	uint8_t *v = SRC_LINE( ctx, 2, row / 2 );
+	int j = ctx->width / 2 + 1;
+
+	while ( --j )
 	{
-		s = rgb + ( stride * i );
-		j = n;
-		while ( --j )
-		{
-			r = *s++;
-			g = *s++;
-			b = *s++;
-			RGB2YUV_601( r, g, b, y0, u0 , v0 );
-			r = *s++;
-			g = *s++;
-			b = *s++;
-			RGB2YUV_601( r, g, b, y1, u1 , v1 );
-			*d++ = y0;
-			*d++ = (u0+u1) >> 1;
-			*d++ = y1;
-			*d++ = (v0+v1) >> 1;
-		}
-		if ( width % 2 )
-		{
-			r = *s++;
-			g = *s++;
-			b = *s++;
-			RGB2YUV_601( r, g, b, y0, u0 , v0 );
-			*d++ = y0;
-			*d++ = u0;
-		}
+		*yuv++ = *y++;
+		*yuv++ = *u++;
+		*yuv++ = *y++;
+		*yuv++ = *v++;
+	}
+	if ( ctx->width % 2 )
+	{
+		*yuv++ = *y;
+		*yuv++ = *u;
 	}
-	return ret;
 }
 
-static int convert_yuv420p_to_yuv422( uint8_t *yuv420p, uint8_t *yuv, uint8_t *alpha, int width, int height )
+static void yuv422p16_to_yuv422_line( convert_context ctx, int row, uint8_t *yuv )
 {
-	int ret = 0;
-	int i, j;
-	int half = width >> 1;
-	uint8_t *Y = yuv420p;
-	uint8_t *U = Y + width * height;
-	uint8_t *V = U + width * height / 4;
-	uint8_t *d = yuv;
+	uint16_t *y = ( uint16_t* ) SRC_LINE( ctx, 0, row );
+	uint16_t *u = ( uint16_t* ) SRC_LINE( ctx, 1, row );
+	uint16_t *v = ( uint16_t* ) SRC_LINE( ctx, 2, row );
+	int j = ctx->width / 2 + 1;
 
-	for ( i = 0; i < height; i++ )
+	while ( --j )
 	{
-		uint8_t *u = U + ( i / 2 ) * ( half );
-		uint8_t *v = V + ( i / 2 ) * ( half );
+		*yuv++ = *y++ >> 8;
+		*yuv++ = *u++ >> 8;
+		*yuv++ = *y++ >> 8;
+		*yuv++ = *v++ >> 8;
+	}
+	if ( ctx->width % 2 )
+	{
+		*yuv++ = *y >> 8;
+		*yuv++ = *u >> 8;
+	}
+}
 
-		j = half + 1;
-		while ( --j )
-		{
-			*d ++ = *Y ++;
-			*d ++ = *u ++;
-			*d ++ = *Y ++;
-			*d ++ = *v ++;
-		}
+static void yuv422_to_rgb24_line( convert_context ctx, int row, uint8_t *yuv )
+{
+	uint8_t *d = DST_LINE( ctx, 0, row );
+	int j = simd.yuv422_to_rgb24 ? simd.yuv422_to_rgb24( ctx->from_yuv, yuv, d, NULL, ctx->width ) : 0;
+	yuv422_to_rgb( ctx->from_yuv, yuv, d, 3, NULL, j, ctx->width );
+}
+
+static void yuv422_to_rgb24a_line( convert_context ctx, int row, uint8_t *yuv )
+{
+	uint8_t *d = DST_LINE( ctx, 0, row );
+	uint8_t *alpha = ALPHA_LINE( ctx, row );
+	int j = simd.yuv422_to_rgb24a ? simd.yuv422_to_rgb24a( ctx->from_yuv, yuv, d, alpha, ctx->width ) : 0;
+	yuv422_to_rgb( ctx->from_yuv, yuv, d, 4, alpha, j, ctx->width );
+}
+
+static void yuv422_to_yuv420p_line( convert_context ctx, int row, uint8_t *yuv )
+{
+	uint8_t *y = DST_LINE( ctx, 0, row );
+	uint8_t *u = DST_LINE( ctx, 1, row / 2 );
+	uint8_t *v = DST_LINE( ctx, 2, row / 2 );
+	int j;
+
+	// The chroma of the odd lines is dropped
+	if ( row % 2 )
+	{
+		for ( j = 0; j < ctx->width; j++, yuv += 2 )
+			*y++ = *yuv;
+		return;
+	}
+	for ( j = 0; j + 1 < ctx->width; j += 2 )
+	{
+		*y++ = *yuv++;
+		*u++ = *yuv++;
+		*y++ = *yuv++;
+		*v++ = *yuv++;
+	}
+	if ( j < ctx->width )
+	{
+		*y = yuv[0];
+		*u = yuv[1];
+		*v = 128;
 	}
-	return ret;
 }
 
-static int convert_rgb24_to_rgb24a( uint8_t *rgb, uint8_t *rgba, uint8_t *alpha, int width, int height )
+static void yuv422_to_yuv422p16_line( convert_context ctx, int row, uint8_t *yuv )
 {
-	uint8_t *s = rgb;
-	uint8_t *d = rgba;
-	int total = width * height + 1;
+	uint16_t *y = ( uint16_t* ) DST_LINE( ctx, 0, row );
+	uint16_t *u = ( uint16_t* ) DST_LINE( ctx, 1, row );
+	uint16_t *v = ( uint16_t* ) DST_LINE( ctx, 2, row );
+	int j;
 
-	while ( --total )
+	for ( j = 0; j + 1 < ctx->width; j += 2, yuv += 4 )
+	{
+		*y++ = ( yuv[0] << 8 ) | yuv[0];
+		*u++ = ( yuv[1] << 8 ) | yuv[1];
+		*y++ = ( yuv[2] << 8 ) | yuv[2];
+		*v++ = ( yuv[3] << 8 ) | yuv[3];
+	}
+	if ( j < ctx->width )
+	{
+		*y = ( yuv[0] << 8 ) | yuv[0];
+		*u = ( yuv[1] << 8 ) | yuv[1];
+		*v = 0x8080;
+	}
+}
+
+static void rgb24_to_rgb24a_line( convert_context ctx, int row, uint8_t *yuv )
+{
+	uint8_t *s = SRC_LINE( ctx, 0, row );
+	uint8_t *d = DST_LINE( ctx, 0, row );
+	int j = ctx->width + 1;
+
+	while ( --j )
 	{
 		*d++ = s[0];
 		*d++ = s[1];
@@ -271,38 +356,112 @@ static int convert_rgb24_to_rgb24a( uint8_t *rgb, uint8_t *rgba, uint8_t *alpha,
 		*d++ = 0xff;
 		s += 3;
 	}
-	return 0;
 }
 
-static int convert_rgb24a_to_rgb24( uint8_t *rgba, uint8_t *rgb, uint8_t *alpha, int width, int height )
+static void rgb24a_to_rgb24_line( convert_context ctx, int row, uint8_t *yuv )
 {
-	uint8_t *s = rgba;
-	uint8_t *d = rgb;
-	int total = width * height + 1;
+	uint8_t *s = SRC_LINE( ctx, 0, row );
+	uint8_t *d = DST_LINE( ctx, 0, row );
+	uint8_t *alpha = ALPHA_LINE( ctx, row );
+	int j = ctx->width + 1;
 
-	while ( --total )
+	while ( --j )
 	{
 		*d++ = s[0];
 		*d++ = s[1];
 		*d++ = s[2];
-		*alpha++ = s[3];
+		if ( alpha )
+			*alpha++ = s[3];
 		s += 4;
 	}
-	return 0;
 }
 
-typedef int ( *conversion_function )( uint8_t *yuv, uint8_t *rgba, uint8_t *alpha, int width, int height );
+static void rgb24a_to_opengl_line( convert_context ctx, int row, uint8_t *yuv )
+{
+	memcpy( DST_LINE( ctx, 0, row ), SRC_LINE( ctx, 0, row ), ctx->width * 4 );
+}
+
+/** The conversions between formats that are not done through yuv422.
+*/
 
-static conversion_function conversion_matrix[ mlt_image_invalid - 1 ][ mlt_image_invalid - 1 ] = {
-	{ NULL, convert_rgb24_to_rgb24a, convert_rgb24_to_yuv422, NULL, convert_rgb24_to_rgb24a, NULL },
-	{ convert_rgb24a_to_rgb24, NULL, convert_rgb24a_to_yuv422, NULL, NULL, NULL },
-	{ convert_yuv422_to_rgb24, convert_yuv422_to_rgb24a, NULL, NULL, convert_yuv422_to_rgb24a, NULL },
-	{ NULL, NULL, convert_yuv420p_to_yuv422, NULL, NULL, NULL },
-	{ convert_rgb24a_to_rgb24, NULL, convert_rgb24a_to_yuv422, NULL, NULL, NULL },
-	{ NULL, NULL, NULL, NULL, NULL, NULL },
+static const convert_line conversion_matrix[ mlt_image_invalid ][ mlt_image_invalid ] =
+{
+	[ mlt_image_rgb24 ] = {
+		[ mlt_image_rgb24a ] = rgb24_to_rgb24a_line,
+		[ mlt_image_opengl ] = rgb24_to_rgb24a_line,
+	},
+	[ mlt_image_rgb24a ] = {
+		[ mlt_image_rgb24 ] = rgb24a_to_rgb24_line,
+		[ mlt_image_opengl ] = rgb24a_to_opengl_line,
+	},
+	[ mlt_image_opengl ] = {
+		[ mlt_image_rgb24 ] = rgb24a_to_rgb24_line,
+		[ mlt_image_rgb24a ] = rgb24a_to_opengl_line,
+	},
 };
 
-static uint8_t bpp_table[4] = { 3, 4, 2, 0 };
+/** How each format is read into and written from packed yuv422, which the
+ * remaining conversions go through one line at a time.
+*/
+
+static const struct
+{
+	convert_line to_yuv422;
+	convert_line from_yuv422;
+} yuv422_lines[ mlt_image_invalid ] =
+{
+	[ mlt_image_rgb24 ] = { rgb24_to_yuv422_line, yuv422_to_rgb24_line },
+	[ mlt_image_rgb24a ] = { rgb24a_to_yuv422_line, yuv422_to_rgb24a_line },
+	[ mlt_image_yuv420p ] = { yuv420p_to_yuv422_line, yuv422_to_yuv420p_line },
+	[ mlt_image_opengl ] = { rgb24a_to_yuv422_line, yuv422_to_rgb24a_line },
+	[ mlt_image_yuv422p16 ] = { yuv422p16_to_yuv422_line, yuv422_to_yuv422p16_line },
+};
+
+static int convert_slice( int id, int index, int count, void *context )
+{
+	convert_context ctx = context;
+	// Slices have an even number of lines to keep the chroma of yuv420p together
+	int slice_height = ( ( ctx->height + count - 1 ) / count + 1 ) & ~1;
+	int start = index * slice_height;
+	int end = MIN( start + slice_height, ctx->height );
+	uint8_t *line = NULL;
+	int i;
+
+	if ( ctx->read_line && ctx->write_line )
+		line = mlt_pool_alloc( ctx->width * 2 );
+	for ( i = start; i < end; i++ )
+	{
+		uint8_t *yuv = line;
+		if ( !ctx->write_line )
+			yuv = DST_LINE( ctx, 0, i );
+		else if ( !ctx->read_line )
+			yuv = SRC_LINE( ctx, 0, i );
+		if ( ctx->read_line )
+			ctx->read_line( ctx, i, yuv );
+		if ( ctx->write_line )
+			ctx->write_line( ctx, i, yuv );
+		if ( ctx->alpha_value < 255 )
+		{
+			// Fill in a constant alpha while the line is still in the cache
+			uint8_t *d = DST_LINE( ctx, 0, i ) + 3;
+			int j;
+			for ( j = 0; j < ctx->width; j++, d += 4 )
+				*d = ctx->alpha_value;
+		}
+	}
+	mlt_pool_release( line );
+	return 0;
+}
+
+static int is_rgb( mlt_image_format format )
+{
+	return format == mlt_image_rgb24 || format == mlt_image_rgb24a || format == mlt_image_opengl;
+}
+
+static int is_yuv( mlt_image_format format )
+{
+	return format == mlt_image_yuv422 || format == mlt_image_yuv420p || format == mlt_image_yuv422p16;
+}
 
 static int convert_image( mlt_frame frame, uint8_t **buffer, mlt_image_format *format, mlt_image_format requested_format )
 {
@@ -313,41 +472,78 @@ static int convert_image( mlt_frame frame, uint8_t **buffer, mlt_image_format *f
 
 	if ( *format != requested_format )
 	{
-		conversion_function converter = conversion_matrix[ *format - 1 ][ requested_format - 1 ];
+		struct convert_context_s ctx = { .alpha_value = 255, .width = width, .height = height };
+
+		if ( *format > mlt_image_none && *format < mlt_image_invalid &&
+		     requested_format > mlt_image_none && requested_format < mlt_image_invalid )
+		{
+			ctx.read_line = conversion_matrix[ *format ][ requested_format ];
+			if ( !ctx.read_line && ( is_rgb( *format ) || is_yuv( *format ) ) &&
+			     ( is_rgb( requested_format ) || is_yuv( requested_format ) ) )
+			{
+				ctx.read_line = yuv422_lines[ *format ].to_yuv422;
+				ctx.write_line = yuv422_lines[ requested_format ].from_yuv422;
+			}
+		}
 
 		mlt_log_debug( NULL, "[filter imageconvert] %s -> %s @ %dx%d\n",
 			mlt_image_format_name( *format ), mlt_image_format_name( requested_format ),
 			width, height );
-		if ( converter )
+		if ( ctx.read_line || ctx.write_line )
 		{
-			int size = width * height * bpp_table[ requested_format - 1 ];
+			int size = mlt_image_format_size( requested_format, width, height, NULL );
 			int alpha_size = width * height;
 			uint8_t *image = mlt_pool_alloc( size );
-			uint8_t *alpha = ( *format == mlt_image_rgb24a ||
-			                   *format == mlt_image_opengl )
-			                 ? mlt_pool_alloc( width * height ) : NULL;
-			if ( requested_format == mlt_image_rgb24a || requested_format == mlt_image_opengl )
+			int threads = mlt_slices_count_normal();
+
+			if ( is_rgb( *format ) && !is_rgb( requested_format ) )
 			{
-				if ( alpha )
-					mlt_pool_release( alpha );
-				alpha = mlt_frame_get_alpha_mask( frame );
-				mlt_properties_get_data( properties, "alpha", &alpha_size );
+				mlt_profile profile = mlt_service_profile(
+					MLT_PRODUCER_SERVICE( mlt_frame_get_original_producer( frame ) ) );
+				ctx.to_yuv = get_coefficients( profile ? profile->colorspace : 601, 0 );
 			}
-
-			if ( !( error = converter( *buffer, image, alpha, width, height ) ) )
+			else if ( is_yuv( *format ) && is_rgb( requested_format ) )
+			{
+				ctx.from_yuv = get_coefficients( mlt_properties_get_int( properties, "colorspace" ),
+					mlt_properties_get_int( properties, "full_luma" ) );
+			}
+			if ( *format == mlt_image_rgb24a || *format == mlt_image_opengl )
+			{
+				if ( requested_format != mlt_image_rgb24a && requested_format != mlt_image_opengl )
+					ctx.alpha = mlt_pool_alloc( alpha_size );
+			}
+			else if ( requested_format == mlt_image_rgb24a || requested_format == mlt_image_opengl )
 			{
-				mlt_frame_set_image( frame, image, size, mlt_pool_release );
-				if ( alpha && ( *format == mlt_image_rgb24a || *format == mlt_image_opengl ) )
-					mlt_frame_set_alpha( frame, alpha, alpha_size, mlt_pool_release );
-				*buffer = image;
-				*format = requested_format;
+				// A constant alpha is filled in without creating the alpha channel
+				int alpha_value = mlt_frame_get_alpha_value( frame );
+				if ( alpha_value >= 0 && is_yuv( *format ) )
+					ctx.alpha_value = alpha_value;
+				else if ( alpha_value < 0 && is_yuv( *format ) )
+				{
+					ctx.alpha = mlt_frame_get_alpha( frame );
+					mlt_properties_get_data( properties, "alpha", &alpha_size );
+				}
 			}
+			mlt_image_format_planes( *format, width, height, *buffer, ctx.src, ctx.src_strides );
+			mlt_image_format_planes( requested_format, width, height, image, ctx.dst, ctx.dst_strides );
+
+			if ( threads > 1 && width * height >= MIN_SLICE_PIXELS )
+				mlt_slices_run_normal( MIN( threads, height / 2 ), convert_slice, &ctx );
 			else
+				convert_slice( 0, 0, 1, &ctx );
+
+			mlt_frame_set_image( frame, image, size, mlt_pool_release );
+			if ( ctx.alpha && ( *format == mlt_image_rgb24a || *format == mlt_image_opengl ) )
+				mlt_frame_set_alpha( frame, ctx.alpha, alpha_size, mlt_pool_release );
+			if ( ctx.to_yuv )
 			{
-				mlt_pool_release( image );
-				if ( alpha )
-					mlt_pool_release( alpha );
+				// The new colorspace is only valid if destination is YUV.
+				mlt_properties_set_int( properties, "colorspace", ctx.to_yuv == &bt709 ? 709 : 601 );
+				if ( mlt_properties_get_int( properties, "full_luma" ) )
+					mlt_properties_set_int( properties, "full_luma", 0 );
 			}
+			*buffer = image;
+			*format = requested_format;
 		}
 		else
 		{
@@ -377,6 +573,10 @@ mlt_filter filter_imageconvert_init( mlt_profile profile, mlt_service_type type,
 	if ( mlt_filter_init( filter, filter ) == 0 )
 	{
 		filter->process = filter_process;
+		pthread_once( &simd_once, init_simd );
+
+		// This only sets the converter, so a tractor may render the frames again
+		mlt_properties_set_int( MLT_FILTER_PROPERTIES( filter ), "_track_ahead_safe", 1 );
 	}
 	return filter;
 }
@@ -0,0 +1,52 @@
+/*
+ * filter_imageconvert.h -- colorspace and pixel format converter
+ * Copyright (C) 2009-2014 Meltytech, LLC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _FILTER_IMAGECONVERT_H_
+#define _FILTER_IMAGECONVERT_H_
+
+#include <stdint.h>
+
+/** Fixed point coefficients, scaled by 1024, of a Y'CbCr colorspace and range.
+*/
+
+typedef struct
+{
+	int16_t yr, yg, yb, y_offset;  // RGB to Y'
+	int16_t ur, ug, ub;            // RGB to Cb
+	int16_t vr, vg, vb;            // RGB to Cr
+	int16_t ry, rv, gu, gv, bu;    // Y'CbCr to RGB
+} yuv_coefficients;
+
+/** Convert the start of a line and return the number of pixels converted.
+ * The remaining pixels are left to the scalar converter.
+*/
+
+typedef int ( *convert_line_simd )( const yuv_coefficients *c, const uint8_t *src, uint8_t *dst, uint8_t *alpha, int width );
+
+#if defined(USE_SSE2) && defined(ARCH_X86_64)
+extern int convert_yuv422_to_rgb24a_sse2( const yuv_coefficients *c, const uint8_t *src, uint8_t *dst, uint8_t *alpha, int width );
+extern int convert_yuv422_to_rgb24_sse2( const yuv_coefficients *c, const uint8_t *src, uint8_t *dst, uint8_t *alpha, int width );
+extern int convert_rgb24a_to_yuv422_sse2( const yuv_coefficients *c, const uint8_t *src, uint8_t *dst, uint8_t *alpha, int width );
+extern int convert_yuv422_to_rgb24a_avx2( const yuv_coefficients *c, const uint8_t *src, uint8_t *dst, uint8_t *alpha, int width );
+extern int convert_yuv422_to_rgb24_avx2( const yuv_coefficients *c, const uint8_t *src, uint8_t *dst, uint8_t *alpha, int width );
+extern int convert_rgb24a_to_yuv422_avx2( const yuv_coefficients *c, const uint8_t *src, uint8_t *dst, uint8_t *alpha, int width );
+extern int convert_rgb24_to_yuv422_avx2( const yuv_coefficients *c, const uint8_t *src, uint8_t *dst, uint8_t *alpha, int width );
+#endif
+
+#endif
@@ -0,0 +1,310 @@
+/*
+ * filter_imageconvert_simd.c -- SSE2 and AVX2 line converters
+ * Copyright (C) 2009-2014 Meltytech, LLC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "filter_imageconvert.h"
+
+#if defined(USE_SSE2) && defined(ARCH_X86_64)
+
+#include <immintrin.h>
+
+// The AVX2 functions are compiled for AVX2 regardless of the compiler flags
+// and are only called when the CPU supports it.
+#define AVX2 __attribute__((target("avx2")))
+
+// Two 16-bit coefficients for _mm_madd_epi16, a applies to the even and b to the odd elements.
+#define PAIR( a, b ) ( ( int )( ( ( uint32_t )( uint16_t )( b ) << 16 ) | ( uint16_t )( a ) ) )
+
+// Each kernel computes exactly the same integer expressions as the scalar
+// converter so that the results do not depend on the CPU.
+
+static inline __m128i madd_shift_sse2( __m128i a_lo, __m128i a_hi, __m128i b_lo, __m128i b_hi, __m128i ka, __m128i kb )
+{
+	__m128i lo = _mm_add_epi32( _mm_madd_epi16( a_lo, ka ), _mm_madd_epi16( b_lo, kb ) );
+	__m128i hi = _mm_add_epi32( _mm_madd_epi16( a_hi, ka ), _mm_madd_epi16( b_hi, kb ) );
+	return _mm_packs_epi32( _mm_srai_epi32( lo, 10 ), _mm_srai_epi32( hi, 10 ) );
+}
+
+/** Convert 8 pixels of yuv422 to 8-bit R, G, and B in the low half of each register.
+*/
+
+static inline void yuv422_to_rgb_sse2( const yuv_coefficients *c, __m128i p, __m128i *r, __m128i *g, __m128i *b )
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i y = _mm_sub_epi16( _mm_and_si128( p, _mm_set1_epi16( 0xff ) ), _mm_set1_epi16( c->y_offset ) );
+	__m128i uv = _mm_srli_epi16( p, 8 );
+	__m128i u = _mm_and_si128( uv, _mm_set1_epi32( 0xffff ) );
+	__m128i v = _mm_srli_epi32( uv, 16 );
+	u = _mm_sub_epi16( _mm_or_si128( u, _mm_slli_epi32( u, 16 ) ), _mm_set1_epi16( 128 ) );
+	v = _mm_sub_epi16( _mm_or_si128( v, _mm_slli_epi32( v, 16 ) ), _mm_set1_epi16( 128 ) );
+	__m128i yv_lo = _mm_unpacklo_epi16( y, v );
+	__m128i yv_hi = _mm_unpackhi_epi16( y, v );
+	__m128i yu_lo = _mm_unpacklo_epi16( y, u );
+	__m128i yu_hi = _mm_unpackhi_epi16( y, u );
+	*r = madd_shift_sse2( yv_lo, yv_hi, yu_lo, yu_hi, _mm_set1_epi32( PAIR( c->ry, c->rv ) ), zero );
+	*g = madd_shift_sse2( yv_lo, yv_hi, yu_lo, yu_hi, _mm_set1_epi32( PAIR( c->ry, c->gv ) ), _mm_set1_epi32( PAIR( 0, c->gu ) ) );
+	*b = madd_shift_sse2( yv_lo, yv_hi, yu_lo, yu_hi, zero, _mm_set1_epi32( PAIR( c->ry, c->bu ) ) );
+	*r = _mm_packus_epi16( *r, *r );
+	*g = _mm_packus_epi16( *g, *g );
+	*b = _mm_packus_epi16( *b, *b );
+}
+
+/** Convert 8 pixels of 16-bit R, G, and B to yuv422.
+*/
+
+static inline __m128i rgb_to_yuv422_sse2( const yuv_coefficients *c, __m128i r, __m128i g, __m128i b )
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i rg_lo = _mm_unpacklo_epi16( r, g );
+	__m128i rg_hi = _mm_unpackhi_epi16( r, g );
+	__m128i b_lo = _mm_unpacklo_epi16( b, zero );
+	__m128i b_hi = _mm_unpackhi_epi16( b, zero );
+	__m128i y = madd_shift_sse2( rg_lo, rg_hi, b_lo, b_hi, _mm_set1_epi32( PAIR( c->yr, c->yg ) ), _mm_set1_epi32( PAIR( c->yb, 0 ) ) );
+	__m128i u = madd_shift_sse2( rg_lo, rg_hi, b_lo, b_hi, _mm_set1_epi32( PAIR( c->ur, c->ug ) ), _mm_set1_epi32( PAIR( c->ub, 0 ) ) );
+	__m128i v = madd_shift_sse2( rg_lo, rg_hi, b_lo, b_hi, _mm_set1_epi32( PAIR( c->vr, c->vg ) ), _mm_set1_epi32( PAIR( c->vb, 0 ) ) );
+	__m128i ones = _mm_set1_epi16( 1 );
+	y = _mm_add_epi16( y, _mm_set1_epi16( c->y_offset ) );
+	// Average the chroma of each pair of pixels
+	u = _mm_srli_epi32( _mm_madd_epi16( _mm_add_epi16( u, _mm_set1_epi16( 128 ) ), ones ), 1 );
+	v = _mm_srli_epi32( _mm_madd_epi16( _mm_add_epi16( v, _mm_set1_epi16( 128 ) ), ones ), 1 );
+	u = _mm_or_si128( u, _mm_slli_epi32( v, 16 ) );
+	return _mm_or_si128( y, _mm_slli_epi16( u, 8 ) );
+}
+
+/** Convert 8 pixels of rgb24a to yuv422 and write their alpha.
+*/
+
+static inline __m128i rgb24a_to_yuv422_sse2( const yuv_coefficients *c, __m128i p0, __m128i p1, uint8_t *alpha )
+{
+	__m128i mask = _mm_set1_epi32( 0xff );
+	__m128i r = _mm_packs_epi32( _mm_and_si128( p0, mask ), _mm_and_si128( p1, mask ) );
+	__m128i g = _mm_packs_epi32( _mm_and_si128( _mm_srli_epi32( p0, 8 ), mask ), _mm_and_si128( _mm_srli_epi32( p1, 8 ), mask ) );
+	__m128i b = _mm_packs_epi32( _mm_and_si128( _mm_srli_epi32( p0, 16 ), mask ), _mm_and_si128( _mm_srli_epi32( p1, 16 ), mask ) );
+	if ( alpha )
+	{
+		__m128i a = _mm_packs_epi32( _mm_srli_epi32( p0, 24 ), _mm_srli_epi32( p1, 24 ) );
+		_mm_storel_epi64( ( __m128i* ) alpha, _mm_packus_epi16( a, a ) );
+	}
+	return rgb_to_yuv422_sse2( c, r, g, b );
+}
+
+int convert_yuv422_to_rgb24a_sse2( const yuv_coefficients *c, const uint8_t *src, uint8_t *dst, uint8_t *alpha, int width )
+{
+	__m128i r, g, b, a = _mm_set1_epi8( 0xff );
+	int j;
+
+	for ( j = 0; j + 8 <= width; j += 8 )
+	{
+		yuv422_to_rgb_sse2( c, _mm_loadu_si128( ( const __m128i* )( src + j * 2 ) ), &r, &g, &b );
+		if ( alpha )
+			a = _mm_loadl_epi64( ( const __m128i* )( alpha + j ) );
+		__m128i rg = _mm_unpacklo_epi8( r, g );
+		__m128i ba = _mm_unpacklo_epi8( b, a );
+		_mm_storeu_si128( ( __m128i* )( dst + j * 4 ), _mm_unpacklo_epi16( rg, ba ) );
+		_mm_storeu_si128( ( __m128i* )( dst + j * 4 + 16 ), _mm_unpackhi_epi16( rg, ba ) );
+	}
+	return j;
+}
+
+int convert_yuv422_to_rgb24_sse2( const yuv_coefficients *c, const uint8_t *src, uint8_t *dst, uint8_t *alpha, int width )
+{
+	uint8_t rgba[ 32 ];
+	int i, j;
+
+	// SSE2 has no byte shuffle to drop the alpha, so it is done in a small buffer
+	for ( j = 0; j + 8 <= width; j += 8 )
+	{
+		convert_yuv422_to_rgb24a_sse2( c, src + j * 2, rgba, NULL, 8 );
+		for ( i = 0; i < 8; i++ )
+		{
+			*dst++ = rgba[ i * 4 ];
+			*dst++ = rgba[ i * 4 + 1 ];
+			*dst++ = rgba[ i * 4 + 2 ];
+		}
+	}
+	return j;
+}
+
+int convert_rgb24a_to_yuv422_sse2( const yuv_coefficients *c, const uint8_t *src, uint8_t *dst, uint8_t *alpha, int width )
+{
+	int j;
+
+	for ( j = 0; j + 8 <= width; j += 8 )
+	{
+		__m128i p0 = _mm_loadu_si128( ( const __m128i* )( src + j * 4 ) );
+		__m128i p1 = _mm_loadu_si128( ( const __m128i* )( src + j * 4 + 16 ) );
+		__m128i yuv = rgb24a_to_yuv422_sse2( c, p0, p1, alpha ? alpha + j : NULL );
+		_mm_storeu_si128( ( __m128i* )( dst + j * 2 ), yuv );
+	}
+	return j;
+}
+
+// The AVX2 kernels process 16 pixels at a time. Most instructions work on each
+// 128-bit lane separately, so pixels 0-7 are kept in the low lane and 8-15 in
+// the high lane.
+
+static inline AVX2 __m256i madd_shift_avx2( __m256i a_lo, __m256i a_hi, __m256i b_lo, __m256i b_hi, __m256i ka, __m256i kb )
+{
+	__m256i lo = _mm256_add_epi32( _mm256_madd_epi16( a_lo, ka ), _mm256_madd_epi16( b_lo, kb ) );
+	__m256i hi = _mm256_add_epi32( _mm256_madd_epi16( a_hi, ka ), _mm256_madd_epi16( b_hi, kb ) );
+	return _mm256_packs_epi32( _mm256_srai_epi32( lo, 10 ), _mm256_srai_epi32( hi, 10 ) );
+}
+
+/** Convert 16 pixels of yuv422 to 4 registers of 4 rgb24a pixels.
+*/
+
+static inline AVX2 void yuv422_to_rgb24a_avx2( const yuv_coefficients *c, const uint8_t *src, const uint8_t *alpha, __m128i out[4] )
+{
+	__m256i p = _mm256_loadu_si256( ( const __m256i* ) src );
+	__m256i zero = _mm256_setzero_si256();
+	__m256i y = _mm256_sub_epi16( _mm256_and_si256( p, _mm256_set1_epi16( 0xff ) ), _mm256_set1_epi16( c->y_offset ) );
+	__m256i uv = _mm256_srli_epi16( p, 8 );
+	__m256i u = _mm256_and_si256( uv, _mm256_set1_epi32( 0xffff ) );
+	__m256i v = _mm256_srli_epi32( uv, 16 );
+	u = _mm256_sub_epi16( _mm256_or_si256( u, _mm256_slli_epi32( u, 16 ) ), _mm256_set1_epi16( 128 ) );
+	v = _mm256_sub_epi16( _mm256_or_si256( v, _mm256_slli_epi32( v, 16 ) ), _mm256_set1_epi16( 128 ) );
+	__m256i yv_lo = _mm256_unpacklo_epi16( y, v );
+	__m256i yv_hi = _mm256_unpackhi_epi16( y, v );
+	__m256i yu_lo = _mm256_unpacklo_epi16( y, u );
+	__m256i yu_hi = _mm256_unpackhi_epi16( y, u );
+	__m256i r = madd_shift_avx2( yv_lo, yv_hi, yu_lo, yu_hi, _mm256_set1_epi32( PAIR( c->ry, c->rv ) ), zero );
+	__m256i g = madd_shift_avx2( yv_lo, yv_hi, yu_lo, yu_hi, _mm256_set1_epi32( PAIR( c->ry, c->gv ) ), _mm256_set1_epi32( PAIR( 0, c->gu ) ) );
+	__m256i b = madd_shift_avx2( yv_lo, yv_hi, yu_lo, yu_hi, zero, _mm256_set1_epi32( PAIR( c->ry, c->bu ) ) );
+	__m256i a = _mm256_set1_epi8( 0xff );
+	if ( alpha )
+	{
+		__m128i a128 = _mm_loadu_si128( ( const __m128i* ) alpha );
+		a = _mm256_inserti128_si256( _mm256_castsi128_si256( a128 ), _mm_srli_si128( a128, 8 ), 1 );
+	}
+	r = _mm256_packus_epi16( r, r );
+	g = _mm256_packus_epi16( g, g );
+	b = _mm256_packus_epi16( b, b );
+	__m256i rg = _mm256_unpacklo_epi8( r, g );
+	__m256i ba = _mm256_unpacklo_epi8( b, a );
+	__m256i lo = _mm256_unpacklo_epi16( rg, ba );
+	__m256i hi = _mm256_unpackhi_epi16( rg, ba );
+	out[0] = _mm256_castsi256_si128( lo );
+	out[1] = _mm256_castsi256_si128( hi );
+	out[2] = _mm256_extracti128_si256( lo, 1 );
+	out[3] = _mm256_extracti128_si256( hi, 1 );
+}
+
+/** Convert 16 pixels given as 2 registers of rgb24a, pixels 0-3 and 8-11 in
+ * x and 4-7 and 12-15 in y, to yuv422 and write their alpha.
+*/
+
+static inline AVX2 __m256i rgb24a_to_yuv422_avx2( const yuv_coefficients *c, __m256i x, __m256i y, uint8_t *alpha )
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i mask = _mm256_set1_epi32( 0xff );
+	__m256i r = _mm256_packs_epi32( _mm256_and_si256( x, mask ), _mm256_and_si256( y, mask ) );
+	__m256i g = _mm256_packs_epi32( _mm256_and_si256( _mm256_srli_epi32( x, 8 ), mask ), _mm256_and_si256( _mm256_srli_epi32( y, 8 ), mask ) );
+	__m256i b = _mm256_packs_epi32( _mm256_and_si256( _mm256_srli_epi32( x, 16 ), mask ), _mm256_and_si256( _mm256_srli_epi32( y, 16 ), mask ) );
+	if ( alpha )
+	{
+		__m256i a = _mm256_packs_epi32( _mm256_srli_epi32( x, 24 ), _mm256_srli_epi32( y, 24 ) );
+		a = _mm256_permute4x64_epi64( _mm256_packus_epi16( a, a ), 0x08 );
+		_mm_storeu_si128( ( __m128i* ) alpha, _mm256_castsi256_si128( a ) );
+	}
+	__m256i rg_lo = _mm256_unpacklo_epi16( r, g );
+	__m256i rg_hi = _mm256_unpackhi_epi16( r, g );
+	__m256i b_lo = _mm256_unpacklo_epi16( b, zero );
+	__m256i b_hi = _mm256_unpackhi_epi16( b, zero );
+	__m256i yy = madd_shift_avx2( rg_lo, rg_hi, b_lo, b_hi, _mm256_set1_epi32( PAIR( c->yr, c->yg ) ), _mm256_set1_epi32( PAIR( c->yb, 0 ) ) );
+	__m256i u = madd_shift_avx2( rg_lo, rg_hi, b_lo, b_hi, _mm256_set1_epi32( PAIR( c->ur, c->ug ) ), _mm256_set1_epi32( PAIR( c->ub, 0 ) ) );
+	__m256i v = madd_shift_avx2( rg_lo, rg_hi, b_lo, b_hi, _mm256_set1_epi32( PAIR( c->vr, c->vg ) ), _mm256_set1_epi32( PAIR( c->vb, 0 ) ) );
+	__m256i ones = _mm256_set1_epi16( 1 );
+	yy = _mm256_add_epi16( yy, _mm256_set1_epi16( c->y_offset ) );
+	u = _mm256_srli_epi32( _mm256_madd_epi16( _mm256_add_epi16( u, _mm256_set1_epi16( 128 ) ), ones ), 1 );
+	v = _mm256_srli_epi32( _mm256_madd_epi16( _mm256_add_epi16( v, _mm256_set1_epi16( 128 ) ), ones ), 1 );
+	u = _mm256_or_si256( u, _mm256_slli_epi32( v, 16 ) );
+	return _mm256_or_si256( yy, _mm256_slli_epi16( u, 8 ) );
+}
+
+AVX2 int convert_yuv422_to_rgb24a_avx2( const yuv_coefficients *c, const uint8_t *src, uint8_t *dst, uint8_t *alpha, int width )
+{
+	__m128i rgba[4];
+	int j;
+
+	for ( j = 0; j + 16 <= width; j += 16 )
+	{
+		yuv422_to_rgb24a_avx2( c, src + j * 2, alpha ? alpha + j : NULL, rgba );
+		_mm_storeu_si128( ( __m128i* )( dst + j * 4 ), rgba[0] );
+		_mm_storeu_si128( ( __m128i* )( dst + j * 4 + 16 ), rgba[1] );
+		_mm_storeu_si128( ( __m128i* )( dst + j * 4 + 32 ), rgba[2] );
+		_mm_storeu_si128( ( __m128i* )( dst + j * 4 + 48 ), rgba[3] );
+	}
+	return j;
+}
+
+AVX2 int convert_yuv422_to_rgb24_avx2( const yuv_coefficients *c, const uint8_t *src, uint8_t *dst, uint8_t *alpha, int width )
+{
+	__m128i shuffle = _mm_setr_epi8( 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1 );
+	__m128i rgba[4];
+	int j;
+
+	// Each store of 12 bytes writes 4 more, which the next store or the
+	// scalar converter overwrites, so 2 more pixels must follow.
+	for ( j = 0; j + 18 <= width; j += 16 )
+	{
+		yuv422_to_rgb24a_avx2( c, src + j * 2, NULL, rgba );
+		_mm_storeu_si128( ( __m128i* )( dst + j * 3 ), _mm_shuffle_epi8( rgba[0], shuffle ) );
+		_mm_storeu_si128( ( __m128i* )( dst + j * 3 + 12 ), _mm_shuffle_epi8( rgba[1], shuffle ) );
+		_mm_storeu_si128( ( __m128i* )( dst + j * 3 + 24 ), _mm_shuffle_epi8( rgba[2], shuffle ) );
+		_mm_storeu_si128( ( __m128i* )( dst + j * 3 + 36 ), _mm_shuffle_epi8( rgba[3], shuffle ) );
+	}
+	return j;
+}
+
+AVX2 int convert_rgb24a_to_yuv422_avx2( const yuv_coefficients *c, const uint8_t *src, uint8_t *dst, uint8_t *alpha, int width )
+{
+	int j;
+
+	for ( j = 0; j + 16 <= width; j += 16 )
+	{
+		__m256i p0 = _mm256_loadu_si256( ( const __m256i* )( src + j * 4 ) );
+		__m256i p1 = _mm256_loadu_si256( ( const __m256i* )( src + j * 4 + 32 ) );
+		__m256i x = _mm256_permute2x128_si256( p0, p1, 0x20 );
+		__m256i y = _mm256_permute2x128_si256( p0, p1, 0x31 );
+		__m256i yuv = rgb24a_to_yuv422_avx2( c, x, y, alpha ? alpha + j : NULL );
+		_mm256_storeu_si256( ( __m256i* )( dst + j * 2 ), yuv );
+	}
+	return j;
+}
+
+AVX2 int convert_rgb24_to_yuv422_avx2( const yuv_coefficients *c, const uint8_t *src, uint8_t *dst, uint8_t *alpha, int width )
+{
+	__m128i shuffle = _mm_setr_epi8( 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1 );
+	int j;
+
+	// Each load of 12 bytes reads 4 more, so 2 more pixels must follow.
+	for ( j = 0; j + 18 <= width; j += 16 )
+	{
+		const uint8_t *s = src + j * 3;
+		__m128i q0 = _mm_shuffle_epi8( _mm_loadu_si128( ( const __m128i* ) s ), shuffle );
+		__m128i q1 = _mm_shuffle_epi8( _mm_loadu_si128( ( const __m128i* )( s + 12 ) ), shuffle );
+		__m128i q2 = _mm_shuffle_epi8( _mm_loadu_si128( ( const __m128i* )( s + 24 ) ), shuffle );
+		__m128i q3 = _mm_shuffle_epi8( _mm_loadu_si128( ( const __m128i* )( s + 36 ) ), shuffle );
+		__m256i x = _mm256_inserti128_si256( _mm256_castsi128_si256( q0 ), q2, 1 );
+		__m256i y = _mm256_inserti128_si256( _mm256_castsi128_si256( q1 ), q3, 1 );
+		_mm256_storeu_si256( ( __m256i* )( dst + j * 2 ), rgb24a_to_yuv422_avx2( c, x, y, NULL ) );
+	}
+	return j;
+}
+
+#endif
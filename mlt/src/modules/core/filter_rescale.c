@@ -35,6 +35,9 @@
  * rgb24a -> rgb24a
  * rgb24 -> yuv422
  * rgb24a -> yuv422
+ *
+ * The image is packed unless the filter has the property "_strided", in which
+ * case the scaler gets the planes with mlt_frame_get_image_planes().
  */
 
 typedef int ( *image_scaler )( mlt_frame frame, uint8_t **image, mlt_image_format *format, int iwidth, int iheight, int owidth, int oheight );
@@ -113,7 +116,8 @@ static void scale_alpha( mlt_frame frame, int iwidth, int iheight, int owidth, i
 {
 	// Scale the alpha
 	uint8_t *output = NULL;
-	uint8_t *input = mlt_frame_get_alpha( frame );
+	// A constant alpha does not need to be scaled
+	uint8_t *input = mlt_frame_get_alpha_value( frame ) < 0 ? mlt_frame_get_alpha( frame ) : NULL;
 
 	if ( input != NULL )
 	{
@@ -217,8 +221,11 @@ static int filter_get_image( mlt_frame frame, uint8_t **image, mlt_image_format
 		if ( scaler_method == filter_scale )
 			*format = mlt_image_yuv422;
 
-		// Get the image as requested
-		mlt_frame_get_image( frame, image, format, &iwidth, &iheight, writable );
+		// Get the image as requested, packed only if the scaler needs it
+		uint8_t *planes[4];
+		int strides[4];
+		mlt_frame_get_image_strided( frame, planes, strides, format, &iwidth, &iheight, writable );
+		*image = planes[0];
 
 		// Get rescale interpretation again, in case the producer wishes to override scaling
 		interps = mlt_properties_get( properties, "rescale.interp" );
@@ -232,6 +239,9 @@ static int filter_get_image( mlt_frame frame, uint8_t **image, mlt_image_format
 			if ( *format == mlt_image_yuv422 || *format == mlt_image_rgb24 ||
 			     *format == mlt_image_rgb24a || *format == mlt_image_opengl )
 			{
+				if ( !mlt_properties_get_int( filter_properties, "_strided" ) )
+					mlt_frame_get_image( frame, image, format, &iwidth, &iheight, writable );
+
 				// Call the virtual function
 				scaler_method( frame, image, format, iwidth, iheight, owidth, oheight );
 				*width = owidth;
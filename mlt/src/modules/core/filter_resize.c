@@ -137,9 +137,6 @@ static uint8_t *frame_resize_image( mlt_frame frame, int owidth, int oheight, ml
 
 	// Get the input image, width and height
 	uint8_t *input = mlt_properties_get_data( properties, "image", NULL );
-	uint8_t *alpha = mlt_frame_get_alpha( frame );
-	int alpha_size = 0;
-	mlt_properties_get_data( properties, "alpha", &alpha_size );
 	int bpp = 0;
 	mlt_image_format_size( format, owidth, oheight, &bpp );
 
@@ -150,6 +147,10 @@ static uint8_t *frame_resize_image( mlt_frame frame, int owidth, int oheight, ml
 	if ( iwidth < owidth || iheight < oheight )
 	{
 		uint8_t alpha_value = mlt_properties_get_int( properties, "resize_alpha" );
+		uint8_t *alpha = mlt_frame_get_alpha( frame );
+		int alpha_size = 0;
+		mlt_properties_get_data( properties, "alpha", &alpha_size );
+
 		// Create the output image
 		uint8_t *output = mlt_pool_alloc( owidth * ( oheight + 1 ) * bpp );
 
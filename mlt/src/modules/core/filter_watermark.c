@@ -120,7 +120,7 @@ static int filter_get_image( mlt_frame frame, uint8_t **image, mlt_image_format
 
 	// Process all remaining filters first
 	*format = mlt_image_yuv422;
-	error = mlt_frame_get_image( frame, image, format, width, height, 0 );
+	error = mlt_frame_get_image( frame, image, format, width, height, 1 );
 
 	// Only continue if we have both producer and composite
 	if ( !error && composite != NULL && producer != NULL )
@@ -184,7 +184,7 @@ static int filter_get_image( mlt_frame frame, uint8_t **image, mlt_image_format
 			{
 				char temp[ 132 ];
 				int count = 0;
-				uint8_t *alpha = NULL;
+				int alpha_value;
 				const char *rescale = mlt_properties_get( a_props, "rescale.interp" );
 				if ( rescale == NULL || !strcmp( rescale, "none" ) )
 					rescale = "hyper";
@@ -195,9 +195,12 @@ static int filter_get_image( mlt_frame frame, uint8_t **image, mlt_image_format
 				mlt_properties_set( b_props, "rescale.interp", rescale );
 				mlt_service_apply_filters( MLT_FILTER_SERVICE( filter ), b_frame, 0 );
 				error = mlt_frame_get_image( b_frame, image, format, width, height, 1 );
-				alpha = mlt_frame_get_alpha_mask( b_frame );
+				alpha_value = mlt_frame_get_alpha_value( b_frame );
 				mlt_frame_set_image( frame, *image, *width * *height * 2, NULL );
-				mlt_frame_set_alpha( frame, alpha, *width * *height, NULL );
+				if ( alpha_value < 0 )
+					mlt_frame_set_alpha( frame, mlt_frame_get_alpha( b_frame ), *width * *height, NULL );
+				else
+					mlt_frame_set_alpha_value( frame, alpha_value );
 				mlt_properties_set_int( a_props, "width", *width );
 				mlt_properties_set_int( a_props, "height", *height );
 				mlt_properties_set_int( a_props, "progressive", 1 );
@@ -46,6 +46,9 @@ mlt_producer producer_colour_init( mlt_profile profile, mlt_service_type type, c
 		mlt_properties_set( properties, "resource", ( !colour || !strcmp( colour, "" ) ) ? "0x000000ff" : colour );
 		mlt_properties_set( properties, "_resource", "" );
 		mlt_properties_set_double( properties, "aspect_ratio", mlt_profile_sar( profile ) );
+
+		// A tractor may render the frames again on a copy
+		mlt_properties_set_int( properties, "_track_ahead_safe", 1 );
 		
 		return producer;
 	}
@@ -120,8 +123,6 @@ static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_form
 		mlt_properties_set_int( producer_props, "_format", *format );
 		mlt_properties_set( producer_props, "_resource", now );
 
-		mlt_service_unlock( MLT_PRODUCER_SERVICE( producer ) );
-
 		switch ( *format )
 		{
 		case mlt_image_yuv420p:
@@ -189,34 +190,20 @@ static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_form
 				"invalid image format %s\n", mlt_image_format_name( *format ) );
 		}
 	}
-	else
-	{
-		mlt_service_unlock( MLT_PRODUCER_SERVICE( producer ) );
-	}
 
-	// Create the alpha channel
-	int alpha_size = 0;
-	uint8_t *alpha = NULL;
-
-	// Initialise the alpha
-	if (color.a < 255 || *format == mlt_image_rgb24a) {
-		alpha_size = *width * *height;
-		alpha = mlt_pool_alloc( alpha_size );
-		if ( alpha )
-			memset( alpha, color.a, alpha_size );
-		else
-			alpha_size = 0;
-	}
-
-	// Clone our image
+	// Share our image while another frame cannot replace it, it is copied when written
 	if (buffer && image && size > 0) {
-		*buffer = mlt_pool_alloc( size );
-		memcpy( *buffer, image, size );
+		mlt_pool_inc_ref( image );
+		*buffer = image;
 	}
 
+	mlt_service_unlock( MLT_PRODUCER_SERVICE( producer ) );
+
 	// Now update properties so we free the copy after
 	mlt_frame_set_image( frame, *buffer, size, mlt_pool_release );
-	mlt_frame_set_alpha( frame, alpha, alpha_size, mlt_pool_release );
+
+	// The alpha channel is only created if something needs it
+	mlt_frame_set_alpha_value( frame, color.a );
 	mlt_properties_set_double( properties, "aspect_ratio", mlt_properties_get_double( producer_props, "aspect_ratio" ) );
 	mlt_properties_set_int( properties, "meta.media.width", *width );
 	mlt_properties_set_int( properties, "meta.media.height", *height );
@@ -113,9 +113,17 @@ static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_form
 	// Set the values obtained on the frame
 	if ( *buffer != NULL )
 	{
-		uint8_t *image = mlt_pool_alloc( size );
-		memcpy( image, *buffer, size );
-		*buffer = image;
+		// Share the held image when possible, it is copied when written
+		if ( mlt_properties_get_destructor( MLT_FRAME_PROPERTIES( real_frame ), "image" ) == mlt_pool_release )
+		{
+			mlt_pool_inc_ref( *buffer );
+		}
+		else
+		{
+			uint8_t *image = mlt_pool_alloc( size );
+			memcpy( image, *buffer, size );
+			*buffer = image;
+		}
 		mlt_frame_set_image( frame, *buffer, size, mlt_pool_release );
 	}
 	else
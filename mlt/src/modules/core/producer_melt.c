@@ -447,7 +447,8 @@ mlt_producer producer_melt_init( mlt_profile profile, mlt_service_type type, con
 			int backtrack = 0;
 			if ( !strcmp( argv[ i ], "-serialise" ) ||
 			     !strcmp( argv[ i ], "-consumer" ) ||
-			     !strcmp( argv[ i ], "-profile" ) )
+			     !strcmp( argv[ i ], "-profile" ) ||
+			     !strcmp( argv[ i ], "-trace" ) )
 			{
 				i += 2;
 				backtrack = 1;
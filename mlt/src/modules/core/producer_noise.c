@@ -68,6 +68,9 @@ mlt_producer producer_noise_init( mlt_profile profile, mlt_service_type type, co
 		// Callback registration
 		producer->get_frame = producer_get_frame;
 		producer->close = ( mlt_destructor )producer_close;
+
+		// A tractor may render the frames again on a copy
+		mlt_properties_set_int( MLT_PRODUCER_PROPERTIES( producer ), "_track_ahead_safe", 1 );
 	}
 
 	return producer;
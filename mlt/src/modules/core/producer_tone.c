@@ -115,6 +115,9 @@ mlt_producer producer_tone_init( mlt_profile profile, mlt_service_type type, con
 		// Callback registration
 		producer->get_frame = producer_get_frame;
 		producer->close = ( mlt_destructor )producer_close;
+
+		// A tractor may render the frames again on a copy
+		mlt_properties_set_int( producer_properties, "_track_ahead_safe", 1 );
 	}
 
 	return producer;
@@ -26,6 +26,7 @@
 #include <ctype.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
 
 typedef void ( *composite_line_fn )( uint8_t *dest, uint8_t *src, int width_src, uint8_t *alpha_b, uint8_t *alpha_a, int weight, uint16_t *luma, int softness, uint32_t step );
 
@@ -39,6 +40,8 @@ struct geometry_s
 	int nh; // normalised height
 	int sw; // scaled width, not including consumer scale based upon w/nw
 	int sh; // scaled height, not including consumer scale based upon h/nh
+	int ss; // source stride in bytes, if the lines of the b image are padded
+	int alpha; // alpha of every pixel of the b image, if it has no alpha channel
 	int halign; // horizontal alignment: 0=left, 1=center, 2=right
 	int valign; // vertical alignment: 0=top, 1=middle, 2=bottom
 	int x_src;
@@ -226,15 +229,34 @@ static inline uint8_t sample_mix( uint8_t dest, uint8_t src, int mix )
 void composite_line_yuv_sse2_simple(uint8_t *dest, uint8_t *src, int width, uint8_t *alpha_b, uint8_t *alpha_a, int weight);
 #endif
 
+typedef void ( *composite_line_simple_fn )( uint8_t *dest, uint8_t *src, int width, uint8_t *alpha_b, uint8_t *alpha_a, int weight );
+static composite_line_simple_fn line_simple = NULL;
+static pthread_once_t line_simple_once = PTHREAD_ONCE_INIT;
+
+static void init_line_simple( )
+{
+#if defined(USE_SSE) && defined(ARCH_X86_64)
+	mlt_cpu_register( "composite.line_yuv", mlt_cpu_sse2, composite_line_yuv_sse2_simple );
+#endif
+	line_simple = mlt_cpu_select( "composite.line_yuv" );
+}
+
+/** Select the line function for this CPU before composite_line_yuv() is used.
+*/
+
+void composite_line_init( )
+{
+	pthread_once( &line_simple_once, init_line_simple );
+}
+
 void composite_line_yuv( uint8_t *dest, uint8_t *src, int width, uint8_t *alpha_b, uint8_t *alpha_a, int weight, uint16_t *luma, int soft, uint32_t step )
 {
 	register int j = 0;
 	register int mix;
 
-#if defined(USE_SSE) && defined(ARCH_X86_64)
-	if ( !luma && width > 7 )
+	if ( line_simple && !luma && width > 7 )
 	{
-		composite_line_yuv_sse2_simple(dest, src, width, alpha_b, alpha_a, weight);
+		line_simple( dest, src, width, alpha_b, alpha_a, weight );
 		j = width - width % 8;
 		dest += j * 2;
 		src += j * 2;
@@ -243,7 +265,6 @@ void composite_line_yuv( uint8_t *dest, uint8_t *src, int width, uint8_t *alpha_
 		if ( alpha_b )
 			alpha_b += j;
 	}
-#endif
 
 	for ( ; j < width; j ++ )
 	{
@@ -368,10 +389,19 @@ static int composite_yuv( uint8_t *p_dest, int width_dest, int height_dest, uint
 	int uneven_x_src = ( x_src % 2 );
 	int step = ( field > -1 ) ? 2 : 1;
 	int bpp = 2;
-	int stride_src = geometry.sw * bpp;
+	int stride_src = geometry.ss ? geometry.ss : geometry.sw * bpp;
 	int stride_dest = width_dest * bpp;
+	int stride_alpha_src = geometry.sw;
 	int i_softness = ( 1 << 16 ) * softness;
 	int weight = ( ( 1 << 16 ) * geometry.item.mix + 50 ) / 100;
+	// Folding a constant alpha into the weight gives the same mix as
+	// calculate_mix() does per pixel, since ( weight * 256 ) >> 8 == weight.
+	// The caller only does it without a luma or an operator, for which the
+	// mix would not be proportional to the alpha. The SIMD line works with
+	// 8 bit weights, so there the result may differ by up to two levels from
+	// filling in an alpha channel, which is within its usual rounding.
+	if ( !alpha_b && geometry.alpha < 255 )
+		weight = weight * ( geometry.alpha + 1 ) >> 8;
 	uint32_t luma_step = ( ( ( 1 << 16 ) - 1 ) * geometry.item.mix + 50 ) / 100 * ( 1.0 + softness );
 
 	// Adjust to consumer scale
@@ -436,13 +466,13 @@ static int composite_yuv( uint8_t *p_dest, int width_dest, int height_dest, uint
 
 	// offset pointer into alpha channel based upon cropping
 	if ( alpha_b )
-		alpha_b += x_src + y_src * stride_src / bpp;
+		alpha_b += x_src + y_src * stride_alpha_src;
 	if ( alpha_a )
 		alpha_a += x + y * stride_dest / bpp;
 
 	// offset pointer into luma channel based upon cropping
 	if ( p_luma )
-		p_luma += x_src + y_src * stride_src / bpp;
+		p_luma += x_src + y_src * stride_alpha_src;
 	
 	// Assuming lower field first
 	// Special care is taken to make sure the b_frame is aligned to the correct field.
@@ -461,7 +491,7 @@ static int composite_yuv( uint8_t *p_dest, int width_dest, int height_dest, uint
 	{
 		p_src += stride_src;
 		if ( alpha_b )
-			alpha_b += stride_src / bpp;
+			alpha_b += stride_alpha_src;
 		if ( alpha_a )
 			alpha_a += stride_dest / bpp;
 		height_src--;
@@ -469,7 +499,7 @@ static int composite_yuv( uint8_t *p_dest, int width_dest, int height_dest, uint
 
 	stride_src *= step;
 	stride_dest *= step;
-	int alpha_b_stride = stride_src / bpp;
+	int alpha_b_stride = stride_alpha_src * step;
 	int alpha_a_stride = stride_dest / bpp;
 
 	// Align chroma of source and destination
@@ -843,12 +873,17 @@ static int get_b_frame_image( mlt_transition self, mlt_frame b_frame, uint8_t **
 // fprintf(stderr, "%s: scaled %dx%d norm %dx%d resize %dx%d\n", __FILE__,
 // geometry->sw, geometry->sh, geometry->nw, geometry->nh, *width, *height);
 
-	error = mlt_frame_get_image( b_frame, image, &format, width, height, 1 );
+	// Get the image without packing it, composite_yuv honors the stride
+	uint8_t *planes[4];
+	int strides[4];
+	error = mlt_frame_get_image_strided( b_frame, planes, strides, &format, width, height, 1 );
+	*image = planes[0];
 
 	// composite_yuv uses geometry->sw to determine source stride, which
 	// should equal the image width if not using crop property.
 	if ( !mlt_properties_get( properties, "crop" ) )
 		geometry->sw = *width;
+	geometry->ss = strides[0] != *width * 2 ? strides[0] : 0;
 
 	// Set the frame back
 	mlt_properties_set_int( b_props, "resize_alpha", resize_alpha );
@@ -856,6 +891,37 @@ static int get_b_frame_image( mlt_transition self, mlt_frame b_frame, uint8_t **
 	return !error && image;
 }
 
+/** Pack the b frame image for code that does not honor its stride.
+*/
+
+static int pack_b_frame_image( mlt_frame b_frame, uint8_t **image, int *width, int *height, struct geometry_s *geometry )
+{
+	int error = 0;
+	if ( geometry->ss )
+	{
+		mlt_image_format format = mlt_image_yuv422;
+		error = mlt_frame_get_image( b_frame, image, &format, width, height, 1 );
+		geometry->ss = 0;
+	}
+	return error;
+}
+
+/** Determine whether the b frame image hides everything below it.
+ *
+ * The answer is kept on the b frame, which another composite may ask about.
+*/
+
+static int b_frame_is_opaque( mlt_frame b_frame, uint8_t *image, int width, int height )
+{
+	mlt_properties b_props = MLT_FRAME_PROPERTIES( b_frame );
+	if ( mlt_properties_get_data( b_props, "_composite.opaque_image", NULL ) != image )
+	{
+		mlt_properties_set_data( b_props, "_composite.opaque_image", image, 0, NULL, NULL );
+		mlt_properties_set_int( b_props, "_composite.opaque", mlt_frame_is_opaque( b_frame, image, mlt_image_yuv422, width, height ) );
+	}
+	return mlt_properties_get_int( b_props, "_composite.opaque" );
+}
+
 static void crop_calculate( mlt_transition self, mlt_properties properties, struct geometry_s *result, double position )
 {
 	// Initialize panning info
@@ -1080,6 +1146,62 @@ mlt_frame composite_copy_region( mlt_transition self, mlt_frame a_frame, mlt_pos
 	return b_frame;
 }
 
+/** Set the size of the frame being composited onto, which titles are made for.
+ *
+ * This is called after the a frame was rendered, which may set it first.
+*/
+
+static void set_dest_size( mlt_properties a_props, mlt_properties b_props, int width, int height )
+{
+	if ( mlt_properties_get( a_props, "dest_width" ) == NULL )
+	{
+		mlt_properties_set_int( a_props, "dest_width", width );
+		mlt_properties_set_int( a_props, "dest_height", height );
+		mlt_properties_set_int( b_props, "dest_width", width );
+		mlt_properties_set_int( b_props, "dest_height", height );
+	}
+	else
+	{
+		mlt_properties_set_int( b_props, "dest_width", mlt_properties_get_int( a_props, "dest_width" ) );
+		mlt_properties_set_int( b_props, "dest_height", mlt_properties_get_int( a_props, "dest_height" ) );
+	}
+}
+
+/** Determine whether the b frame is placed over all of the a frame and fully mixed.
+ *
+ * Then nothing of the a frame shows unless the b frame is transparent.
+ * The geometry is checked for the second field too, and for options that
+ * leave some of the a frame or change how it is mixed.
+*/
+
+static int composite_covers( mlt_transition self, mlt_frame a_frame, struct geometry_s *result, double field_position, int width, int height )
+{
+	mlt_properties properties = MLT_TRANSITION_PROPERTIES( self );
+	mlt_properties a_props = MLT_FRAME_PROPERTIES( a_frame );
+	struct geometry_s second;
+	int progressive = mlt_properties_get_int( a_props, "consumer_deinterlace" ) ||
+		mlt_properties_get_int( properties, "progressive" );
+
+	if ( width <= 0 || height <= 0 ||
+		 mlt_properties_get( properties, "luma" ) || mlt_properties_get( properties, "operator" ) ||
+		 mlt_properties_get( properties, "crop" ) || mlt_properties_get_int( properties, "crop_to_fill" ) ||
+		 mlt_properties_get( properties, "alpha_b" ) || mlt_properties_get_int( properties, "titles" ) )
+		return 0;
+	if ( result->item.mix != 100 || result->item.x != 0 || result->item.y != 0 ||
+		 result->item.w != result->nw || result->item.h != result->nh || result->x_src || result->y_src )
+		return 0;
+	if ( !progressive )
+	{
+		mlt_service_lock( MLT_TRANSITION_SERVICE( self ) );
+		composite_calculate( self, &second, a_frame, field_position );
+		mlt_service_unlock( MLT_TRANSITION_SERVICE( self ) );
+		if ( second.item.mix != 100 || second.item.x != 0 || second.item.y != 0 ||
+			 second.item.w != second.nw || second.item.h != second.nh )
+			return 0;
+	}
+	return 1;
+}
+
 /** Get the image.
 */
 
@@ -1165,10 +1287,33 @@ static int transition_get_image( mlt_frame a_frame, uint8_t **image, mlt_image_f
 			return 0;
 		}
 
+		// Optimisation - the a frame is not needed if the b frame hides all of it
+		if ( a_frame != b_frame && composite_covers( self, a_frame, &result, position + delta * length, *width, *height ) )
+		{
+			// The a frame is not rendered yet, so leave its properties alone
+			// and give the b frame the size that the a frame is asked for.
+			int dest_width = mlt_properties_get( a_props, "dest_width" ) ? mlt_properties_get_int( a_props, "dest_width" ) : *width;
+			int dest_height = mlt_properties_get( a_props, "dest_width" ) ? mlt_properties_get_int( a_props, "dest_height" ) : *height;
+			mlt_properties_set_int( b_props, "dest_width", dest_width );
+			mlt_properties_set_int( b_props, "dest_height", dest_height );
+			if ( get_b_frame_image( self, b_frame, &image_b, &width_b, &height_b, &result ) &&
+				 !pack_b_frame_image( b_frame, &image_b, &width_b, &height_b, &result ) &&
+				 width_b == *width && height_b == *height &&
+				 b_frame_is_opaque( b_frame, image_b, width_b, height_b ) )
+			{
+				set_dest_size( a_props, b_props, *width, *height );
+				*image = image_b;
+				mlt_frame_replace_image( a_frame, image_b, *format, *width, *height );
+				mlt_properties_pass_list( a_props, b_props, "progressive, top_field_first, colorspace, force_full_luma" );
+				return 0;
+			}
+		}
+
 		if ( a_frame == b_frame )
 		{
 			double aspect_ratio = mlt_frame_get_aspect_ratio( b_frame );
 			get_b_frame_image( self, b_frame, &image_b, &width_b, &height_b, &result );
+			pack_b_frame_image( b_frame, &image_b, &width_b, &height_b, &result );
 			alpha_b = mlt_frame_get_alpha( b_frame );
 			mlt_properties_set_double( a_props, "aspect_ratio", aspect_ratio );
 		}
@@ -1182,18 +1327,7 @@ static int transition_get_image( mlt_frame a_frame, uint8_t **image, mlt_image_f
 			return 0;
 
 		// Need to keep the width/height of the a_frame on the b_frame for titling
-		if ( mlt_properties_get( a_props, "dest_width" ) == NULL )
-		{
-			mlt_properties_set_int( a_props, "dest_width", *width );
-			mlt_properties_set_int( a_props, "dest_height", *height );
-			mlt_properties_set_int( b_props, "dest_width", *width );
-			mlt_properties_set_int( b_props, "dest_height", *height );
-		}
-		else
-		{
-			mlt_properties_set_int( b_props, "dest_width", mlt_properties_get_int( a_props, "dest_width" ) );
-			mlt_properties_set_int( b_props, "dest_height", mlt_properties_get_int( a_props, "dest_height" ) );
-		}
+		set_dest_size( a_props, b_props, *width, *height );
 
 		// Special case for titling...
 		if ( mlt_properties_get_int( properties, "titles" ) )
@@ -1220,8 +1354,6 @@ static int transition_get_image( mlt_frame a_frame, uint8_t **image, mlt_image_f
 			mlt_service_unlock( MLT_TRANSITION_SERVICE( self ) );
 			char *operator = mlt_properties_get( properties, "operator" );
 
-			alpha_b = alpha_b == NULL ? mlt_frame_get_alpha( b_frame ) : alpha_b;
-
 			composite_line_fn line_fn = composite_line_yuv;
 
 			// Replacement and override
@@ -1235,6 +1367,16 @@ static int transition_get_image( mlt_frame a_frame, uint8_t **image, mlt_image_f
 					line_fn = composite_line_yuv_xor;
 			}
 
+			// A constant alpha of the b frame only scales the mix, which
+			// composite_yuv() does exactly for the plain operator without luma
+			result.alpha = alpha_b ? 255 : mlt_frame_get_alpha_value( b_frame );
+			if ( result.alpha < 0 || ( result.alpha < 255 && ( luma_bitmap || line_fn != composite_line_yuv
+				 || mlt_properties_get( properties, "alpha_b" ) ) ) )
+			{
+				alpha_b = alpha_b == NULL ? mlt_frame_get_alpha( b_frame ) : alpha_b;
+				result.alpha = 255;
+			}
+
 			// Allow the user to completely obliterate the alpha channels from both frames
 			if ( mlt_properties_get( properties, "alpha_a" ) && alpha_a )
 				memset( alpha_a, mlt_properties_get_int( properties, "alpha_a" ), *width * *height );
@@ -1357,6 +1499,8 @@ mlt_transition transition_composite_init( mlt_profile profile, mlt_service_type
 		
 		// Inform apps and framework that this is a video only transition
 		mlt_properties_set_int( properties, "_transition_type", 1 );
+
+		composite_line_init( );
 	}
 	return self;
 }
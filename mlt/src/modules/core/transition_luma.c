@@ -38,6 +38,14 @@ static inline int is_opaque( uint8_t *alpha_channel, int width, int height )
 	return 1;
 }
 
+/** Get the alpha channel of a frame unless it is known to be opaque.
+*/
+
+static uint8_t *get_alpha( mlt_frame frame )
+{
+	return mlt_frame_get_alpha_value( frame ) == 255 ? NULL : mlt_frame_get_alpha_mask( frame );
+}
+
 static inline float calculate_mix( float weight, float alpha )
 {
 	return weight * alpha / 255.f;
@@ -118,12 +126,19 @@ static inline int dissolve_yuv( mlt_frame frame, mlt_frame that, float weight, i
 	if ( mlt_properties_get( &frame->parent, "distort" ) )
 		mlt_properties_set( &that->parent, "distort", mlt_properties_get( &frame->parent, "distort" ) );
 	mlt_frame_get_image( frame, &p_dest, &format, &width, &height, 1 );
-	alpha_dst = mlt_frame_get_alpha_mask( frame );
+	alpha_dst = get_alpha( frame );
 	mlt_frame_get_image( that, &p_src, &format, &width_src, &height_src, 0 );
-	alpha_src = mlt_frame_get_alpha_mask( that );
+	alpha_src = get_alpha( that );
 	int is_translucent = ( alpha_dst && !is_opaque(alpha_dst, width, height) )
 	                  || ( alpha_src && !is_opaque(alpha_src, width_src, height_src) );
 
+	// The alpha channels are blended too when either is translucent
+	if ( is_translucent && alpha_over )
+	{
+		alpha_dst = mlt_frame_get_alpha_mask( frame );
+		alpha_src = mlt_frame_get_alpha_mask( that );
+	}
+
 	// Pick the lesser of two evils ;-)
 	width_src = width_src > width ? width : width_src;
 	height_src = height_src > height ? height : height_src;
@@ -148,8 +163,10 @@ static inline int dissolve_yuv( mlt_frame frame, mlt_frame that, float weight, i
 			composite_line_yuv( p_dest, p_src, width_src, alpha_src, alpha_dst, mix, NULL, 0, 0 );
 			p_src += width_src << 1;
 			p_dest += width << 1;
-			alpha_src += width_src;
-			alpha_dst += width;
+			if ( alpha_src )
+				alpha_src += width_src;
+			if ( alpha_dst )
+				alpha_dst += width;
 		}
 	}
 
@@ -205,9 +222,9 @@ static void luma_composite( mlt_frame a_frame, mlt_frame b_frame, int luma_width
 	if ( mlt_properties_get( &a_frame->parent, "distort" ) )
 		mlt_properties_set( &b_frame->parent, "distort", mlt_properties_get( &a_frame->parent, "distort" ) );
 	mlt_frame_get_image( a_frame, &p_dest, &format_dest, &width_dest, &height_dest, 1 );
-	alpha_dest = mlt_frame_get_alpha_mask( a_frame );
+	alpha_dest = get_alpha( a_frame );
 	mlt_frame_get_image( b_frame, &p_src, &format_src, &width_src, &height_src, 0 );
-	alpha_src = mlt_frame_get_alpha_mask( b_frame );
+	alpha_src = get_alpha( b_frame );
 
 	if ( *width == 0 || *height == 0 )
 		return;
@@ -215,6 +232,13 @@ static void luma_composite( mlt_frame a_frame, mlt_frame b_frame, int luma_width
 	int is_translucent = ( alpha_dest && !is_opaque(alpha_dest, width_dest, height_dest) )
 	                  || ( alpha_src  && !is_opaque(alpha_src,  width_src,  height_src ) );
 
+	// The alpha channels are blended too when either is translucent
+	if ( is_translucent )
+	{
+		alpha_dest = mlt_frame_get_alpha_mask( a_frame );
+		alpha_src = mlt_frame_get_alpha_mask( b_frame );
+	}
+
 	// Pick the lesser of two evils ;-)
 	width_src = width_src > width_dest ? width_dest : width_src;
 	height_src = height_src > height_dest ? height_dest : height_src;
@@ -592,6 +616,7 @@ mlt_transition transition_luma_init( mlt_profile profile, mlt_service_type type,
 		// Inform apps and framework that this is a video only transition
 		mlt_properties_set_int( MLT_TRANSITION_PROPERTIES( transition ), "_transition_type", 1 );
 
+		composite_line_init( );
 		return transition;
 	}
 	return NULL;
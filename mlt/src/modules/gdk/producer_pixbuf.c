@@ -711,29 +711,21 @@ static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_form
 	*height = self->height;
 	*format = self->format;
 
-	// NB: Cloning is necessary with this producer (due to processing of images ahead of use)
-	// The fault is not in the design of mlt, but in the implementation of the pixbuf producer...
+	// The cached image is shared with the frame and copied when a filter writes to it
 	if ( self->image )
 	{
-		// Clone the image
+		// Share the image
 		int image_size = mlt_image_format_size( self->format, self->width, self->height, NULL );
-		uint8_t *image_copy = mlt_pool_alloc( image_size );
-		// We use height-1 because mlt_image_format_size() uses height + 1.
-		// XXX Remove -1 when mlt_image_format_size() is changed.
-		memcpy( image_copy, self->image,
-			mlt_image_format_size( self->format, self->width, self->height - 1, NULL ) );
-		// Now update properties so we free the copy after
-		mlt_frame_set_image( frame, image_copy, image_size, mlt_pool_release );
-		// We're going to pass the copy on
-		*buffer = image_copy;
+		mlt_pool_inc_ref( self->image );
+		mlt_frame_set_image( frame, self->image, image_size, mlt_pool_release );
+		*buffer = self->image;
 		mlt_log_debug( MLT_PRODUCER_SERVICE( &self->parent ), "%dx%d (%s)\n",
 			self->width, self->height, mlt_image_format_name( *format ) );
-		// Clone the alpha channel
+		// Share the alpha channel
 		if ( self->alpha )
 		{
-			image_copy = mlt_pool_alloc( self->width * self->height );
-			memcpy( image_copy, self->alpha, self->width * self->height );
-			mlt_frame_set_alpha( frame, image_copy, self->width * self->height, mlt_pool_release );
+			mlt_pool_inc_ref( self->alpha );
+			mlt_frame_set_alpha( frame, self->alpha, self->width * self->height, mlt_pool_release );
 		}
 	}
 	else
@@ -111,7 +111,11 @@ static int filter_get_image( mlt_frame frame, uint8_t **image, mlt_image_format
 		mlt_frame_get_image( a_frame, image, format, width, height, writable );
 		mlt_properties_set_data( frame_properties, "affine_frame", a_frame, 0, (mlt_destructor)mlt_frame_close, NULL );
 		mlt_frame_set_image( frame, *image, *width * *height * 4, NULL );
-		mlt_frame_set_alpha( frame, mlt_frame_get_alpha_mask( a_frame ), *width * *height, NULL );
+		int alpha_value = mlt_frame_get_alpha_value( a_frame );
+		if ( alpha_value < 0 )
+			mlt_frame_set_alpha( frame, mlt_frame_get_alpha( a_frame ), *width * *height, NULL );
+		else
+			mlt_frame_set_alpha_value( frame, alpha_value );
 		mlt_service_unlock( MLT_FILTER_SERVICE( filter ) );
 	}
 	else
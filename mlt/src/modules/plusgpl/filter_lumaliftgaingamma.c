@@ -110,7 +110,7 @@ static int filter_get_image( mlt_frame frame, uint8_t **image, mlt_image_format
 	mlt_position length = mlt_filter_get_length2( filter, frame );
 
 	*format = mlt_image_rgb24;
-	int error = mlt_frame_get_image( frame, image, format, width, height, 0 );
+	int error = mlt_frame_get_image( frame, image, format, width, height, 1 );
 
 	// Only process if we have no error and a valid colour space
 	if ( error == 0 )
@@ -95,24 +95,16 @@ static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_form
 
 	if ( self->current_image )
 	{
-		// Clone the image and the alpha
+		// Share the image and the alpha, they are copied when written
 		int image_size = mlt_image_format_size( self->format, self->current_width, self->current_height, NULL );
-		uint8_t *image_copy = mlt_pool_alloc( image_size );
-		// We use height-1 because mlt_image_format_size() uses height + 1.
-		// XXX Remove -1 when mlt_image_format_size() is changed.
-		memcpy( image_copy, self->current_image,
-			mlt_image_format_size( self->format, self->current_width, self->current_height - 1, NULL ) );
-		// Now update properties so we free the copy after
-		mlt_frame_set_image( frame, image_copy, image_size, mlt_pool_release );
-		// We're going to pass the copy on
-		*buffer = image_copy;
-
-		// Clone the alpha channel
+		mlt_pool_inc_ref( self->current_image );
+		mlt_frame_set_image( frame, self->current_image, image_size, mlt_pool_release );
+		*buffer = self->current_image;
+
 		if ( self->current_alpha )
 		{
-			image_copy = mlt_pool_alloc( self->current_width * self->current_height );
-			memcpy( image_copy, self->current_alpha, self->current_width * self->current_height );
-			mlt_frame_set_alpha( frame, image_copy, self->current_width * self->current_height, mlt_pool_release );
+			mlt_pool_inc_ref( self->current_alpha );
+			mlt_frame_set_alpha( frame, self->current_alpha, self->current_width * self->current_height, mlt_pool_release );
 		}
 	}
 	else
@@ -255,30 +255,24 @@ static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_form
 	*height = mlt_properties_get_int( properties, "height" );
 	*format = self->format;
 
-	// NB: Cloning is necessary with this producer (due to processing of images ahead of use)
-	// The fault is not in the design of mlt, but in the implementation of the qimage producer...
+	// The cached image is shared with the frame and copied when a filter writes to it
 	if ( self->current_image )
 	{
 		int image_size = mlt_image_format_size( self->format, self->current_width, self->current_height, NULL );
 		if ( enable_caching )
 		{
-			// Clone the image and the alpha
-			uint8_t *image_copy = mlt_pool_alloc( image_size );
-			memcpy( image_copy, self->current_image, image_size );
-			// Now update properties so we free the copy after
-			mlt_frame_set_image( frame, image_copy, image_size, mlt_pool_release );
-			// We're going to pass the copy on
-			*buffer = image_copy;
+			// Share the image and the alpha
+			mlt_pool_inc_ref( self->current_image );
+			mlt_frame_set_image( frame, self->current_image, image_size, mlt_pool_release );
+			*buffer = self->current_image;
 			mlt_log_debug( MLT_PRODUCER_SERVICE( &self->parent ), "%dx%d (%s)\n",
 				self->current_width, self->current_height, mlt_image_format_name( *format ) );
-			// Clone the alpha channel
 			if ( self->current_alpha )
 			{
 				if ( !self->alpha_size )
 					self->alpha_size = self->current_width * self->current_height;
-				uint8_t * alpha_copy = mlt_pool_alloc( self->alpha_size );
-				memcpy( alpha_copy, self->current_alpha, self->alpha_size );
-				mlt_frame_set_alpha( frame, alpha_copy, self->alpha_size, mlt_pool_release );
+				mlt_pool_inc_ref( self->current_alpha );
+				mlt_frame_set_alpha( frame, self->current_alpha, self->alpha_size, mlt_pool_release );
 			}
 		}
 		else
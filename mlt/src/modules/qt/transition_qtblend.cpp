@@ -187,7 +187,7 @@ static int get_image( mlt_frame a_frame, uint8_t **image, mlt_image_format *form
 	{
 		// fetch image
 		error = mlt_frame_get_image( b_frame, &b_image, format, width, height, 1 );
-		if ( *format == mlt_image_rgb24a || mlt_frame_get_alpha( b_frame ) )
+		if ( *format == mlt_image_rgb24a || mlt_frame_get_alpha_value( b_frame ) != 255 )
 		{
 			hasAlpha = true;
 		}
@@ -88,6 +88,17 @@ struct deserialise_context_s
 	int consumer_count;
 	int seekable;
 	mlt_consumer qglsl;
+	int lazy;
+	int producer_count;
+	mlt_deque probe_stack;
+	char *probe_property;
+	int probe_depth;
+	int probe_count;
+	int *probe_ordinals;
+	char **probe_arguments;
+	mlt_producer *probe_producers;
+	mlt_producer probe_offer;
+	const char *probe_offer_argument;
 };
 typedef struct deserialise_context_s *deserialise_context;
 
@@ -570,6 +581,349 @@ static void on_end_playlist( deserialise_context context, const xmlChar *name )
 	}
 }
 
+/** Get the argument with which to create the producer of a producer element.
+ *
+ * This is "service:resource", or the service alone without a resource. It
+ * returns NULL if there is no service or a document saved an invalid
+ * producer (see on_end_producer) and the caller must free it otherwise.
+*/
+
+static char *producer_argument( mlt_properties properties, const char *resource )
+{
+	char *service_name = trim( mlt_properties_get( properties, "mlt_service" ) );
+	char *argument = NULL;
+
+	if ( service_name && resource )
+	{
+		// If a document was saved as +INVALID.txt (see below), then ignore the mlt_service and
+		// try to load it just from the resource. This is an attempt to recover the failed
+		// producer in case, for example, a file returns.
+		if (!strcmp("qtext", service_name)) {
+			const char *text = mlt_properties_get( properties, "text" );
+			if (text && !strcmp("INVALID", text)) {
+				service_name = NULL;
+			}
+		} else if (!strcmp("pango", service_name)) {
+			const char *markup = mlt_properties_get( properties, "markup" );
+			if (markup && !strcmp("INVALID", markup)) {
+				service_name = NULL;
+			}
+		}
+		if (service_name) {
+			argument = calloc( 1, strlen( service_name ) + strlen( resource ) + 2 );
+			strcat( argument, service_name );
+			strcat( argument, ":" );
+			strcat( argument, resource );
+		}
+	}
+	else if ( service_name )
+	{
+		argument = strdup( service_name );
+	}
+	return argument;
+}
+
+/** Check whether a producer element is for media that may be opened lazily or probed in parallel.
+*/
+
+static int is_media_producer( mlt_properties properties, const char *resource )
+{
+	const char *service_name = mlt_properties_get( properties, "mlt_service" );
+	return resource && service_name && !strncmp( service_name, "avformat", 8 );
+}
+
+/** Check whether a property of a lazy producer belongs to the producer that it opens.
+*/
+
+static int lazy_passes( const char *name )
+{
+	return name && name[0] != '_' && strcmp( name, "in" ) && strcmp( name, "out" ) &&
+		strcmp( name, "eof" ) && strcmp( name, "resource" ) &&
+		strcmp( name, "mlt_type" ) && strcmp( name, "mlt_service" );
+}
+
+/** Open the media of a lazy producer.
+ *
+ * This holds the service lock so that only one thread opens it.
+*/
+
+static mlt_producer lazy_open( mlt_producer producer )
+{
+	mlt_properties properties = MLT_PRODUCER_PROPERTIES( producer );
+	mlt_producer real;
+
+	mlt_service_lock( MLT_PRODUCER_SERVICE( producer ) );
+	real = mlt_properties_get_data( properties, "_lazy_producer", NULL );
+	if ( !real && !mlt_properties_get_int( properties, "_lazy_failed" ) )
+	{
+		mlt_profile profile = mlt_service_profile( MLT_PRODUCER_SERVICE( producer ) );
+		const char *argument = mlt_properties_get( properties, "_lazy_argument" );
+
+		real = mlt_factory_producer( profile, NULL, argument );
+		if ( real )
+		{
+			mlt_properties real_properties = MLT_PRODUCER_PROPERTIES( real );
+			int i;
+
+			// Pass the properties loaded from XML and set since then
+			mlt_properties_lock( properties );
+			for ( i = 0; i < mlt_properties_count( properties ); i++ )
+			{
+				const char *name = mlt_properties_get_name( properties, i );
+				const char *value = mlt_properties_get_value( properties, i );
+				if ( value && lazy_passes( name ) )
+					mlt_properties_set_string( real_properties, name, value );
+			}
+			mlt_properties_unlock( properties );
+			mlt_properties_set_data( properties, "_lazy_producer", real, 0, ( mlt_destructor )mlt_producer_close, NULL );
+		}
+		else
+		{
+			mlt_log_error( MLT_PRODUCER_SERVICE( producer ), "failed to open \"%s\"\n", argument );
+			mlt_properties_set_int( properties, "_lazy_failed", 1 );
+		}
+	}
+	mlt_service_unlock( MLT_PRODUCER_SERVICE( producer ) );
+
+	return real;
+}
+
+static void lazy_property_changed( mlt_service owner, mlt_producer producer, char *name )
+{
+	mlt_properties properties = MLT_PRODUCER_PROPERTIES( producer );
+	mlt_producer real = mlt_properties_get_data( properties, "_lazy_producer", NULL );
+
+	if ( real && lazy_passes( name ) )
+		mlt_properties_set_string( MLT_PRODUCER_PROPERTIES( real ), name, mlt_properties_get( properties, name ) );
+}
+
+static int lazy_get_frame( mlt_producer producer, mlt_frame_ptr frame, int index )
+{
+	mlt_producer real = lazy_open( producer );
+	int error = 0;
+
+	if ( real )
+	{
+		mlt_producer_seek( real, mlt_producer_frame( producer ) );
+		mlt_producer_set_speed( real, mlt_producer_get_speed( producer ) );
+		error = mlt_service_get_frame( MLT_PRODUCER_SERVICE( real ), frame, index );
+		if ( *frame )
+			mlt_properties_set_data( MLT_FRAME_PROPERTIES( *frame ), "_producer", MLT_PRODUCER_SERVICE( producer ), 0, NULL, NULL );
+	}
+	else
+	{
+		*frame = mlt_frame_init( MLT_PRODUCER_SERVICE( producer ) );
+		mlt_frame_set_position( *frame, mlt_producer_position( producer ) );
+	}
+	mlt_producer_prepare_next( producer );
+
+	return error;
+}
+
+/** Create a producer that takes its length and metadata from XML and opens the media on the first frame.
+*/
+
+static mlt_service lazy_producer( deserialise_context context, mlt_properties properties, const char *argument )
+{
+	mlt_producer producer = mlt_producer_new( context->profile );
+
+	if ( producer )
+	{
+		mlt_properties producer_properties = MLT_PRODUCER_PROPERTIES( producer );
+		mlt_properties_set_string( producer_properties, "mlt_service", trim( mlt_properties_get( properties, "mlt_service" ) ) );
+		mlt_properties_set_string( producer_properties, "_lazy_argument", argument );
+		producer->get_frame = lazy_get_frame;
+		mlt_events_listen( producer_properties, producer, "property-changed", ( mlt_listener )lazy_property_changed );
+	}
+	return MLT_PRODUCER_SERVICE( producer );
+}
+
+/** Collect the properties of producer elements in the first pass to probe them in parallel.
+*/
+
+static void on_start_probe( deserialise_context context, const xmlChar *name, const xmlChar **atts )
+{
+	mlt_properties properties = mlt_deque_peek_back( context->probe_stack );
+
+	if ( context->probe_depth > 0 )
+	{
+		// Ignore the elements within a property value
+		context->probe_depth++;
+	}
+	else if ( xmlStrcmp( name, _x("producer") ) == 0 || xmlStrcmp( name, _x("video") ) == 0 )
+	{
+		properties = mlt_properties_new();
+		mlt_properties_set_int( properties, "_xml_ordinal", context->producer_count++ );
+		for ( ; atts != NULL && *atts != NULL; atts += 2 )
+			mlt_properties_set_string( properties, (const char*) atts[0], atts[1] == NULL ? "" : (const char*) atts[1] );
+		mlt_deque_push_back( context->probe_stack, properties );
+	}
+	else if ( xmlStrcmp( name, _x("property") ) == 0 )
+	{
+		const char *value = NULL;
+
+		// Only collect the properties of the producer itself, not of its filters
+		context->probe_depth = 1;
+		if ( !properties || mlt_properties_get_int( properties, "_xml_nested" ) )
+			return;
+		for ( ; atts != NULL && *atts != NULL; atts += 2 )
+		{
+			if ( xmlStrcmp( atts[ 0 ], _x("name") ) == 0 && !context->probe_property )
+				context->probe_property = strdup( _s(atts[ 1 ]) );
+			else if ( xmlStrcmp( atts[ 0 ], _x("value") ) == 0 )
+				value = _s(atts[ 1 ]);
+		}
+		if ( context->probe_property )
+			mlt_properties_set_string( properties, context->probe_property, value == NULL ? "" : value );
+	}
+	else if ( properties )
+	{
+		mlt_properties_set_int( properties, "_xml_nested", mlt_properties_get_int( properties, "_xml_nested" ) + 1 );
+	}
+}
+
+static void on_end_probe( deserialise_context context, const xmlChar *name )
+{
+	if ( context->probe_depth > 0 )
+	{
+		if ( --context->probe_depth == 0 )
+		{
+			free( context->probe_property );
+			context->probe_property = NULL;
+		}
+	}
+	else if ( ( xmlStrcmp( name, _x("producer") ) == 0 || xmlStrcmp( name, _x("video") ) == 0 ) &&
+	          mlt_deque_count( context->probe_stack ) )
+	{
+		mlt_properties properties = mlt_deque_pop_back( context->probe_stack );
+		char *resource;
+
+		qualify_property( context, properties, "resource" );
+		resource = mlt_properties_get( properties, "resource" );
+		if ( resource == NULL )
+		{
+			qualify_property( context, properties, "src" );
+			resource = mlt_properties_get( properties, "src" );
+		}
+
+		// Only media that cannot be opened lazily needs probing now
+		if ( is_media_producer( properties, resource ) && !mlt_properties_get( properties, "length" ) )
+		{
+			char *argument = producer_argument( properties, resource );
+			if ( argument )
+			{
+				int i = context->probe_count++;
+				context->probe_ordinals = realloc( context->probe_ordinals, context->probe_count * sizeof( int ) );
+				context->probe_arguments = realloc( context->probe_arguments, context->probe_count * sizeof( char* ) );
+				context->probe_ordinals[i] = mlt_properties_get_int( properties, "_xml_ordinal" );
+				context->probe_arguments[i] = argument;
+			}
+		}
+		mlt_properties_close( properties );
+	}
+	else if ( mlt_deque_count( context->probe_stack ) )
+	{
+		mlt_properties properties = mlt_deque_peek_back( context->probe_stack );
+		mlt_properties_set_int( properties, "_xml_nested", mlt_properties_get_int( properties, "_xml_nested" ) - 1 );
+	}
+}
+
+/** Open the media producer itself, without the loader, for a "service:resource" argument.
+*/
+
+static mlt_producer probe_open( mlt_profile profile, const char *argument )
+{
+	char *service = strdup( argument );
+	char *resource = strchr( service, ':' );
+	mlt_producer producer = NULL;
+
+	if ( resource )
+	{
+		*resource++ = '\0';
+		producer = mlt_factory_producer( profile, service, resource );
+	}
+	free( service );
+
+	return producer;
+}
+
+static int probe_proc( int id, int idx, int jobs, void *cookie )
+{
+	deserialise_context context = cookie;
+	context->probe_producers[ idx + 1 ] = probe_open( context->profile, context->probe_arguments[ idx + 1 ] );
+	return 0;
+}
+
+/** Open the media collected in the first pass on the slices thread pool.
+ *
+ * Only the media producers are opened in parallel. The loader and its
+ * normalising filters are applied later on this thread by load_probed().
+*/
+
+static void probe_producers( deserialise_context context )
+{
+	if ( context->probe_count > 0 )
+	{
+		context->probe_producers = calloc( context->probe_count, sizeof( mlt_producer ) );
+
+		// Open the first one alone so that the module initializes its shared state
+		context->probe_producers[0] = probe_open( context->profile, context->probe_arguments[0] );
+		if ( context->probe_count > 1 )
+			mlt_slices_run_normal( context->probe_count - 1, probe_proc, context );
+	}
+}
+
+/** Offer a probed producer to the loader when it asks the factory for the same media.
+*/
+
+static void on_probe_request( mlt_properties owner, deserialise_context context, const char *service,
+	const char *resource, mlt_service *obj )
+{
+	const char *argument = context->probe_offer_argument;
+	size_t n = service ? strlen( service ) : 0;
+
+	if ( !*obj && context->probe_offer && n && resource && !strncmp( argument, service, n ) &&
+	     argument[ n ] == ':' && !strcmp( argument + n + 1, resource ) )
+	{
+		*obj = MLT_PRODUCER_SERVICE( context->probe_offer );
+		context->probe_offer = NULL;
+	}
+}
+
+/** Load a producer element through the loader using the producer probed for it if it has the same argument.
+*/
+
+static mlt_service load_probed( deserialise_context context, int ordinal, const char *argument )
+{
+	mlt_producer producer = NULL;
+	int i;
+
+	for ( i = 0; context->probe_producers && i < context->probe_count; i++ )
+	{
+		if ( context->probe_ordinals[i] == ordinal )
+		{
+			if ( context->probe_producers[i] && !strcmp( context->probe_arguments[i], argument ) )
+			{
+				context->probe_offer = context->probe_producers[i];
+				context->probe_offer_argument = argument;
+				context->probe_producers[i] = NULL;
+			}
+			break;
+		}
+	}
+	if ( context->probe_offer )
+	{
+		mlt_events_listen( mlt_factory_event_object(), context, "producer-create-request", ( mlt_listener )on_probe_request );
+		producer = mlt_factory_producer( context->profile, NULL, argument );
+		mlt_events_disconnect( mlt_factory_event_object(), context );
+
+		// The loader did not ask for it
+		mlt_producer_close( context->probe_offer );
+		context->probe_offer = NULL;
+	}
+	return MLT_PRODUCER_SERVICE( producer );
+}
+
 static void on_start_producer( deserialise_context context, const xmlChar *name, const xmlChar **atts)
 {
 	// use a dummy service to hold properties to allow arbitrary nesting
@@ -579,6 +933,7 @@ static void on_start_producer( deserialise_context context, const xmlChar *name,
 	mlt_properties properties = MLT_SERVICE_PROPERTIES( service );
 
 	context_push_service( context, service, mlt_dummy_producer_type );
+	mlt_properties_set_int( properties, "_xml_ordinal", context->producer_count++ );
 
 	for ( ; atts != NULL && *atts != NULL; atts += 2 )
 		mlt_properties_set_string( properties, (const char*) atts[0], atts[1] == NULL ? "" : (const char*) atts[1] );
@@ -605,38 +960,17 @@ static void on_end_producer( deserialise_context context, const xmlChar *name )
 		}
 
 		// Instantiate the producer
-		if ( mlt_properties_get( properties, "mlt_service" ) != NULL )
+		char *argument = producer_argument( properties, resource );
+		if ( argument )
 		{
-			char *service_name = trim( mlt_properties_get( properties, "mlt_service" ) );
-			if ( resource )
-			{
-				// If a document was saved as +INVALID.txt (see below), then ignore the mlt_service and
-				// try to load it just from the resource. This is an attempt to recover the failed
-				// producer in case, for example, a file returns.
-				if (!strcmp("qtext", service_name)) {
-					const char *text = mlt_properties_get( properties, "text" );
-					if (text && !strcmp("INVALID", text)) {
-						service_name = NULL;
-					}
-				} else if (!strcmp("pango", service_name)) {
-					const char *markup = mlt_properties_get( properties, "markup" );
-					if (markup && !strcmp("INVALID", markup)) {
-						service_name = NULL;
-					}
-				}
-				if (service_name) {
-					char *temp = calloc( 1, strlen( service_name ) + strlen( resource ) + 2 );
-					strcat( temp, service_name );
-					strcat( temp, ":" );
-					strcat( temp, resource );
-					producer = MLT_SERVICE( mlt_factory_producer( context->profile, NULL, temp ) );
-					free( temp );
-				}
-			}
-			else
-			{
-				producer = MLT_SERVICE( mlt_factory_producer( context->profile, NULL, service_name ) );
-			}
+			// Media with a known length is opened on its first frame
+			if ( context->lazy && is_media_producer( properties, resource ) && mlt_properties_get( properties, "length" ) )
+				producer = lazy_producer( context, properties, argument );
+			if ( !producer )
+				producer = load_probed( context, mlt_properties_get_int( properties, "_xml_ordinal" ), argument );
+			if ( !producer )
+				producer = MLT_SERVICE( mlt_factory_producer( context->profile, NULL, argument ) );
+			free( argument );
 		}
 
 		// Just in case the plugin requested doesn't exist...
@@ -693,6 +1027,7 @@ static void on_end_producer( deserialise_context context, const xmlChar *name )
 		// Remove in and out
 		mlt_properties_set_string( properties, "in", NULL );
 		mlt_properties_set_string( properties, "out", NULL );
+		mlt_properties_set_string( properties, "_xml_ordinal", NULL );
 
 		// Do not let XML overwrite these important properties set by mlt_factory.
 		mlt_properties_set_string( properties, "mlt_type", NULL );
@@ -700,6 +1035,9 @@ static void on_end_producer( deserialise_context context, const xmlChar *name )
 
 		// Inherit the properties
 		mlt_properties_inherit( MLT_SERVICE_PROPERTIES( producer ), properties );
+		if ( mlt_properties_get( MLT_SERVICE_PROPERTIES( producer ), "_lazy_argument" ) )
+			mlt_properties_set_position( MLT_SERVICE_PROPERTIES( producer ), "out",
+				mlt_properties_get_position( MLT_SERVICE_PROPERTIES( producer ), "length" ) - 1 );
 
 		// Attach all filters from service onto producer
 		attach_filters( producer, service );
@@ -1352,6 +1690,8 @@ static void on_start_element( void *ctx, const xmlChar *name, const xmlChar **at
 	
 	if ( context->pass == 0 )
 	{
+		if ( context->lazy )
+			on_start_probe( context, name, atts );
 		if ( xmlStrcmp( name, _x("mlt") ) == 0 ||
 		     xmlStrcmp( name, _x("profile") ) == 0 ||
 		     xmlStrcmp( name, _x("profileinfo") ) == 0 )
@@ -1432,6 +1772,12 @@ static void on_end_element( void *ctx, const xmlChar *name )
 	struct _xmlParserCtxt *xmlcontext = ( struct _xmlParserCtxt* )ctx;
 	deserialise_context context = ( deserialise_context )( xmlcontext->_private );
 	
+	if ( context->pass == 0 )
+	{
+		if ( context->lazy )
+			on_end_probe( context, name );
+		return;
+	}
 	if ( context->is_value == 1 && context->pass == 1 && xmlStrcmp( name, _x("property") ) != 0 )
 		context_pop_node( context );
 	else if ( xmlStrcmp( name, _x("multitrack") ) == 0 )
@@ -1473,6 +1819,19 @@ static void on_characters( void *ctx, const xmlChar *ch, int len )
 	value[ len ] = 0;
 	strncpy( value, (const char*) ch, len );
 
+	// Collect the value of a property of a producer to probe
+	if ( context->pass == 0 && context->probe_property && context->probe_depth == 1 && mlt_deque_count( context->probe_stack ) )
+	{
+		mlt_properties probe = mlt_deque_peek_back( context->probe_stack );
+		char *s = mlt_properties_get( probe, context->probe_property );
+		char *new = calloc( 1, ( s ? strlen( s ) : 0 ) + len + 1 );
+		if ( s )
+			strcat( new, s );
+		strcat( new, value );
+		mlt_properties_set_string( probe, context->probe_property, new );
+		free( new );
+	}
+
 	if ( mlt_deque_count( context->stack_node ) )
 		xmlNodeAddContent( mlt_deque_peek_back( context->stack_node ), ( xmlChar* )value );
 
@@ -1754,6 +2113,7 @@ static deserialise_context context_new( mlt_profile profile )
 		context->stack_types = mlt_deque_init();
 		context->stack_node = mlt_deque_init();
 		context->stack_branch = mlt_deque_init();
+		context->probe_stack = mlt_deque_init();
 		mlt_deque_push_back_int( context->stack_branch, 0 );
 	}
 	return context;
@@ -1761,6 +2121,8 @@ static deserialise_context context_new( mlt_profile profile )
 
 static void context_close( deserialise_context context )
 {
+	int i;
+
 	mlt_properties_close( context->producer_map );
 	mlt_properties_close( context->destructors );
 	mlt_properties_close( context->params );
@@ -1770,6 +2132,19 @@ static void context_close( deserialise_context context )
 	mlt_deque_close( context->stack_branch );
 	xmlFreeDoc( context->entity_doc );
 	free( context->lc_numeric );
+	while ( mlt_deque_count( context->probe_stack ) )
+		mlt_properties_close( mlt_deque_pop_back( context->probe_stack ) );
+	mlt_deque_close( context->probe_stack );
+	free( context->probe_property );
+	for ( i = 0; i < context->probe_count; i++ )
+	{
+		free( context->probe_arguments[i] );
+		if ( context->probe_producers )
+			mlt_producer_close( context->probe_producers[i] );
+	}
+	free( context->probe_ordinals );
+	free( context->probe_arguments );
+	free( context->probe_producers );
 	free( context );
 }
 
@@ -1844,6 +2219,9 @@ mlt_producer producer_xml_init( mlt_profile profile, mlt_service_type servtype,
 	// We need to track the number of registered filters
 	mlt_properties_set_int( context->destructors, "registered", 0 );
 
+	// Open media only when needed, or else in parallel
+	context->lazy = mlt_properties_get_int( context->params, "lazy" ) || getenv( "MLT_XML_LAZY" );
+
 	// Setup SAX callbacks for first pass
 	sax = calloc( 1, sizeof( xmlSAXHandler ) );
 	sax->startElement = on_start_element;
@@ -1851,6 +2229,8 @@ mlt_producer producer_xml_init( mlt_profile profile, mlt_service_type servtype,
 	sax->warning = on_error;
 	sax->error = on_error;
 	sax->fatalError = on_error;
+	if ( context->lazy )
+		sax->endElement = on_end_element;
 
 	// Setup libxml2 SAX parsing
 	xmlInitParser(); 
@@ -1892,8 +2272,12 @@ mlt_producer producer_xml_init( mlt_profile profile, mlt_service_type servtype,
 		return NULL;
 	}
 
+	// Probe the media that cannot be opened lazily
+	probe_producers( context );
+
 	// Setup the second pass
 	context->pass ++;
+	context->producer_count = 0;
 	if ( is_filename )
 		xmlcontext = xmlCreateFileParserCtxt( filename );
 	else
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2020 Meltytech, LLC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with consumer library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef MLT_TESTS_CHILD_PROCESS_H
+#define MLT_TESTS_CHILD_PROCESS_H
+
+// Some state, such as the CPU features, is read once per process. A test of
+// it runs a function of the test program in a child process, which it starts
+// with "--child", an output file, and an argument for the function.
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QProcess>
+#include <QTemporaryDir>
+#include <QtTest>
+#include <cstring>
+
+// The function run by the child process returns what it writes to the output
+// file. An empty result means it failed.
+typedef QByteArray (*ChildFunction)(const QByteArray& argument);
+
+// Run the child function with the environment and return what it wrote,
+// or an empty array if it failed.
+inline QByteArray runChild(const QProcessEnvironment& env, const QByteArray& argument = QByteArray())
+{
+    QTemporaryDir dir;
+    QString output = dir.path() + "/output";
+    QProcess process;
+
+    if (!dir.isValid())
+        return QByteArray();
+    process.setProcessEnvironment(env);
+    process.start(QCoreApplication::applicationFilePath(),
+                  QStringList() << "--child" << output << QString::fromUtf8(argument));
+    if (!process.waitForFinished(-1) || process.exitStatus() != QProcess::NormalExit || process.exitCode())
+        return QByteArray();
+    QFile file(output);
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+    return file.readAll();
+}
+
+// The same as runChild() with MLT_CPU_FEATURES set to features or else unset.
+inline QByteArray runChildWithFeatures(const char* features, const QByteArray& argument = QByteArray())
+{
+    QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
+    if (features)
+        env.insert("MLT_CPU_FEATURES", features);
+    else
+        env.remove("MLT_CPU_FEATURES");
+    return runChild(env, argument);
+}
+
+inline int writeChild(ChildFunction function, const char* output, const char* argument)
+{
+    QByteArray result = function(QByteArray(argument));
+    QFile file(QString::fromLocal8Bit(output));
+    if (result.isEmpty() || !file.open(QIODevice::WriteOnly))
+        return 1;
+    return file.write(result) == result.size() ? 0 : 1;
+}
+
+// Use this instead of QTEST_GUILESS_MAIN in a test that runs a child function.
+#define QTEST_CHILD_MAIN(TestObject, function) \
+int main(int argc, char *argv[]) \
+{ \
+    if (argc == 4 && !strcmp(argv[1], "--child")) \
+        return writeChild(function, argv[2], argv[3]); \
+    QCoreApplication app(argc, argv); \
+    TestObject tc; \
+    QTEST_SET_MAIN_SOURCE_PATH \
+    return QTest::qExec(&tc, argc, argv); \
+}
+
+#endif
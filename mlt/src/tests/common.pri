@@ -8,6 +8,7 @@ CONFIG   += c++11
 QMAKE_CXXFLAGS += -std=c++11
 TEMPLATE = app
 DEFINES  += SRCDIR=\\\"$$PWD/\\\"
+INCLUDEPATH += $$PWD
 
 win32 {
     INCLUDEPATH += $$PWD/..
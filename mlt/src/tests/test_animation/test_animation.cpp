@@ -353,6 +353,44 @@ private Q_SLOTS:
         QCOMPARE(p.anim_get("foo", 50), "100");
         QCOMPARE(p.anim_get("foo", 60), "60; 100=0");
     }
+
+	void GetDoublesForRange()
+	{
+		Properties p;
+		p.set("foo", "50=100; 60=60; 100=0");
+		// Cause the string to be interpreted as animated value.
+		p.anim_get_int("foo", 0);
+		Animation a = p.get_animation("foo");
+		QVERIFY(a.is_valid());
+		double values[61];
+		int error = mlt_animation_get_doubles(a.get_animation(), values, 45, 61);
+		QVERIFY(!error);
+		QCOMPARE(values[0], 100.0);
+		QCOMPARE(values[5], 100.0);
+		QCOMPARE(values[10], 80.0);
+		QCOMPARE(values[15], 60.0);
+		QCOMPARE(values[35], 30.0);
+		QCOMPARE(values[55], 0.0);
+		QCOMPARE(values[60], 0.0);
+	}
+
+	void ManyKeyframesInAnyOrder()
+	{
+		Properties p;
+		QString s;
+		for (int i = 0; i < 1000; i++)
+			s += QString("%1=%2;").arg(i * 10).arg(i);
+		p.set("foo", s.toLatin1().constData());
+		// Forward, backward, and random access must agree.
+		for (int i = 0; i <= 9990; i += 7)
+			QCOMPARE(p.anim_get_double("foo", i), i / 10.0);
+		for (int i = 9990; i >= 0; i -= 13)
+			QCOMPARE(p.anim_get_double("foo", i), i / 10.0);
+		for (int i = 0; i < 1000; i++) {
+			int position = (i * 7919) % 9990;
+			QCOMPARE(p.anim_get_double("foo", position), position / 10.0);
+		}
+	}
 };
 
 QTEST_APPLESS_MAIN(TestAnimation)
@@ -0,0 +1,281 @@
+/*
+ * Copyright (C) 2020 Meltytech, LLC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with consumer library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <QDir>
+#include <QString>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QtTest>
+
+#include <mlt++/Mlt.h>
+using namespace Mlt;
+
+// The clip has a keyframe every 10 frames and no B-frames, so decoding
+// from any keyframe reproduces exactly what sequential decoding gives.
+static const int kClipLength = 50;
+
+class TestAvformat : public QObject
+{
+    Q_OBJECT
+    Profile profile;
+    QTemporaryDir dir;
+    QString resource;
+    QList<QByteArray> expected;
+
+    QByteArray image(Frame* frame)
+    {
+        mlt_image_format format = mlt_image_yuv422;
+        int width = profile.width();
+        int height = profile.height();
+        uint8_t* image = frame->get_image(format, width, height);
+        if (!image || format != mlt_image_yuv422)
+            return QByteArray();
+        return QByteArray((const char*) image, width * height * 2);
+    }
+
+    QByteArray audio(Frame* frame)
+    {
+        mlt_audio_format format = mlt_audio_s16;
+        int frequency = 48000;
+        int channels = 2;
+        int samples = mlt_sample_calculator(profile.fps(), frequency, frame->get_position());
+        int16_t* pcm = (int16_t*) frame->get_audio(format, frequency, channels, samples);
+        if (!pcm || format != mlt_audio_s16)
+            return QByteArray();
+        return QByteArray((const char*) pcm, samples * channels * sizeof(int16_t));
+    }
+
+    void encode(const QString& target, int pipeline)
+    {
+        Producer count(profile, "count");
+        QVERIFY(count.is_valid());
+        count.set("out", kClipLength - 1);
+        Consumer consumer(profile, "avformat");
+        consumer.set("target", target.toUtf8().constData());
+        consumer.set("vcodec", "mpeg4");
+        consumer.set("qscale", 2);
+        consumer.set("g", 10);
+        consumer.set("bf", 0);
+        consumer.set("acodec", "pcm_s16le");
+        consumer.set("pipeline", pipeline);
+        consumer.set("real_time", -1);
+        consumer.set("terminate_on_pause", 1);
+        consumer.connect(count);
+        QCOMPARE(consumer.run(), 0);
+    }
+
+    QByteArray imageAt(Producer& producer, int position)
+    {
+        producer.seek(position);
+        Frame* frame = producer.get_frame();
+        QByteArray result = image(frame);
+        delete frame;
+        return result;
+    }
+
+public:
+    TestAvformat()
+    {
+        Factory::init();
+        profile.set_width(320);
+        profile.set_height(240);
+        profile.set_sample_aspect(1, 1);
+        profile.set_display_aspect(4, 3);
+        profile.set_progressive(1);
+        profile.set_colorspace(601);
+        profile.set_frame_rate(25, 1);
+    }
+
+private Q_SLOTS:
+
+    void initTestCase()
+    {
+        Consumer consumer(profile, "avformat");
+        if (!consumer.is_valid())
+            QSKIP("The avformat module is not available");
+        QVERIFY(dir.isValid());
+        resource = dir.filePath("clip.mkv");
+
+        Producer count(profile, "count");
+        QVERIFY(count.is_valid());
+        count.set("out", kClipLength - 1);
+        consumer.set("target", resource.toUtf8().constData());
+        consumer.set("vcodec", "mpeg4");
+        consumer.set("qscale", 2);
+        consumer.set("g", 10);
+        consumer.set("bf", 0);
+        consumer.set("an", 1);
+        consumer.set("real_time", -1);
+        consumer.set("terminate_on_pause", 1);
+        consumer.connect(count);
+        QCOMPARE(consumer.run(), 0);
+
+        Producer producer(profile, "avformat", resource.toUtf8().constData());
+        QVERIFY(producer.is_valid());
+        QCOMPARE(producer.get_length(), kClipLength);
+        for (int i = 0; i < kClipLength; i++) {
+            Frame* frame = producer.get_frame();
+            expected << image(frame);
+            delete frame;
+            QVERIFY(!expected.last().isEmpty());
+        }
+        QVERIFY(expected.first() != expected.last());
+    }
+
+    void SeekMatchesSequentialDecoding()
+    {
+        Producer producer(profile, "avformat", resource.toUtf8().constData());
+        QVERIFY(producer.is_valid());
+        const int positions[] = {37, 5, 20, 49, 0, 12, 11, 30, 29};
+        for (int position : positions)
+            QCOMPARE(imageAt(producer, position), expected[position]);
+    }
+
+    void SeekWithKeyframeIndexMatchesSequentialDecoding()
+    {
+        QDir cache(dir.filePath("cache"));
+        qputenv("MLT_AVFORMAT_CACHE_DIR", cache.path().toUtf8());
+        Producer* producer = new Producer(profile, "avformat", resource.toUtf8().constData());
+        QVERIFY(producer->is_valid());
+        producer->set("keyframe_index", 1);
+        for (int i = 0; i < kClipLength; i++)
+            QCOMPARE(imageAt(*producer, i), expected[i]);
+        const int positions[] = {43, 9, 10, 27, 0};
+        for (int position : positions)
+            QCOMPARE(imageAt(*producer, position), expected[position]);
+        delete producer;
+
+        // The index is saved and seeks of the next producer use it.
+        QCOMPARE(QDir(cache.filePath("index")).entryList(QDir::Files).count(), 1);
+        Producer second(profile, "avformat", resource.toUtf8().constData());
+        QVERIFY(second.is_valid());
+        second.set("keyframe_index", 1);
+        for (int position : positions)
+            QCOMPARE(imageAt(second, position), expected[position]);
+        qunsetenv("MLT_AVFORMAT_CACHE_DIR");
+    }
+
+    void ReversePlaybackMatchesForward()
+    {
+        Producer producer(profile, "avformat", resource.toUtf8().constData());
+        QVERIFY(producer.is_valid());
+        producer.set("reverse_cache", 16);
+        producer.seek(kClipLength - 1);
+        producer.set_speed(-1);
+        for (int i = kClipLength - 1; i >= 0; i--) {
+            Frame* frame = producer.get_frame();
+            QCOMPARE(mlt_frame_get_position(frame->get_frame()), i);
+            QCOMPARE(image(frame), expected[i]);
+            delete frame;
+        }
+        // All but the last frame of each GOP come from the cache.
+        QVERIFY(producer.get_int("reverse_cache_hits") > kClipLength / 2);
+    }
+
+    void SteppingBackMatchesForward()
+    {
+        Producer producer(profile, "avformat", resource.toUtf8().constData());
+        QVERIFY(producer.is_valid());
+        producer.set("reverse_cache", 16);
+        producer.set_speed(0);
+        for (int i = 35; i >= 15; i--)
+            QCOMPARE(imageAt(producer, i), expected[i]);
+        QVERIFY(producer.get_int("reverse_cache_hits") > 0);
+    }
+
+    void DecodeAheadMatchesSequentialDecoding()
+    {
+        Producer producer(profile, "avformat", resource.toUtf8().constData());
+        QVERIFY(producer.is_valid());
+        producer.set("decode_ahead", 4);
+        producer.set_speed(1);
+        for (int i = 0; i < kClipLength; i++) {
+            // Give the thread time to decode ahead.
+            QThread::msleep(5);
+            Frame* frame = producer.get_frame();
+            QCOMPARE(image(frame), expected[i]);
+            delete frame;
+        }
+        QVERIFY(producer.get_int("decode_ahead_taken") > 0);
+        QCOMPARE(imageAt(producer, 8), expected[8]);
+    }
+
+    void PooledDecoderMatchesSequentialDecoding()
+    {
+        Producer* first = new Producer(profile, "avformat", resource.toUtf8().constData());
+        QVERIFY(first->is_valid());
+        first->set("decoder_pool", 1);
+        QCOMPARE(imageAt(*first, 20), expected[20]);
+        delete first;
+
+        // This takes over the file and decoders that the first one left at 21.
+        Producer second(profile, "avformat", resource.toUtf8().constData());
+        QVERIFY(second.is_valid());
+        second.set("decoder_pool", 1);
+        QCOMPARE(imageAt(second, 25), expected[25]);
+        QCOMPARE(second.get_int("decoder_pool_taken"), 1);
+        QCOMPARE(imageAt(second, 3), expected[3]);
+    }
+
+    void WritingAnImageLeavesTheDecoderAlone()
+    {
+        Producer producer(profile, "avformat", resource.toUtf8().constData());
+        QVERIFY(producer.is_valid());
+        for (int i = 0; i < 15; i++) {
+            Frame* frame = producer.get_frame();
+            // This is the format of the decoded pictures, so they are not converted.
+            mlt_image_format format = mlt_image_yuv420p;
+            int width = profile.width();
+            int height = profile.height();
+            uint8_t* image = frame->get_image(format, width, height, 1);
+            QVERIFY(image != NULL);
+            QCOMPARE(format, mlt_image_yuv420p);
+            // The next pictures are predicted from this one.
+            memset(image, 0, mlt_image_format_size(format, width, height, NULL));
+            delete frame;
+        }
+        QCOMPARE(imageAt(producer, 15), expected[15]);
+        QCOMPARE(imageAt(producer, 14), expected[14]);
+    }
+
+    void PipelineMatchesSerialEncoding()
+    {
+        QString serial = dir.filePath("serial.mkv");
+        QString pipelined = dir.filePath("pipelined.mkv");
+        encode(serial, 0);
+        encode(pipelined, 4);
+
+        Producer a(profile, "avformat", serial.toUtf8().constData());
+        Producer b(profile, "avformat", pipelined.toUtf8().constData());
+        QVERIFY(a.is_valid());
+        QVERIFY(b.is_valid());
+        QCOMPARE(b.get_length(), a.get_length());
+        for (int i = 0; i < a.get_length(); i++) {
+            Frame* fa = a.get_frame();
+            Frame* fb = b.get_frame();
+            QCOMPARE(image(fb), image(fa));
+            QCOMPARE(audio(fb), audio(fa));
+            delete fa;
+            delete fb;
+        }
+    }
+};
+
+QTEST_APPLESS_MAIN(TestAvformat)
+
+#include "test_avformat.moc"
@@ -0,0 +1,3 @@
+include(../common.pri)
+TARGET = test_avformat
+SOURCES += test_avformat.cpp
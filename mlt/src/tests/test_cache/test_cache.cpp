@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2020 Meltytech, LLC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with consumer library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include <QtTest>
+#include <mlt++/Mlt.h>
+using namespace Mlt;
+
+static int destroyed[8];
+
+static void destroy(void* data)
+{
+    destroyed[(intptr_t) data]++;
+}
+
+static void* key(intptr_t i)
+{
+    return (void*) i;
+}
+
+class TestCache: public QObject
+{
+    Q_OBJECT
+
+public:
+    TestCache()
+    {
+        Factory::init();
+    }
+
+private Q_SLOTS:
+    void init()
+    {
+        memset(destroyed, 0, sizeof(destroyed));
+        mlt_cache_set_budget(0);
+    }
+
+    void cleanup()
+    {
+        mlt_cache_set_budget(0);
+    }
+
+    void SizeEvictsLeastRecentlyUsed()
+    {
+        mlt_cache cache = mlt_cache_init();
+        mlt_cache_set_size(cache, 2);
+        mlt_cache_put(cache, key(1), key(1), 0, destroy);
+        mlt_cache_put(cache, key(2), key(2), 0, destroy);
+        mlt_cache_item_close(mlt_cache_get(cache, key(1)));
+        mlt_cache_put(cache, key(3), key(3), 0, destroy);
+        QCOMPARE(destroyed[1], 0);
+        QCOMPARE(destroyed[2], 1);
+        QVERIFY(mlt_cache_get(cache, key(2)) == NULL);
+        mlt_cache_close(cache);
+        QCOMPARE(destroyed[1], 1);
+        QCOMPARE(destroyed[3], 1);
+    }
+
+    void SizeZeroKeepsOnlyTheLastItem()
+    {
+        mlt_cache cache = mlt_cache_init();
+        mlt_cache_set_size(cache, 0);
+        QCOMPARE(mlt_cache_get_size(cache), 0);
+        mlt_cache_put(cache, key(1), key(1), 0, destroy);
+        mlt_cache_item item = mlt_cache_get(cache, key(1));
+        QVERIFY(item != NULL);
+        mlt_cache_item_close(item);
+        mlt_cache_put(cache, key(2), key(2), 0, destroy);
+        QCOMPARE(destroyed[1], 1);
+        QVERIFY(mlt_cache_get(cache, key(1)) == NULL);
+
+        // A negative size is ignored.
+        mlt_cache_set_size(cache, -1);
+        QCOMPARE(mlt_cache_get_size(cache), 0);
+        mlt_cache_close(cache);
+        QCOMPARE(destroyed[2], 1);
+    }
+
+    void BudgetEvictsLeastRecentlyUsedOfAllCaches()
+    {
+        mlt_cache a = mlt_cache_init();
+        mlt_cache b = mlt_cache_init();
+        mlt_cache_set_size(a, 10);
+        mlt_cache_set_size(b, 10);
+        mlt_cache_set_budget(300);
+        mlt_cache_put(a, key(1), key(1), 100, destroy);
+        mlt_cache_put(b, key(2), key(2), 100, destroy);
+        mlt_cache_item_close(mlt_cache_get(a, key(1)));
+        mlt_cache_put(b, key(3), key(3), 150, destroy);
+        QCOMPARE(destroyed[1], 0);
+        QCOMPARE(destroyed[2], 1);
+        QCOMPARE(destroyed[3], 0);
+        QCOMPARE(mlt_cache_get_bytes(), int64_t(250));
+        mlt_cache_close(a);
+        mlt_cache_close(b);
+        QCOMPARE(mlt_cache_get_bytes(), int64_t(0));
+    }
+
+    void BudgetKeepsItemsWithoutSize()
+    {
+        mlt_cache a = mlt_cache_init();
+        mlt_cache b = mlt_cache_init();
+        mlt_cache_set_size(b, 10);
+        mlt_cache_set_budget(100);
+        mlt_cache_put(a, key(1), key(1), 0, destroy);
+        mlt_cache_put(b, key(2), key(2), 100, destroy);
+        mlt_cache_put(b, key(3), key(3), 100, destroy);
+        QCOMPARE(destroyed[1], 0);
+        QCOMPARE(destroyed[2], 1);
+        mlt_cache_item item = mlt_cache_get(a, key(1));
+        QVERIFY(item != NULL);
+        mlt_cache_item_close(item);
+        mlt_cache_close(a);
+        mlt_cache_close(b);
+    }
+
+    void EvictedItemLivesUntilClosed()
+    {
+        mlt_cache cache = mlt_cache_init();
+        mlt_cache_set_size(cache, 1);
+        mlt_cache_put(cache, key(1), key(1), 0, destroy);
+        mlt_cache_item item = mlt_cache_get(cache, key(1));
+        mlt_cache_put(cache, key(2), key(2), 0, destroy);
+        QCOMPARE(destroyed[1], 0);
+        QCOMPARE(mlt_cache_item_data(item, NULL), key(1));
+        mlt_cache_close(cache);
+        QCOMPARE(destroyed[1], 0);
+        mlt_cache_item_close(item);
+        QCOMPARE(destroyed[1], 1);
+    }
+};
+
+QTEST_APPLESS_MAIN(TestCache)
+
+#include "test_cache.moc"
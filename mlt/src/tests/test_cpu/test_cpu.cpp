@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2020 Meltytech, LLC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with consumer library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <QtTest>
+#include "child_process.h"
+
+#include <mlt++/Mlt.h>
+using namespace Mlt;
+
+static void kernel_c() {}
+static void kernel_sse2() {}
+static void kernel_ssse3() {}
+static void kernel_neon() {}
+
+static QByteArray cpuFeatures(const QByteArray&)
+{
+    return QByteArray::number(mlt_cpu_features());
+}
+
+class TestCpu : public QObject
+{
+    Q_OBJECT
+
+    // Get the features in a child process, since MLT_CPU_FEATURES is read
+    // once per process.
+    int features(const char* value)
+    {
+        QByteArray result = runChildWithFeatures(value);
+        return result.isEmpty() ? -1 : result.toInt();
+    }
+
+public:
+    TestCpu()
+    {
+        Factory::init();
+    }
+
+private Q_SLOTS:
+    void EnvironmentRestrictsFeatures()
+    {
+        int detected = features(NULL);
+        QVERIFY(detected >= 0);
+        QCOMPARE(features("none"), 0);
+        QCOMPARE(features(""), 0);
+        QCOMPARE(features("sse2"), detected & mlt_cpu_sse2);
+        QCOMPARE(features("ssse3,avx2"), detected & (mlt_cpu_ssse3 | mlt_cpu_avx2));
+    }
+
+    void EnvironmentIgnoresSeparatorsAndUnknownNames()
+    {
+        int detected = features(NULL);
+        QCOMPARE(features(" sse2,, avx2 ,"), detected & (mlt_cpu_sse2 | mlt_cpu_avx2));
+        QCOMPARE(features("sse2,bogus,SSSE3,sse"), detected & mlt_cpu_sse2);
+        QCOMPARE(features("nonesse2"), 0);
+    }
+
+    void EnvironmentCannotAddFeatures()
+    {
+        int detected = features(NULL);
+        QCOMPARE(features("sse2,ssse3,avx2,avx512,neon"), detected);
+    }
+
+    void FeatureNamesRoundTrip()
+    {
+        QCOMPARE(mlt_cpu_feature_name(mlt_cpu_sse2), "sse2");
+        QCOMPARE(mlt_cpu_feature_name(mlt_cpu_avx512), "avx512");
+        QVERIFY(mlt_cpu_feature_name(mlt_cpu_feature(0)) == NULL);
+        QVERIFY(mlt_cpu_feature_name(mlt_cpu_feature(mlt_cpu_sse2 | mlt_cpu_ssse3)) == NULL);
+    }
+
+    void SelectPrefersGreatestAvailableFeature()
+    {
+        QVERIFY(mlt_cpu_select("test.none") == NULL);
+
+        mlt_cpu_register("test.select", mlt_cpu_ssse3 | mlt_cpu_sse2, (void*) kernel_ssse3);
+        mlt_cpu_register("test.select", mlt_cpu_sse2 | mlt_cpu_neon, (void*) kernel_neon);
+        mlt_cpu_register("test.select", mlt_cpu_sse2, (void*) kernel_sse2);
+        mlt_cpu_register("test.select", 0, (void*) kernel_c);
+
+        void* expected = (void*) kernel_c;
+        if (mlt_cpu_has(mlt_cpu_ssse3 | mlt_cpu_sse2))
+            expected = (void*) kernel_ssse3;
+        else if (mlt_cpu_has(mlt_cpu_sse2))
+            expected = (void*) kernel_sse2;
+        // No CPU has the features of two architectures.
+        QVERIFY(mlt_cpu_select("test.select") == expected);
+    }
+
+    void RegisterReplacesSameFeatures()
+    {
+        mlt_cpu_register("test.replace", 0, (void*) kernel_sse2);
+        mlt_cpu_register("test.replace", 0, (void*) kernel_c);
+        QVERIFY(mlt_cpu_select("test.replace") == (void*) kernel_c);
+
+        // A kernel requiring features the CPU lacks is never selected.
+        mlt_cpu_register("test.unavailable", mlt_cpu_sse2 | mlt_cpu_neon, (void*) kernel_neon);
+        QVERIFY(mlt_cpu_select("test.unavailable") == NULL);
+    }
+
+    void KernelsOutliveTheFactory()
+    {
+        // Modules register their kernels only once per process.
+        mlt_cpu_register("test.factory", 0, (void*) kernel_c);
+        Factory::close();
+        Factory::init();
+        QVERIFY(mlt_cpu_select("test.factory") == (void*) kernel_c);
+    }
+};
+
+QTEST_CHILD_MAIN(TestCpu, cpuFeatures)
+
+#include "test_cpu.moc"
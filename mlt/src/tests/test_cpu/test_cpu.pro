@@ -0,0 +1,3 @@
+include(../common.pri)
+TARGET = test_cpu
+SOURCES += test_cpu.cpp
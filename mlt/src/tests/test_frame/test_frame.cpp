@@ -25,7 +25,10 @@ class TestFrame: public QObject
     Q_OBJECT
 
 public:
-    TestFrame() {}
+    TestFrame()
+    {
+        Factory::init();
+    }
 
 private Q_SLOTS:
     void FrameConstructorAddsReference()
@@ -93,6 +96,168 @@ private Q_SLOTS:
         QCOMPARE(f1.ref_count(), 2);
         mlt_frame_close(frame);
     }
+
+    void IsOpaqueChecksAlpha()
+    {
+        mlt_frame frame = mlt_frame_init(NULL);
+        uint8_t image[4 * 2 * 2];
+        uint8_t* alpha = (uint8_t*) mlt_pool_alloc(2 * 2);
+
+        // YUV without an alpha mask is opaque.
+        QVERIFY(mlt_frame_is_opaque(frame, image, mlt_image_yuv422, 2, 2));
+        memset(alpha, 0xff, 4);
+        mlt_frame_set_alpha(frame, alpha, 4, mlt_pool_release);
+        QVERIFY(mlt_frame_is_opaque(frame, image, mlt_image_yuv422, 2, 2));
+        // The alpha mask is left as it was.
+        QCOMPARE(mlt_frame_get_alpha_value(frame), -1);
+        QVERIFY(mlt_frame_get_alpha(frame) == alpha);
+        alpha = (uint8_t*) mlt_pool_alloc(2 * 2);
+        memset(alpha, 0xff, 4);
+        alpha[3] = 0x80;
+        mlt_frame_set_alpha(frame, alpha, 4, mlt_pool_release);
+        QVERIFY(!mlt_frame_is_opaque(frame, image, mlt_image_yuv422, 2, 2));
+        QCOMPARE(mlt_frame_get_alpha_value(frame), -1);
+
+        memset(image, 0xff, sizeof(image));
+        QVERIFY(mlt_frame_is_opaque(frame, image, mlt_image_rgb24a, 2, 2));
+        image[7] = 0;
+        QVERIFY(!mlt_frame_is_opaque(frame, image, mlt_image_rgb24a, 2, 2));
+        mlt_frame_close(frame);
+    }
+
+    void DeepCloneSharesImageUntilWritten()
+    {
+        mlt_frame frame = mlt_frame_init(NULL);
+        mlt_properties properties = MLT_FRAME_PROPERTIES(frame);
+        int size = mlt_image_format_size(mlt_image_rgb24, 2, 2, NULL);
+        uint8_t* image = (uint8_t*) mlt_pool_alloc(size);
+        memset(image, 0x40, size);
+        mlt_frame_set_image(frame, image, size, mlt_pool_release);
+        mlt_properties_set_int(properties, "format", mlt_image_rgb24);
+        mlt_properties_set_int(properties, "width", 2);
+        mlt_properties_set_int(properties, "height", 2);
+
+        mlt_frame clone = mlt_frame_clone(frame, 1);
+        QCOMPARE(mlt_properties_get_data(MLT_FRAME_PROPERTIES(clone), "image", NULL), (void*) image);
+        QCOMPARE(mlt_pool_ref_count(image), 2);
+
+        // Reading does not copy.
+        mlt_image_format format = mlt_image_rgb24;
+        int width = 2;
+        int height = 2;
+        uint8_t* buffer = NULL;
+        QCOMPARE(mlt_frame_get_image(clone, &buffer, &format, &width, &height, 0), 0);
+        QCOMPARE(buffer, image);
+
+        // Writing copies the shared image.
+        QCOMPARE(mlt_frame_get_image(clone, &buffer, &format, &width, &height, 1), 0);
+        QVERIFY(buffer != image);
+        QCOMPARE(buffer[0], uint8_t(0x40));
+        QCOMPARE(mlt_pool_ref_count(image), 1);
+        buffer[0] = 0;
+        QCOMPARE(image[0], uint8_t(0x40));
+        mlt_frame_close(clone);
+
+        // The last owner writes in place.
+        buffer = NULL;
+        QCOMPARE(mlt_frame_get_image(frame, &buffer, &format, &width, &height, 1), 0);
+        QCOMPARE(buffer, image);
+        mlt_frame_close(frame);
+    }
+
+    void WritableImageCopiesUnownedImage()
+    {
+        mlt_frame frame = mlt_frame_init(NULL);
+        mlt_properties properties = MLT_FRAME_PROPERTIES(frame);
+        uint8_t image[2 * 3 * 3];
+        memset(image, 0x40, sizeof(image));
+        // The frame does not own an image without the pool as destructor,
+        // for example a picture that a decoder still references.
+        mlt_frame_set_image(frame, image, sizeof(image), NULL);
+        mlt_properties_set_int(properties, "format", mlt_image_rgb24);
+        mlt_properties_set_int(properties, "width", 2);
+        mlt_properties_set_int(properties, "height", 2);
+
+        mlt_image_format format = mlt_image_rgb24;
+        int width = 2;
+        int height = 2;
+        uint8_t* buffer = NULL;
+        QCOMPARE(mlt_frame_get_image(frame, &buffer, &format, &width, &height, 0), 0);
+        QCOMPARE(buffer, image);
+        QCOMPARE(mlt_frame_get_image(frame, &buffer, &format, &width, &height, 1), 0);
+        QVERIFY(buffer != image);
+        buffer[0] = 0;
+        QCOMPARE(image[0], uint8_t(0x40));
+        QCOMPARE(mlt_properties_get_destructor(properties, "image"), (mlt_destructor) mlt_pool_release);
+        mlt_frame_close(frame);
+    }
+
+    void GetImagePacksStridedPlanes()
+    {
+        mlt_frame frame = mlt_frame_init(NULL);
+        mlt_properties properties = MLT_FRAME_PROPERTIES(frame);
+        uint8_t* planes[4];
+        int strides[4];
+        int size = mlt_image_format_aligned_planes(mlt_image_rgb24, 2, 2, NULL, planes, strides);
+        uint8_t* image = (uint8_t*) mlt_pool_alloc(size);
+        mlt_image_format_aligned_planes(mlt_image_rgb24, 2, 2, image, planes, strides);
+        QCOMPARE(strides[0], MLT_IMAGE_ALIGN);
+        QCOMPARE(uintptr_t(planes[0]) % MLT_IMAGE_ALIGN, uintptr_t(0));
+        memset(image, 0, size);
+        planes[0][0] = 1;
+        planes[0][strides[0]] = 2;
+        mlt_frame_set_image(frame, image, size, mlt_pool_release);
+        mlt_frame_set_image_planes(frame, planes, strides);
+        mlt_properties_set_int(properties, "format", mlt_image_rgb24);
+        mlt_properties_set_int(properties, "width", 2);
+        mlt_properties_set_int(properties, "height", 2);
+
+        // The strided variant returns the planes as they are.
+        mlt_image_format format = mlt_image_rgb24;
+        int width = 2;
+        int height = 2;
+        uint8_t* out_planes[4];
+        int out_strides[4];
+        QCOMPARE(mlt_frame_get_image_strided(frame, out_planes, out_strides, &format, &width, &height, 0), 0);
+        QCOMPARE(out_planes[0], planes[0]);
+        QCOMPARE(out_strides[0], MLT_IMAGE_ALIGN);
+
+        // Others get a packed copy.
+        uint8_t* buffer = NULL;
+        QCOMPARE(mlt_frame_get_image(frame, &buffer, &format, &width, &height, 0), 0);
+        QCOMPARE(buffer[0], uint8_t(1));
+        QCOMPARE(buffer[2 * 3], uint8_t(2));
+        QCOMPARE(mlt_frame_get_image_planes(frame, out_planes, out_strides), 0);
+        QCOMPARE(out_planes[0], buffer);
+        QCOMPARE(out_strides[0], 2 * 3);
+        mlt_frame_close(frame);
+    }
+
+    void AlphaValueIsCreatedOnlyIfNotOpaque()
+    {
+        mlt_frame frame = mlt_frame_init(NULL);
+        mlt_properties properties = MLT_FRAME_PROPERTIES(frame);
+        mlt_properties_set_int(properties, "width", 2);
+        mlt_properties_set_int(properties, "height", 2);
+        QCOMPARE(mlt_frame_get_alpha_value(frame), 255);
+
+        mlt_frame_set_alpha_value(frame, 255);
+        QCOMPARE(mlt_frame_get_alpha_value(frame), 255);
+        QVERIFY(mlt_frame_get_alpha(frame) == NULL);
+
+        mlt_frame_set_alpha_value(frame, 0x80);
+        QCOMPARE(mlt_frame_get_alpha_value(frame), 0x80);
+        uint8_t* alpha = mlt_frame_get_alpha(frame);
+        QVERIFY(alpha != NULL);
+        QCOMPARE(alpha[3], uint8_t(0x80));
+        QCOMPARE(mlt_frame_get_alpha_value(frame), -1);
+
+        // Setting an alpha channel replaces the value.
+        mlt_frame_set_alpha_value(frame, 0x80);
+        mlt_frame_set_alpha(frame, NULL, 0, NULL);
+        QCOMPARE(mlt_frame_get_alpha_value(frame), 255);
+        mlt_frame_close(frame);
+    }
 };
 
 QTEST_APPLESS_MAIN(TestFrame)
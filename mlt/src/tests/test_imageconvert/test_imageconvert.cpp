@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2020 Meltytech, LLC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with consumer library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <QtTest>
+#include <random>
+#include "child_process.h"
+
+#include <mlt++/Mlt.h>
+using namespace Mlt;
+
+static const int kConversions = 200;
+
+// Convert random images with the CPU features of this process.
+static QByteArray convertImages(const QByteArray& seed)
+{
+    std::mt19937 random(seed.toUInt());
+    const mlt_image_format formats[] = { mlt_image_rgb24, mlt_image_rgb24a, mlt_image_yuv422 };
+    Factory::init();
+    Profile profile;
+    Filter filter(profile, "imageconvert");
+    QByteArray result;
+    if (!filter.is_valid())
+        return QByteArray();
+
+    for (int n = 0; n < kConversions; n++) {
+        // Odd and narrow widths exercise the C code after the SIMD code
+        int width = 1 + random() % 300;
+        int height = 1 + random() % 40;
+        mlt_image_format format = formats[random() % 3];
+        mlt_image_format requested = formats[random() % 3];
+        if (format == requested)
+            continue;
+        int size = mlt_image_format_size(format, width, height, NULL);
+        uint8_t* image = (uint8_t*) mlt_pool_alloc(size);
+        for (int i = 0; i < size; i++)
+            image[i] = random();
+        mlt_frame frame = mlt_frame_init(NULL);
+        mlt_properties properties = MLT_FRAME_PROPERTIES(frame);
+        mlt_properties_set_int(properties, "width", width);
+        mlt_properties_set_int(properties, "height", height);
+        mlt_properties_set_int(properties, "format", format);
+        mlt_properties_set_int(properties, "colorspace", random() % 2 ? 709 : 601);
+        mlt_properties_set_int(properties, "full_luma", random() % 2);
+        mlt_frame_set_image(frame, image, size, mlt_pool_release);
+        if (random() % 3 == 0)
+            mlt_frame_set_alpha_value(frame, random() % 256);
+        mlt_filter_process(filter.get_filter(), frame);
+        if (frame->convert_image(frame, &image, &format, requested) || format != requested) {
+            mlt_frame_close(frame);
+            return QByteArray();
+        }
+        // The size of an image includes a spare line
+        result.append((const char*) image, mlt_image_format_size(format, width, height - 1, NULL));
+        mlt_frame_close(frame);
+    }
+    return result;
+}
+
+class TestImageConvert : public QObject
+{
+    Q_OBJECT
+
+    // Run the conversions in a child process, since the CPU features are
+    // chosen once per process.
+    QByteArray conversions(unsigned seed, const char* features)
+    {
+        return runChildWithFeatures(features, QByteArray::number(seed));
+    }
+
+public:
+    TestImageConvert()
+    {
+        Factory::init();
+    }
+
+private Q_SLOTS:
+    void RgbToYuvFollowsProfileColorspace_data()
+    {
+        QTest::addColumn<int>("colorspace");
+        QTest::addColumn<QByteArray>("rgb");
+        QTest::addColumn<QByteArray>("yuv");
+        QTest::newRow("601 red") << 601 << QByteArray("\xff\x00\x00", 3) << QByteArray("\x51\x5a\x51\xf0", 4);
+        QTest::newRow("709 red") << 709 << QByteArray("\xff\x00\x00", 3) << QByteArray("\x3e\x66\x3e\xf0", 4);
+        QTest::newRow("601 green") << 601 << QByteArray("\x00\xff\x00", 3) << QByteArray("\x90\x35\x90\x22", 4);
+        QTest::newRow("709 green") << 709 << QByteArray("\x00\xff\x00", 3) << QByteArray("\xac\x29\xac\x1a", 4);
+    }
+
+    void RgbToYuvFollowsProfileColorspace()
+    {
+        QFETCH(int, colorspace);
+        QFETCH(QByteArray, rgb);
+        QFETCH(QByteArray, yuv);
+        Profile profile;
+        profile.set_colorspace(colorspace);
+        Producer producer(profile, "colour", "black");
+        Filter filter(profile, "imageconvert");
+        QVERIFY(producer.is_valid());
+        QVERIFY(filter.is_valid());
+
+        // The coefficients come from the profile of the original producer.
+        mlt_image_format format = mlt_image_rgb24;
+        int size = mlt_image_format_size(format, 2, 2, NULL);
+        uint8_t* image = (uint8_t*) mlt_pool_alloc(size);
+        for (int i = 0; i < 4; i++)
+            memcpy(image + 3 * i, rgb.constData(), 3);
+        mlt_frame frame = mlt_frame_init(NULL);
+        mlt_properties properties = MLT_FRAME_PROPERTIES(frame);
+        mlt_properties_set_data(properties, "_producer", producer.get_producer(), 0, NULL, NULL);
+        mlt_properties_set_int(properties, "width", 2);
+        mlt_properties_set_int(properties, "height", 2);
+        mlt_properties_set_int(properties, "format", format);
+        mlt_frame_set_image(frame, image, size, mlt_pool_release);
+        mlt_filter_process(filter.get_filter(), frame);
+        QVERIFY(!frame->convert_image(frame, &image, &format, mlt_image_yuv422));
+        QCOMPARE(format, mlt_image_yuv422);
+        QCOMPARE(QByteArray((const char*) image, 4), yuv);
+        QCOMPARE(mlt_properties_get_int(properties, "colorspace"), colorspace);
+        mlt_frame_close(frame);
+    }
+
+    void SimdMatchesC()
+    {
+        unsigned seed = std::random_device()();
+        QByteArray expected = conversions(seed, "none");
+        QByteArray actual = conversions(seed, NULL);
+        QVERIFY2(!expected.isEmpty(), "the conversions failed");
+        QVERIFY2(actual == expected, qPrintable(QString("differs with seed %1").arg(seed)));
+    }
+};
+
+QTEST_CHILD_MAIN(TestImageConvert, convertImages)
+
+#include "test_imageconvert.moc"
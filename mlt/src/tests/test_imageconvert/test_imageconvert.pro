@@ -0,0 +1,3 @@
+include(../common.pri)
+TARGET = test_imageconvert
+SOURCES += test_imageconvert.cpp
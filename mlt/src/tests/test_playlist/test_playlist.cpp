@@ -263,6 +263,46 @@ private Q_SLOTS:
         delete pp2;
         delete pp3;
     }
+
+    void ClipLookupFollowsEdits()
+    {
+        Playlist pl(profile);
+        QVERIFY(pl.is_valid());
+        Producer p(profile, "noise");
+        QVERIFY(p.is_valid());
+
+        // Lengths: 10, 20, 30, ..., 1000
+        for (int i = 0; i < 100; i++)
+            pl.append(p, 0, i * 10 + 9);
+        QCOMPARE(pl.clip_start(99), 49500);
+        QCOMPARE(pl.get_playtime(), 50500);
+        QCOMPARE(pl.get_clip_index_at(0), 0);
+        QCOMPARE(pl.get_clip_index_at(9), 0);
+        QCOMPARE(pl.get_clip_index_at(10), 1);
+        QCOMPARE(pl.get_clip_index_at(49499), 98);
+        QCOMPARE(pl.get_clip_index_at(49500), 99);
+
+        // Insert a clip of length 5 before the second clip.
+        pl.insert(p, 1, 0, 4);
+        QCOMPARE(pl.clip_start(2), 15);
+        QCOMPARE(pl.get_clip_index_at(14), 1);
+        QCOMPARE(pl.get_clip_index_at(15), 2);
+        QCOMPARE(pl.get_playtime(), 50505);
+
+        // Resize the inserted clip to a length of 1.
+        pl.resize_clip(1, 0, 0);
+        QCOMPARE(pl.clip_start(2), 11);
+        QCOMPARE(pl.get_clip_index_at(10), 1);
+        QCOMPARE(pl.get_clip_index_at(11), 2);
+
+        // Remove the first clip.
+        pl.remove(0);
+        QCOMPARE(pl.clip_start(1), 1);
+        QCOMPARE(pl.get_clip_index_at(0), 0);
+        QCOMPARE(pl.get_clip_index_at(1), 1);
+        QCOMPARE(pl.get_playtime(), 50491);
+        QCOMPARE(pl.get_clip_index_at(50491), 100);
+    }
 };
 
 QTEST_APPLESS_MAIN(TestPlaylist)
@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2020 Meltytech, LLC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with consumer library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <QtTest>
+#include <mlt++/Mlt.h>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+using namespace Mlt;
+
+static qint64 allocated = -1;
+static qint64 used = -1;
+
+static void statCallback(void*, int, const char* format, va_list args)
+{
+    char line[256];
+    long long a, u;
+    vsnprintf(line, sizeof(line), format, args);
+    if (sscanf(line, "mlt_pool_stat: allocated %lld bytes, used %lld bytes", &a, &u) == 2) {
+        allocated = a;
+        used = u;
+    }
+}
+
+// Runs a function on a thread that stays alive until release() is called.
+class Holder
+{
+public:
+    template <class F> Holder(F f)
+        : m_state(0)
+        , m_thread([this, f] {
+            f();
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_state = 1;
+            m_cond.notify_all();
+            m_cond.wait(lock, [this] { return m_state == 2; });
+        })
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [this] { return m_state == 1; });
+    }
+
+    ~Holder()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_state = 2;
+            m_cond.notify_all();
+        }
+        m_thread.join();
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    int m_state;
+    std::thread m_thread;
+};
+
+class TestPool: public QObject
+{
+    Q_OBJECT
+
+public:
+    TestPool()
+    {
+        Factory::init();
+    }
+
+private Q_SLOTS:
+    void PurgeReclaimsBlocksCachedByOtherThreads()
+    {
+        Holder holder([] {
+            void* blocks[10];
+            for (int i = 0; i < 10; i++)
+                blocks[i] = mlt_pool_alloc(1000);
+            for (int i = 0; i < 10; i++)
+                mlt_pool_release(blocks[i]);
+        });
+        mlt_pool_purge();
+        mlt_log_set_level(MLT_LOG_VERBOSE);
+        mlt_log_set_callback(statCallback);
+        mlt_pool_stat();
+        mlt_log_set_callback(NULL);
+        mlt_log_set_level(MLT_LOG_WARNING);
+        QVERIFY(allocated >= 0);
+        QCOMPARE(allocated, used);
+    }
+
+    void LargeBlocksAreKeptByThreads()
+    {
+        // A 4K image goes to the 32 MB class, which each thread also caches.
+        void* block = mlt_pool_alloc(3840 * 2160 * 2);
+        mlt_pool_release(block);
+        void* other = mlt_pool_alloc(3840 * 2160 * 2);
+        QVERIFY(other == block);
+        mlt_pool_release(other);
+
+        // Another thread does not get the block cached by this one.
+        void* theirs = NULL;
+        {
+            Holder holder([&theirs] {
+                theirs = mlt_pool_alloc(3840 * 2160 * 2);
+                mlt_pool_release(theirs);
+            });
+        }
+        QVERIFY(theirs != block);
+        mlt_pool_purge();
+    }
+
+    void ConcurrentAllocationAndPurge()
+    {
+        std::thread threads[4];
+        bool ok[4] = {true, true, true, true};
+        for (int t = 0; t < 4; t++) {
+            threads[t] = std::thread([t, &ok] {
+                for (int i = 0; i < 20000; i++) {
+                    int size = 100 + (i * 7919) % 50000;
+                    uint8_t* p = (uint8_t*) mlt_pool_alloc(size);
+                    memset(p, i & 0xff, size);
+                    if (p[0] != (i & 0xff) || p[size - 1] != (i & 0xff))
+                        ok[t] = false;
+                    mlt_pool_release(p);
+                }
+            });
+        }
+        for (int i = 0; i < 20; i++)
+            mlt_pool_purge();
+        for (int t = 0; t < 4; t++) {
+            threads[t].join();
+            QVERIFY(ok[t]);
+        }
+    }
+};
+
+QTEST_APPLESS_MAIN(TestPool)
+
+#include "test_pool.moc"
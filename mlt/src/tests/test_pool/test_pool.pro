@@ -0,0 +1,3 @@
+include(../common.pri)
+TARGET = test_pool
+SOURCES += test_pool.cpp
@@ -1154,6 +1154,92 @@ private Q_SLOTS:
         QCOMPARE(p.get_int("foo"), 123);
         QCOMPARE(p.get_double("foo"), 123.4);
     }
+
+    void AtomsAreInterned()
+    {
+        QVERIFY(mlt_atom_find("test_atoms_are_interned") == NULL);
+        mlt_atom a = mlt_atom_get("test_atoms_are_interned");
+        QVERIFY(a != NULL);
+        QCOMPARE(mlt_atom_name(a), "test_atoms_are_interned");
+        QString name("test_atoms_are_interned");
+        QVERIFY(mlt_atom_get(name.toLatin1().constData()) == a);
+        QVERIFY(mlt_atom_find(name.toLatin1().constData()) == a);
+        QVERIFY(mlt_atom_get("test_atoms_are_interned2") != a);
+    }
+
+    void FixedNamesAreInternedByFactory()
+    {
+        QVERIFY(mlt_atom_find("_profile") != NULL);
+        QVERIFY(mlt_atom_find("progressive") != NULL);
+        Properties p;
+        p.set("progressive", 1);
+        QCOMPARE(mlt_properties_get_int_by_atom(p.get_properties(), mlt_atom_find("progressive")), 1);
+    }
+
+    void GetByAtom()
+    {
+        Properties p;
+        int data = 0;
+        mlt_atom width = mlt_atom_get("width");
+        mlt_atom data_atom = mlt_atom_get("_data");
+        p.set("width", 1920);
+        p.set("_data", &data, 0);
+        QCOMPARE(mlt_properties_get_int_by_atom(p.get_properties(), width), 1920);
+        QCOMPARE(mlt_properties_get_double_by_atom(p.get_properties(), width), 1920.0);
+        QCOMPARE(mlt_properties_get_by_atom(p.get_properties(), width), "1920");
+        QVERIFY(mlt_properties_get_data_by_atom(p.get_properties(), data_atom, NULL) == &data);
+        QVERIFY(mlt_properties_get_by_atom(p.get_properties(), mlt_atom_get("height")) == NULL);
+    }
+
+    void DynamicNamesAreNotInterned()
+    {
+        Properties p;
+        p.set("test_dynamic_name", 1);
+        QVERIFY(mlt_atom_find("test_dynamic_name") == NULL);
+        p.rename("test_dynamic_name", "test_dynamic_name2");
+        QVERIFY(mlt_atom_find("test_dynamic_name2") == NULL);
+        QCOMPARE(p.get_int("test_dynamic_name2"), 1);
+    }
+
+    void GetByAtomInternedLater()
+    {
+        Properties p;
+        p.set("test_interned_later", 42);
+        mlt_atom atom = mlt_atom_get("test_interned_later");
+        QCOMPARE(mlt_properties_get_int_by_atom(p.get_properties(), atom), 42);
+        p.set("test_interned_later", 43);
+        QCOMPARE(p.count(), 1);
+        QCOMPARE(mlt_properties_get_int_by_atom(p.get_properties(), atom), 43);
+    }
+
+    void ManyPropertiesKeepOrder()
+    {
+        Properties p;
+        for (int i = 0; i < 1000; i++)
+            p.set(QString("key%1").arg(i).toLatin1().constData(), i);
+        QCOMPARE(p.count(), 1000);
+        for (int i = 0; i < 1000; i++) {
+            QString name = QString("key%1").arg(i);
+            QCOMPARE(p.get_name(i), name.toLatin1().constData());
+            QCOMPARE(p.get_int(name.toLatin1().constData()), i);
+        }
+        p.set("key500", -1);
+        QCOMPARE(p.count(), 1000);
+        QCOMPARE(p.get_int("key500"), -1);
+    }
+
+    void RenameUpdatesLookup()
+    {
+        Properties p;
+        p.set("foo", 1);
+        p.set("bar", 2);
+        QCOMPARE(p.rename("foo", "bar"), 1);
+        QCOMPARE(p.rename("foo", "baz"), 0);
+        QVERIFY(p.get("foo") == NULL);
+        QCOMPARE(p.get_int("baz"), 1);
+        QCOMPARE(p.get_name(0), "baz");
+        QCOMPARE(p.get_int("bar"), 2);
+    }
 };
 
 QTEST_APPLESS_MAIN(TestProperties)
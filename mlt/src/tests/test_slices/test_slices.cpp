@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2020 Meltytech, LLC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with consumer library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include <QtTest>
+#include <mlt++/Mlt.h>
+#include <atomic>
+#include <thread>
+#include <unistd.h>
+using namespace Mlt;
+
+static std::atomic<int> leaves;
+static std::atomic<int> unrelatedOnWaiter;
+static pthread_t waiter;
+
+static int leafJob(int, int, int, void*)
+{
+    leaves++;
+    return 0;
+}
+
+static int middleJob(int, int, int, void*)
+{
+    mlt_slices_run_normal(4, leafJob, NULL);
+    return 0;
+}
+
+static int outerJob(int, int, int, void*)
+{
+    mlt_slices_run_normal(4, middleJob, NULL);
+    return 0;
+}
+
+// The pool threads keep the waiting thread waiting.
+static int slowJob(int id, int, int, void*)
+{
+    usleep(id < 0 ? 20000 : 300000);
+    return 0;
+}
+
+static int unrelatedJob(int, int, int, void*)
+{
+    if (pthread_equal(pthread_self(), waiter))
+        unrelatedOnWaiter++;
+    usleep(1000);
+    return 0;
+}
+
+class TestSlices: public QObject
+{
+    Q_OBJECT
+
+public:
+    TestSlices()
+    {
+        Factory::init();
+    }
+
+private Q_SLOTS:
+    void NestedRunsComplete()
+    {
+        leaves = 0;
+        mlt_slices_run_normal(4, outerJob, NULL);
+        QCOMPARE(leaves.load(), 64);
+    }
+
+    void WaitingThreadDoesNotRunUnrelatedJobs()
+    {
+        unrelatedOnWaiter = 0;
+        waiter = pthread_self();
+        std::thread other([] {
+            usleep(100000);
+            mlt_slices_run_normal(16, unrelatedJob, NULL);
+        });
+        mlt_slices_run_normal(mlt_slices_count_normal() + 1, slowJob, NULL);
+        other.join();
+        QCOMPARE(unrelatedOnWaiter.load(), 0);
+    }
+};
+
+QTEST_APPLESS_MAIN(TestSlices)
+
+#include "test_slices.moc"
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2020 Meltytech, LLC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with consumer library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include <QtTest>
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QTemporaryFile>
+#include <mlt++/Mlt.h>
+using namespace Mlt;
+
+class TestTrace: public QObject
+{
+    Q_OBJECT
+
+public:
+    TestTrace()
+    {
+        Factory::init();
+    }
+
+private:
+    static void renderFrame(mlt_producer producer)
+    {
+        mlt_frame frame = NULL;
+        mlt_image_format format = mlt_image_yuv422;
+        int width = 0, height = 0;
+        uint8_t* image = NULL;
+        mlt_service_get_frame(MLT_PRODUCER_SERVICE(producer), &frame, 0);
+        mlt_frame_get_image(frame, &image, &format, &width, &height, 0);
+        mlt_frame_close(frame);
+    }
+
+private Q_SLOTS:
+    void TimeIsMonotonic()
+    {
+        int64_t previous = mlt_trace_time();
+        for (int i = 0; i < 1000; i++) {
+            int64_t now = mlt_trace_time();
+            QVERIFY(now >= previous);
+            previous = now;
+        }
+    }
+
+    void SpansAreLabelledByInstance()
+    {
+        Profile profile;
+        QTemporaryFile file;
+        QVERIFY(file.open());
+        mlt_producer a = mlt_factory_producer(profile.get_profile(), NULL, "color:red");
+        mlt_producer b = mlt_factory_producer(profile.get_profile(), NULL, "color:blue");
+        QVERIFY(a && b);
+
+        QCOMPARE(mlt_trace_open(file.fileName().toUtf8().constData()), 0);
+        renderFrame(a);
+        renderFrame(b);
+        renderFrame(a);
+        mlt_trace_close();
+        mlt_producer_close(a);
+        mlt_producer_close(b);
+
+        QJsonDocument doc = QJsonDocument::fromJson(file.readAll());
+        QVERIFY(doc.isObject());
+        QMap<QString, int> images;
+        QSet<QString> frames;
+        for (const QJsonValue& value : doc.object()["traceEvents"].toArray()) {
+            QJsonObject event = value.toObject();
+            QVERIFY(event["ts"].toDouble() >= 0.0);
+            QVERIFY(event["dur"].toDouble() >= 0.0);
+            QString name = event["name"].toString();
+            if (event["cat"].toString() == "get_image" && name.startsWith("color #"))
+                images[name]++;
+            else if (event["cat"].toString() == "get_frame" && name.startsWith("color #"))
+                frames << name;
+        }
+        // Both producers push the same function, but each gets its own label.
+        QCOMPARE(images.size(), 2);
+        QCOMPARE(frames.size(), 2);
+        QCOMPARE(images.values().at(0) + images.values().at(1), 3);
+        QVERIFY(frames.contains(images.keys().at(0)));
+        QVERIFY(frames.contains(images.keys().at(1)));
+    }
+};
+
+QTEST_APPLESS_MAIN(TestTrace)
+
+#include "test_trace.moc"
@@ -0,0 +1,3 @@
+include(../common.pri)
+TARGET = test_trace
+SOURCES += test_trace.cpp
@@ -34,6 +34,56 @@ public:
         Factory::init();
     }
 
+private:
+    // Renders three tracks with composite, luma and mix and returns how many
+    // images and audio of the two video tracks were rendered ahead.
+    int renderTracks(int threads, const QString& geometry, const char* filter,
+                     QList<QByteArray>& images, QList<QByteArray>& audio)
+    {
+        Tractor t(profile);
+        t.set("track_threads", threads);
+        Producer p0(profile, "color:red");
+        Producer p1(profile, "color:#8000ff00");
+        Producer p2(profile, "tone");
+        p0.set("track_ahead", 1);
+        p1.set("track_ahead", 1);
+        p2.set("track_ahead", 1);
+        Filter brightness(profile, "brightness");
+        brightness.set("level", "0=0.2;9=1.0");
+        p1.attach(brightness);
+        QScopedPointer<Filter> other(filter ? new Filter(profile, filter) : NULL);
+        if (other)
+            p0.attach(*other);
+        t.set_track(p0, 0);
+        t.set_track(p1, 1);
+        t.set_track(p2, 2);
+        Transition composite(profile, "composite");
+        composite.set("geometry", geometry.toUtf8().constData());
+        t.plant_transition(composite, 0, 1);
+        Transition luma(profile, "luma");
+        t.plant_transition(luma, 0, 2);
+        Transition mix(profile, "mix");
+        mix.set("always_active", 1);
+        t.plant_transition(mix, 0, 2);
+
+        for (int i = 0; i < 10; i++) {
+            int width = profile.width();
+            int height = profile.height();
+            mlt_image_format format = mlt_image_yuv422;
+            mlt_audio_format audio_format = mlt_audio_s16;
+            int frequency = 48000;
+            int channels = 2;
+            int samples = mlt_sample_calculator(profile.fps(), frequency, i);
+            Frame* frame = t.get_frame();
+            uint8_t* image = frame->get_image(format, width, height, 0);
+            images << (image ? QByteArray((const char*) image, width * height * 2) : QByteArray());
+            int16_t* pcm = (int16_t*) frame->get_audio(audio_format, frequency, channels, samples);
+            audio << (pcm ? QByteArray((const char*) pcm, samples * channels * 2) : QByteArray());
+            delete frame;
+        }
+        return p0.get_int("track_ahead_hits") + p1.get_int("track_ahead_hits");
+    }
+
 private Q_SLOTS:
 
     void CreateSingleTrack()
@@ -402,6 +452,41 @@ private Q_SLOTS:
         QCOMPARE(t.count(), 1);
         QCOMPARE(filter.get_track(), 0);
     }
+
+    void TrackThreadsMatchSerialRendering_data()
+    {
+        QTest::addColumn<QString>("geometry");
+        QTest::addColumn<bool>("ahead");
+        QTest::newRow("fixed") << "10%/10%:50%x50%" << true;
+        // The size of the composited track changes with every frame.
+        QTest::newRow("animated") << "0=10%/10%:50%x50%;9=30%/20%:40%x60%" << false;
+    }
+
+    void TrackThreadsMatchSerialRendering()
+    {
+        QFETCH(QString, geometry);
+        QFETCH(bool, ahead);
+        QList<QByteArray> images[2];
+        QList<QByteArray> audio[2];
+        QCOMPARE(renderTracks(0, geometry, NULL, images[0], audio[0]), 0);
+        int hits = renderTracks(2, geometry, NULL, images[1], audio[1]);
+        QCOMPARE(hits > 0, ahead);
+        QVERIFY(!images[0].first().isEmpty());
+        QVERIFY(!audio[0].first().isEmpty());
+        QCOMPARE(images[1], images[0]);
+        QCOMPARE(audio[1], audio[0]);
+    }
+
+    void TrackThreadsRenderUnsafeTracksSerially()
+    {
+        // crop does not declare that its frames may be rendered again.
+        QList<QByteArray> images[2];
+        QList<QByteArray> audio[2];
+        renderTracks(0, "10%/10%:50%x50%", "crop", images[0], audio[0]);
+        QCOMPARE(renderTracks(2, "10%/10%:50%x50%", "crop", images[1], audio[1]), 0);
+        QCOMPARE(images[1], images[0]);
+        QCOMPARE(audio[1], audio[0]);
+    }
 };
 
 QTEST_APPLESS_MAIN(TestTractor)
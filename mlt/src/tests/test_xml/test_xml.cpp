@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2020 Meltytech, LLC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with consumer library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <QFile>
+#include <QString>
+#include <QTemporaryDir>
+#include <QtTest>
+
+#include <mlt++/Mlt.h>
+using namespace Mlt;
+
+static const int kClipLength = 20;
+
+class TestXml : public QObject
+{
+    Q_OBJECT
+    Profile profile;
+    QTemporaryDir dir;
+    QString clip;
+
+    QByteArray image(Frame* frame)
+    {
+        mlt_image_format format = mlt_image_yuv422;
+        int width = profile.width();
+        int height = profile.height();
+        uint8_t* image = frame->get_image(format, width, height);
+        if (!image || format != mlt_image_yuv422)
+            return QByteArray();
+        return QByteArray((const char*) image, width * height * 2);
+    }
+
+    QList<QByteArray> images(Producer& producer)
+    {
+        QList<QByteArray> result;
+        producer.seek(0);
+        for (int i = 0; i < producer.get_playtime(); i++) {
+            Frame* frame = producer.get_frame();
+            result << image(frame);
+            delete frame;
+        }
+        return result;
+    }
+
+    // A playlist of the clip three times, with or without the length known.
+    QString writeXml(const QString& name, bool withLength)
+    {
+        QString path = dir.filePath(name);
+        QFile file(path);
+        if (!file.open(QIODevice::WriteOnly))
+            return QString();
+        QString length = withLength ? QString("<property name=\"length\">%1</property>").arg(kClipLength) : QString();
+        QString xml = "<mlt><playlist id=\"playlist0\">";
+        for (int i = 0; i < 3; i++) {
+            xml += QString("<entry in=\"%1\" out=\"%2\"><producer id=\"producer%3\">"
+                           "<property name=\"mlt_service\">avformat</property>"
+                           "<property name=\"resource\">%4</property>%5</producer></entry>")
+                       .arg(i * 5).arg(i * 5 + 4).arg(i).arg(clip).arg(length);
+        }
+        xml += "</playlist></mlt>";
+        file.write(xml.toUtf8());
+        return path;
+    }
+
+public:
+    TestXml()
+    {
+        Factory::init();
+        profile.set_width(320);
+        profile.set_height(240);
+        profile.set_sample_aspect(1, 1);
+        profile.set_display_aspect(4, 3);
+        profile.set_progressive(1);
+        profile.set_colorspace(601);
+        profile.set_frame_rate(25, 1);
+    }
+
+private Q_SLOTS:
+
+    void initTestCase()
+    {
+        Consumer consumer(profile, "avformat");
+        if (!consumer.is_valid())
+            QSKIP("The avformat module is not available");
+        QVERIFY(dir.isValid());
+        clip = dir.filePath("clip.mkv");
+
+        Producer count(profile, "count");
+        QVERIFY(count.is_valid());
+        count.set("out", kClipLength - 1);
+        consumer.set("target", clip.toUtf8().constData());
+        consumer.set("vcodec", "mpeg4");
+        consumer.set("qscale", 2);
+        consumer.set("an", 1);
+        consumer.set("real_time", -1);
+        consumer.set("terminate_on_pause", 1);
+        consumer.connect(count);
+        QCOMPARE(consumer.run(), 0);
+    }
+
+    void LazyLoadMatchesEagerLoad()
+    {
+        QString path = writeXml("length.mlt", true);
+        Producer eager(profile, "xml", path.toUtf8().constData());
+        Producer lazy(profile, "xml", (path + "?lazy=1").toUtf8().constData());
+        QVERIFY(eager.is_valid());
+        QVERIFY(lazy.is_valid());
+        QCOMPARE(lazy.get_playtime(), eager.get_playtime());
+        QCOMPARE(images(lazy), images(eager));
+    }
+
+    void LazyProducerPassesProperties()
+    {
+        QString path = writeXml("length.mlt", true);
+        Producer producer(profile, "xml", (path + "?lazy=1").toUtf8().constData());
+        QVERIFY(producer.is_valid());
+        Playlist playlist(producer);
+        QCOMPARE(playlist.count(), 3);
+        ClipInfo* info = playlist.clip_info(0);
+        QVERIFY(info);
+        info->producer->set("video_index", -1);
+        Frame* frame = producer.get_frame();
+        delete frame;
+        Producer* real = new Producer((mlt_producer) info->producer->get_data("_lazy_producer"));
+        QVERIFY(real->is_valid());
+        QCOMPARE(real->get_int("video_index"), -1);
+        delete real;
+        Playlist::delete_clip_info(info);
+    }
+
+    void ProbedProducersMatchSerialLoad()
+    {
+        QString path = writeXml("probe.mlt", false);
+        Producer serial(profile, "xml", path.toUtf8().constData());
+        Producer probed(profile, "xml", (path + "?lazy=1").toUtf8().constData());
+        QVERIFY(serial.is_valid());
+        QVERIFY(probed.is_valid());
+
+        // The loader still attaches its normalising filters to the producers opened in parallel.
+        Playlist a(serial);
+        Playlist b(probed);
+        QCOMPARE(b.count(), a.count());
+        for (int i = 0; i < a.count(); i++) {
+            ClipInfo* infoA = a.clip_info(i);
+            ClipInfo* infoB = b.clip_info(i);
+            QVERIFY(infoA && infoB);
+            QVERIFY(infoA->producer->filter_count() > 0);
+            QCOMPARE(infoB->producer->filter_count(), infoA->producer->filter_count());
+            QCOMPARE(infoB->producer->get_int("_mlt_service_hidden"), 1);
+            Playlist::delete_clip_info(infoA);
+            Playlist::delete_clip_info(infoB);
+        }
+        QCOMPARE(images(probed), images(serial));
+    }
+};
+
+QTEST_APPLESS_MAIN(TestXml)
+
+#include "test_xml.moc"
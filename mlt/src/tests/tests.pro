@@ -1,11 +1,19 @@
 TEMPLATE = subdirs
 SUBDIRS = test_audio \
+    test_avformat \
+    test_cache \
+    test_cpu \
     test_filter \
     test_events \
     test_frame \
+    test_imageconvert \
     test_playlist \
+    test_pool \
     test_properties \
     test_repository \
     test_animation \
     test_tractor \
-    test_service
+    test_service \
+    test_slices \
+    test_trace \
+    test_xml